@@ -0,0 +1,141 @@
+#ifndef __ASYNC_INFERENCE_H_
+#define __ASYNC_INFERENCE_H_
+
+// Awaitable inference for coroutine-based services (needs C++20):
+//
+//   float prediction = co_await inferAsync(&batcher, features);
+//
+// The request joins the batcher's queue like any other, so it's
+// batched with requests from blocking callers and other coroutines.
+// Only the awaiting coroutine is suspended, never its thread, so one
+// thread can keep thousands of requests in flight.
+//
+// A request the batcher fails (see InferenceBatcher::submit) gives NaN,
+// or no outputs.
+//
+// The coroutine is resumed on the batcher's worker thread, which holds
+// up the next batch until the coroutine suspends again, unless a
+// resumer is given to hand it elsewhere, e.g. to the service's event
+// loop (see CoroutineQueue).
+
+#include "batcher.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Resumes a suspended coroutine, on whatever thread it chooses.
+typedef std::function<void(std::coroutine_handle<>)> Resumer;
+
+// Coroutines waiting to be resumed by one thread: other threads post
+// them, and the owning thread resumes them in its loop with
+// runPending().
+class CoroutineQueue {
+ public:
+  void post(std::coroutine_handle<> handle) {
+    // Notifies under the lock: once the owner has run the coroutine it
+    // may destroy the queue, which mustn't happen mid-notify.
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(handle);
+    posted_.notify_one();
+  }
+
+  // Resumes every coroutine posted so far, on the calling thread, and
+  // returns how many there were.
+  size_t runPending() {
+    std::deque<std::coroutine_handle<>> ready;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ready.swap(queue_);
+    }
+    for (std::coroutine_handle<> handle : ready) {
+      handle.resume();
+    }
+    return ready.size();
+  }
+
+  // Blocks until a coroutine is posted or timeout passes; true if
+  // there's one to run.
+  bool waitFor(std::chrono::microseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return posted_.wait_for(lock, timeout, [this]() {
+	return !queue_.empty();
+      });
+  }
+
+  Resumer resumer() {
+    return [this](std::coroutine_handle<> handle) { post(handle); };
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable posted_;
+  std::deque<std::coroutine_handle<>> queue_;
+};
+
+// Awaits all of the model's outputs for one input.
+class InferAllAwaitable {
+ public:
+  InferAllAwaitable(InferenceBatcher* batcher, vector<float> inputs,
+		    Resumer resumer) :
+    batcher_(batcher), inputs_(std::move(inputs)),
+    resumer_(std::move(resumer)) {}
+
+  bool await_ready() const { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    // The coroutine may be resumed, and this awaitable destroyed, as
+    // soon as the request is queued, so nothing here touches this
+    // afterwards, and the callback copies what it needs before
+    // resuming.
+    batcher_->submitAll(std::move(inputs_), [this, handle](
+	const float* outputs, size_t n) {
+	outputs_.assign(outputs, outputs + n);
+	Resumer resumer = resumer_;
+	if (resumer) {
+	  resumer(handle);
+	} else {
+	  handle.resume();
+	}
+      });
+  }
+
+  vector<float> await_resume() { return std::move(outputs_); }
+
+ protected:
+  InferenceBatcher* batcher_;
+  vector<float> inputs_;
+  Resumer resumer_;
+  vector<float> outputs_;
+};
+
+// Awaits the model's first output for one input.
+class InferAwaitable : public InferAllAwaitable {
+ public:
+  using InferAllAwaitable::InferAllAwaitable;
+
+  float await_resume() {
+    return (outputs_.empty() ? std::numeric_limits<float>::quiet_NaN() :
+	    outputs_[0]);
+  }
+};
+
+inline InferAwaitable inferAsync(InferenceBatcher* batcher,
+				 vector<float> inputs,
+				 Resumer resumer = nullptr) {
+  return InferAwaitable(batcher, std::move(inputs), std::move(resumer));
+}
+
+inline InferAllAwaitable inferAllAsync(InferenceBatcher* batcher,
+				       vector<float> inputs,
+				       Resumer resumer = nullptr) {
+  return InferAllAwaitable(batcher, std::move(inputs), std::move(resumer));
+}
+
+#endif
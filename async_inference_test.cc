@@ -0,0 +1,101 @@
+#include "async_inference.h"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// A coroutine that starts immediately and cleans up after itself, as a
+// service's request handlers would.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return Detached(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+std::unique_ptr<NN> randomModel(size_t num_outputs) {
+  NNParams params(3, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(params));
+  nn->addLayer(LayerType::RELU, 6);
+  nn->addOutputLayer(LayerType::SIGMOID, num_outputs);
+  srand(11);
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+    });
+  return nn;
+}
+
+vector<float> inputsFor(size_t i) {
+  return { 0.001f * i, 1.0f - 0.002f * i, (i % 7) * 0.1f };
+}
+
+Detached score(InferenceBatcher* batcher, size_t i, Resumer resumer,
+	       vector<float>* results, std::atomic<size_t>* done) {
+  (*results)[i] = co_await inferAsync(batcher, inputsFor(i), resumer);
+  (*done)++;
+}
+
+Detached scoreAll(InferenceBatcher* batcher, vector<float> inputs,
+		  vector<float>* outputs, std::thread::id* resumed_on,
+		  std::atomic<bool>* done) {
+  *outputs = co_await inferAllAsync(batcher, std::move(inputs));
+  *resumed_on = std::this_thread::get_id();
+  *done = true;
+}
+
+}  // namespace
+
+TEST(AsyncInferenceTest, OneThreadKeepsManyRequestsInFlight) {
+  std::unique_ptr<NN> reference = randomModel(1);
+  ModelHandle handle(randomModel(1));
+  BatcherParams params;
+  params.maxBatchSize = 32;
+  InferenceBatcher batcher(&handle, params);
+  CoroutineQueue loop;
+
+  const size_t kRequests = 2000;
+  vector<float> results(kRequests);
+  std::atomic<size_t> done{0};
+  for (size_t i = 0; i < kRequests; i++) {
+    score(&batcher, i, loop.resumer(), &results, &done);
+  }
+  // Every request was queued without this thread blocking.
+  EXPECT_GT(kRequests, done.load());
+  while (done < kRequests) {
+    loop.waitFor(std::chrono::milliseconds(100));
+    loop.runPending();
+  }
+  for (size_t i = 0; i < kRequests; i++) {
+    EXPECT_EQ(reference->inference(inputsFor(i)), results[i]) << i;
+  }
+  EXPECT_EQ(kRequests, batcher.requestsRun());
+  EXPECT_LT(batcher.batchesRun(), kRequests / 4);
+}
+
+TEST(AsyncInferenceTest, ResumesOnWorkerWithoutResumer) {
+  std::unique_ptr<NN> reference = randomModel(3);
+  ModelHandle handle(randomModel(3));
+  InferenceBatcher batcher(&handle, BatcherParams());
+  vector<float> inputs = { 0.3, 0.2, 0.1 }, outputs, expected;
+  reference->inferenceAll(inputs, &expected);
+  std::thread::id resumed_on;
+  std::atomic<bool> done{false};
+  scoreAll(&batcher, inputs, &outputs, &resumed_on, &done);
+  while (!done) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(expected, outputs);
+  EXPECT_NE(std::this_thread::get_id(), resumed_on);
+}
@@ -0,0 +1,234 @@
+#include "autotune.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kCacheHeader[] = "autotune 1";
+
+size_t batchBucket(size_t batch_size) {
+  size_t bucket = 1;
+  while (bucket < batch_size) {
+    bucket <<= 1;
+  }
+  return bucket;
+}
+
+// Candidate block sizes for a dimension of size n: unblocked, and
+// each of sizes smaller than n.
+vector<size_t> blockCandidates(size_t n, const vector<size_t>& sizes) {
+  vector<size_t> candidates = {0};
+  for (size_t size : sizes) {
+    if (size < n) {
+      candidates.push_back(size);
+    }
+  }
+  return candidates;
+}
+
+}  // namespace
+
+string hostCpuModel() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      size_t colon = line.find(':');
+      if (colon != string::npos) {
+	size_t start = line.find_first_not_of(" \t", colon + 1);
+	if (start != string::npos) {
+	  return line.substr(start);
+	}
+      }
+    }
+  }
+  return "unknown";
+}
+
+KernelAutotuner::KernelAutotuner(const string& cache_path,
+				 const string& cpu_model,
+				 const AutotunerParams& params) :
+  cache_path_(cache_path), cpu_model_(cpu_model), params_(params) {
+  readCache(&choices_, &other_lines_);
+}
+
+void KernelAutotuner::readCache(std::map<Shape, KernelBlocking>* choices,
+				vector<string>* other_lines) const {
+  if (cache_path_.empty()) {
+    return;
+  }
+  std::ifstream in(cache_path_);
+  string line;
+  if (!std::getline(in, line) || line != kCacheHeader) {
+    return;
+  }
+  // Each line is: units inputs batch unit_block example_block cpu model
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    size_t units, inputs, batch;
+    KernelBlocking blocking;
+    string cpu_model;
+    if (!(fields >> units >> inputs >> batch >> blocking.units >>
+	  blocking.examples)) {
+      continue;
+    }
+    std::getline(fields >> std::ws, cpu_model);
+    if (cpu_model == cpu_model_) {
+      (*choices)[Shape(units, inputs, batch)] = blocking;
+    } else {
+      other_lines->push_back(line);
+    }
+  }
+}
+
+bool KernelAutotuner::saveCache() const {
+  if (cache_path_.empty()) {
+    return true;
+  }
+  // Other processes sharing the file may have tuned shapes, or other
+  // CPUs' lines, since it was read.
+  std::map<Shape, KernelBlocking> saved;
+  vector<string> other_lines;
+  readCache(&saved, &other_lines);
+  {
+    std::unique_lock<std::shared_mutex> lock(choices_mutex_);
+    choices_.insert(saved.begin(), saved.end());
+  }
+  other_lines_ = other_lines;
+  std::ostringstream out;
+  out << kCacheHeader << "\n";
+  for (const string& line : other_lines_) {
+    out << line << "\n";
+  }
+  for (const auto& choice : choices_) {
+    out << std::get<0>(choice.first) << " " <<
+      std::get<1>(choice.first) << " " << std::get<2>(choice.first) <<
+      " " << choice.second.units << " " << choice.second.examples <<
+      " " << cpu_model_ << "\n";
+  }
+  // Written aside and renamed into place, so concurrent readers never
+  // see a partial file; the name is unique, so processes saving at
+  // once don't write over each other's.
+  string temp_path = cache_path_ + ".XXXXXX";
+  int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    return false;
+  }
+  string contents = out.str();
+  bool ok = fchmod(fd, 0644) == 0 &&
+    write(fd, contents.data(), contents.size()) ==
+    static_cast<ssize_t>(contents.size());
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), cache_path_.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+KernelBlocking KernelAutotuner::blocking(size_t num_units,
+					 size_t num_inputs,
+					 size_t batch_size) const {
+  Shape shape(num_units, num_inputs, batchBucket(batch_size));
+  {
+    std::shared_lock<std::shared_mutex> lock(choices_mutex_);
+    auto choice = choices_.find(shape);
+    if (choice != choices_.end()) {
+      return choice->second;
+    }
+  }
+  std::lock_guard<std::mutex> tuning(tune_mutex_);
+  {
+    // Another thread may have tuned it while this one waited.
+    std::shared_lock<std::shared_mutex> lock(choices_mutex_);
+    auto choice = choices_.find(shape);
+    if (choice != choices_.end()) {
+      return choice->second;
+    }
+  }
+  KernelBlocking best = tuneShape(shape);
+  {
+    std::unique_lock<std::shared_mutex> lock(choices_mutex_);
+    choices_[shape] = best;
+  }
+  num_tuned_++;
+  saveCache();
+  return best;
+}
+
+void KernelAutotuner::tune(const NN& nn,
+			   const vector<size_t>& batch_sizes) const {
+  for (const auto& layer : nn.layers) {
+    for (size_t batch_size : batch_sizes) {
+      blocking(layer->inWeights.row_size, layer->inWeights.col_size,
+	       batch_size);
+    }
+  }
+}
+
+size_t KernelAutotuner::numTuned() const {
+  std::lock_guard<std::mutex> lock(tune_mutex_);
+  return num_tuned_;
+}
+
+KernelBlocking KernelAutotuner::tuneShape(const Shape& shape) const {
+  size_t num_units = std::get<0>(shape), num_inputs = std::get<1>(shape);
+  size_t batch_size = std::get<2>(shape);
+  // Times a layer of the same shape on random data. The activation
+  // function is a small, fixed share of the work, so any will do.
+  PReluNNLayer layer(num_inputs, num_units, 0.01);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(-0.5, 0.5);
+  for (float& w : layer.inWeights.data) {
+    w = dist(rng);
+  }
+  for (float& b : layer.bias) {
+    b = dist(rng);
+  }
+  vector<float> inputs(batch_size * num_inputs), outputs(batch_size *
+							 num_units);
+  for (float& x : inputs) {
+    x = dist(rng);
+  }
+
+  KernelBlocking best;
+  double best_seconds = std::numeric_limits<double>::max();
+  for (size_t units : blockCandidates(num_units, {4, 16, 64})) {
+    for (size_t examples : blockCandidates(batch_size, {2, 8, 32})) {
+      KernelBlocking candidate;
+      candidate.units = units;
+      candidate.examples = examples;
+      layer.forwardBatch(inputs.data(), batch_size, outputs.data(),
+			 candidate);
+      double seconds = std::numeric_limits<double>::max();
+      for (int trial = 0; trial < 3; trial++) {
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0.0;
+	size_t runs = 0;
+	do {
+	  layer.forwardBatch(inputs.data(), batch_size, outputs.data(),
+			     candidate);
+	  runs++;
+	  elapsed = std::chrono::duration<double>(
+	      std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < params_.secondsPerCandidate);
+	seconds = std::min(seconds, elapsed / runs);
+      }
+      if (seconds < best_seconds) {
+	best_seconds = seconds;
+	best = candidate;
+      }
+    }
+  }
+  return best;
+}
@@ -0,0 +1,84 @@
+#ifndef __AUTOTUNE_H_
+#define __AUTOTUNE_H_
+
+#include "nn.h"
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// The host CPU's model name from /proc/cpuinfo, or "unknown".
+string hostCpuModel();
+
+struct AutotunerParams {
+  // Minimum time to run each candidate blocking for, per trial; the
+  // fastest of three trials counts.
+  double secondsPerCandidate = 0.001;
+};
+
+// Picks the fastest kernel blocking for each (units, inputs, batch)
+// layer shape by timing the candidates on this host the first time the
+// shape is asked for, and remembers the choices in a cache file so
+// later processes on the same kind of CPU needn't tune again. Batch
+// sizes are rounded up to a power of two, so nearby sizes share a
+// choice.
+//
+// The cache file holds choices for any number of CPU models; one file
+// can be shared by hosts of different generations, and each only
+// reads and replaces its own CPU's lines. It's rewritten after every
+// newly tuned shape, merged with what other processes have written to
+// it since.
+//
+// Set it as NN::kernelTuning. Shapes already chosen are looked up
+// under a shared lock, so scoring threads don't serialize on it;
+// tuning a shape stalls only other threads waiting for a shape to be
+// tuned, and servers should still tune() their models up front.
+class KernelAutotuner : public KernelTuning {
+ public:
+  // An empty cache_path keeps the choices in memory only.
+  explicit KernelAutotuner(const string& cache_path,
+			   const string& cpu_model = hostCpuModel(),
+			   const AutotunerParams& params = AutotunerParams());
+
+  KernelBlocking blocking(size_t num_units, size_t num_inputs,
+			  size_t batch_size) const override;
+  // Tunes every layer of nn now for each of batch_sizes, unless
+  // they're cached already.
+  void tune(const NN& nn, const vector<size_t>& batch_sizes) const;
+
+  // Number of shapes this autotuner has timed (rather than found in
+  // the cache).
+  size_t numTuned() const;
+  const string& cpuModel() const { return cpu_model_; }
+
+ private:
+  typedef std::tuple<size_t, size_t, size_t> Shape;
+
+  // Reads the cache file's choices for this CPU model into choices,
+  // and its lines for other models into other_lines.
+  void readCache(std::map<Shape, KernelBlocking>* choices,
+		 vector<string>* other_lines) const;
+  // With tune_mutex_ held: adds choices other processes have saved
+  // since, then rewrites the cache file.
+  bool saveCache() const;
+  KernelBlocking tuneShape(const Shape& shape) const;
+
+  string cache_path_;
+  string cpu_model_;
+  AutotunerParams params_;
+  // Held shared to look choices_ up and exclusively to change it,
+  // which is only done with tune_mutex_ held too, so a thread holding
+  // that can read choices_ without it.
+  mutable std::shared_mutex choices_mutex_;
+  mutable std::map<Shape, KernelBlocking> choices_;
+  // Serializes tuning and saving, and guards the rest.
+  mutable std::mutex tune_mutex_;
+  mutable size_t num_tuned_ = 0;
+  // Cache lines for other CPU models, written back unchanged.
+  mutable vector<string> other_lines_;
+};
+
+#endif
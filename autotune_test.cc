@@ -0,0 +1,181 @@
+#include "autotune.h"
+
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+class AutotuneTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = "/tmp/autotune_test_" + std::to_string(getpid()) + ".cache";
+    remove(path_.c_str());
+    params_.secondsPerCandidate = 1e-5;
+  }
+  void TearDown() override { remove(path_.c_str()); }
+
+  string path_;
+  AutotunerParams params_;
+};
+
+TEST_F(AutotuneTest, BlockingDoesntChangeResults) {
+  PReluNNLayer layer(19, 23, 0.01);
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> dist(-1.0, 1.0);
+  for (float& w : layer.inWeights.data) {
+    w = dist(rng);
+  }
+  for (float& b : layer.bias) {
+    b = dist(rng);
+  }
+  size_t batch_size = 13;
+  vector<float> inputs(batch_size * 19);
+  for (float& x : inputs) {
+    x = dist(rng);
+  }
+  vector<float> expected(batch_size * 23), outputs(batch_size * 23);
+  layer.forwardBatch(inputs.data(), batch_size, expected.data(),
+		     KernelBlocking());
+  for (size_t units : {1, 4, 16, 64}) {
+    for (size_t examples : {1, 2, 8, 32}) {
+      KernelBlocking blocking;
+      blocking.units = units;
+      blocking.examples = examples;
+      layer.forwardBatch(inputs.data(), batch_size, outputs.data(),
+			 blocking);
+      EXPECT_EQ(expected, outputs) << units << " " << examples;
+    }
+  }
+}
+
+TEST_F(AutotuneTest, TunesEachShapeOnce) {
+  KernelAutotuner tuner(path_, "test cpu", params_);
+  KernelBlocking first = tuner.blocking(40, 30, 30);
+  EXPECT_EQ(1, tuner.numTuned());
+  EXPECT_LT(first.units, 40);
+  EXPECT_LT(first.examples, 32);
+  // 30 and 32 share a batch bucket.
+  KernelBlocking again = tuner.blocking(40, 30, 32);
+  EXPECT_EQ(1, tuner.numTuned());
+  EXPECT_EQ(first.units, again.units);
+  EXPECT_EQ(first.examples, again.examples);
+  tuner.blocking(40, 30, 33);
+  EXPECT_EQ(2, tuner.numTuned());
+}
+
+TEST_F(AutotuneTest, ReadsChoicesForItsCpuFromCache) {
+  KernelBlocking tuned;
+  {
+    KernelAutotuner tuner(path_, "cpu A", params_);
+    tuned = tuner.blocking(64, 16, 8);
+  }
+  KernelAutotuner same_cpu(path_, "cpu A", params_);
+  KernelBlocking cached = same_cpu.blocking(64, 16, 8);
+  EXPECT_EQ(0, same_cpu.numTuned());
+  EXPECT_EQ(tuned.units, cached.units);
+  EXPECT_EQ(tuned.examples, cached.examples);
+
+  // Another CPU tunes for itself, keeping the first CPU's choices.
+  {
+    KernelAutotuner other_cpu(path_, "cpu B (rev 2)", params_);
+    other_cpu.blocking(64, 16, 8);
+    EXPECT_EQ(1, other_cpu.numTuned());
+  }
+  KernelAutotuner reloaded(path_, "cpu A", params_);
+  reloaded.blocking(64, 16, 8);
+  EXPECT_EQ(0, reloaded.numTuned());
+  KernelAutotuner other_reloaded(path_, "cpu B (rev 2)", params_);
+  other_reloaded.blocking(64, 16, 8);
+  EXPECT_EQ(0, other_reloaded.numTuned());
+}
+
+TEST_F(AutotuneTest, ProcessesSharingACacheKeepEachOthersChoices) {
+  // Both read the file before either saved to it.
+  KernelAutotuner a(path_, "cpu A", params_);
+  KernelAutotuner b(path_, "cpu A", params_);
+  KernelAutotuner c(path_, "cpu B", params_);
+  a.blocking(64, 16, 8);
+  b.blocking(32, 16, 8);
+  c.blocking(64, 16, 8);
+  KernelAutotuner reloaded(path_, "cpu A", params_);
+  reloaded.blocking(64, 16, 8);
+  reloaded.blocking(32, 16, 8);
+  EXPECT_EQ(0, reloaded.numTuned());
+  KernelAutotuner other_reloaded(path_, "cpu B", params_);
+  other_reloaded.blocking(64, 16, 8);
+  EXPECT_EQ(0, other_reloaded.numTuned());
+  // No temporary files are left behind.
+  string dir = path_.substr(0, path_.rfind('/'));
+  string base = path_.substr(dir.size() + 1);
+  std::unique_ptr<DIR, int (*)(DIR*)> listing(opendir(dir.c_str()), closedir);
+  ASSERT_TRUE(listing != nullptr);
+  int files = 0;
+  while (struct dirent* entry = readdir(listing.get())) {
+    if (string(entry->d_name).compare(0, base.size(), base) == 0) {
+      files++;
+    }
+  }
+  EXPECT_EQ(1, files);
+}
+
+TEST_F(AutotuneTest, ConcurrentLookupsAgree) {
+  KernelAutotuner tuner(path_, "test cpu", params_);
+  vector<std::thread> threads;
+  vector<KernelBlocking> results(8);
+  for (size_t t = 0; t < results.size(); t++) {
+    threads.emplace_back([&, t]() {
+	for (int i = 0; i < 1000; i++) {
+	  results[t] = tuner.blocking(40, 30, 1 + i % 64);
+	}
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  // One tuning per batch bucket, 1 through 64.
+  EXPECT_EQ(7, tuner.numTuned());
+  for (const KernelBlocking& result : results) {
+    EXPECT_EQ(results[0].units, result.units);
+    EXPECT_EQ(results[0].examples, result.examples);
+  }
+}
+
+TEST_F(AutotuneTest, TunedNetworkGivesSameResults) {
+  NNParams params(6, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(params));
+  nn->addLayer(RELU, 24);
+  nn->addLayer(SIGMOID, 12);
+  nn->addOutputLayer(RELU, 2);
+  srand(7);
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>((rand() % 1000) * 0.002 - 1.0);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    });
+  vector<vector<float>> inputs;
+  for (int e = 0; e < 20; e++) {
+    inputs.push_back({0.1f * e, 0.3f, -0.2f * e, 1.0f, 0.05f * e, 0.7f});
+  }
+  vector<float> expected, results;
+  nn->inferenceBatch(inputs, &expected);
+  auto tuner = std::make_shared<KernelAutotuner>(path_, "test cpu",
+						 params_);
+  tuner->tune(*nn, {20});
+  EXPECT_EQ(3, tuner->numTuned());
+  nn->kernelTuning = tuner;
+  nn->inferenceBatch(inputs, &results);
+  EXPECT_EQ(3, tuner->numTuned());
+  EXPECT_EQ(expected, results);
+}
+
+TEST_F(AutotuneTest, FindsCpuModel) {
+  EXPECT_FALSE(hostCpuModel().empty());
+}
@@ -0,0 +1,151 @@
+#include "batcher.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace {
+
+BatcherParams validated(BatcherParams params) {
+  // With no room in a batch, the worker would spin without serving.
+  params.maxBatchSize = std::max<size_t>(params.maxBatchSize, 1);
+  return params;
+}
+
+}  // namespace
+
+InferenceBatcher::InferenceBatcher(const ModelHandle* model,
+				   const BatcherParams& params) :
+  model_(model), params_(validated(params)), worker_([this]() {
+      if (params_.onWorkerStart) {
+	params_.onWorkerStart();
+      }
+      run();
+    }) {}
+
+InferenceBatcher::~InferenceBatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  request_available_.notify_all();
+  worker_.join();
+}
+
+void InferenceBatcher::submit(vector<float> inputs,
+			      std::function<void(float)> done) {
+  submitAll(std::move(inputs), [done](const float* outputs, size_t n) {
+      done(n > 0 ? outputs[0] : std::numeric_limits<float>::quiet_NaN());
+    });
+}
+
+void InferenceBatcher::submitAll(
+    vector<float> inputs,
+    std::function<void(const float*, size_t)> done) {
+  if (inputs.size() != model_->read()->params->numInputs) {
+    done(nullptr, 0);
+    return;
+  }
+  bool batch_full;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(Request{std::move(inputs), std::move(done),
+			     std::chrono::steady_clock::now()});
+    batch_full = queue_.size() == 1 ||
+      queue_.size() >= params_.maxBatchSize;
+  }
+  // The worker only needs waking for the first request of a batch (to
+  // start its timer) and for a full batch.
+  if (batch_full) {
+    request_available_.notify_one();
+  }
+}
+
+float InferenceBatcher::infer(vector<float> inputs) {
+  vector<float> outputs = inferAll(std::move(inputs));
+  return (outputs.empty() ? std::numeric_limits<float>::quiet_NaN() :
+	  outputs[0]);
+}
+
+vector<float> InferenceBatcher::inferAll(vector<float> inputs) {
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  bool done = false;
+  vector<float> result;
+  submitAll(std::move(inputs), [&](const float* outputs, size_t n) {
+      std::lock_guard<std::mutex> lock(done_mutex);
+      result.assign(outputs, outputs + n);
+      done = true;
+      done_cv.notify_one();
+    });
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done_cv.wait(lock, [&]() { return done; });
+  return result;
+}
+
+void InferenceBatcher::run() {
+  vector<Request> batch, failed;
+  vector<vector<float>> inputs;
+  vector<float> results;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      request_available_.wait(lock, [this]() {
+	  return stopping_ || !queue_.empty();
+	});
+      if (queue_.empty()) {
+	return;
+      }
+      std::chrono::steady_clock::time_point deadline =
+	queue_.front().arrival + params_.maxWait;
+      request_available_.wait_until(lock, deadline, [this]() {
+	  return stopping_ || queue_.size() >= params_.maxBatchSize;
+	});
+      size_t n = std::min(queue_.size(), params_.maxBatchSize);
+      batch.clear();
+      for (size_t i = 0; i < n; i++) {
+	batch.push_back(std::move(queue_.front()));
+	queue_.pop_front();
+      }
+    }
+    size_t num_outputs;
+    {
+      ModelHandle::ReadGuard model = model_->read();
+      // submitAll checked the widths against the model of its time,
+      // which may have been replaced since.
+      size_t num_inputs = model->params->numInputs;
+      failed.clear();
+      size_t kept = 0;
+      for (size_t i = 0; i < batch.size(); i++) {
+	if (batch[i].inputs.size() != num_inputs) {
+	  failed.push_back(std::move(batch[i]));
+	} else if (kept++ != i) {
+	  batch[kept - 1] = std::move(batch[i]);
+	}
+      }
+      batch.resize(kept);
+      inputs.resize(batch.size());
+      for (size_t i = 0; i < batch.size(); i++) {
+	inputs[i].swap(batch[i].inputs);
+      }
+      if (!batch.empty()) {
+	model->inferenceBatch(inputs, &results);
+      }
+      num_outputs = model->numOutputs();
+    }
+    for (Request& request : failed) {
+      request.done(nullptr, 0);
+    }
+    if (batch.empty()) {
+      continue;
+    }
+    batches_run_++;
+    requests_run_ += batch.size();
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i].done(&results[i * num_outputs], num_outputs);
+    }
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef __BATCHER_H_
+#define __BATCHER_H_
+
+#include "model_handle.h"
+#include "nn.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct BatcherParams {
+  // At least 1; smaller values are taken as 1.
+  size_t maxBatchSize = 32;
+  // How long the first request of a batch may wait for others to join.
+  std::chrono::microseconds maxWait{500};
+  // If set, the worker thread calls this before running any batch, e.g.
+  // to pin itself to a NUMA node's CPUs.
+  std::function<void()> onWorkerStart;
+};
+
+// Coalesces concurrent single-example inference requests into micro
+// batches, which a worker thread runs through NN::inferenceBatch. A
+// batch is run as soon as it has maxBatchSize requests, or maxWait
+// after its first request arrived, whichever comes first. Each batch
+// runs on whatever model the handle holds when the batch starts.
+class InferenceBatcher {
+ public:
+  InferenceBatcher(const ModelHandle* model, const BatcherParams& params);
+  // Runs any requests still queued before returning.
+  ~InferenceBatcher();
+
+  InferenceBatcher(const InferenceBatcher&) = delete;
+  InferenceBatcher& operator=(const InferenceBatcher&) = delete;
+
+  // Queues a request; done is called with the result (the model's
+  // first output) on the worker thread, so it should be quick.
+  //
+  // A request whose inputs aren't as wide as the model's fails: done
+  // gets NaN, or no outputs from submitAll. That happens on the calling
+  // thread before submit returns if the current model is the wrong
+  // width, otherwise on the worker if the model is replaced by one of
+  // another width before the request runs.
+  void submit(vector<float> inputs, std::function<void(float)> done);
+  // As above, but done gets all of the model's outputs.
+  void submitAll(vector<float> inputs,
+		 std::function<void(const float* outputs,
+				    size_t num_outputs)> done);
+  // Queues a request and blocks until its result is ready (NaN, or no
+  // outputs, if it fails).
+  float infer(vector<float> inputs);
+  vector<float> inferAll(vector<float> inputs);
+
+  uint64_t batchesRun() const { return batches_run_.load(); }
+  uint64_t requestsRun() const { return requests_run_.load(); }
+
+ private:
+  struct Request {
+    vector<float> inputs;
+    std::function<void(const float*, size_t)> done;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  void run();
+
+  const ModelHandle* model_;
+  BatcherParams params_;
+  std::mutex mutex_;
+  std::condition_variable request_available_;
+  std::deque<Request> queue_;
+  bool stopping_ = false;
+  std::atomic<uint64_t> batches_run_{0};
+  std::atomic<uint64_t> requests_run_{0};
+  std::thread worker_;
+};
+
+#endif
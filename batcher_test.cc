@@ -0,0 +1,157 @@
+#include "batcher.h"
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::unique_ptr<NN> randomModel(unsigned int seed) {
+  NNParams params(3, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(params));
+  nn->addLayer(LayerType::RELU, 4);
+  nn->addOutputLayer(LayerType::SIGMOID);
+  srand(seed);
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+    });
+  return nn;
+}
+
+}  // namespace
+
+TEST(InferenceBatcherTest, MatchesInference) {
+  std::unique_ptr<NN> reference = randomModel(1);
+  ModelHandle handle(randomModel(1));
+  InferenceBatcher batcher(&handle, BatcherParams());
+  for (float x = 0.0; x < 1.0; x += 0.125) {
+    vector<float> inputs = { x, 1.0f - x, x * x };
+    EXPECT_FLOAT_EQ(reference->inference(inputs), batcher.infer(inputs));
+  }
+}
+
+TEST(InferenceBatcherTest, CoalescesConcurrentRequests) {
+  std::unique_ptr<NN> reference = randomModel(2);
+  ModelHandle handle(randomModel(2));
+  BatcherParams params;
+  params.maxBatchSize = 8;
+  params.maxWait = std::chrono::milliseconds(20);
+  InferenceBatcher batcher(&handle, params);
+
+  const size_t kThreads = 8, kRequests = 20;
+  std::atomic<size_t> mismatches{0};
+  vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; t++) {
+    threads.emplace_back([&, t]() {
+	for (size_t r = 0; r < kRequests; r++) {
+	  vector<float> inputs = { 0.1f * t, 0.01f * r, 0.5 };
+	  if (batcher.infer(inputs) != reference->inference(inputs)) {
+	    mismatches++;
+	  }
+	}
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, mismatches.load());
+  EXPECT_EQ(kThreads * kRequests, batcher.requestsRun());
+  EXPECT_LT(batcher.batchesRun(), batcher.requestsRun());
+}
+
+TEST(InferenceBatcherTest, FullBatchDoesNotWaitForDeadline) {
+  ModelHandle handle(randomModel(3));
+  BatcherParams params;
+  params.maxBatchSize = 1;
+  params.maxWait = std::chrono::seconds(10);
+  InferenceBatcher batcher(&handle, params);
+  auto start = std::chrono::steady_clock::now();
+  batcher.infer({ 0.1, 0.2, 0.3 });
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST(InferenceBatcherTest, UsesPublishedModel) {
+  std::unique_ptr<NN> first = randomModel(4), second = randomModel(5);
+  vector<float> inputs = { 0.3, 0.6, 0.9 };
+  float first_result = first->inference(inputs);
+  float second_result = second->inference(inputs);
+  ASSERT_NE(first_result, second_result);
+  ModelHandle handle(std::move(first));
+  InferenceBatcher batcher(&handle, BatcherParams());
+  EXPECT_FLOAT_EQ(first_result, batcher.infer(inputs));
+  handle.publish(std::move(second));
+  EXPECT_FLOAT_EQ(second_result, batcher.infer(inputs));
+}
+
+TEST(InferenceBatcherTest, SubmitCallsBackBeforeDestruction) {
+  ModelHandle handle(randomModel(6));
+  std::atomic<size_t> done{0};
+  {
+    InferenceBatcher batcher(&handle, BatcherParams());
+    for (int i = 0; i < 50; i++) {
+      batcher.submit({ 0.1, 0.2, 0.3 }, [&done](float) { done++; });
+    }
+  }
+  EXPECT_EQ(50, done.load());
+}
+
+TEST(InferenceBatcherTest, ReturnsEveryOutput) {
+  NNParams params(2, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(params));
+  nn->addLayer(LayerType::RELU, 3);
+  nn->addOutputLayer(LayerType::SIGMOID, 2);
+  srand(8);
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+    });
+  vector<float> inputs = { 0.2, 0.7 }, expected;
+  nn->inferenceAll(inputs, &expected);
+  ModelHandle handle(std::move(nn));
+  InferenceBatcher batcher(&handle, BatcherParams());
+  EXPECT_EQ(expected, batcher.inferAll(inputs));
+  EXPECT_EQ(expected[0], batcher.infer(inputs));
+}
+
+TEST(InferenceBatcherTest, ZeroMaxBatchSizeRunsSingleRequests) {
+  std::unique_ptr<NN> reference = randomModel(9);
+  vector<float> inputs = { 0.3, 0.1, 0.4 };
+  float expected = reference->inference(inputs);
+  ModelHandle handle(std::move(reference));
+  BatcherParams params;
+  params.maxBatchSize = 0;
+  InferenceBatcher batcher(&handle, params);
+  EXPECT_EQ(expected, batcher.infer(inputs));
+  EXPECT_EQ(1, batcher.batchesRun());
+}
+
+TEST(InferenceBatcherTest, FailsRequestsOfTheWrongWidth) {
+  ModelHandle handle(randomModel(10));
+  BatcherParams params;
+  params.maxWait = std::chrono::milliseconds(200);
+  InferenceBatcher batcher(&handle, params);
+  EXPECT_TRUE(batcher.inferAll({ 0.1, 0.2 }).empty());
+  EXPECT_TRUE(std::isnan(batcher.infer({ 0.1, 0.2, 0.3, 0.4 })));
+
+  // Queued for the current model, but run by a narrower one.
+  std::atomic<bool> failed(false);
+  batcher.submitAll({ 0.1, 0.2, 0.3 }, [&failed](const float*, size_t n) {
+      failed = (n == 0);
+    });
+  NNParams narrow(2, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(narrow));
+  nn->addLayer(LayerType::RELU, 1);
+  handle.publish(std::move(nn));
+  EXPECT_EQ(1, batcher.inferAll({ 0.1, 0.2 }).size());
+  EXPECT_TRUE(failed.load());
+  EXPECT_EQ(1, batcher.requestsRun());
+}
@@ -0,0 +1,44 @@
+#include "cross_validation.h"
+
+#include <cmath>
+#include <vector>
+
+#include "thread_pool.h"
+
+CrossValidationResult crossValidate(
+    const ModelSpec& spec,
+    const vector<pair<vector<float>, float>>& examples,
+    const vector<Dataset::Split>& folds,
+    size_t num_threads) {
+  CrossValidationResult result;
+  result.folds.resize(folds.size());
+  {
+    ThreadPool pool(num_threads);
+    for (size_t i = 0; i < folds.size(); i++) {
+      pool.schedule([&, i]() {
+	  FoldResult& fold = result.folds[i];
+	  fold.nn = buildModel(spec);
+	  fold.nn->params->verbose = false;
+	  fold.nn->train(ExampleView(examples, folds[i].train),
+			 &fold.report);
+	  fold.validationLoss =
+	    fold.nn->evaluate(ExampleView(examples, folds[i].validation));
+	});
+    }
+    pool.wait();
+  }
+  if (folds.empty()) {
+    return result;
+  }
+  for (const FoldResult& fold : result.folds) {
+    result.meanValidationLoss += fold.validationLoss;
+  }
+  result.meanValidationLoss /= folds.size();
+  for (const FoldResult& fold : result.folds) {
+    float d = fold.validationLoss - result.meanValidationLoss;
+    result.stdDevValidationLoss += d * d;
+  }
+  result.stdDevValidationLoss =
+    std::sqrt(result.stdDevValidationLoss / folds.size());
+  return result;
+}
@@ -0,0 +1,34 @@
+#ifndef __CROSS_VALIDATION_H_
+#define __CROSS_VALIDATION_H_
+
+#include "dataset.h"
+#include "multi_trainer.h"
+#include "nn.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+struct FoldResult {
+  std::unique_ptr<NN> nn;
+  TrainingReport report;
+  float validationLoss = 0.0;
+};
+
+struct CrossValidationResult {
+  vector<FoldResult> folds;
+  float meanValidationLoss = 0.0;
+  float stdDevValidationLoss = 0.0;
+};
+
+// Trains one model per fold, in parallel, each from the same spec.
+// examples must hold every processed row of the dataset the folds were
+// split from, in row order (as Dataset::process_examples produces);
+// folds only index into it, so no examples are copied per fold.
+CrossValidationResult crossValidate(
+    const ModelSpec& spec,
+    const vector<pair<vector<float>, float>>& examples,
+    const vector<Dataset::Split>& folds,
+    size_t num_threads = 0);
+
+#endif
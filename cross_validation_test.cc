@@ -0,0 +1,49 @@
+#include "cross_validation.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(CrossValidationTest, TrainsEachFoldOnItsRows) {
+  vector<string> field_names = { "x", "color", "y" };
+  Dataset dataset(field_names, 2);
+  const char* colors[] = { "red", "green", "blue" };
+  for (int i = 0; i < 30; i++) {
+    dataset.add_row({ std::to_string(i * 0.1), colors[i % 3],
+		      std::to_string(i * 0.05 + (i % 3)) });
+  }
+  dataset.process_features();
+  vector<pair<vector<float>, float>> examples;
+  dataset.process_examples(&examples);
+  ASSERT_EQ(30, examples.size());
+
+  NNParams params(dataset.output_features().size(), 15, DEFAULT_MIN_DELTA,
+		  3, 10, 0.05);
+  ModelSpec spec("cv", params, {{RELU, 4}});
+  vector<Dataset::Split> folds = dataset.k_fold_splits(5, 3);
+  CrossValidationResult result = crossValidate(spec, examples, folds, 5);
+  ASSERT_EQ(5, result.folds.size());
+
+  float mean = 0.0;
+  for (size_t i = 0; i < folds.size(); i++) {
+    // Same as training on a copy of the fold's rows.
+    vector<pair<vector<float>, float>> train, validation;
+    for (size_t row : folds[i].train) {
+      train.push_back(examples[row]);
+    }
+    for (size_t row : folds[i].validation) {
+      validation.push_back(examples[row]);
+    }
+    std::unique_ptr<NN> nn = buildModel(spec);
+    nn->params->verbose = false;
+    TrainingReport report;
+    nn->train(train, &report);
+    EXPECT_EQ(report.losses, result.folds[i].report.losses);
+    EXPECT_FLOAT_EQ(nn->evaluate(validation), result.folds[i].validationLoss);
+    mean += result.folds[i].validationLoss / folds.size();
+  }
+  EXPECT_FLOAT_EQ(mean, result.meanValidationLoss);
+  EXPECT_GE(result.stdDevValidationLoss, 0.0);
+}
@@ -0,0 +1,147 @@
+#include "data_parallel.h"
+
+#include "thread_pool.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+DataParallelTrainer::DataParallelTrainer(RingAllReduce* ring,
+					 const DataParallelParams& params) :
+  ring_(ring), params_(params) {}
+
+bool DataParallelTrainer::train(
+    NN* nn, const vector<pair<vector<float>, float>>& shard,
+    TrainingReport* report) {
+  return trainShard(nn, shard, report);
+}
+
+bool DataParallelTrainer::train(
+    NN* nn, const vector<pair<vector<float>, vector<float>>>& shard,
+    TrainingReport* report) {
+  return trainShard(nn, shard, report);
+}
+
+template <typename Examples>
+bool DataParallelTrainer::trainShard(NN* nn, const Examples& shard,
+				     TrainingReport* report) {
+  report->losses.clear();
+  report->targetLosses.clear();
+  report->epochSeconds.clear();
+  report->phases = PhaseTimes();
+  size_t num_ranks = ring_->size();
+  float largest_shard = shard.size();
+  vector<float> shard_sizes(num_ranks, 0.0);
+  shard_sizes[ring_->rank()] = shard.size();
+  if (!ring_->allReduce(shard_sizes.data(), num_ranks)) {
+    return false;
+  }
+  size_t total_examples = 0;
+  for (float size : shard_sizes) {
+    if (size == 0) {
+      return false;
+    }
+    largest_shard = std::max(largest_shard, size);
+    total_examples += size;
+  }
+  size_t batch_size = std::max<size_t>(params_.batchSize, 1);
+  size_t steps_per_epoch = (static_cast<size_t>(largest_shard) +
+			    batch_size - 1) / batch_size;
+  float step_size = nn->params->learningRate / num_ranks;
+
+  // Sends each layer's gradients while the layers before it are still
+  // being computed.
+  ThreadPool comm(1);
+  std::atomic<bool> comm_ok{true};
+  NNGradients gradients;
+  auto layer_done = [&](size_t i) {
+    comm.schedule([&, i]() {
+	if (!ring_->allReduce(gradients.weights[i].data(),
+			      gradients.weights[i].size()) ||
+	    !ring_->allReduce(gradients.biases[i].data(),
+			      gradients.biases[i].size())) {
+	  comm_ok = false;
+	}
+      });
+  };
+
+  vector<size_t> batch(batch_size);
+  size_t next_example = 0;
+  size_t num_outputs = nn->numOutputs();
+  double total_seconds = 0.0;
+  for (size_t num_iterations = 0;
+       num_iterations < nn->params->maxIterations &&
+	 !nn->trainingShouldStop(report); num_iterations++) {
+    double epoch_seconds = 0.0;
+    // Mean loss over the shard times its size, per output unit, for
+    // the ring to sum.
+    vector<float> losses(num_outputs, 0.0);
+    {
+      ScopedTimer timer(&epoch_seconds);
+      for (size_t step = 0; step < steps_per_epoch; step++) {
+	// Shards smaller than the largest wrap around.
+	for (size_t& index : batch) {
+	  index = next_example;
+	  next_example = (next_example + 1) % shard.size();
+	}
+	{
+	  ScopedTimer timer(&report->phases.backward);
+	  nn->computeGradients(ExampleView(shard, batch), &gradients,
+			       layer_done);
+	  comm.wait();
+	}
+	if (!comm_ok) {
+	  return false;
+	}
+	ScopedTimer timer(&report->phases.update);
+	for (size_t i = 0; i < nn->layers.size(); i++) {
+	  NNLayer* layer = nn->layers[i].get();
+	  layer->sparseWeights.clear();
+	  const vector<float>& weight_gradients = gradients.weights[i];
+	  for (size_t j = 0; j < weight_gradients.size(); j++) {
+	    layer->inWeights.data[j] -= step_size * weight_gradients[j];
+	  }
+	  const vector<float>& bias_gradients = gradients.biases[i];
+	  for (size_t j = 0; j < bias_gradients.size(); j++) {
+	    layer->bias[j] -= step_size * bias_gradients[j];
+	  }
+	  if (!layer->pruneMask.empty()) {
+	    for (size_t j = 0; j < layer->inWeights.data.size(); j++) {
+	      if (!layer->pruneMask[j]) {
+		layer->inWeights.data[j] = 0.0;
+	      }
+	    }
+	  }
+	}
+      }
+      nn->evaluate(shard, &losses);
+      for (float& loss : losses) {
+	loss *= shard.size();
+      }
+      if (!ring_->allReduce(losses.data(), losses.size())) {
+	return false;
+      }
+    }
+    float loss = 0.0;
+    for (float& target_loss : losses) {
+      target_loss /= total_examples;
+      loss += target_loss;
+    }
+    if (nn->params->verbose && ring_->rank() == 0) {
+      std::cout << " iteration: " << num_iterations << " loss: " << loss <<
+	std::endl;
+    }
+    report->losses.push_back(loss);
+    report->targetLosses.push_back(losses);
+    report->epochSeconds.push_back(epoch_seconds);
+    total_seconds += epoch_seconds;
+  }
+  report->timeElapsed = total_seconds;
+  report->examplesPerSecond =
+    (total_seconds > 0 ? report->losses.size() * steps_per_epoch *
+     batch_size * num_ranks / total_seconds : 0.0);
+  report->peakMemoryBytes = peakMemoryBytes();
+  nn->updateSparseWeights();
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef __DATA_PARALLEL_H_
+#define __DATA_PARALLEL_H_
+
+#include "nn.h"
+#include "ring_allreduce.h"
+
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+struct DataParallelParams {
+  // Examples each rank contributes to every step, so a step's update
+  // averages the gradients of batchSize * ring size examples.
+  size_t batchSize = 32;
+};
+
+// Trains one replica of a network per process, each on its own shard
+// of the examples, keeping the replicas identical by summing their
+// gradients with a ring all-reduce before every update.
+//
+// Unlike NN::train, which updates the weights once per example, this
+// is mini-batch SGD: each step moves every weight by learningRate
+// times its gradient averaged over the step's examples on all ranks.
+// A layer's gradients are sent as soon as backpropagation has
+// finished them, so communication overlaps the remaining layers.
+class DataParallelTrainer {
+ public:
+  // ring must already be connected.
+  DataParallelTrainer(RingAllReduce* ring,
+		      const DataParallelParams& params = DataParallelParams());
+
+  // Trains nn on this rank's shard. Every rank must call this with
+  // identically initialized networks and the same parameters; shards
+  // may differ in size but not be empty. Each iteration takes as many
+  // steps as an epoch over the largest shard would, and the report's
+  // losses are over all shards, so every rank stops after the same
+  // iteration. False on a communication error.
+  bool train(NN* nn, const vector<pair<vector<float>, float>>& shard,
+	     TrainingReport* report);
+  bool train(NN* nn,
+	     const vector<pair<vector<float>, vector<float>>>& shard,
+	     TrainingReport* report);
+
+ private:
+  template <typename Examples>
+  bool trainShard(NN* nn, const Examples& shard, TrainingReport* report);
+
+  RingAllReduce* ring_;
+  DataParallelParams params_;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "data_parallel.h"
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+// Runs body(rank) for every rank of a ring on its own thread, the
+// ranks connected over Unix sockets.
+void runRing(size_t num_ranks,
+	     const std::function<void(RingAllReduce*)>& body) {
+  vector<string> addresses;
+  for (size_t r = 0; r < num_ranks; r++) {
+    addresses.push_back("/tmp/data_parallel_test." +
+			std::to_string(getpid()) + "." + std::to_string(r));
+  }
+  vector<std::thread> threads;
+  for (size_t r = 0; r < num_ranks; r++) {
+    threads.emplace_back([&, r]() {
+	RingAllReduce ring(r, addresses);
+	ASSERT_TRUE(ring.connect(std::chrono::seconds(10)));
+	body(&ring);
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+TEST(RingAllReduceTest, SumsAcrossRanks) {
+  // Sizes divisible by the ring size, not divisible, and smaller.
+  for (size_t n : { 9, 1000, 7, 2, 1 }) {
+    vector<vector<float>> results(3);
+    runRing(3, [&](RingAllReduce* ring) {
+	vector<float> data(n);
+	for (size_t i = 0; i < n; i++) {
+	  data[i] = 0.1f * i + ring->rank();
+	}
+	ASSERT_TRUE(ring->allReduce(data.data(), n));
+	results[ring->rank()] = data;
+      });
+    for (size_t i = 0; i < n; i++) {
+      EXPECT_NEAR(0.3f * i + 3.0f, results[0][i], 1e-3) << n << " " << i;
+    }
+    // Every rank gets the very same sums.
+    EXPECT_EQ(results[0], results[1]);
+    EXPECT_EQ(results[0], results[2]);
+  }
+}
+
+TEST(RingAllReduceTest, SingleRankIsANoOp) {
+  RingAllReduce ring(0, { "/tmp/unused" });
+  ASSERT_TRUE(ring.connect());
+  vector<float> data = { 1.0, 2.0 };
+  ASSERT_TRUE(ring.allReduce(data.data(), data.size()));
+  EXPECT_EQ(vector<float>({ 1.0, 2.0 }), data);
+  EXPECT_EQ(0, ring.bytesSent());
+}
+
+TEST(RingAllReduceTest, FailsWhenARankGoesAway) {
+  vector<string> addresses;
+  for (size_t r = 0; r < 2; r++) {
+    addresses.push_back("/tmp/data_parallel_test." +
+			std::to_string(getpid()) + ".gone." +
+			std::to_string(r));
+  }
+  std::unique_ptr<RingAllReduce> rings[2];
+  vector<std::thread> threads;
+  for (size_t r = 0; r < 2; r++) {
+    threads.emplace_back([&, r]() {
+	rings[r].reset(new RingAllReduce(r, addresses));
+	ASSERT_TRUE(rings[r]->connect(std::chrono::seconds(10)));
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  // Rank 1 exits; rank 0's writes to it must fail, not raise SIGPIPE.
+  rings[1].reset();
+  vector<float> data(100000, 1.0);
+  EXPECT_FALSE(rings[0]->allReduce(data.data(), data.size()));
+}
+
+class DataParallelTest : public ::testing::Test {
+ public:
+  std::unique_ptr<NN> makeModel() {
+    NNParams params(3, 8, DEFAULT_MIN_DELTA, 10, 1, 0.1);
+    params.verbose = false;
+    std::unique_ptr<NN> nn(new NN(params));
+    nn->addLayer(RELU, 6);
+    nn->addLayer(SIGMOID, 4);
+    nn->addOutputLayer(RELU, 2);
+    srand(7);
+    nn->initializeWeights([](size_t i, size_t j, size_t k) {
+	return static_cast<float>((rand() % 100) * 0.01 - 0.5);
+      },
+      [](size_t i, size_t j) {
+	return static_cast<float>((rand() % 100) * 0.01 - 0.5);
+      });
+    return nn;
+  }
+
+  // Examples of two linear functions, dealt to num_ranks shards of
+  // unequal sizes.
+  vector<vector<pair<vector<float>, vector<float>>>> makeShards(
+      size_t num_ranks) {
+    vector<vector<pair<vector<float>, vector<float>>>> shards(num_ranks);
+    for (int e = 0; e < 50; e++) {
+      vector<float> x = { 0.02f * e, (e % 5) * 0.2f, (e % 7) * 0.1f };
+      vector<float> y = { 0.5f * x[0] + 0.3f * x[1] + 0.1f,
+			  0.2f * x[2] + 0.4f };
+      shards[e % 3 == 0 ? 0 : e % num_ranks].push_back(make_pair(x, y));
+    }
+    return shards;
+  }
+};
+
+TEST_F(DataParallelTest, ReplicasStayIdenticalAndLossFalls) {
+  auto shards = makeShards(2);
+  vector<std::unique_ptr<NN>> models;
+  vector<TrainingReport> reports(2);
+  models.push_back(makeModel());
+  models.push_back(makeModel());
+  DataParallelParams params;
+  params.batchSize = 5;
+  runRing(2, [&](RingAllReduce* ring) {
+      size_t r = ring->rank();
+      DataParallelTrainer trainer(ring, params);
+      ASSERT_TRUE(trainer.train(models[r].get(), shards[r], &reports[r]));
+    });
+  ASSERT_EQ(8, reports[0].losses.size());
+  EXPECT_EQ(reports[0].losses, reports[1].losses);
+  EXPECT_LT(reports[0].losses.back(), reports[0].losses.front());
+  for (size_t i = 0; i < models[0]->layers.size(); i++) {
+    EXPECT_EQ(models[0]->layers[i]->inWeights.data,
+	      models[1]->layers[i]->inWeights.data);
+    EXPECT_EQ(models[0]->layers[i]->bias, models[1]->layers[i]->bias);
+  }
+}
+
+TEST_F(DataParallelTest, MatchesMiniBatchGradientDescent) {
+  // One step over two shards of two examples each is one gradient step
+  // on the mean over all four.
+  auto shards = makeShards(2);
+  shards[0].resize(2);
+  shards[1].resize(2);
+  vector<pair<vector<float>, vector<float>>> all = shards[0];
+  all.insert(all.end(), shards[1].begin(), shards[1].end());
+  std::unique_ptr<NN> expected = makeModel();
+  NNGradients gradients;
+  expected->computeGradients(all, &gradients);
+  for (size_t i = 0; i < expected->layers.size(); i++) {
+    NNLayer* layer = expected->layers[i].get();
+    for (size_t j = 0; j < layer->inWeights.data.size(); j++) {
+      layer->inWeights.data[j] -= 0.1 * gradients.weights[i][j];
+    }
+    for (size_t j = 0; j < layer->bias.size(); j++) {
+      layer->bias[j] -= 0.1 * gradients.biases[i][j];
+    }
+  }
+
+  vector<std::unique_ptr<NN>> models;
+  models.push_back(makeModel());
+  models.push_back(makeModel());
+  DataParallelParams params;
+  params.batchSize = 2;
+  runRing(2, [&](RingAllReduce* ring) {
+      size_t r = ring->rank();
+      models[r]->params->maxIterations = 1;
+      DataParallelTrainer trainer(ring, params);
+      TrainingReport report;
+      ASSERT_TRUE(trainer.train(models[r].get(), shards[r], &report));
+    });
+  for (size_t i = 0; i < expected->layers.size(); i++) {
+    for (size_t j = 0; j < expected->layers[i]->inWeights.data.size(); j++) {
+      EXPECT_NEAR(expected->layers[i]->inWeights.data[j],
+		  models[0]->layers[i]->inWeights.data[j], 1e-5);
+    }
+    for (size_t j = 0; j < expected->layers[i]->bias.size(); j++) {
+      EXPECT_NEAR(expected->layers[i]->bias[j],
+		  models[0]->layers[i]->bias[j], 1e-5);
+    }
+  }
+}
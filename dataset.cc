@@ -1,7 +1,13 @@
 #include "dataset.h"
 
+#include "example_file.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <iostream>
+#include <random>
 #include <set>
 #include <string>
 #include <utility>
@@ -14,43 +20,135 @@ using std::sqrt;
 using std::string;
 using std::vector;
 
+void Dataset::add_window_features(size_t group_field,
+				  const vector<WindowFeature>& features) {
+  windows_.reset(new RollingWindows(field_names_, group_field, features));
+  for (const string& name : windows_->featureNames()) {
+    field_names_.push_back(name);
+  }
+}
+
 void Dataset::add_row(const vector<string>& fields) {
+  if (windows_) {
+    // Room for the window fields, so appending them doesn't move the
+    // row.
+    examples_.emplace_back();
+    examples_.back().reserve(field_names_.size());
+    examples_.back().assign(fields.begin(), fields.end());
+  } else {
+    examples_.push_back(fields);
+  }
+  update_statistics(fields);
+  if (windows_) {
+    add_window_fields(&examples_.back());
+  }
+  Metrics::addDatasetRowsParsed(1);
+}
+
+void Dataset::stream_row(const vector<string>& fields,
+			 pair<vector<float>, float>* example) {
+  update_statistics(fields);
+  if (windows_) {
+    window_row_ = fields;
+    add_window_fields(&window_row_);
+  }
+  process_example(windows_ ? window_row_ : fields, example);
+  Metrics::addDatasetRowsParsed(1);
+}
+
+void Dataset::stream_row(const vector<string>& fields,
+			 pair<vector<float>, vector<float>>* example) {
+  update_statistics(fields);
+  if (windows_) {
+    window_row_ = fields;
+    add_window_fields(&window_row_);
+  }
+  process_example(windows_ ? window_row_ : fields, example);
+  Metrics::addDatasetRowsParsed(1);
+}
+
+void Dataset::add_window_fields(vector<string>* fields) {
+  window_values_.resize(windows_->numFeatures());
+  windows_->update(*fields, window_values_.data());
+  // The values are at hand, so they needn't be parsed back.
+  size_t first = field_names_.size() - window_values_.size();
+  char buffer[32];
+  for (size_t i = 0; i < window_values_.size(); i++) {
+    update_numeric_statistics(first + i, window_values_[i]);
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer),
+			      window_values_[i]).ptr;
+    fields->emplace_back(buffer, end);
+  }
+}
+
+void Dataset::update_statistics(const vector<string>& fields) {
   char *endptr;
-  for (size_t i = 0; i < field_names_.size(); i++) {
+  size_t num_fields = field_names_.size() -
+    (windows_ ? windows_->numFeatures() : 0);
+  for (size_t i = 0; i < num_fields; i++) {
     // If we've found non-numeric values for this feature
     // or it's not convertible to a float, we will assume
     // it's categorical.
     float val = strtod(fields[i].data(), &endptr);
     if (*endptr == 0) {
-      auto range_pair_iter = range_index_.find(i);
-      if (range_pair_iter == range_index_.end()) {
-	range_index_[i] = make_pair(val, val);
-      } else {
-	auto& range_pair = range_pair_iter->second;
-	if (range_pair.first > val) {
-	  range_pair.first = val;
-	}
-	if (range_pair.second < val) {
-	  range_pair.second = val;
-	}
-      }
-      
-      auto mv = means_variances_.find(i);
-      if (mv == means_variances_.end()) {
-	means_variances_[i] = make_pair(val, 0.0);
-      } else {
-	auto& mv_pair = mv->second;
-	size_t n = examples_.size();
-	mv_pair.second = (n/(n+1)) *
-	  (mv_pair.second +
-	   (((mv_pair.first - val) * (mv_pair.first - val)) / (n+1)));
-	mv_pair.first = (mv_pair.first * n + val) / (n + 1);
-      }
-    } else {
+      update_numeric_statistics(i, val);
+    } else if (!features_processed_) {
       field_index_[i].insert(fields[i]);
     }
   }
-  examples_.push_back(fields);
+}
+
+void Dataset::update_numeric_statistics(size_t i, float val) {
+  auto range_pair_iter = range_index_.find(i);
+  if (range_pair_iter == range_index_.end()) {
+    if (features_processed_) {
+      // Categorical when features were processed; the layout is
+      // fixed now.
+      return;
+    }
+    range_index_[i] = make_pair(val, val);
+  } else if (!features_processed_ ||
+	     out_of_range_policy_ == EXTEND_RANGE) {
+    auto& range_pair = range_pair_iter->second;
+    if (range_pair.first > val) {
+      range_pair.first = val;
+    }
+    if (range_pair.second < val) {
+      range_pair.second = val;
+    }
+  }
+
+  // Running (population) mean and variance, by Welford's method.
+  size_t& n = numeric_counts_[i];
+  auto mv = means_variances_.find(i);
+  if (mv == means_variances_.end()) {
+    means_variances_[i] = make_pair(val, 0.0);
+  } else {
+    auto& mv_pair = mv->second;
+    float delta = val - mv_pair.first;
+    mv_pair.first += delta / (n + 1);
+    mv_pair.second = (mv_pair.second * n +
+		      delta * (val - mv_pair.first)) / (n + 1);
+  }
+  n++;
+}
+
+bool Dataset::numeric_range(size_t field, pair<float, float>* range) const {
+  auto iter = range_index_.find(field);
+  if (iter == range_index_.end()) {
+    return false;
+  }
+  *range = iter->second;
+  return true;
+}
+
+bool Dataset::mean_variance(size_t field, pair<float, float>* mv) const {
+  auto iter = means_variances_.find(field);
+  if (iter == means_variances_.end()) {
+    return false;
+  }
+  *mv = iter->second;
+  return true;
 }
 
 float Dataset::scale(float val, float min_val,
@@ -72,8 +170,8 @@ float Dataset::standardize(float val, float mean,
   return (val - mean) / std_dev;
 }
 */
-float Dataset::unscale_label(float val) {
-  auto range = range_index_.find(label_index_);
+float Dataset::unscale_label(float val, size_t label) {
+  auto range = range_index_.find(label_indices_[label]);
   if (range == range_index_.end()) {
     // No scaling; just return as is.
     return val;
@@ -93,7 +191,7 @@ float Dataset::unstandardize_label(float val) {
 */
 void Dataset::process_features() {
   for (size_t i = 0; i < field_names_.size(); i++) {
-    if (i == label_index_) {      
+    if (label_position(i) >= 0) {
       continue;
     }
     auto fields = field_index_.find(i);
@@ -113,28 +211,60 @@ void Dataset::process_features() {
     mv.second.second = sqrt(mv.second.second);
   }
   pos_ = examples_.begin();
+  features_processed_ = true;
+}
+
+int Dataset::label_position(size_t field) const {
+  for (size_t i = 0; i < label_indices_.size(); i++) {
+    if (label_indices_[i] == field) {
+      return i;
+    }
+  }
+  return -1;
 }
 
 void Dataset::process_example(const vector<string>& fields,
 			      pair<vector<float>, float>* example) {
-  vector<float>& features = example->first;
+  if (label_indices_.size() == 1) {
+    process_fields(fields, &example->first, &example->second);
+    return;
+  }
+  vector<float> labels(label_indices_.size());
+  process_fields(fields, &example->first, labels.data());
+  example->second = labels[0];
+}
+
+void Dataset::process_example(const vector<string>& fields,
+			      pair<vector<float>, vector<float>>* example) {
+  example->second.resize(label_indices_.size());
+  process_fields(fields, &example->first, example->second.data());
+}
+
+void Dataset::process_fields(const vector<string>& fields,
+			     vector<float>* features_out, float* labels) {
+  vector<float>& features = *features_out;
   features.clear();
   features.reserve(output_features_.size());
   for (size_t i = 0; i < field_names_.size(); i++) {
-    if (i == label_index_) {
+    int label = label_position(i);
+    if (label >= 0) {
       float val = strtod(fields[i].data(), nullptr);
       auto range = range_index_.find(i);
       if (range != range_index_.end()) {
-	example->second = scale(val, range->second.first,
-				range->second.second);
+	labels[label] = scale(val, range->second.first,
+			      range->second.second);
       }	else {
-	example->second = val;
+	labels[label] = val;
       }
       continue;
     }
     auto range = range_index_.find(i);
     if (range != range_index_.end()) {
       float val = strtod(fields[i].data(), nullptr);
+      if (out_of_range_policy_ == CLAMP_TO_RANGE) {
+	val = std::min(std::max(val, range->second.first),
+		       range->second.second);
+      }
       features.push_back(scale(val, range->second.first,
 			       range->second.second));
     } else {
@@ -145,6 +275,114 @@ void Dataset::process_example(const vector<string>& fields,
   }
 }
 
+void Dataset::process_examples(vector<pair<vector<float>, float>>* examples) {
+  examples->resize(examples_.size());
+  for (size_t i = 0; i < examples_.size(); i++) {
+    process_example(examples_[i], &(*examples)[i]);
+  }
+}
+
+void Dataset::process_examples(
+    vector<pair<vector<float>, vector<float>>>* examples) {
+  examples->resize(examples_.size());
+  for (size_t i = 0; i < examples_.size(); i++) {
+    process_example(examples_[i], &(*examples)[i]);
+  }
+}
+
+bool Dataset::write_examples(const string& path, size_t rows_per_group,
+			     const ExampleSourceStamp& source) {
+  ExampleFileWriter writer(rows_per_group);
+  if (!writer.open(path, output_features_.size(), label_indices_.size(),
+		   source)) {
+    return false;
+  }
+  pair<vector<float>, vector<float>> example;
+  for (const vector<string>& row : examples_) {
+    process_example(row, &example);
+    if (!writer.add(example.first, example.second.data())) {
+      return false;
+    }
+  }
+  return writer.close();
+}
+
+FeatureTransform Dataset::feature_transform() const {
+  FeatureTransform transform(scale_, out_of_range_policy_ == CLAMP_TO_RANGE);
+  for (size_t i = 0; i < field_names_.size(); i++) {
+    // Mirrors process_fields: a range makes a field numeric.
+    auto range = range_index_.find(i);
+    int label = label_position(i);
+    if (label >= 0) {
+      bool has_range = range != range_index_.end();
+      transform.addLabelColumn(label, has_range,
+			       has_range ? range->second.first : 0.0,
+			       has_range ? range->second.second : 0.0);
+    } else if (range != range_index_.end()) {
+      transform.addNumericColumn(range->second.first, range->second.second);
+    } else {
+      auto values = field_index_.find(i);
+      transform.addCategoricalColumn(
+	  values != field_index_.end() ?
+	  vector<string>(values->second.begin(), values->second.end()) :
+	  vector<string>());
+    }
+  }
+  return transform;
+}
+
+namespace {
+
+vector<size_t> shuffledIndices(size_t n, unsigned int seed) {
+  vector<size_t> indices(n);
+  for (size_t i = 0; i < n; i++) {
+    indices[i] = i;
+  }
+  std::mt19937 rng(seed);
+  std::shuffle(indices.begin(), indices.end(), rng);
+  return indices;
+}
+
+}  // namespace
+
+Dataset::Split Dataset::split(float validation_fraction,
+			      float test_fraction,
+			      unsigned int seed) const {
+  vector<size_t> indices = shuffledIndices(examples_.size(), seed);
+  size_t num_validation = validation_fraction * indices.size();
+  size_t num_test = std::min(static_cast<size_t>(test_fraction *
+						 indices.size()),
+			     indices.size() - num_validation);
+  Split split;
+  split.validation.assign(indices.begin(),
+			  indices.begin() + num_validation);
+  split.test.assign(indices.begin() + num_validation,
+		    indices.begin() + num_validation + num_test);
+  split.train.assign(indices.begin() + num_validation + num_test,
+		     indices.end());
+  return split;
+}
+
+vector<Dataset::Split> Dataset::k_fold_splits(size_t k,
+					      unsigned int seed) const {
+  // Every fold needs a row to validate on, or it would report a loss
+  // of 0.
+  k = std::min(k, examples_.size());
+  if (k == 0) {
+    return {};
+  }
+  vector<size_t> indices = shuffledIndices(examples_.size(), seed);
+  vector<Split> folds(k);
+  for (size_t i = 0; i < indices.size(); i++) {
+    size_t fold = i % k;
+    for (size_t j = 0; j < k; j++) {
+      (j == fold ? folds[j].validation : folds[j].train).push_back(
+	  indices[i]);
+    }
+  }
+  return folds;
+}
+
 bool Dataset::next(pair<vector<float>, float>* example) {
   if (!hasNext()) {
     return false;
@@ -153,3 +391,11 @@ bool Dataset::next(pair<vector<float>, float>* example) {
   process_example(input_example, example);
   return true; 
 }
+
+bool Dataset::next(pair<vector<float>, vector<float>>* example) {
+  if (!hasNext()) {
+    return false;
+  }
+  process_example(*pos_++, example);
+  return true;
+}
@@ -1,5 +1,10 @@
+#include "example_file.h"
+#include "feature_transform.h"
+#include "rolling_window.h"
+
 #include <string>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -10,36 +15,136 @@ using std::set;
 using std::string;
 using std::vector;
 
+// What to do with numeric values outside the range seen so far, once
+// features have been processed (before that, ranges always extend).
+typedef enum {
+  EXTEND_RANGE,        // widen the range; rescales later examples
+  CLAMP_TO_RANGE,      // keep the range, clamp inputs into it
+  ALLOW_OUT_OF_RANGE,  // keep the range, let scaled inputs exceed it
+} OutOfRangePolicy;
+
 class Dataset {
  public:
+  // A partition of the rows into training, validation and test sets,
+  // as row indices so no rows are copied.
+  struct Split {
+    vector<size_t> train;
+    vector<size_t> validation;
+    vector<size_t> test;
+  };
+
  Dataset(const vector<string>& field_names,
 	 size_t label_index,
 	 float scale = 1.0) : field_names_(field_names),
-    label_index_(label_index),
+    label_indices_(1, label_index),
+    scale_(scale),
+    pos_(examples_.begin()) {}
+ // For several targets: examples get one label per index, in this
+ // order. The single-label methods below return only the first.
+ Dataset(const vector<string>& field_names,
+	 const vector<size_t>& label_indices,
+	 float scale = 1.0) : field_names_(field_names),
+    label_indices_(label_indices),
     scale_(scale),
     pos_(examples_.begin()) {}
 
   const vector<string>& output_features() {
     return output_features_;
   }
+  // Before any rows: adds time-series features over the rows' history
+  // (see rolling_window.h), grouped by group_field. They become numeric
+  // fields after the given ones, computed as each row is added or
+  // streamed, so rows must come in time order within each group.
+  // process_example and the like then expect rows with them appended.
+  void add_window_features(size_t group_field,
+			   const vector<WindowFeature>& features);
+  // The windows' state, histories included; scoring outside the
+  // Dataset can continue from a copy, appending the window fields to
+  // each row before FeatureTransform::transform.
+  const RollingWindows* rolling_windows() const { return windows_.get(); }
   void add_row(const vector<string>& fields);
   void process_features();
+  // For streaming data, after process_features: updates the numeric
+  // ranges (per the out-of-range policy) and mean/variance statistics
+  // with a new row and processes it into example, without keeping the
+  // row. Categorical values not seen before processing are encoded as
+  // all zeros, since the feature layout is fixed by then.
+  void stream_row(const vector<string>& fields,
+		  pair<vector<float>, float>* example);
+  void stream_row(const vector<string>& fields,
+		  pair<vector<float>, vector<float>>* example);
+  void set_out_of_range_policy(OutOfRangePolicy policy) {
+    out_of_range_policy_ = policy;
+  }
+  // Range and running mean/variance of a numeric field; false if the
+  // field isn't numeric.
+  bool numeric_range(size_t field, pair<float, float>* range) const;
+  bool mean_variance(size_t field, pair<float, float>* mv) const;
   void process_example(const vector<string>& fields,
 		       pair<vector<float>, float>* example);
+  void process_example(const vector<string>& fields,
+		       pair<vector<float>, vector<float>>* example);
+  // Processes every row into examples, independently of the
+  // hasNext()/next() position.
+  void process_examples(vector<pair<vector<float>, float>>* examples);
+  void process_examples(vector<pair<vector<float>, vector<float>>>* examples);
+  // Processes every row into an example file at path (see
+  // example_file.h), so later runs can train from it without parsing
+  // and featurizing the rows again; source is recorded in its header.
+  // False on a write error.
+  bool write_examples(const string& path, size_t rows_per_group = 4096,
+		      const ExampleSourceStamp& source = ExampleSourceStamp());
+  // After process_features: the processing process_example applies,
+  // as a standalone transform that can be saved and used for scoring
+  // without the Dataset or its rows.
+  FeatureTransform feature_transform() const;
   bool hasNext() { return pos_ != examples_.end(); } 
+  size_t num_rows() const { return examples_.size(); }
+  size_t num_labels() const { return label_indices_.size(); }
+
+  // Shuffles the rows with the given seed and splits them by the given
+  // fractions; the rest go to training.
+  Split split(float validation_fraction, float test_fraction,
+	      unsigned int seed) const;
+  // Shuffles the rows with the given seed and deals them into k folds
+  // of near-equal size. Fold i validates on the i-th fold and trains on
+  // the rest; test is empty. k is at most num_rows(), so no fold
+  // validates on nothing; for k == 0, or no rows, there are no folds.
+  vector<Split> k_fold_splits(size_t k, unsigned int seed) const;
+
   bool next(pair<vector<float>, float>* example);
+  bool next(pair<vector<float>, vector<float>>* example);
 
   float scale(float val, float min_val, float max_val);
-  // Given a scaled label value, unscale it according to
-  // the processing for this dataset.
-  float unscale_label(float val);
+  // Given a scaled value of the label-th label, unscale it according
+  // to the processing for this dataset.
+  float unscale_label(float val, size_t label = 0);
 
  private:
+  // Updates the statistics of the given fields, not window fields.
+  void update_statistics(const vector<string>& fields);
+  void update_numeric_statistics(size_t field, float val);
+  // Computes the window fields of a row and appends them to it.
+  void add_window_fields(vector<string>* fields);
+  // Processes fields into features and labels; labels must have room
+  // for num_labels() values.
+  void process_fields(const vector<string>& fields,
+		      vector<float>* features, float* labels);
+  // Position of field among the labels, or -1 if it isn't one.
+  int label_position(size_t field) const;
+
+  // Fields after the given ones, or nullptr if there are none.
+  std::unique_ptr<RollingWindows> windows_;
+  vector<string> window_row_;
+  vector<float> window_values_;
+
   // Ranges for numeric features.
   map<size_t, pair<float, float>> range_index_;
   // Mean/variances of numeric features,
   // for normal scaling (not implemented yet).
   map<size_t, pair<float, float>> means_variances_;
+  // Number of values seen for each numeric feature.
+  map<size_t, size_t> numeric_counts_;
   // Sets of unique values for non-numeric features.
   map<size_t, set<string>> field_index_;
   // Map of input feature column index to output feature columns index.
@@ -50,7 +155,9 @@ class Dataset {
   vector<string> output_features_;
 
   vector<string> field_names_;  
-  size_t label_index_;
+  vector<size_t> label_indices_;
   float scale_;
   vector<vector<string>>::iterator pos_;
+  bool features_processed_ = false;
+  OutOfRangePolicy out_of_range_policy_ = EXTEND_RANGE;
 };
@@ -1,5 +1,9 @@
 #include "dataset.h"
 
+#include <algorithm>
+#include <cstdio>
+
+#include "example_file.h"
 #include "gtest/gtest.h"
 
 class DatasetTest : public ::testing::Test {
@@ -116,3 +120,222 @@ TEST_F(DatasetTest, UnscalesLabels) {
   EXPECT_FLOAT_EQ(4.0, dataset_->unscale_label(2.0));
   EXPECT_FLOAT_EQ(-2.0, dataset_->unscale_label(-1.0));
 }
+
+TEST_F(DatasetTest, SplitsPartitionRows) {
+  dataset_.reset(new Dataset(field_names_,
+			     field_names_.size() - 1));
+  for (int i = 0; i < 20; i++) {
+    dataset_->add_row(examples_[i % examples_.size()]);
+  }
+  ASSERT_EQ(20, dataset_->num_rows());
+  Dataset::Split split = dataset_->split(0.25, 0.1, 7);
+  EXPECT_EQ(5, split.validation.size());
+  EXPECT_EQ(2, split.test.size());
+  EXPECT_EQ(13, split.train.size());
+  vector<size_t> all(split.train);
+  all.insert(all.end(), split.validation.begin(), split.validation.end());
+  all.insert(all.end(), split.test.begin(), split.test.end());
+  std::sort(all.begin(), all.end());
+  for (size_t i = 0; i < all.size(); i++) {
+    EXPECT_EQ(i, all[i]);
+  }
+  // The same seed gives the same split.
+  EXPECT_EQ(split.train, dataset_->split(0.25, 0.1, 7).train);
+}
+
+TEST_F(DatasetTest, KFoldSplitsValidateOnEachRowOnce) {
+  dataset_.reset(new Dataset(field_names_,
+			     field_names_.size() - 1));
+  for (int i = 0; i < 11; i++) {
+    dataset_->add_row(examples_[i % examples_.size()]);
+  }
+  vector<Dataset::Split> folds = dataset_->k_fold_splits(3, 1);
+  ASSERT_EQ(3, folds.size());
+  vector<int> validated(11, 0);
+  for (const Dataset::Split& fold : folds) {
+    EXPECT_EQ(11, fold.train.size() + fold.validation.size());
+    EXPECT_TRUE(fold.test.empty());
+    EXPECT_GE(fold.validation.size(), 3);
+    EXPECT_LE(fold.validation.size(), 4);
+    for (size_t row : fold.validation) {
+      validated[row]++;
+      EXPECT_EQ(fold.train.end(),
+		std::find(fold.train.begin(), fold.train.end(), row));
+    }
+  }
+  EXPECT_EQ(vector<int>(11, 1), validated);
+}
+
+TEST_F(DatasetTest, KFoldSplitsHaveARowToValidateOn) {
+  dataset_.reset(new Dataset(field_names_,
+			     field_names_.size() - 1));
+  EXPECT_TRUE(dataset_->k_fold_splits(3, 1).empty());
+  for (int i = 0; i < 2; i++) {
+    dataset_->add_row(examples_[i]);
+  }
+  EXPECT_TRUE(dataset_->k_fold_splits(0, 1).empty());
+  vector<Dataset::Split> folds = dataset_->k_fold_splits(5, 1);
+  ASSERT_EQ(2, folds.size());
+  for (const Dataset::Split& fold : folds) {
+    EXPECT_EQ(1, fold.validation.size());
+    EXPECT_EQ(1, fold.train.size());
+  }
+}
+
+class StreamingDatasetTest : public DatasetTest {
+ public:
+  void SetUp() {
+    DatasetTest::SetUp();
+    dataset_.reset(new Dataset(field_names_,
+			       field_names_.size() - 1));
+    for (vector<string> example: examples_) {
+      dataset_->add_row(example);
+    }
+    dataset_->process_features();
+  }
+};
+
+TEST_F(StreamingDatasetTest, TracksMeanAndVariance) {
+  pair<float, float> mv;
+  ASSERT_TRUE(dataset_->mean_variance(2, &mv));
+  // baz: -2.5, -1.5, -2.0, -5.5, -2.5
+  EXPECT_FLOAT_EQ(-2.8, mv.first);
+  EXPECT_FLOAT_EQ(1.96, mv.second);
+  EXPECT_FALSE(dataset_->mean_variance(1, &mv));
+
+  pair<vector<float>, float> example;
+  dataset_->stream_row({"0.0", "red", "-2.8", "22", "4f", "0"}, &example);
+  ASSERT_TRUE(dataset_->mean_variance(2, &mv));
+  EXPECT_FLOAT_EQ(-2.8, mv.first);
+  EXPECT_FLOAT_EQ(1.96 * 5 / 6, mv.second);
+  EXPECT_EQ(5, dataset_->num_rows());
+}
+
+TEST_F(StreamingDatasetTest, ExtendsRangeByDefault) {
+  pair<vector<float>, float> example;
+  dataset_->stream_row({"0.0", "purple", "-1.0", "22", "4f", "0"},
+		       &example);
+  pair<float, float> range;
+  ASSERT_TRUE(dataset_->numeric_range(2, &range));
+  EXPECT_FLOAT_EQ(-5.5, range.first);
+  EXPECT_FLOAT_EQ(-1.0, range.second);
+  EXPECT_FLOAT_EQ(1.0, example.first[5]);
+  // Unseen categories don't change the feature layout.
+  EXPECT_EQ(expected_output_features_, dataset_->output_features());
+  EXPECT_TRUE(exampleMatches(example,
+			     {0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.11090909,
+				 0.0, 0.0, 1.0}, 0.0));
+}
+
+TEST_F(StreamingDatasetTest, ClampsOutOfRangeValues) {
+  dataset_->set_out_of_range_policy(CLAMP_TO_RANGE);
+  pair<vector<float>, float> example;
+  dataset_->stream_row({"0.0", "red", "-1.0", "2000", "4f", "0"},
+		       &example);
+  pair<float, float> range;
+  ASSERT_TRUE(dataset_->numeric_range(2, &range));
+  EXPECT_FLOAT_EQ(-1.5, range.second);
+  EXPECT_FLOAT_EQ(1.0, example.first[5]);
+  EXPECT_FLOAT_EQ(1.0, example.first[6]);
+}
+
+TEST_F(StreamingDatasetTest, AllowsOutOfRangeValues) {
+  dataset_->set_out_of_range_policy(ALLOW_OUT_OF_RANGE);
+  pair<vector<float>, float> example;
+  dataset_->stream_row({"0.0", "red", "-1.0", "2100", "4f", "0"},
+		       &example);
+  pair<float, float> range;
+  ASSERT_TRUE(dataset_->numeric_range(3, &range));
+  EXPECT_FLOAT_EQ(1000, range.second);
+  EXPECT_FLOAT_EQ(2.0, example.first[6]);
+}
+
+TEST_F(DatasetTest, ProcessesSeveralLabels) {
+  // "foo" (numeric) and the last column are both labels.
+  dataset_.reset(new Dataset(field_names_, vector<size_t>{ 5, 0 }));
+  for (const vector<string>& example : examples_) {
+    dataset_->add_row(example);
+  }
+  dataset_->process_features();
+  EXPECT_EQ(2, dataset_->num_labels());
+  vector<string> expected_features(expected_output_features_.begin() + 1,
+				   expected_output_features_.end());
+  EXPECT_EQ(expected_features, dataset_->output_features());
+
+  pair<vector<float>, vector<float>> example;
+  ASSERT_TRUE(dataset_->next(&example));
+  EXPECT_EQ(expected_features.size(), example.first.size());
+  ASSERT_EQ(2, example.second.size());
+  EXPECT_FLOAT_EQ(1.0, example.second[0]);
+  EXPECT_FLOAT_EQ(1.0, example.second[1]);
+  ASSERT_TRUE(dataset_->next(&example));
+  EXPECT_FLOAT_EQ(1.0, example.second[0]);
+  EXPECT_FLOAT_EQ(0.0, example.second[1]);
+  EXPECT_FLOAT_EQ(2.0, dataset_->unscale_label(1.0, 0));
+  EXPECT_FLOAT_EQ(1.0, dataset_->unscale_label(1.0, 1));
+
+  // Single-label examples get the first label.
+  pair<vector<float>, float> single;
+  dataset_->process_example(examples_[2], &single);
+  EXPECT_FLOAT_EQ(0.0, single.second);
+  vector<pair<vector<float>, vector<float>>> all;
+  dataset_->process_examples(&all);
+  ASSERT_EQ(examples_.size(), all.size());
+  EXPECT_EQ(all[1].second, example.second);
+}
+
+TEST_F(DatasetTest, WritesExampleFile) {
+  dataset_.reset(new Dataset(field_names_, field_names_.size() - 1));
+  for (const vector<string>& example : examples_) {
+    dataset_->add_row(example);
+  }
+  dataset_->process_features();
+  string path = ::testing::TempDir() + "dataset_test.nnex";
+  ASSERT_TRUE(dataset_->write_examples(path, 2));
+
+  vector<pair<vector<float>, vector<float>>> expected, read;
+  dataset_->process_examples(&expected);
+  MappedExampleFile file;
+  ASSERT_TRUE(file.open(path));
+  EXPECT_EQ(expected_output_features_.size(), file.numFeatures());
+  EXPECT_EQ(1, file.numLabels());
+  vector<pair<vector<float>, vector<float>>> batch;
+  while (file.nextBatch(&batch)) {
+    read.insert(read.end(), batch.begin(), batch.end());
+  }
+  EXPECT_EQ(expected, read);
+  remove(path.c_str());
+}
+
+TEST_F(DatasetTest, AddsWindowFeatures) {
+  dataset_.reset(new Dataset(field_names_, field_names_.size() - 1));
+  // "quux" over earlier rows with the same "quuux".
+  dataset_->add_window_features(4, {{3, WINDOW_LAG, 1}, {3, WINDOW_MEAN, 2}});
+  for (const vector<string>& example : examples_) {
+    dataset_->add_row(example);
+  }
+  dataset_->process_features();
+  vector<string> expected_features = expected_output_features_;
+  expected_features.push_back("quux_lag_1");
+  expected_features.push_back("quux_mean_2");
+  EXPECT_EQ(expected_features, dataset_->output_features());
+
+  pair<vector<float>, float> example;
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(dataset_->next(&example));
+  }
+  // The third "4f" row: 53 and 22 came before it.
+  ASSERT_TRUE(dataset_->next(&example));
+  ASSERT_EQ(expected_features.size(), example.first.size());
+  EXPECT_FLOAT_EQ(22.0 / 53, example.first[10]);
+  EXPECT_FLOAT_EQ(37.5 / 53, example.first[11]);
+
+  // Streaming continues each group's history.
+  dataset_->stream_row({"0.0", "red", "-1.0", "10", "4f", "0"}, &example);
+  pair<float, float> range;
+  ASSERT_TRUE(dataset_->numeric_range(6, &range));
+  EXPECT_FLOAT_EQ(1000, range.second);
+  ASSERT_TRUE(dataset_->numeric_range(7, &range));
+  EXPECT_FLOAT_EQ(511, range.second);
+  EXPECT_EQ(3, dataset_->rolling_windows()->numGroups());
+}
@@ -0,0 +1,209 @@
+#include "example_file.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[4] = { 'N', 'N', 'E', 'X' };
+// Version 2 added the source stamp.
+const uint32_t kVersion = 2;
+
+}  // namespace
+
+bool ExampleSourceStamp::of(const string& path, ExampleSourceStamp* stamp) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  stamp->size = st.st_size;
+  stamp->mtimeNanos = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+    st.st_mtim.tv_nsec;
+  return true;
+}
+
+bool ExampleFileWriter::open(const string& path, size_t num_features,
+			     size_t num_labels,
+			     const ExampleSourceStamp& source) {
+  out_.open(path, std::ios::binary | std::ios::trunc);
+  memcpy(header_.magic, kMagic, sizeof(kMagic));
+  header_.version = kVersion;
+  header_.numRows = 0;
+  header_.numFeatures = num_features;
+  header_.numLabels = num_labels;
+  header_.rowsPerGroup = rows_per_group_;
+  header_.reserved = 0;
+  header_.sourceSize = source.size;
+  header_.sourceMtimeNanos = source.mtimeNanos;
+  group_.resize(rows_per_group_ * (num_features + num_labels));
+  columns_.resize(group_.size());
+  group_rows_ = 0;
+  // Rewritten with the row count by close().
+  out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  return out_.good();
+}
+
+bool ExampleFileWriter::add(const vector<float>& features,
+			    const float* labels) {
+  if (!out_.is_open()) {
+    return false;
+  }
+  size_t width = header_.numFeatures + header_.numLabels;
+  float* row = &group_[group_rows_ * width];
+  std::copy(features.begin(), features.begin() + header_.numFeatures, row);
+  std::copy(labels, labels + header_.numLabels, row + header_.numFeatures);
+  header_.numRows++;
+  if (++group_rows_ == rows_per_group_) {
+    return flushGroup();
+  }
+  return true;
+}
+
+bool ExampleFileWriter::flushGroup() {
+  size_t width = header_.numFeatures + header_.numLabels;
+  for (size_t c = 0; c < width; c++) {
+    for (size_t r = 0; r < group_rows_; r++) {
+      columns_[c * group_rows_ + r] = group_[r * width + c];
+    }
+  }
+  out_.write(reinterpret_cast<const char*>(columns_.data()),
+	     group_rows_ * width * sizeof(float));
+  group_rows_ = 0;
+  return out_.good();
+}
+
+bool ExampleFileWriter::close() {
+  if (!out_.is_open()) {
+    return true;
+  }
+  if (group_rows_ > 0) {
+    flushGroup();
+  }
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  bool ok = out_.good();
+  out_.close();
+  return ok && !out_.fail();
+}
+
+MappedExampleFile::~MappedExampleFile() {
+  close();
+}
+
+bool MappedExampleFile::open(const string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(ExampleFileHeader)) {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+  memcpy(&header_, data_, sizeof(header_));
+  uint64_t expected_size = sizeof(header_) + header_.numRows *
+    (header_.numFeatures + header_.numLabels) * sizeof(float);
+  if (memcmp(header_.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header_.version != kVersion || header_.rowsPerGroup == 0 ||
+      expected_size != size_) {
+    close();
+    return false;
+  }
+  advise(0, size_, MADV_SEQUENTIAL);
+  rewind();
+  return true;
+}
+
+void MappedExampleFile::close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  header_ = ExampleFileHeader();
+}
+
+ExampleSourceStamp MappedExampleFile::source() const {
+  ExampleSourceStamp stamp;
+  stamp.size = header_.sourceSize;
+  stamp.mtimeNanos = header_.sourceMtimeNanos;
+  return stamp;
+}
+
+size_t MappedExampleFile::numGroups() const {
+  return (header_.numRows + header_.rowsPerGroup - 1) / header_.rowsPerGroup;
+}
+
+size_t MappedExampleFile::groupOffset(size_t g) const {
+  return sizeof(header_) + g * header_.rowsPerGroup *
+    (header_.numFeatures + header_.numLabels) * sizeof(float);
+}
+
+size_t MappedExampleFile::groupRows(size_t g) const {
+  return std::min<size_t>(header_.rowsPerGroup,
+			  header_.numRows - g * header_.rowsPerGroup);
+}
+
+void MappedExampleFile::advise(size_t offset, size_t length,
+			       int advice) const {
+  // madvise wants a page-aligned start; advising a little of the
+  // neighbouring group along with it is harmless.
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  length = std::min(length, size_ - offset);
+  size_t start = offset - offset % page_size;
+  madvise(const_cast<char*>(data_) + start, offset + length - start, advice);
+}
+
+bool MappedExampleFile::nextBatch(
+    vector<pair<vector<float>, vector<float>>>* batch) {
+  if (data_ == nullptr || next_group_ >= numGroups()) {
+    batch->clear();
+    return false;
+  }
+  size_t g = next_group_++;
+  if (g + 1 < numGroups()) {
+    advise(groupOffset(g + 1), groupOffset(g + 2) - groupOffset(g + 1),
+	   MADV_WILLNEED);
+  }
+  if (g > 0) {
+    advise(groupOffset(g - 1), groupOffset(g) - groupOffset(g - 1),
+	   MADV_DONTNEED);
+  }
+  size_t rows = groupRows(g);
+  size_t num_features = header_.numFeatures;
+  size_t num_labels = header_.numLabels;
+  const float* columns =
+    reinterpret_cast<const float*>(data_ + groupOffset(g));
+  batch->resize(rows);
+  for (size_t r = 0; r < rows; r++) {
+    (*batch)[r].first.resize(num_features);
+    (*batch)[r].second.resize(num_labels);
+  }
+  for (size_t c = 0; c < num_features; c++) {
+    const float* column = columns + c * rows;
+    for (size_t r = 0; r < rows; r++) {
+      (*batch)[r].first[c] = column[r];
+    }
+  }
+  for (size_t c = 0; c < num_labels; c++) {
+    const float* column = columns + (num_features + c) * rows;
+    for (size_t r = 0; r < rows; r++) {
+      (*batch)[r].second[c] = column[r];
+    }
+  }
+  return true;
+}
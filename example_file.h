@@ -0,0 +1,123 @@
+#ifndef __EXAMPLE_FILE_H_
+#define __EXAMPLE_FILE_H_
+
+// A compact binary file of processed examples, so they can be
+// featurized once and trained on many times, even when they don't fit
+// in memory.
+//
+// The file is a 48-byte header followed by groups of rowsPerGroup rows
+// (the last group may be shorter). Within a group, values are stored
+// column by column: every row's first feature, then every row's second
+// feature, and so on through the features and then the labels, as
+// native floats. A group is read sequentially to make a batch of
+// examples.
+//
+// The header also records the size and modification time of the file
+// the examples were made from, if the writer gave them, so a cached
+// example file can be rebuilt once its source changes.
+
+#include "example_source.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+
+struct ExampleFileHeader {
+  char magic[4];  // "NNEX"
+  uint32_t version;
+  uint64_t numRows;
+  uint32_t numFeatures;
+  uint32_t numLabels;
+  uint32_t rowsPerGroup;
+  uint32_t reserved;
+  uint64_t sourceSize;
+  int64_t sourceMtimeNanos;
+};
+
+// The size and modification time of the file examples were made from;
+// all zero if unknown.
+struct ExampleSourceStamp {
+  uint64_t size = 0;
+  int64_t mtimeNanos = 0;
+
+  // False if path can't be stat'ed.
+  static bool of(const string& path, ExampleSourceStamp* stamp);
+  bool operator==(const ExampleSourceStamp& other) const {
+    return size == other.size && mtimeNanos == other.mtimeNanos;
+  }
+  bool operator!=(const ExampleSourceStamp& other) const {
+    return !(*this == other);
+  }
+};
+
+// Writes examples to an example file, one group at a time.
+class ExampleFileWriter {
+ public:
+  explicit ExampleFileWriter(size_t rows_per_group = 4096) :
+    rows_per_group_(rows_per_group > 0 ? rows_per_group : 1) {}
+  ~ExampleFileWriter() { close(); }
+
+  bool open(const string& path, size_t num_features, size_t num_labels,
+	    const ExampleSourceStamp& source = ExampleSourceStamp());
+  // features must have num_features values and labels num_labels.
+  bool add(const vector<float>& features, const float* labels);
+  // Writes any partial group and the final header; false if any write
+  // failed.
+  bool close();
+
+ private:
+  bool flushGroup();
+
+  size_t rows_per_group_;
+  std::ofstream out_;
+  ExampleFileHeader header_;
+  // Rows of the group being filled, row-major.
+  vector<float> group_;
+  size_t group_rows_ = 0;
+  vector<float> columns_;
+};
+
+// Reads an example file through a read-only memory mapping, one group
+// per batch. The kernel is told the file is read sequentially, each
+// group is prefetched while the one before it is trained on, and
+// groups already read are dropped from the page cache's working set,
+// so files larger than memory stream through without thrashing.
+class MappedExampleFile : public ExampleSource {
+ public:
+  MappedExampleFile() {}
+  ~MappedExampleFile();
+
+  MappedExampleFile(const MappedExampleFile&) = delete;
+  MappedExampleFile& operator=(const MappedExampleFile&) = delete;
+
+  // False if the file can't be mapped or isn't a valid example file.
+  bool open(const string& path);
+  void close();
+
+  size_t numRows() const { return header_.numRows; }
+  size_t numFeatures() const { return header_.numFeatures; }
+  size_t numLabels() const { return header_.numLabels; }
+  // What the writer said the examples were made from.
+  ExampleSourceStamp source() const;
+
+  void rewind() override { next_group_ = 0; }
+  bool nextBatch(vector<pair<vector<float>, vector<float>>>* batch) override;
+
+ private:
+  size_t numGroups() const;
+  // Offset of group g from the start of the file, in bytes.
+  size_t groupOffset(size_t g) const;
+  size_t groupRows(size_t g) const;
+  void advise(size_t offset, size_t length, int advice) const;
+
+  ExampleFileHeader header_ = ExampleFileHeader();
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  size_t next_group_ = 0;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "example_file.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nn.h"
+#include "gtest/gtest.h"
+
+class ExampleFileTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    path_ = ::testing::TempDir() + "example_file_test.nnex";
+    for (int i = 0; i < 7; i++) {
+      examples_.push_back(make_pair(
+	  vector<float>{ 0.1f * i, 1.0f - 0.1f * i, (i % 2) * 0.5f },
+	  vector<float>{ 0.2f * i, 0.05f * i }));
+    }
+  }
+  void TearDown() { remove(path_.c_str()); }
+
+  void writeExamples(size_t rows_per_group) {
+    ExampleFileWriter writer(rows_per_group);
+    ASSERT_TRUE(writer.open(path_, 3, 2));
+    for (const auto& example : examples_) {
+      ASSERT_TRUE(writer.add(example.first, example.second.data()));
+    }
+    ASSERT_TRUE(writer.close());
+  }
+
+  string path_;
+  vector<pair<vector<float>, vector<float>>> examples_;
+};
+
+TEST_F(ExampleFileTest, ReadsBackWrittenExamples) {
+  writeExamples(3);
+  MappedExampleFile file;
+  ASSERT_TRUE(file.open(path_));
+  EXPECT_EQ(7, file.numRows());
+  EXPECT_EQ(3, file.numFeatures());
+  EXPECT_EQ(2, file.numLabels());
+
+  // Two passes, to check rewinding.
+  for (int pass = 0; pass < 2; pass++) {
+    file.rewind();
+    vector<pair<vector<float>, vector<float>>> batch, all;
+    vector<size_t> batch_sizes;
+    while (file.nextBatch(&batch)) {
+      batch_sizes.push_back(batch.size());
+      all.insert(all.end(), batch.begin(), batch.end());
+    }
+    EXPECT_TRUE(batch.empty());
+    EXPECT_EQ(vector<size_t>({ 3, 3, 1 }), batch_sizes);
+    EXPECT_EQ(examples_, all);
+  }
+}
+
+TEST_F(ExampleFileTest, RejectsInvalidFiles) {
+  MappedExampleFile file;
+  EXPECT_FALSE(file.open(path_));
+  {
+    std::ofstream out(path_, std::ios::binary);
+    out << "not an example file, but long enough for a header";
+  }
+  EXPECT_FALSE(file.open(path_));
+
+  writeExamples(4);
+  // Truncate the last row.
+  std::ifstream in(path_, std::ios::binary);
+  string contents((std::istreambuf_iterator<char>(in)),
+		  std::istreambuf_iterator<char>());
+  {
+    std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size() - sizeof(float));
+  }
+  EXPECT_FALSE(file.open(path_));
+}
+
+TEST_F(ExampleFileTest, RecordsItsSourcesStamp) {
+  writeExamples(4);
+  MappedExampleFile file;
+  ASSERT_TRUE(file.open(path_));
+  EXPECT_EQ(ExampleSourceStamp(), file.source());
+
+  string source_path = ::testing::TempDir() + "example_file_test.csv";
+  {
+    std::ofstream out(source_path);
+    out << "a,b\n1,2\n";
+  }
+  ExampleSourceStamp stamp;
+  ASSERT_TRUE(ExampleSourceStamp::of(source_path, &stamp));
+  EXPECT_EQ(8, stamp.size);
+  ExampleFileWriter writer;
+  ASSERT_TRUE(writer.open(path_, 3, 2, stamp));
+  ASSERT_TRUE(writer.add(examples_[0].first, examples_[0].second.data()));
+  ASSERT_TRUE(writer.close());
+  ASSERT_TRUE(file.open(path_));
+  EXPECT_EQ(stamp, file.source());
+
+  // Once the source changes, its stamp no longer matches.
+  {
+    std::ofstream out(source_path, std::ios::app);
+    out << "3,4\n";
+  }
+  ExampleSourceStamp changed;
+  ASSERT_TRUE(ExampleSourceStamp::of(source_path, &changed));
+  EXPECT_NE(stamp, changed);
+  remove(source_path.c_str());
+  EXPECT_FALSE(ExampleSourceStamp::of(source_path, &changed));
+}
+
+TEST_F(ExampleFileTest, TrainingFromFileMatchesInMemory) {
+  writeExamples(2);
+  MappedExampleFile file;
+  ASSERT_TRUE(file.open(path_));
+
+  NNParams params(3, 10, DEFAULT_MIN_DELTA, 4, 1, 0.05);
+  params.verbose = false;
+  NN in_memory(params), streamed(params);
+  for (NN* nn : { &in_memory, &streamed }) {
+    nn->addLayer(LayerType::RELU, 4);
+    nn->addOutputLayer(LayerType::RELU, 2);
+    srand(3);
+    nn->initializeWeights([](size_t i, size_t j, size_t k) {
+	return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+      },
+      [](size_t i, size_t j) {
+	return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+      });
+  }
+  TrainingReport in_memory_report, streamed_report;
+  in_memory.train(examples_, &in_memory_report);
+  streamed.train(&file, &streamed_report);
+  ASSERT_EQ(in_memory_report.losses.size(), streamed_report.losses.size());
+  for (size_t i = 0; i < in_memory_report.losses.size(); i++) {
+    EXPECT_NEAR(in_memory_report.losses[i], streamed_report.losses[i], 1e-5);
+  }
+  for (size_t i = 0; i < in_memory.layers.size(); i++) {
+    EXPECT_EQ(in_memory.layers[i]->inWeights.data,
+	      streamed.layers[i]->inWeights.data);
+  }
+}
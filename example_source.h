@@ -0,0 +1,26 @@
+#ifndef __EXAMPLE_SOURCE_H_
+#define __EXAMPLE_SOURCE_H_
+
+#include <utility>
+#include <vector>
+
+using std::pair;
+using std::vector;
+
+// Produces training examples a batch at a time, for example sets too
+// large to hold in memory at once. Examples have one label per output
+// unit.
+class ExampleSource {
+ public:
+  virtual ~ExampleSource() {}
+
+  // Starts a new pass over the examples.
+  virtual void rewind() = 0;
+  // Replaces batch with the next examples of the current pass, reusing
+  // its storage; returns false, with batch empty, once the pass is
+  // over.
+  virtual bool nextBatch(
+      vector<pair<vector<float>, vector<float>>>* batch) = 0;
+};
+
+#endif
@@ -0,0 +1,287 @@
+#include "feature_transform.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+
+void FeatureTransform::addNumericColumn(float min_val, float max_val) {
+  Column column = Column();
+  column.kind = NUMERIC;
+  column.index = num_features_++;
+  column.minVal = min_val;
+  column.maxVal = max_val;
+  columns_.push_back(column);
+}
+
+void FeatureTransform::addCategoricalColumn(const vector<string>& values) {
+  Column column = Column();
+  column.kind = CATEGORICAL;
+  column.index = num_features_;
+  column.vocabBegin = vocab_offsets_.size() - 1;
+  column.vocabSize = values.size();
+  for (const string& value : values) {
+    vocab_chars_ += value;
+    vocab_offsets_.push_back(vocab_chars_.size());
+  }
+  num_features_ += values.size();
+  columns_.push_back(column);
+}
+
+void FeatureTransform::addLabelColumn(size_t label, bool has_range,
+				      float min_val, float max_val) {
+  Column column = Column();
+  column.kind = LABEL;
+  column.hasRange = has_range;
+  column.index = label;
+  column.minVal = min_val;
+  column.maxVal = max_val;
+  if (label_columns_.size() <= label) {
+    label_columns_.resize(label + 1);
+  }
+  label_columns_[label] = columns_.size();
+  columns_.push_back(column);
+}
+
+float FeatureTransform::scaleValue(float val, float min_val,
+				   float max_val) const {
+  // As Dataset::scale.
+  if (scale_ != 0.0) {
+    if (min_val == max_val) {
+      return 0.0;
+    } else {
+      return ((val - min_val) * scale_ / (max_val - min_val));
+    }
+  }
+  return val;
+}
+
+void FeatureTransform::transformField(const Column& column,
+				      const char* begin, const char* end,
+				      float* features, float* labels) const {
+  if (column.kind == CATEGORICAL) {
+    float* one_hot = features + column.index;
+    std::fill(one_hot, one_hot + column.vocabSize, 0.0f);
+    size_t length = end - begin;
+    // Binary search over the column's values, in std::string order.
+    size_t lo = 0, hi = column.vocabSize;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      uint32_t v = column.vocabBegin + mid;
+      const char* value = vocab_chars_.data() + vocab_offsets_[v];
+      size_t value_length = vocab_offsets_[v + 1] - vocab_offsets_[v];
+      int cmp = memcmp(value, begin, std::min(value_length, length));
+      if (cmp == 0) {
+	cmp = (value_length < length ? -1 : (value_length > length ? 1 : 0));
+      }
+      if (cmp == 0) {
+	one_hot[mid] = 1.0;
+	return;
+      }
+      if (cmp < 0) {
+	lo = mid + 1;
+      } else {
+	hi = mid;
+      }
+    }
+    return;
+  }
+  // strtod needs a terminated string; fields aren't, in a line.
+  char buffer[64];
+  size_t length = std::min<size_t>(end - begin, sizeof(buffer) - 1);
+  memcpy(buffer, begin, length);
+  buffer[length] = 0;
+  float val = strtod(buffer, nullptr);
+  if (column.kind == LABEL) {
+    if (labels != nullptr) {
+      labels[column.index] = (column.hasRange ?
+			      scaleValue(val, column.minVal, column.maxVal) :
+			      val);
+    }
+    return;
+  }
+  if (clamp_) {
+    val = std::min(std::max(val, column.minVal), column.maxVal);
+  }
+  features[column.index] = scaleValue(val, column.minVal, column.maxVal);
+}
+
+bool FeatureTransform::transform(const vector<string>& fields,
+				 float* features, float* labels) const {
+  if (fields.size() < columns_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < columns_.size(); i++) {
+    const string& field = fields[i];
+    transformField(columns_[i], field.data(), field.data() + field.size(),
+		   features, labels);
+  }
+  return true;
+}
+
+bool FeatureTransform::transformLine(const char* line, size_t length,
+				     char delimiter, float* features,
+				     float* labels) const {
+  while (length > 0 && (line[length - 1] == '\n' ||
+			line[length - 1] == '\r')) {
+    length--;
+  }
+  const char* end = line + length;
+  const char* field = line;
+  for (size_t i = 0; i < columns_.size(); i++) {
+    if (field > end) {
+      return false;
+    }
+    const char* field_end = static_cast<const char*>(
+	memchr(field, delimiter, end - field));
+    if (field_end == nullptr) {
+      field_end = end;
+    }
+    transformField(columns_[i], field, field_end, features, labels);
+    field = field_end + 1;
+  }
+  return true;
+}
+
+float FeatureTransform::unscaleLabel(float val, size_t label) const {
+  // As Dataset::unscale_label.
+  const Column& column = columns_[label_columns_[label]];
+  if (!column.hasRange) {
+    return val;
+  }
+  return (val * (column.maxVal - column.minVal)) + column.minVal;
+}
+
+void FeatureTransform::featureAffine(vector<float>* scale,
+				     vector<float>* offset) const {
+  scale->assign(num_features_, 1.0);
+  offset->assign(num_features_, 0.0);
+  if (scale_ == 0.0) {
+    return;
+  }
+  for (const Column& column : columns_) {
+    if (column.kind != NUMERIC) {
+      continue;
+    }
+    if (column.minVal == column.maxVal) {
+      (*scale)[column.index] = 0.0;
+    } else {
+      float a = scale_ / (column.maxVal - column.minVal);
+      (*scale)[column.index] = a;
+      (*offset)[column.index] = -column.minVal * a;
+    }
+  }
+}
+
+void FeatureTransform::labelAffine(size_t label, float* scale,
+				   float* offset) const {
+  const Column& column = columns_[label_columns_[label]];
+  if (column.hasRange) {
+    *scale = column.maxVal - column.minVal;
+    *offset = column.minVal;
+  } else {
+    *scale = 1.0;
+    *offset = 0.0;
+  }
+}
+
+FeatureTransform FeatureTransform::unscaled() const {
+  FeatureTransform copy(*this);
+  copy.scale_ = 0.0;
+  copy.clamp_ = false;
+  for (Column& column : copy.columns_) {
+    column.hasRange = false;
+  }
+  return copy;
+}
+
+bool FeatureTransform::save(std::ostream& out) const {
+  out << std::setprecision(std::numeric_limits<float>::max_digits10);
+  out << "transform 1\n";
+  out << "scale " << scale_ << " " << (clamp_ ? 1 : 0) << "\n";
+  out << "columns " << columns_.size() << "\n";
+  for (const Column& column : columns_) {
+    switch (column.kind) {
+    case NUMERIC:
+      out << "numeric " << column.minVal << " " << column.maxVal << "\n";
+      break;
+    case CATEGORICAL:
+      out << "categorical " << column.vocabSize << "\n";
+      for (uint32_t v = column.vocabBegin;
+	   v < column.vocabBegin + column.vocabSize; v++) {
+	size_t length = vocab_offsets_[v + 1] - vocab_offsets_[v];
+	// Length-prefixed, since values may hold any character.
+	out << length << " ";
+	out.write(vocab_chars_.data() + vocab_offsets_[v], length);
+	out << "\n";
+      }
+      break;
+    case LABEL:
+      out << "label " << column.index << " " <<
+	(column.hasRange ? 1 : 0) << " " <<
+	column.minVal << " " << column.maxVal << "\n";
+      break;
+    }
+  }
+  return out.good();
+}
+
+std::unique_ptr<FeatureTransform> FeatureTransform::load(std::istream& in) {
+  string tag;
+  int version, clamp;
+  float scale;
+  size_t num_columns;
+  if (!(in >> tag >> version) || tag != "transform" || version != 1) {
+    return nullptr;
+  }
+  if (!(in >> tag >> scale >> clamp) || tag != "scale") {
+    return nullptr;
+  }
+  if (!(in >> tag >> num_columns) || tag != "columns") {
+    return nullptr;
+  }
+  std::unique_ptr<FeatureTransform> transform(
+      new FeatureTransform(scale, clamp != 0));
+  for (size_t i = 0; i < num_columns; i++) {
+    if (!(in >> tag)) {
+      return nullptr;
+    }
+    if (tag == "numeric") {
+      float min_val, max_val;
+      if (!(in >> min_val >> max_val)) {
+	return nullptr;
+      }
+      transform->addNumericColumn(min_val, max_val);
+    } else if (tag == "categorical") {
+      size_t num_values;
+      if (!(in >> num_values)) {
+	return nullptr;
+      }
+      vector<string> values(num_values);
+      for (string& value : values) {
+	size_t length;
+	if (!(in >> length) || in.get() != ' ') {
+	  return nullptr;
+	}
+	value.resize(length);
+	if (!in.read(&value[0], length)) {
+	  return nullptr;
+	}
+      }
+      transform->addCategoricalColumn(values);
+    } else if (tag == "label") {
+      size_t label;
+      int has_range;
+      float min_val, max_val;
+      if (!(in >> label >> has_range >> min_val >> max_val) ||
+	  label >= num_columns) {
+	return nullptr;
+      }
+      transform->addLabelColumn(label, has_range != 0, min_val, max_val);
+    } else {
+      return nullptr;
+    }
+  }
+  return transform;
+}
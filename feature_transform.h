@@ -0,0 +1,105 @@
+#ifndef __FEATURE_TRANSFORM_H_
+#define __FEATURE_TRANSFORM_H_
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// The preprocessing a Dataset fitted to its rows (numeric ranges,
+// categorical vocabularies, label ranges), flattened into arrays so
+// that raw rows can be turned into features at scoring time without a
+// Dataset. Transforming a row does no allocation: numeric fields are
+// parsed in place and categorical values are found by binary search in
+// one sorted block of characters.
+//
+// Build one with Dataset::feature_transform(), or load a saved one.
+class FeatureTransform {
+ public:
+  // scale and clamp are as in the Dataset: the numeric range is mapped
+  // onto [0, scale] (scale 0 leaves values unscaled), and with clamp
+  // out-of-range inputs are first clamped into the range.
+  FeatureTransform(float scale, bool clamp) : scale_(scale), clamp_(clamp) {}
+
+  // Columns are added in field order. A numeric column yields one
+  // feature; a categorical one a one-hot encoding over values, which
+  // must be sorted; a label column yields no features, but the label-th
+  // label, scaled by its range if it has one.
+  void addNumericColumn(float min_val, float max_val);
+  void addCategoricalColumn(const vector<string>& values);
+  void addLabelColumn(size_t label, bool has_range, float min_val,
+		      float max_val);
+
+  size_t numFields() const { return columns_.size(); }
+  size_t numFeatures() const { return num_features_; }
+  size_t numLabels() const { return label_columns_.size(); }
+
+  // Writes numFeatures() features for a row of numFields() raw fields,
+  // and its numLabels() scaled labels if labels is non-null. Returns
+  // false if there are too few fields.
+  bool transform(const vector<string>& fields, float* features,
+		 float* labels = nullptr) const;
+  // The same for an unquoted delimited line, e.g. a CSV row.
+  bool transformLine(const char* line, size_t length, char delimiter,
+		     float* features, float* labels = nullptr) const;
+  // Inverse of the scaling of the label-th label.
+  float unscaleLabel(float val, size_t label = 0) const;
+
+  // Whether out-of-range numeric values are clamped; clamping isn't
+  // affine, so it can't be folded into a model.
+  bool clamps() const { return clamp_; }
+  // The scaling of each feature as an affine map: the transformed
+  // feature k is raw * (*scale)[k] + (*offset)[k], where raw is the
+  // parsed numeric value, or the one-hot value for categorical
+  // features (which aren't scaled). Ignores clamping.
+  void featureAffine(vector<float>* scale, vector<float>* offset) const;
+  // The label-th label's unscaling as an affine map, so that
+  // unscaleLabel(val) is val * *scale + *offset.
+  void labelAffine(size_t label, float* scale, float* offset) const;
+  // A copy that encodes fields the same way but leaves numeric
+  // features and labels unscaled, for models with the scaling folded
+  // in (see foldScaling in fold_scaling.h).
+  FeatureTransform unscaled() const;
+
+  // Writes the transform as text; load() reads it back, returning
+  // nullptr if the input is malformed.
+  bool save(std::ostream& out) const;
+  static std::unique_ptr<FeatureTransform> load(std::istream& in);
+
+ private:
+  typedef enum : uint8_t {
+    NUMERIC,
+    CATEGORICAL,
+    LABEL,
+  } ColumnKind;
+
+  struct Column {
+    ColumnKind kind;
+    bool hasRange;       // labels only
+    uint32_t index;      // first feature, or label position
+    uint32_t vocabBegin;  // categorical only: first value in vocab_
+    uint32_t vocabSize;
+    float minVal, maxVal;
+  };
+
+  // Processes one field, given as [begin, end).
+  void transformField(const Column& column, const char* begin,
+		      const char* end, float* features, float* labels) const;
+  float scaleValue(float val, float min_val, float max_val) const;
+
+  float scale_;
+  bool clamp_;
+  vector<Column> columns_;
+  vector<uint32_t> label_columns_;
+  size_t num_features_ = 0;
+  // Categorical values: value k is vocab_chars_[vocab_offsets_[k],
+  // vocab_offsets_[k+1]).
+  string vocab_chars_;
+  vector<uint32_t> vocab_offsets_ = vector<uint32_t>(1, 0);
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "feature_transform.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dataset.h"
+#include "gtest/gtest.h"
+
+class FeatureTransformTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    rows_.push_back({"1.0", "green", "-2.5", "100", "2g", "2"});
+    rows_.push_back({"0.0", "blue", "-1.5", "-100", "3f", "2"});
+    rows_.push_back({"0.0", "green", "-2.0", "53", "4f", "0"});
+    rows_.push_back({"0.0", "red", "-5.5", "22", "4f", "0"});
+    rows_.push_back({"1.0", "yellow", "-2.5", "1000", "4f", "1"});
+    field_names_ = { "foo", "bar", "baz", "quux", "quuux", "label" };
+  }
+
+  void makeDataset(const vector<size_t>& label_indices) {
+    dataset_.reset(new Dataset(field_names_, label_indices));
+    for (const vector<string>& row : rows_) {
+      dataset_->add_row(row);
+    }
+    dataset_->process_features();
+  }
+
+  // Checks that transform gives exactly what the dataset gives for row.
+  void expectMatchesDataset(const FeatureTransform& transform,
+			    const vector<string>& row) {
+    pair<vector<float>, vector<float>> expected;
+    dataset_->process_example(row, &expected);
+    vector<float> features(transform.numFeatures());
+    vector<float> labels(transform.numLabels());
+    ASSERT_TRUE(transform.transform(row, features.data(), labels.data()));
+    EXPECT_EQ(expected.first, features);
+    EXPECT_EQ(expected.second, labels);
+  }
+
+  vector<vector<string>> rows_;
+  vector<string> field_names_;
+  std::unique_ptr<Dataset> dataset_;
+};
+
+TEST_F(FeatureTransformTest, MatchesDatasetProcessing) {
+  makeDataset({ 5 });
+  FeatureTransform transform = dataset_->feature_transform();
+  EXPECT_EQ(dataset_->output_features().size(), transform.numFeatures());
+  EXPECT_EQ(6, transform.numFields());
+  EXPECT_EQ(1, transform.numLabels());
+  for (const vector<string>& row : rows_) {
+    expectMatchesDataset(transform, row);
+  }
+  // Unseen categories encode as zeros, and values out of range scale
+  // beyond it, as in the dataset.
+  expectMatchesDataset(transform, {"3.0", "purple", "0.5", "7", "5x", "9"});
+  EXPECT_FLOAT_EQ(dataset_->unscale_label(0.25), transform.unscaleLabel(0.25));
+
+  vector<float> features(transform.numFeatures());
+  EXPECT_FALSE(transform.transform({"1.0", "green"}, features.data()));
+}
+
+TEST_F(FeatureTransformTest, ClampsLikeDataset) {
+  makeDataset({ 5 });
+  dataset_->set_out_of_range_policy(CLAMP_TO_RANGE);
+  FeatureTransform transform = dataset_->feature_transform();
+  expectMatchesDataset(transform, {"3.0", "red", "9.5", "-700", "2g", "1"});
+}
+
+TEST_F(FeatureTransformTest, TransformsDelimitedLines) {
+  makeDataset({ 5, 0 });
+  FeatureTransform transform = dataset_->feature_transform();
+  ASSERT_EQ(2, transform.numLabels());
+  vector<float> expected(transform.numFeatures());
+  vector<float> expected_labels(2);
+  ASSERT_TRUE(transform.transform(rows_[2], expected.data(),
+				  expected_labels.data()));
+  vector<float> features(transform.numFeatures(), -1.0);
+  vector<float> labels(2, -1.0);
+  string line = "0.0,green,-2.0,53,4f,0\r\n";
+  ASSERT_TRUE(transform.transformLine(line.data(), line.size(), ',',
+				      features.data(), labels.data()));
+  EXPECT_EQ(expected, features);
+  EXPECT_EQ(expected_labels, labels);
+  line = "0.0\tgreen\t-2.0\t53\t4f\t0";
+  ASSERT_TRUE(transform.transformLine(line.data(), line.size(), '\t',
+				      features.data()));
+  EXPECT_EQ(expected, features);
+  line = "0.0,green,-2.0";
+  EXPECT_FALSE(transform.transformLine(line.data(), line.size(), ',',
+				       features.data()));
+}
+
+TEST_F(FeatureTransformTest, SaveAndLoadRoundTrip) {
+  rows_.push_back({"0.5", "two words", "-2.0", "5", "", "1"});
+  makeDataset({ 5, 0 });
+  FeatureTransform transform = dataset_->feature_transform();
+  std::stringstream stream;
+  ASSERT_TRUE(transform.save(stream));
+  std::unique_ptr<FeatureTransform> loaded = FeatureTransform::load(stream);
+  ASSERT_NE(nullptr, loaded);
+  EXPECT_EQ(transform.numFeatures(), loaded->numFeatures());
+  EXPECT_EQ(transform.numLabels(), loaded->numLabels());
+  for (const vector<string>& row : rows_) {
+    expectMatchesDataset(*loaded, row);
+  }
+  for (size_t label = 0; label < 2; label++) {
+    EXPECT_FLOAT_EQ(dataset_->unscale_label(0.75, label),
+		    loaded->unscaleLabel(0.75, label));
+  }
+
+  std::stringstream truncated("transform 1\nscale 1 0\ncolumns 2\n"
+			      "numeric 0 1\ncategorical 2\n3 abc\n");
+  EXPECT_EQ(nullptr, FeatureTransform::load(truncated));
+}
@@ -0,0 +1,40 @@
+#include "fold_scaling.h"
+
+#include <vector>
+
+std::unique_ptr<NN> foldScaling(const NN& nn,
+				const FeatureTransform& transform) {
+  if (transform.clamps() || nn.layers.empty() ||
+      transform.numFeatures() != nn.params->numInputs ||
+      transform.numLabels() != nn.numOutputs()) {
+    return nullptr;
+  }
+  std::unique_ptr<NN> folded = nn.clone();
+
+  vector<float> a, b;
+  transform.featureAffine(&a, &b);
+  NNLayer* first = folded->layers[0].get();
+  for (size_t j = 0; j < first->inWeights.row_size; j++) {
+    double bias = first->bias[j];
+    for (size_t k = 0; k < first->inWeights.col_size; k++) {
+      float& w = first->inWeights.at(j, k);
+      bias += static_cast<double>(w) * b[k];
+      w *= a[k];
+    }
+    first->bias[j] = bias;
+  }
+  folded->updateSparseWeights();
+
+  size_t num_outputs = folded->numOutputs();
+  if (folded->outputScale.empty()) {
+    folded->outputScale.assign(num_outputs, 1.0);
+    folded->outputOffset.assign(num_outputs, 0.0);
+  }
+  for (size_t j = 0; j < num_outputs; j++) {
+    float scale, offset;
+    transform.labelAffine(j, &scale, &offset);
+    folded->outputOffset[j] = folded->outputOffset[j] * scale + offset;
+    folded->outputScale[j] *= scale;
+  }
+  return folded;
+}
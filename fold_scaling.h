@@ -0,0 +1,23 @@
+#ifndef __FOLD_SCALING_H_
+#define __FOLD_SCALING_H_
+
+#include "feature_transform.h"
+#include "nn.h"
+
+#include <memory>
+
+// Returns a copy of nn with the transform's scaling folded in, so it
+// takes the features of transform.unscaled() (raw numeric values) and
+// predicts unscaled labels directly, saving a pass over the features
+// and outputs on every inference.
+//
+// Min-max scaling is affine per feature, so it's absorbed into the
+// first layer: w'[j][k] = w[j][k] * a[k] and bias'[j] = bias[j] +
+// sum_k w[j][k] * b[k]. Label unscaling follows the output activation,
+// so it becomes the copy's output map (composed with any nn already
+// has). Returns nullptr if the transform clamps, which isn't affine,
+// or doesn't match nn's inputs and outputs.
+std::unique_ptr<NN> foldScaling(const NN& nn,
+				const FeatureTransform& transform);
+
+#endif
@@ -0,0 +1,127 @@
+#include "fold_scaling.h"
+
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "dataset.h"
+#include "gtest/gtest.h"
+
+class FoldScalingTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    rows_.push_back({"1.0", "green", "-2.5", "100", "2g", "2"});
+    rows_.push_back({"0.0", "blue", "-1.5", "-100", "3f", "2"});
+    rows_.push_back({"0.0", "green", "-2.0", "53", "4f", "0"});
+    rows_.push_back({"0.0", "red", "-5.5", "22", "4f", "0"});
+    rows_.push_back({"1.0", "yellow", "-2.5", "1000", "4f", "1"});
+    rows_.push_back({"0.5", "red", "-3.0", "400", "3f", "5"});
+    field_names_ = { "foo", "bar", "baz", "quux", "quuux", "label" };
+  }
+
+  void makeDataset(const vector<size_t>& label_indices) {
+    dataset_.reset(new Dataset(field_names_, label_indices));
+    for (const vector<string>& row : rows_) {
+      dataset_->add_row(row);
+    }
+    dataset_->process_features();
+  }
+
+  std::unique_ptr<NN> makeModel(size_t num_inputs, size_t num_outputs) {
+    NNParams params(num_inputs, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+    std::unique_ptr<NN> nn(new NN(params));
+    nn->addLayer(LayerType::RELU, 6);
+    nn->addLayer(LayerType::SIGMOID, 4);
+    nn->addOutputLayer(LayerType::RELU, num_outputs);
+    srand(9);
+    nn->initializeWeights([](size_t i, size_t j, size_t k) {
+	return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+      },
+      [](size_t i, size_t j) {
+	return static_cast<float>((rand() % 1000) * 0.001);
+      });
+    return nn;
+  }
+
+  // Checks the folded model on raw features against scaling, running
+  // nn and unscaling its outputs.
+  void expectMatchesTwoStage(const NN& nn, const NN& folded,
+			     const FeatureTransform& transform) {
+    FeatureTransform raw = transform.unscaled();
+    vector<float> features(transform.numFeatures());
+    vector<float> raw_features(transform.numFeatures());
+    vector<float> outputs, folded_outputs;
+    for (const vector<string>& row : rows_) {
+      ASSERT_TRUE(transform.transform(row, features.data()));
+      ASSERT_TRUE(raw.transform(row, raw_features.data()));
+      nn.inferenceAll(features, &outputs);
+      folded.inferenceAll(raw_features, &folded_outputs);
+      ASSERT_EQ(outputs.size(), folded_outputs.size());
+      for (size_t j = 0; j < outputs.size(); j++) {
+	float expected = transform.unscaleLabel(outputs[j], j);
+	EXPECT_NEAR(expected, folded_outputs[j],
+		    1e-4 * std::max(1.0f, std::fabs(expected)));
+      }
+    }
+  }
+
+  vector<vector<string>> rows_;
+  vector<string> field_names_;
+  std::unique_ptr<Dataset> dataset_;
+};
+
+TEST_F(FoldScalingTest, MatchesTwoStagePath) {
+  makeDataset({ 5 });
+  FeatureTransform transform = dataset_->feature_transform();
+  std::unique_ptr<NN> nn = makeModel(transform.numFeatures(), 1);
+  std::unique_ptr<NN> folded = foldScaling(*nn, transform);
+  ASSERT_NE(nullptr, folded);
+  expectMatchesTwoStage(*nn, *folded, transform);
+  // Later layers are untouched.
+  EXPECT_EQ(nn->layers[1]->inWeights.data, folded->layers[1]->inWeights.data);
+
+  // The folded model, output map included, survives saving.
+  std::stringstream stream;
+  ASSERT_TRUE(folded->save(stream));
+  std::unique_ptr<NN> loaded = NN::load(stream);
+  ASSERT_NE(nullptr, loaded);
+  EXPECT_EQ(folded->outputScale, loaded->outputScale);
+  EXPECT_EQ(folded->outputOffset, loaded->outputOffset);
+  expectMatchesTwoStage(*nn, *loaded, transform);
+}
+
+TEST_F(FoldScalingTest, FoldsEveryTarget) {
+  makeDataset({ 5, 2 });
+  FeatureTransform transform = dataset_->feature_transform();
+  std::unique_ptr<NN> nn = makeModel(transform.numFeatures(), 2);
+  std::unique_ptr<NN> folded = foldScaling(*nn, transform);
+  ASSERT_NE(nullptr, folded);
+  expectMatchesTwoStage(*nn, *folded, transform);
+
+  vector<vector<float>> batch;
+  FeatureTransform raw = transform.unscaled();
+  for (const vector<string>& row : rows_) {
+    batch.push_back(vector<float>(raw.numFeatures()));
+    raw.transform(row, batch.back().data());
+  }
+  vector<float> results, outputs;
+  folded->inferenceBatch(batch, &results);
+  for (size_t e = 0; e < batch.size(); e++) {
+    folded->inferenceAll(batch[e], &outputs);
+    EXPECT_EQ(outputs[0], results[2 * e]);
+    EXPECT_EQ(outputs[1], results[2 * e + 1]);
+  }
+}
+
+TEST_F(FoldScalingTest, RejectsClampingOrMismatchedTransforms) {
+  makeDataset({ 5 });
+  std::unique_ptr<NN> nn =
+    makeModel(dataset_->feature_transform().numFeatures(), 1);
+  dataset_->set_out_of_range_policy(CLAMP_TO_RANGE);
+  EXPECT_EQ(nullptr, foldScaling(*nn, dataset_->feature_transform()));
+  dataset_->set_out_of_range_policy(ALLOW_OUT_OF_RANGE);
+  std::unique_ptr<NN> two_outputs =
+    makeModel(dataset_->feature_transform().numFeatures(), 2);
+  EXPECT_EQ(nullptr, foldScaling(*two_outputs, dataset_->feature_transform()));
+}
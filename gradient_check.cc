@@ -0,0 +1,229 @@
+#include "gradient_check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace {
+
+// The network's layers and loss in double precision, with every
+// example's activations cached.
+class ReferenceNetwork {
+ public:
+  ReferenceNetwork(const NN& nn, const ExampleView& examples) :
+    examples_(examples) {
+    for (const auto& layer : nn.layers) {
+      Layer ref;
+      ref.type = layer->type();
+      ref.rows = layer->inWeights.row_size;
+      ref.cols = layer->inWeights.col_size;
+      ref.param = (ref.type == RELU ?
+		   static_cast<const PReluNNLayer*>(layer.get())->slope : 0.0);
+      ref.weights.assign(layer->inWeights.data.begin(),
+			 layer->inWeights.data.end());
+      ref.bias.assign(layer->bias.begin(), layer->bias.end());
+      max_units_ = std::max(max_units_, ref.rows);
+      layers_.push_back(ref);
+    }
+    preActivations_.resize(examples.size());
+    outputs_.resize(examples.size());
+    for (size_t e = 0; e < examples.size(); e++) {
+      const vector<float>& inputs = examples.inputs(e);
+      outputs_[e].push_back(vector<double>(inputs.begin(), inputs.end()));
+      for (size_t l = 0; l < layers_.size(); l++) {
+	const Layer& layer = layers_[l];
+	vector<double> z(layer.rows), f(layer.rows);
+	for (size_t j = 0; j < layer.rows; j++) {
+	  z[j] = preActivation(layer, j, outputs_[e][l]);
+	  f[j] = activate(layer, z[j]);
+	}
+	preActivations_[e].push_back(z);
+	outputs_[e].push_back(f);
+      }
+    }
+  }
+
+  size_t numLayers() const { return layers_.size(); }
+  size_t rows(size_t l) const { return layers_[l].rows; }
+  size_t cols(size_t l) const { return layers_[l].cols; }
+
+  // Derivatives of the mean loss w.r.t. the bias and every weight of
+  // unit j of layer l, by central differences.
+  void unitGradients(size_t l, size_t j, double epsilon,
+		     double* bias_gradient, double* weight_gradients) const {
+    static thread_local vector<double> current, next;
+    current.resize(max_units_);
+    next.resize(max_units_);
+    size_t n = examples_.size();
+    *bias_gradient = 0.0;
+    std::fill(weight_gradients, weight_gradients + cols(l), 0.0);
+    for (size_t e = 0; e < n; e++) {
+      *bias_gradient += lossWithShift(e, l, j, epsilon, &current, &next) -
+	lossWithShift(e, l, j, -epsilon, &current, &next);
+      const vector<double>& inputs = outputs_[e][l];
+      for (size_t k = 0; k < cols(l); k++) {
+	double shift = epsilon * inputs[k];
+	weight_gradients[k] += lossWithShift(e, l, j, shift, &current, &next) -
+	  lossWithShift(e, l, j, -shift, &current, &next);
+      }
+    }
+    double scale = (n > 0 ? 1.0 / (2 * epsilon * n) : 0.0);
+    *bias_gradient *= scale;
+    for (size_t k = 0; k < cols(l); k++) {
+      weight_gradients[k] *= scale;
+    }
+  }
+
+ private:
+  struct Layer {
+    LayerType type;
+    size_t rows, cols;
+    double param;  // PReLU slope
+    vector<double> weights, bias;
+  };
+
+  static double preActivation(const Layer& layer, size_t unit,
+			      const vector<double>& inputs) {
+    double z = layer.bias[unit];
+    const double* w = &layer.weights[unit * layer.cols];
+    for (size_t k = 0; k < layer.cols; k++) {
+      z += w[k] * inputs[k];
+    }
+    return z;
+  }
+
+  static double activate(const Layer& layer, double z) {
+    switch (layer.type) {
+    case RELU:
+      return (z >= 0 ? z : layer.param * z);
+    case SIGMOID:
+      return 1.0 / (1.0 + std::exp(-z));
+    }
+    return z;
+  }
+
+  // Loss of example e, summed over the outputs, with the
+  // pre-activation of unit j of layer l moved by shift.
+  double lossWithShift(size_t e, size_t l, size_t j, double shift,
+		       vector<double>* current, vector<double>* next) const {
+    const vector<double>& cached = outputs_[e][l+1];
+    std::copy(cached.begin(), cached.end(), current->begin());
+    (*current)[j] = activate(layers_[l], preActivations_[e][l][j] + shift);
+    for (size_t m = l + 1; m < layers_.size(); m++) {
+      const Layer& layer = layers_[m];
+      for (size_t u = 0; u < layer.rows; u++) {
+	(*next)[u] = activate(layer, preActivation(layer, u, *current));
+      }
+      current->swap(*next);
+    }
+    const Layer& output = layers_.back();
+    const float* labels = examples_.labels(e);
+    double loss = 0.0;
+    for (size_t u = 0; u < output.rows; u++) {
+      double f = (*current)[u], y = labels[u];
+      // The losses the output layers report.
+      if (output.type == SIGMOID) {
+	loss -= y * std::log(f) + (1 - y) * std::log(1 - f);
+      } else {
+	loss += (y - f) * (y - f);
+      }
+    }
+    return loss;
+  }
+
+  const ExampleView& examples_;
+  vector<Layer> layers_;
+  size_t max_units_ = 0;
+  // Per example and layer, as in ForwardPass.
+  vector<vector<vector<double>>> preActivations_;
+  vector<vector<vector<double>>> outputs_;
+};
+
+double relativeError(double analytic, double numerical, double min_scale) {
+  double scale = std::max(std::max(std::fabs(analytic), std::fabs(numerical)),
+			  min_scale);
+  return std::fabs(analytic - numerical) / scale;
+}
+
+}  // namespace
+
+double GradientCheckResult::maxError() const {
+  double error = 0.0;
+  for (const LayerGradientError& layer : layers) {
+    error = std::max(error, layer.maxError());
+  }
+  return error;
+}
+
+string GradientCheckResult::toString() const {
+  std::ostringstream out;
+  for (size_t l = 0; l < layers.size(); l++) {
+    out << "layer " << l << ": max relative error " <<
+      layers[l].maxWeightError << " (weight " << layers[l].worstWeight <<
+      "), bias " << layers[l].maxBiasError << " (bias " <<
+      layers[l].worstBias << ")\n";
+  }
+  return out.str();
+}
+
+GradientCheckResult checkGradients(const NN& nn,
+				   const ExampleView& examples,
+				   const NNGradients& gradients,
+				   const GradientCheckParams& params) {
+  ReferenceNetwork reference(nn, examples);
+  size_t num_layers = reference.numLayers();
+  vector<vector<double>> weight_errors(num_layers), bias_errors(num_layers);
+  {
+    ThreadPool pool(params.numThreads);
+    for (size_t l = 0; l < num_layers; l++) {
+      weight_errors[l].resize(reference.rows(l) * reference.cols(l));
+      bias_errors[l].resize(reference.rows(l));
+      for (size_t j = 0; j < reference.rows(l); j++) {
+	pool.schedule([&, l, j]() {
+	    size_t cols = reference.cols(l);
+	    vector<double> numerical(cols);
+	    double bias_numerical;
+	    reference.unitGradients(l, j, params.epsilon, &bias_numerical,
+				    numerical.data());
+	    bias_errors[l][j] = relativeError(gradients.biases[l][j],
+					      bias_numerical, params.minScale);
+	    for (size_t k = 0; k < cols; k++) {
+	      weight_errors[l][j * cols + k] =
+		relativeError(gradients.weights[l][j * cols + k],
+			      numerical[k], params.minScale);
+	    }
+	  });
+      }
+    }
+    pool.wait();
+  }
+  GradientCheckResult result;
+  result.layers.resize(num_layers);
+  for (size_t l = 0; l < num_layers; l++) {
+    LayerGradientError& layer = result.layers[l];
+    for (size_t i = 0; i < weight_errors[l].size(); i++) {
+      if (weight_errors[l][i] > layer.maxWeightError) {
+	layer.maxWeightError = weight_errors[l][i];
+	layer.worstWeight = i;
+      }
+    }
+    for (size_t i = 0; i < bias_errors[l].size(); i++) {
+      if (bias_errors[l][i] > layer.maxBiasError) {
+	layer.maxBiasError = bias_errors[l][i];
+	layer.worstBias = i;
+      }
+    }
+  }
+  return result;
+}
+
+GradientCheckResult checkGradients(const NN& nn,
+				   const ExampleView& examples,
+				   const GradientCheckParams& params) {
+  NNGradients gradients;
+  nn.computeGradients(examples, &gradients);
+  return checkGradients(nn, examples, gradients, params);
+}
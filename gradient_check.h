@@ -0,0 +1,53 @@
+#ifndef __GRADIENT_CHECK_H_
+#define __GRADIENT_CHECK_H_
+
+#include "nn.h"
+
+#include <string>
+#include <vector>
+
+struct GradientCheckParams {
+  double epsilon = 1e-6;  // central difference step
+  // Gradients smaller in magnitude than this are compared absolutely
+  // rather than relatively, so float rounding in tiny gradients isn't
+  // reported as a large relative error.
+  double minScale = 1e-4;
+  size_t numThreads = 0;  // 0 uses one thread per hardware thread
+};
+
+struct LayerGradientError {
+  double maxWeightError = 0.0;  // largest relative error over weights
+  size_t worstWeight = 0;       // its index in inWeights.data
+  double maxBiasError = 0.0;
+  size_t worstBias = 0;
+
+  double maxError() const {
+    return (maxWeightError > maxBiasError ? maxWeightError : maxBiasError);
+  }
+};
+
+struct GradientCheckResult {
+  vector<LayerGradientError> layers;
+
+  double maxError() const;
+  string toString() const;
+};
+
+// Checks gradients of nn's mean loss over examples, at its current
+// weights, against central differences of that loss. Every weight and
+// bias is perturbed, in parallel. The reference loss is computed in
+// double precision, by its own implementation of the layers rather
+// than the network's kernels, so it can vouch for any of them.
+//
+// Perturbing a weight of unit j only moves unit j's pre-activation, by
+// epsilon times the weight's input, so each perturbation reruns only
+// that unit and the layers after it from cached activations.
+GradientCheckResult checkGradients(
+    const NN& nn, const ExampleView& examples, const NNGradients& gradients,
+    const GradientCheckParams& params = GradientCheckParams());
+// Checks the gradients NN::computeGradients gives.
+GradientCheckResult checkGradients(
+    const NN& nn, const ExampleView& examples,
+    const GradientCheckParams& params = GradientCheckParams());
+
+#endif
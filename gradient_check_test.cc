@@ -0,0 +1,124 @@
+#include "gradient_check.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+class GradientCheckTest : public ::testing::Test {
+ public:
+  std::unique_ptr<NN> makeModel(LayerType hidden, size_t num_outputs) {
+    NNParams params(4, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+    std::unique_ptr<NN> nn(new NN(params));
+    nn->addLayer(hidden, 6);
+    nn->addLayer(SIGMOID, 5);
+    nn->addOutputLayer(RELU, num_outputs);
+    srand(13);
+    nn->initializeWeights([](size_t i, size_t j, size_t k) {
+	return static_cast<float>((rand() % 1000) * 0.002 - 1.0);
+      },
+      [](size_t i, size_t j) {
+	return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+      });
+    for (int e = 0; e < 12; e++) {
+      vector<float> x = { 0.1f * e, 1.0f - 0.07f * e, (e % 3) * 0.4f,
+			  -0.05f * e };
+      vector<float> y;
+      for (size_t j = 0; j < num_outputs; j++) {
+	y.push_back(0.3f * j + 0.02f * e);
+      }
+      examples_.push_back(make_pair(x, y));
+    }
+    return nn;
+  }
+
+  vector<pair<vector<float>, vector<float>>> examples_;
+};
+
+TEST_F(GradientCheckTest, BackpropagationGradientsMatch) {
+  std::unique_ptr<NN> nn = makeModel(RELU, 1);
+  GradientCheckResult result = checkGradients(*nn, examples_);
+  ASSERT_EQ(3, result.layers.size());
+  EXPECT_LT(result.maxError(), 1e-3) << result.toString();
+}
+
+TEST_F(GradientCheckTest, MultiOutputGradientsMatch) {
+  std::unique_ptr<NN> nn = makeModel(SIGMOID, 3);
+  EXPECT_LT(checkGradients(*nn, examples_).maxError(), 1e-3);
+}
+
+TEST_F(GradientCheckTest, ComputeGradientsDoesntTrain) {
+  std::unique_ptr<NN> nn = makeModel(RELU, 1);
+  vector<float> weights = nn->layers[0]->inWeights.data;
+  vector<float> bias = nn->layers[2]->bias;
+  NNGradients gradients;
+  nn->computeGradients(examples_, &gradients);
+  EXPECT_EQ(weights, nn->layers[0]->inWeights.data);
+  EXPECT_EQ(bias, nn->layers[2]->bias);
+}
+
+TEST_F(GradientCheckTest, FindsWrongGradients) {
+  std::unique_ptr<NN> nn = makeModel(RELU, 2);
+  NNGradients gradients;
+  nn->computeGradients(examples_, &gradients);
+  gradients.weights[1][7] = gradients.weights[1][7] * 1.5 + 0.01;
+  gradients.biases[2][1] += 0.05;
+  GradientCheckResult result = checkGradients(*nn, examples_, gradients);
+  EXPECT_LT(result.layers[0].maxError(), 1e-3);
+  EXPECT_GT(result.layers[1].maxWeightError, 0.1);
+  EXPECT_EQ(7, result.layers[1].worstWeight);
+  EXPECT_LT(result.layers[1].maxBiasError, 1e-3);
+  EXPECT_GT(result.layers[2].maxBiasError, 0.1);
+  EXPECT_EQ(1, result.layers[2].worstBias);
+}
+
+TEST_F(GradientCheckTest, ThreadCountDoesntChangeResult) {
+  std::unique_ptr<NN> nn = makeModel(RELU, 2);
+  GradientCheckParams one_thread, four_threads;
+  one_thread.numThreads = 1;
+  four_threads.numThreads = 4;
+  GradientCheckResult a = checkGradients(*nn, examples_, one_thread);
+  GradientCheckResult b = checkGradients(*nn, examples_, four_threads);
+  for (size_t l = 0; l < a.layers.size(); l++) {
+    EXPECT_EQ(a.layers[l].maxWeightError, b.layers[l].maxWeightError);
+    EXPECT_EQ(a.layers[l].worstWeight, b.layers[l].worstWeight);
+    EXPECT_EQ(a.layers[l].maxBiasError, b.layers[l].maxBiasError);
+  }
+}
+
+TEST_F(GradientCheckTest, LayersFinishLastToFirst) {
+  std::unique_ptr<NN> nn = makeModel(RELU, 2);
+  NNGradients gradients;
+  vector<size_t> order;
+  vector<vector<float>> at_callback(3);
+  nn->computeGradients(examples_, &gradients, [&](size_t layer) {
+      order.push_back(layer);
+      at_callback[layer] = gradients.weights[layer];
+    });
+  EXPECT_EQ(vector<size_t>({ 2, 1, 0 }), order);
+  // Each layer's gradients were already final when it was reported.
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(gradients.weights[i], at_callback[i]);
+  }
+}
+
+TEST_F(GradientCheckTest, ShapeChangesDontChangeResult) {
+  std::unique_ptr<NN> nn = makeModel(RELU, 2);
+  NNGradients expected, gradients;
+  nn->computeGradients(examples_, &expected);
+  // Other batch sizes and another network, which replace the forward
+  // passes kept between calls.
+  vector<pair<vector<float>, vector<float>>> few(examples_.begin(),
+						 examples_.begin() + 3);
+  nn->computeGradients(few, &gradients);
+  // makeModel adds the other network's examples after the first's.
+  std::unique_ptr<NN> other = makeModel(SIGMOID, 3);
+  vector<pair<vector<float>, vector<float>>> others(examples_.begin() + 12,
+						    examples_.end());
+  examples_.resize(12);
+  other->computeGradients(others, &gradients);
+  nn->computeGradients(examples_, &gradients);
+  EXPECT_EQ(expected.weights, gradients.weights);
+  EXPECT_EQ(expected.biases, gradients.biases);
+}
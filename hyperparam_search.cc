@@ -0,0 +1,178 @@
+#include "hyperparam_search.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace {
+
+template <typename T>
+vector<T> orDefault(const vector<T>& values, const T& def) {
+  return values.empty() ? vector<T>{def} : values;
+}
+
+string layersToString(const vector<LayerSpec>& layers) {
+  ostringstream out;
+  for (size_t i = 0; i < layers.size(); i++) {
+    out << (i > 0 ? "-" : "") << (layers[i].type == RELU ? "relu" : "sig") <<
+      layers[i].numUnits;
+  }
+  return out.str();
+}
+
+}  // namespace
+
+vector<ModelSpec> searchCandidates(const NNParams& base,
+				   const SearchSpace& space,
+				   const SearchParams& search_params) {
+  vector<float> learning_rates = orDefault(space.learningRates,
+					   base.learningRate);
+  vector<size_t> patiences = orDefault(space.patiences, base.patience);
+  vector<float> min_deltas = orDefault(space.minDeltaSgds, base.minDeltaSgd);
+  vector<vector<LayerSpec>> hidden_layers =
+    orDefault(space.hiddenLayers, vector<LayerSpec>{{RELU, 10}});
+  vector<LayerType> output_types = orDefault(space.outputTypes, RELU);
+  const size_t radices[] = {
+    learning_rates.size(), patiences.size(),
+    min_deltas.size(), hidden_layers.size(), output_types.size()
+  };
+  const size_t num_params = sizeof(radices) / sizeof(radices[0]);
+  size_t grid_size = 1;
+  for (size_t radix : radices) {
+    grid_size *= radix;
+  }
+
+  std::mt19937 rng(search_params.seed);
+  size_t num_trials = (search_params.strategy == GRID ? grid_size :
+		       search_params.numTrials);
+  vector<ModelSpec> candidates;
+  for (size_t t = 0; t < num_trials; t++) {
+    // Position of this trial along each hyperparameter.
+    size_t index[num_params];
+    size_t rest = t;
+    for (size_t p = 0; p < num_params; p++) {
+      if (search_params.strategy == GRID) {
+	index[p] = rest % radices[p];
+	rest /= radices[p];
+      } else {
+	index[p] = std::uniform_int_distribution<size_t>(
+	    0, radices[p] - 1)(rng);
+      }
+    }
+    NNParams params(base);
+    params.learningRate = learning_rates[index[0]];
+    params.patience = patiences[index[1]];
+    params.minDeltaSgd = min_deltas[index[2]];
+    // Trials run concurrently; their progress would interleave.
+    params.verbose = false;
+    candidates.emplace_back("trial_" + std::to_string(t), params,
+			    hidden_layers[index[3]], output_types[index[4]],
+			    search_params.seed + t);
+  }
+  return candidates;
+}
+
+vector<TrialResult> searchHyperparameters(
+    const NNParams& base, const SearchSpace& space,
+    const SearchParams& search_params,
+    const vector<pair<vector<float>, float>>& training,
+    const vector<pair<vector<float>, float>>& validation) {
+  vector<ModelSpec> candidates = searchCandidates(base, space, search_params);
+  vector<TrialResult> trials;
+  vector<std::unique_ptr<NN>> models;
+  vector<size_t> alive;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    trials.emplace_back(candidates[i]);
+    models.push_back(buildModel(candidates[i]));
+    alive.push_back(i);
+  }
+
+  bool halving = search_params.eta > 1;
+  size_t max_iterations = std::max<size_t>(base.maxIterations, 1);
+  size_t budget = (halving ?
+		   std::min(std::max<size_t>(search_params.minIterations, 1),
+			    max_iterations) :
+		   max_iterations);
+  size_t trained = 0;
+  ThreadPool pool(search_params.numThreads);
+  while (!alive.empty()) {
+    // Every trial still alive has been trained for the same number of
+    // iterations; bring them all up to the budget for this rung.
+    size_t steps = budget - trained;
+    for (size_t i : alive) {
+      pool.schedule([&, i, steps]() {
+	  NN* nn = models[i].get();
+	  TrialResult& trial = trials[i];
+	  // The stopping rule judges the trial's whole loss history, so
+	  // train one iteration at a time and ask it before each.
+	  NNParams stop_params(trial.spec.params);
+	  stop_params.maxIterations = max_iterations;
+	  TrainingReport history;
+	  history.losses = trial.losses;
+	  nn->params->maxIterations = 1;
+	  for (size_t step = 0; step < steps && !trial.stoppedEarly; step++) {
+	    if (trainingShouldStop(stop_params, &history)) {
+	      trial.stoppedEarly = true;
+	      break;
+	    }
+	    TrainingReport report;
+	    nn->train(training, &report);
+	    history.losses.insert(history.losses.end(), report.losses.begin(),
+				  report.losses.end());
+	    trial.trainingSeconds += report.timeElapsed;
+	  }
+	  if (history.losses.size() > trial.losses.size()) {
+	    trial.validationLoss = nn->evaluate(validation);
+	  }
+	  trial.iterations = history.losses.size();
+	  trial.losses.swap(history.losses);
+	  trial.rungs++;
+	});
+    }
+    pool.wait();
+    trained = budget;
+    if (!halving || alive.size() <= 1 || budget >= max_iterations) {
+      break;
+    }
+    std::stable_sort(alive.begin(), alive.end(), [&](size_t a, size_t b) {
+	return trials[a].validationLoss < trials[b].validationLoss;
+      });
+    alive.resize(std::max<size_t>(alive.size() / search_params.eta, 1));
+    budget = std::min(budget * search_params.eta, max_iterations);
+  }
+
+  // Trials that survived more rungs were compared on longer training,
+  // so they rank ahead of those eliminated earlier.
+  std::stable_sort(trials.begin(), trials.end(),
+		   [](const TrialResult& a, const TrialResult& b) {
+		     if (a.rungs != b.rungs) {
+		       return a.rungs > b.rungs;
+		     }
+		     return a.validationLoss < b.validationLoss;
+		   });
+  return trials;
+}
+
+string formatSearchResults(const vector<TrialResult>& results) {
+  ostringstream out;
+  out << std::left << std::setw(6) << "rank" << std::setw(10) << "trial" <<
+    std::setw(12) << "lr" << std::setw(9) << "patience" << std::setw(12) << "min_delta" << std::setw(16) <<
+    "layers" << std::setw(7) << "iters" << std::setw(14) << "val_loss" <<
+    "train_s" << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const TrialResult& r = results[i];
+    out << std::left << std::setw(6) << (i + 1) << std::setw(10) <<
+      r.spec.name << std::setw(12) << r.spec.params.learningRate <<
+      std::setw(9) << r.spec.params.patience << std::setw(12) << r.spec.params.minDeltaSgd <<
+      std::setw(16) << layersToString(r.spec.hiddenLayers) <<
+      std::setw(7) << r.iterations << std::setw(14) << r.validationLoss <<
+      r.trainingSeconds << endl;
+  }
+  return out.str();
+}
@@ -0,0 +1,75 @@
+#ifndef __HYPERPARAM_SEARCH_H_
+#define __HYPERPARAM_SEARCH_H_
+
+#include "multi_trainer.h"
+#include "nn.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Candidate values for each hyperparameter. An empty list means the
+// value from the base NNParams is always used. (NN::train updates after
+// every example, so sgdBatchSize isn't searched.)
+struct SearchSpace {
+  vector<float> learningRates;
+  vector<size_t> patiences;
+  vector<float> minDeltaSgds;
+  vector<vector<LayerSpec>> hiddenLayers;
+  vector<LayerType> outputTypes;
+};
+
+typedef enum {
+  GRID,    // every combination in the space
+  RANDOM,  // numTrials combinations drawn at random
+} SearchStrategy;
+
+struct SearchParams {
+  SearchStrategy strategy = GRID;
+  size_t numTrials = 20;  // for RANDOM search
+  unsigned int seed = 42;
+  size_t numThreads = 0;  // 0 uses one thread per hardware thread
+  // Successive halving: every trial first trains for minIterations;
+  // then only the best 1/eta of them continue, for eta times as many
+  // iterations in total, and so on until one trial is left or
+  // maxIterations (from the base NNParams) is reached. eta <= 1
+  // disables elimination and trains every trial to maxIterations.
+  // A trial's stopping rule (patience, minDeltaSgd) sees its losses
+  // over every rung; once it says stop, the trial trains no further
+  // but still competes on its validation loss.
+  size_t minIterations = 10;
+  size_t eta = 3;
+};
+
+struct TrialResult {
+  ModelSpec spec;
+  float validationLoss;
+  double trainingSeconds;  // summed over every rung the trial ran in
+  size_t iterations;       // total training iterations run
+  size_t rungs;            // successive halving rounds survived
+  bool stoppedEarly;       // its stopping rule ended training
+  vector<float> losses;    // training loss at each iteration
+
+  TrialResult(const ModelSpec& s) : spec(s), validationLoss(0.0),
+    trainingSeconds(0.0), iterations(0), rungs(0), stoppedEarly(false) {}
+};
+
+// Expands the search space into model specs according to the strategy.
+vector<ModelSpec> searchCandidates(const NNParams& base,
+				   const SearchSpace& space,
+				   const SearchParams& search_params);
+
+// Runs the search, training trials in parallel on a thread pool, and
+// returns every trial ranked by validation loss (eliminated trials
+// are ranked by the loss they had when eliminated, after the
+// survivors).
+vector<TrialResult> searchHyperparameters(
+    const NNParams& base, const SearchSpace& space,
+    const SearchParams& search_params,
+    const vector<pair<vector<float>, float>>& training,
+    const vector<pair<vector<float>, float>>& validation);
+
+// Renders ranked results as a fixed-width table.
+string formatSearchResults(const vector<TrialResult>& results);
+
+#endif
@@ -0,0 +1,122 @@
+#include "hyperparam_search.h"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+class HyperparamSearchTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    for (int i = 0; i < 40; i++) {
+      vector<float> inputs { 0.025f * i, (i % 4) * 0.25f };
+      auto example = std::make_pair(inputs, 0.6f * inputs[0] + 0.2f * inputs[1]);
+      (i % 4 == 0 ? validation_ : training_).push_back(example);
+    }
+    space_.learningRates = { 0.001, 0.01, 0.05 };
+    space_.patiences = { 2, 4 };
+    space_.hiddenLayers = { {{RELU, 4}}, {{RELU, 8}, {RELU, 4}} };
+  }
+
+  NNParams base_ = NNParams(2, 27, DEFAULT_MIN_DELTA, 4, 10, 0.01);
+  SearchSpace space_;
+  vector<pair<vector<float>, float>> training_, validation_;
+};
+
+TEST_F(HyperparamSearchTest, GridCoversEveryCombination) {
+  SearchParams search_params;
+  vector<ModelSpec> candidates = searchCandidates(base_, space_,
+						  search_params);
+  ASSERT_EQ(12, candidates.size());
+  std::set<pair<float, size_t>> seen;
+  for (const ModelSpec& spec : candidates) {
+    EXPECT_FALSE(spec.params.verbose);
+    seen.insert(std::make_pair(spec.params.learningRate,
+			  spec.params.patience * 10 +
+			  spec.hiddenLayers.size()));
+    // Values not in the space come from the base params.
+    EXPECT_EQ(base_.sgdBatchSize, spec.params.sgdBatchSize);
+  }
+  EXPECT_EQ(12, seen.size());
+}
+
+TEST_F(HyperparamSearchTest, RandomDrawsRequestedTrials) {
+  SearchParams search_params;
+  search_params.strategy = RANDOM;
+  search_params.numTrials = 5;
+  vector<ModelSpec> candidates = searchCandidates(base_, space_,
+						  search_params);
+  ASSERT_EQ(5, candidates.size());
+  for (const ModelSpec& spec : candidates) {
+    EXPECT_NE(space_.learningRates.end(),
+	      std::find(space_.learningRates.begin(),
+			space_.learningRates.end(),
+			spec.params.learningRate));
+  }
+}
+
+TEST_F(HyperparamSearchTest, SuccessiveHalvingRanksSurvivorsFirst) {
+  SearchParams search_params;
+  search_params.minIterations = 3;
+  search_params.eta = 3;
+  search_params.numThreads = 4;
+  vector<TrialResult> results = searchHyperparameters(
+      base_, space_, search_params, training_, validation_);
+  ASSERT_EQ(12, results.size());
+  // 12 trials -> 4 -> 1, at 3, 9 and 27 iterations.
+  EXPECT_EQ(3, results[0].rungs);
+  size_t by_rung[4] = {0, 0, 0, 0};
+  for (size_t i = 0; i < results.size(); i++) {
+    by_rung[results[i].rungs]++;
+    EXPECT_LE(results[i].iterations, 27);
+    if (i > 0 && results[i].rungs == results[i-1].rungs) {
+      EXPECT_LE(results[i-1].validationLoss, results[i].validationLoss);
+    }
+    if (i > 0) {
+      EXPECT_GE(results[i-1].rungs, results[i].rungs);
+    }
+  }
+  EXPECT_EQ(8, by_rung[1]);
+  EXPECT_EQ(3, by_rung[2]);
+  EXPECT_EQ(1, by_rung[3]);
+  EXPECT_NE(string::npos, formatSearchResults(results).find("val_loss"));
+}
+
+TEST_F(HyperparamSearchTest, NoEliminationTrainsEveryTrialFully) {
+  SearchParams search_params;
+  search_params.eta = 1;
+  space_.patiences = { 100 };
+  vector<TrialResult> results = searchHyperparameters(
+      base_, space_, search_params, training_, validation_);
+  ASSERT_EQ(6, results.size());
+  for (const TrialResult& result : results) {
+    EXPECT_EQ(1, result.rungs);
+    EXPECT_EQ(27, result.iterations);
+  }
+}
+
+TEST_F(HyperparamSearchTest, StoppingRuleSpansRungs) {
+  SearchParams search_params;
+  search_params.minIterations = 3;
+  search_params.eta = 3;
+  // No improvement ever counts, so every trial stops after patience + 2
+  // iterations: 4, partway through the second rung.
+  space_.patiences = { 2 };
+  space_.minDeltaSgds = { 1e9 };
+  vector<TrialResult> results = searchHyperparameters(
+      base_, space_, search_params, training_, validation_);
+  ASSERT_EQ(6, results.size());
+  for (const TrialResult& result : results) {
+    EXPECT_EQ(result.losses.size(), result.iterations);
+    if (result.rungs == 1) {
+      EXPECT_EQ(3, result.iterations);
+      EXPECT_FALSE(result.stoppedEarly);
+    } else {
+      EXPECT_EQ(4, result.iterations);
+      EXPECT_TRUE(result.stoppedEarly);
+    }
+  }
+  EXPECT_EQ(3, results[0].rungs);
+}
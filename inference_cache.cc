@@ -0,0 +1,255 @@
+#include "inference_cache.h"
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+InferenceCache::InferenceCache(const ModelHandle* model,
+			       const InferenceCacheParams& params) :
+  model_(model), params_(params),
+  shard_capacity_(std::max<size_t>(1, params.capacity /
+				   std::max<size_t>(1, params.numShards))),
+  shards_(std::max<size_t>(1, params.numShards)) {}
+
+void InferenceCache::quantize(vector<float>* inputs) const {
+  if (params_.quantum <= 0.0) {
+    return;
+  }
+  for (float& x : *inputs) {
+    // Adding 0 turns -0 into 0, so both get the same key.
+    x = std::nearbyint(x / params_.quantum) * params_.quantum + 0.0f;
+  }
+}
+
+const vector<float>& InferenceCache::key(const vector<float>& inputs) const {
+  static thread_local vector<float> key;
+  key = inputs;
+  quantize(&key);
+  return key;
+}
+
+uint64_t InferenceCache::hash(const vector<float>& key) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ key.size();
+  for (float x : key) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    h = (h ^ bits) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  return h;
+}
+
+bool InferenceCache::catchUp(Shard* shard, uint64_t version) const {
+  if (version < shard->version) {
+    return false;
+  }
+  if (version > shard->version) {
+    shard->version = version;
+    shard->size = 0;
+    shard->hand = 0;
+    // The new model may have other widths, so storage is sized afresh
+    // by the next insert.
+    shard->keyWidth = shard->valueWidth = 0;
+    std::fill(shard->index.begin(), shard->index.end(), 0);
+  }
+  return true;
+}
+
+long InferenceCache::findLocked(const Shard& shard, uint64_t h,
+				const vector<float>& key) const {
+  if (shard.size == 0 || key.size() != shard.keyWidth) {
+    return -1;
+  }
+  size_t mask = shard.index.size() - 1;
+  for (size_t i = h & mask; shard.index[i] != 0; i = (i + 1) & mask) {
+    size_t e = shard.index[i] - 1;
+    if (shard.hashes[e] == h &&
+	memcmp(&shard.keys[e * shard.keyWidth], key.data(),
+	       shard.keyWidth * sizeof(float)) == 0) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+void InferenceCache::evictLocked(Shard* shard, size_t entry) {
+  size_t mask = shard->index.size() - 1;
+  size_t i = shard->hashes[entry] & mask;
+  while (shard->index[i] != entry + 1) {
+    i = (i + 1) & mask;
+  }
+  // Backward-shift deletion: move later entries of the probe run into
+  // the hole unless that would put them before their home slot.
+  for (;;) {
+    shard->index[i] = 0;
+    size_t j = i;
+    for (;;) {
+      j = (j + 1) & mask;
+      if (shard->index[j] == 0) {
+	return;
+      }
+      size_t home = shard->hashes[shard->index[j] - 1] & mask;
+      bool stays = (i <= j ? (i < home && home <= j) :
+		    (i < home || home <= j));
+      if (!stays) {
+	break;
+      }
+    }
+    shard->index[i] = shard->index[j];
+    i = j;
+  }
+}
+
+bool InferenceCache::findKey(const vector<float>& key, uint64_t h,
+			     vector<float>* outputs, uint64_t* version) {
+  uint64_t current = model_->version();
+  Shard& shard = shardFor(h);
+  bool hit;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    long e = catchUp(&shard, current) ? findLocked(shard, h, key) : -1;
+    hit = e >= 0;
+    if (hit) {
+      shard.referenced[e] = 1;
+      const float* values = &shard.values[e * shard.valueWidth];
+      outputs->assign(values, values + shard.valueWidth);
+      shard.hits++;
+    } else {
+      shard.misses++;
+    }
+  }
+  if (hit) {
+    Metrics::addInferenceCacheHits(1);
+  } else {
+    Metrics::addInferenceCacheMisses(1);
+    *version = current;
+  }
+  return hit;
+}
+
+void InferenceCache::insertKey(const vector<float>& key, uint64_t h,
+			       uint64_t version,
+			       const vector<float>& outputs) {
+  Shard& shard = shardFor(h);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (!catchUp(&shard, version)) {
+    return;
+  }
+  if (shard.keyWidth == 0) {
+    shard.keyWidth = key.size();
+    shard.valueWidth = outputs.size();
+    shard.hashes.resize(shard_capacity_);
+    shard.keys.resize(shard_capacity_ * shard.keyWidth);
+    shard.values.resize(shard_capacity_ * shard.valueWidth);
+    shard.referenced.assign(shard_capacity_, 0);
+    size_t index_size = 1;
+    // At most half full, so probe runs stay short.
+    while (index_size < 2 * shard_capacity_) {
+      index_size *= 2;
+    }
+    shard.index.assign(index_size, 0);
+  }
+  if (key.size() != shard.keyWidth || outputs.size() != shard.valueWidth ||
+      findLocked(shard, h, key) >= 0) {
+    return;
+  }
+  size_t e;
+  if (shard.size < shard_capacity_) {
+    e = shard.size++;
+  } else {
+    // CLOCK: entries used since the hand last passed get another round.
+    while (shard.referenced[shard.hand]) {
+      shard.referenced[shard.hand] = 0;
+      shard.hand = (shard.hand + 1) % shard_capacity_;
+    }
+    e = shard.hand;
+    shard.hand = (shard.hand + 1) % shard_capacity_;
+    evictLocked(&shard, e);
+  }
+  shard.hashes[e] = h;
+  std::copy(key.begin(), key.end(), &shard.keys[e * shard.keyWidth]);
+  std::copy(outputs.begin(), outputs.end(),
+	    &shard.values[e * shard.valueWidth]);
+  // Not referenced until it's hit, so inputs seen only once are the
+  // first to go.
+  shard.referenced[e] = 0;
+  size_t mask = shard.index.size() - 1;
+  size_t i = h & mask;
+  while (shard.index[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  shard.index[i] = e + 1;
+}
+
+bool InferenceCache::find(const vector<float>& inputs,
+			  vector<float>* outputs, uint64_t* version) {
+  const vector<float>& k = key(inputs);
+  return findKey(k, hash(k), outputs, version);
+}
+
+void InferenceCache::insert(const vector<float>& inputs, uint64_t version,
+			    const vector<float>& outputs) {
+  const vector<float>& k = key(inputs);
+  insertKey(k, hash(k), version, outputs);
+}
+
+void InferenceCache::inferenceAll(const vector<float>& inputs,
+				  vector<float>* outputs) {
+  const vector<float>& k = key(inputs);
+  uint64_t h = hash(k);
+  uint64_t version;
+  if (findKey(k, h, outputs, &version)) {
+    return;
+  }
+  model_->read()->inferenceAll(k, outputs);
+  insertKey(k, h, version, *outputs);
+}
+
+float InferenceCache::inference(const vector<float>& inputs) {
+  static thread_local vector<float> outputs;
+  inferenceAll(inputs, &outputs);
+  return outputs[0];
+}
+
+int InferenceCache::lookup(const vector<float>& inputs) {
+  float output = inference(inputs);
+  return model_->read()->layers.back()->interpretOutput(output);
+}
+
+uint64_t InferenceCache::hits() const {
+  uint64_t total = 0;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    total += shard.hits;
+  }
+  return total;
+}
+
+uint64_t InferenceCache::misses() const {
+  uint64_t total = 0;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    total += shard.misses;
+  }
+  return total;
+}
+
+size_t InferenceCache::size() const {
+  size_t total = 0;
+  for (const Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    total += shard.size;
+  }
+  return total;
+}
+
+void InferenceCache::clear() {
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.size = 0;
+    shard.hand = 0;
+    std::fill(shard.index.begin(), shard.index.end(), 0);
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef __INFERENCE_CACHE_H_
+#define __INFERENCE_CACHE_H_
+
+#include "model_handle.h"
+#include "nn.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+using std::vector;
+
+struct InferenceCacheParams {
+  // Entries over all shards; each shard keeps capacity / numShards.
+  size_t capacity = 1 << 16;
+  // Shards are locked independently, so more of them contend less.
+  size_t numShards = 16;
+  // If positive, features are rounded to multiples of quantum before
+  // they are looked up or run, so nearby inputs share an entry (and
+  // get the outputs for their rounded features).
+  float quantum = 0.0;
+};
+
+// A bounded cache of a model's outputs by input, in front of the model
+// a ModelHandle holds, for data where the same feature vectors are
+// scored over and over (e.g. every inverter reading zero at night).
+//
+// Inputs are hashed and spread over shards, each with its own lock, a
+// fixed block of entries and an open-addressing index into them; when
+// a shard is full the CLOCK algorithm picks an entry not used lately
+// to replace. Each shard remembers the model version (see
+// ModelHandle::version) its entries were computed with, and drops them
+// all when it sees that a newer model has been published.
+//
+// Hits and misses are counted per shard, under its lock, and in
+// Metrics.
+class InferenceCache {
+ public:
+  InferenceCache(const ModelHandle* model, const InferenceCacheParams& params);
+
+  InferenceCache(const InferenceCache&) = delete;
+  InferenceCache& operator=(const InferenceCache&) = delete;
+
+  // Every output of the current model for inputs, as
+  // NN::inferenceAll gives them, from the cache if they're there.
+  void inferenceAll(const vector<float>& inputs, vector<float>* outputs);
+  // The first output, and its interpretation as NN::lookup gives it.
+  float inference(const vector<float>& inputs);
+  int lookup(const vector<float>& inputs);
+
+  // For callers that run the model themselves, e.g. through an
+  // InferenceBatcher: find() gets the cached outputs for inputs, or
+  // returns false and sets *version to the current model version. On
+  // a miss, run the model on quantize(inputs) and insert() the outputs
+  // with that version; outputs of a model replaced meanwhile are
+  // dropped.
+  bool find(const vector<float>& inputs, vector<float>* outputs,
+	    uint64_t* version);
+  void insert(const vector<float>& inputs, uint64_t version,
+	      const vector<float>& outputs);
+  // Rounds inputs to the quantum, if there is one.
+  void quantize(vector<float>* inputs) const;
+
+  uint64_t hits() const;
+  uint64_t misses() const;
+  // Entries currently held, over all shards.
+  size_t size() const;
+  void clear();
+
+ private:
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    uint64_t version = 0;
+    // Entry e's key is keys[e * keyWidth, (e + 1) * keyWidth), and
+    // its outputs likewise in values; widths are fixed per version.
+    size_t keyWidth = 0, valueWidth = 0;
+    size_t size = 0;
+    vector<uint64_t> hashes;
+    vector<float> keys, values;
+    // Set when an entry is used, cleared as the CLOCK hand passes.
+    vector<uint8_t> referenced;
+    size_t hand = 0;
+    // Open addressing with linear probing: entry + 1, or 0 if empty.
+    vector<uint32_t> index;
+    uint64_t hits = 0, misses = 0;
+  };
+
+  // The key for inputs, quantized, in a per-thread buffer.
+  const vector<float>& key(const vector<float>& inputs) const;
+  static uint64_t hash(const vector<float>& key);
+  // The index uses the hash's low bits, so shards go by its high ones.
+  Shard& shardFor(uint64_t h) { return shards_[(h >> 32) % shards_.size()]; }
+  bool findKey(const vector<float>& key, uint64_t h, vector<float>* outputs,
+	       uint64_t* version);
+  void insertKey(const vector<float>& key, uint64_t h, uint64_t version,
+		 const vector<float>& outputs);
+  // With the shard locked: drops its entries if version is newer than
+  // theirs; false if version is older, so entries of it are stale.
+  bool catchUp(Shard* shard, uint64_t version) const;
+  // The entry for key in a locked shard, or -1.
+  long findLocked(const Shard& shard, uint64_t h,
+		  const vector<float>& key) const;
+  void evictLocked(Shard* shard, size_t entry);
+
+  const ModelHandle* model_;
+  InferenceCacheParams params_;
+  size_t shard_capacity_;
+  vector<Shard> shards_;
+};
+
+#endif
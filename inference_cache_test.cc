@@ -0,0 +1,127 @@
+#include "inference_cache.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// A one-layer network computing relu(a * x0 + b * x1 + bias).
+std::unique_ptr<const NN> linearModel(float a, float b, float bias = 0.0) {
+  NNParams params(2, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(params));
+  nn->addLayer(LayerType::RELU, 1);
+  nn->layers[0]->inWeights.data = { a, b };
+  nn->layers[0]->bias[0] = bias;
+  return std::unique_ptr<const NN>(nn.release());
+}
+
+}  // namespace
+
+TEST(InferenceCacheTest, HitsOnRepeatedInputs) {
+  Metrics::reset();
+  ModelHandle handle(linearModel(1.0, 2.0));
+  InferenceCache cache(&handle, InferenceCacheParams());
+  EXPECT_FLOAT_EQ(5.0, cache.inference({1.0, 2.0}));
+  EXPECT_FLOAT_EQ(5.0, cache.inference({1.0, 2.0}));
+  EXPECT_FLOAT_EQ(4.0, cache.inference({2.0, 1.0}));
+  EXPECT_EQ(handle.read()->lookup({1.0, 2.0}), cache.lookup({1.0, 2.0}));
+  EXPECT_EQ(2, cache.hits());
+  EXPECT_EQ(2, cache.misses());
+  EXPECT_EQ(2, cache.size());
+  MetricsSnapshot snapshot = Metrics::snapshot();
+  EXPECT_EQ(2, snapshot.inferenceCacheHits);
+  EXPECT_EQ(2, snapshot.inferenceCacheMisses);
+  EXPECT_NE(string::npos, snapshot.toJson().find(
+		"\"inference_cache_hits\":2"));
+
+  cache.clear();
+  EXPECT_EQ(0, cache.size());
+  EXPECT_FLOAT_EQ(5.0, cache.inference({1.0, 2.0}));
+  EXPECT_EQ(3, cache.misses());
+}
+
+TEST(InferenceCacheTest, QuantizedInputsShareEntries) {
+  ModelHandle handle(linearModel(1.0, 1.0));
+  InferenceCacheParams params;
+  params.quantum = 0.5;
+  InferenceCache cache(&handle, params);
+  // Both round to (1.0, 0.5), and get its outputs.
+  EXPECT_FLOAT_EQ(1.5, cache.inference({1.1, 0.4}));
+  EXPECT_FLOAT_EQ(1.5, cache.inference({0.9, 0.6}));
+  EXPECT_EQ(1, cache.hits());
+  // -0.1 and 0.1 both round to 0.
+  cache.inference({-0.1, 0.0});
+  cache.inference({0.1, 0.0});
+  EXPECT_EQ(2, cache.hits());
+}
+
+TEST(InferenceCacheTest, PublishingInvalidates) {
+  ModelHandle handle(linearModel(1.0, 1.0));
+  InferenceCache cache(&handle, InferenceCacheParams());
+  EXPECT_FLOAT_EQ(3.0, cache.inference({1.0, 2.0}));
+  handle.publish(linearModel(2.0, 2.0));
+  EXPECT_FLOAT_EQ(6.0, cache.inference({1.0, 2.0}));
+  EXPECT_EQ(0, cache.hits());
+
+  // Outputs computed for a model replaced before they're inserted
+  // would be stale, so they're dropped.
+  vector<float> outputs;
+  uint64_t version;
+  ASSERT_FALSE(cache.find({3.0, 3.0}, &outputs, &version));
+  handle.publish(linearModel(0.0, 0.0));
+  cache.insert({3.0, 3.0}, version, {12.0});
+  EXPECT_FALSE(cache.find({3.0, 3.0}, &outputs, &version));
+  EXPECT_FLOAT_EQ(0.0, cache.inference({3.0, 3.0}));
+}
+
+TEST(InferenceCacheTest, KeepsEntriesInUseWhenFull) {
+  ModelHandle handle(linearModel(1.0, 0.0));
+  InferenceCacheParams params;
+  params.capacity = 8;
+  params.numShards = 1;
+  InferenceCache cache(&handle, params);
+  for (int i = 0; i < 100; i++) {
+    cache.inference({0.0, 0.0});
+    EXPECT_FLOAT_EQ(i + 1, cache.inference({i + 1.0f, 0.0}));
+  }
+  EXPECT_EQ(8, cache.size());
+  // The hot input was never evicted.
+  EXPECT_EQ(99, cache.hits());
+  // The index survived all the evictions: what's left is found.
+  uint64_t hits = cache.hits();
+  for (int i = 93; i < 100; i++) {
+    EXPECT_FLOAT_EQ(i + 1, cache.inference({i + 1.0f, 0.0}));
+  }
+  EXPECT_EQ(hits + 7, cache.hits());
+}
+
+TEST(InferenceCacheTest, ConcurrentCallersGetTheModelsOutputs) {
+  ModelHandle handle(linearModel(1.0, 2.0));
+  InferenceCacheParams params;
+  params.capacity = 64;
+  params.numShards = 4;
+  InferenceCache cache(&handle, params);
+  vector<std::thread> threads;
+  std::atomic<int> wrong(0);
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+	for (int i = 0; i < 20000; i++) {
+	  float x = (i * 7 + t) % 200;
+	  if (cache.inference({x, 1.0}) != x + 2.0) {
+	    wrong++;
+	  }
+	}
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, wrong.load());
+  EXPECT_EQ(80000, cache.hits() + cache.misses());
+  EXPECT_LE(cache.size(), 64);
+}
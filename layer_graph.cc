@@ -0,0 +1,710 @@
+#include "layer_graph.h"
+
+#include "timing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const size_t kNone = static_cast<size_t>(-1);
+
+std::atomic<uint64_t> next_plan_id{1};
+
+}  // namespace
+
+LayerGraph::LayerGraph(const NNParams& nn_params) :
+  params(new NNParams(nn_params)) {
+  nodes_.push_back(Node{INPUT, {}, params->numInputs, nullptr, {}, {}});
+}
+
+LayerGraph::NodeId LayerGraph::addDense(NodeId input, LayerType type,
+					size_t num_units) {
+  assert(input < nodes_.size());
+  size_t num_inputs = nodes_[input].width;
+  Node node{DENSE, {input}, num_units, nullptr, {}, {}};
+  switch (type) {
+  case RELU:
+    node.layer.reset(new PReluNNLayer(num_inputs, num_units, 0.01));
+    break;
+  case SIGMOID:
+    node.layer.reset(new SigmoidNNLayer(num_inputs, num_units));
+    break;
+  }
+  nodes_.push_back(std::move(node));
+  return nodes_.size() - 1;
+}
+
+LayerGraph::NodeId LayerGraph::addConcat(const vector<NodeId>& inputs) {
+  size_t width = 0;
+  for (NodeId input : inputs) {
+    assert(input < nodes_.size());
+    width += nodes_[input].width;
+  }
+  nodes_.push_back(Node{CONCAT, inputs, width, nullptr, {}, {}});
+  return nodes_.size() - 1;
+}
+
+LayerGraph::NodeId LayerGraph::addSum(const vector<NodeId>& inputs) {
+  assert(!inputs.empty());
+  for (NodeId input : inputs) {
+    assert(input < nodes_.size());
+    assert(nodes_[input].width == nodes_[inputs[0]].width);
+  }
+  nodes_.push_back(Node{SUM, inputs, nodes_[inputs[0]].width, nullptr, {},
+			{}});
+  return nodes_.size() - 1;
+}
+
+bool LayerGraph::compile(NodeId output) {
+  if (output >= nodes_.size() || nodes_[output].kind != DENSE) {
+    return false;
+  }
+  output_ = output;
+  size_t n = nodes_.size();
+  // A node's inputs always have smaller ids, so ids are already a
+  // topological order; keep the nodes the output depends on.
+  vector<bool> needed(n, false);
+  needed[output] = true;
+  for (NodeId id = output; id < n; id--) {
+    if (needed[id]) {
+      for (NodeId input : nodes_[id].inputs) {
+	needed[input] = true;
+      }
+    }
+  }
+  order_.clear();
+  vector<size_t> num_consumers(n, 0);
+  for (NodeId id = 0; id <= output; id++) {
+    if (needed[id]) {
+      order_.push_back(id);
+      for (NodeId input : nodes_[id].inputs) {
+	num_consumers[input]++;
+      }
+    }
+  }
+
+  // Nodes whose activations live inside another node's: a
+  // concatenation's inputs in its columns, and a dense layer in the
+  // sum it's the last input of, which it computes.
+  vector<NodeId> alias(n, kNone);
+  vector<size_t> alias_column(n, 0);
+  vector<NodeId> fused_sum(n, kNone);
+  vector<bool> sum_is_fused(n, false);
+  for (NodeId id : order_) {
+    const Node& node = nodes_[id];
+    if (node.kind == CONCAT) {
+      size_t column = 0;
+      for (NodeId input : node.inputs) {
+	// A node repeated in the concatenation is copied the second time.
+	if (alias[input] == kNone) {
+	  alias[input] = id;
+	  alias_column[input] = column;
+	}
+	column += nodes_[input].width;
+      }
+    } else if (node.kind == SUM) {
+      // Every other input is ready before the last one is computed.
+      NodeId last = *std::max_element(node.inputs.begin(), node.inputs.end());
+      if (nodes_[last].kind == DENSE && num_consumers[last] == 1 &&
+	  alias[last] == kNone) {
+	alias[last] = id;
+	fused_sum[last] = id;
+	sum_is_fused[id] = true;
+      }
+    }
+  }
+
+  steps_.clear();
+  written_.assign(n, 0);
+  last_read_.assign(n, 0);
+  needs_gradient_.assign(n, false);
+  dense_index_.assign(n, kNone);
+  num_dense_steps_ = 0;
+  auto read = [this](NodeId id) { last_read_[id] = steps_.size(); };
+  for (NodeId id : order_) {
+    const Node& node = nodes_[id];
+    switch (node.kind) {
+    case INPUT:
+      steps_.push_back(Step{LOAD, id, {}, {}});
+      break;
+    case DENSE: {
+      Step step{DENSE_STEP, id, {}, {}};
+      read(node.inputs[0]);
+      if (fused_sum[id] != kNone) {
+	for (NodeId input : nodes_[fused_sum[id]].inputs) {
+	  if (input != id) {
+	    step.sources.push_back(input);
+	    read(input);
+	  }
+	}
+	written_[fused_sum[id]] = steps_.size();
+      }
+      dense_index_[id] = num_dense_steps_++;
+      needs_gradient_[id] = true;
+      steps_.push_back(step);
+      break;
+    }
+    case SUM:
+      for (NodeId input : node.inputs) {
+	needs_gradient_[id] = needs_gradient_[id] || needs_gradient_[input];
+      }
+      if (sum_is_fused[id]) {
+	// Computed by its last input's dense step.
+	continue;
+      }
+      for (NodeId input : node.inputs) {
+	read(input);
+      }
+      steps_.push_back(Step{SUM_STEP, id, node.inputs, {}});
+      break;
+    case CONCAT: {
+      Step step{COPY, id, {}, {}};
+      size_t column = 0;
+      written_[id] = 0;
+      for (NodeId input : node.inputs) {
+	needs_gradient_[id] = needs_gradient_[id] || needs_gradient_[input];
+	written_[id] = std::max(written_[id], written_[input]);
+	if (alias[input] != id || alias_column[input] != column) {
+	  step.sources.push_back(input);
+	  step.columns.push_back(column);
+	  read(input);
+	}
+	column += nodes_[input].width;
+      }
+      if (step.sources.empty()) {
+	continue;
+      }
+      steps_.push_back(step);
+      break;
+    }
+    }
+    written_[id] = steps_.size() - 1;
+  }
+  // The results are read after the last step.
+  last_read_[output] = steps_.size();
+  for (NodeId id : order_) {
+    last_read_[id] = std::max(last_read_[id], written_[id]);
+  }
+
+  // Give each node that isn't inside another one a buffer.
+  placements_.assign(n, Placement{kNone, 0});
+  buffer_widths_.clear();
+  buffer_needs_gradient_.clear();
+  for (NodeId id : order_) {
+    if (alias[id] == kNone) {
+      placements_[id].buffer = buffer_widths_.size();
+      buffer_widths_.push_back(nodes_[id].width);
+      buffer_needs_gradient_.push_back(false);
+    }
+  }
+  for (NodeId id : order_) {
+    size_t column = 0;
+    NodeId root = id;
+    while (alias[root] != kNone) {
+      column += alias_column[root];
+      root = alias[root];
+    }
+    placements_[id] = Placement{placements_[root].buffer, column};
+    // The output layer starts from the loss instead.
+    if (needs_gradient_[id] && id != output) {
+      buffer_needs_gradient_[placements_[root].buffer] = true;
+    }
+  }
+  for (NodeId id : order_) {
+    Node& node = nodes_[id];
+    if (node.kind == DENSE) {
+      node.weightGradients.assign(node.layer->inWeights.data.size(), 0.0);
+      node.biasGradients.assign(node.width, 0.0);
+    }
+  }
+  plan_id_ = next_plan_id++;
+  return true;
+}
+
+void LayerGraph::initializeWeights(float (*init)(size_t, size_t, size_t),
+				   float (*init_bias)(size_t, size_t)) {
+  size_t i = 0;
+  for (Node& node : nodes_) {
+    if (node.kind != DENSE) {
+      continue;
+    }
+    NNLayer* layer = node.layer.get();
+    for (size_t j = 0; j < layer->inWeights.row_size; j++) {
+      for (size_t k = 0; k < layer->inWeights.col_size; k++) {
+	layer->inWeights.at(j, k) = init(i, j, k);
+      }
+      layer->bias[j] = init_bias(i, j);
+    }
+    i++;
+  }
+}
+
+vector<BufferLifetime> LayerGraph::inferenceBuffers(size_t batch_size) const {
+  vector<size_t> first(buffer_widths_.size(), kNone);
+  vector<size_t> last(buffer_widths_.size(), 0);
+  for (NodeId id : order_) {
+    size_t b = placements_[id].buffer;
+    first[b] = std::min(first[b], written_[id]);
+    last[b] = std::max(last[b], last_read_[id]);
+  }
+  vector<BufferLifetime> buffers;
+  for (size_t b = 0; b < buffer_widths_.size(); b++) {
+    buffers.push_back({"activations " + std::to_string(b),
+		       batch_size * buffer_widths_[b], first[b], last[b]});
+  }
+  return buffers;
+}
+
+vector<BufferLifetime> LayerGraph::trainingBuffers(size_t batch_size) const {
+  // Forward steps are 0 to S - 1, the loss is step S, and step s is
+  // backpropagated at step 2S - s. Activations are needed until the
+  // steps reading them are backpropagated (which is before their own
+  // step is), pre-activations until their own step is.
+  size_t end = 2 * steps_.size();
+  vector<BufferLifetime> buffers = inferenceBuffers(batch_size);
+  for (BufferLifetime& buffer : buffers) {
+    buffer.lastStep = end - buffer.firstStep;
+  }
+  for (const Step& step : steps_) {
+    if (step.kind == DENSE_STEP) {
+      size_t s = written_[step.node];
+      buffers.push_back({"pre-activations " + std::to_string(step.node),
+			 batch_size * nodes_[step.node].width, s, end - s});
+    }
+  }
+  // A buffer's gradients are added to from when the last step reading
+  // it is backpropagated, until the first step writing it is.
+  vector<size_t> first_written(buffer_widths_.size(), kNone);
+  vector<size_t> last_read(buffer_widths_.size(), 0);
+  for (NodeId id : order_) {
+    size_t b = placements_[id].buffer;
+    first_written[b] = std::min(first_written[b], written_[id]);
+    last_read[b] = std::max(last_read[b], last_read_[id]);
+  }
+  for (size_t b = 0; b < buffer_widths_.size(); b++) {
+    if (buffer_needs_gradient_[b]) {
+      buffers.push_back({"gradients " + std::to_string(b),
+			 batch_size * buffer_widths_[b], end - last_read[b],
+			 end - first_written[b]});
+    } else {
+      buffers.push_back({"gradients " + std::to_string(b), 0, 0, 0});
+    }
+  }
+  return buffers;
+}
+
+MemoryPlan LayerGraph::planInference(size_t batch_size) const {
+  return planMemory(inferenceBuffers(batch_size));
+}
+
+MemoryPlan LayerGraph::planTraining(size_t batch_size) const {
+  return planMemory(trainingBuffers(batch_size));
+}
+
+LayerGraph::View LayerGraph::view(const PlannedArena& arena,
+				  NodeId node) const {
+  const Placement& placement = placements_[node];
+  return View{arena.buffer(placement.buffer) + placement.column,
+	      buffer_widths_[placement.buffer]};
+}
+
+LayerGraph::View LayerGraph::gradientView(const PlannedArena& arena,
+					  NodeId node) const {
+  const Placement& placement = placements_[node];
+  return View{arena.buffer(buffer_widths_.size() + num_dense_steps_ +
+			   placement.buffer) + placement.column,
+	      buffer_widths_[placement.buffer]};
+}
+
+void LayerGraph::forward(
+    const std::function<const vector<float>&(size_t)>& inputs,
+    size_t batch_size, bool training, const PlannedArena& arena) const {
+  static thread_local vector<View> sources;
+  for (const Step& step : steps_) {
+    const Node& node = nodes_[step.node];
+    View out = view(arena, step.node);
+    sources.clear();
+    for (NodeId source : step.sources) {
+      sources.push_back(view(arena, source));
+    }
+    switch (step.kind) {
+    case LOAD:
+      for (size_t e = 0; e < batch_size; e++) {
+	const vector<float>& x = inputs(e);
+	std::copy(x.begin(), x.begin() + node.width,
+		  out.data + e * out.stride);
+      }
+      break;
+    case DENSE_STEP: {
+      const NNLayer* layer = node.layer.get();
+      size_t num_inputs = layer->inWeights.col_size;
+      View in = view(arena, node.inputs[0]);
+      // The weighted sums go to the pre-activations when training, and
+      // otherwise straight to the activations, which replace them.
+      View z = (training ?
+		View{arena.buffer(buffer_widths_.size() +
+				  dense_index_[step.node]), node.width} :
+		out);
+      // A unit's weights stay in cache over the whole batch.
+      for (size_t u = 0; u < node.width; u++) {
+	const float* w = &layer->inWeights.data[u * num_inputs];
+	for (size_t e = 0; e < batch_size; e++) {
+	  const float* x = in.data + e * in.stride;
+	  float sum = 0.0;
+	  for (size_t k = 0; k < num_inputs; k++) {
+	    sum += w[k] * x[k];
+	  }
+	  z.data[e * z.stride + u] = sum + layer->bias[u];
+	}
+      }
+      for (size_t e = 0; e < batch_size; e++) {
+	const float* sums = z.data + e * z.stride;
+	float* f = out.data + e * out.stride;
+	for (size_t u = 0; u < node.width; u++) {
+	  f[u] = layer->activate(sums[u]);
+	}
+	for (const View& source : sources) {
+	  const float* x = source.data + e * source.stride;
+	  for (size_t u = 0; u < node.width; u++) {
+	    f[u] += x[u];
+	  }
+	}
+      }
+      break;
+    }
+    case SUM_STEP:
+      for (size_t e = 0; e < batch_size; e++) {
+	float* f = out.data + e * out.stride;
+	std::fill(f, f + node.width, 0.0f);
+	for (const View& source : sources) {
+	  const float* x = source.data + e * source.stride;
+	  for (size_t u = 0; u < node.width; u++) {
+	    f[u] += x[u];
+	  }
+	}
+      }
+      break;
+    case COPY:
+      for (size_t i = 0; i < sources.size(); i++) {
+	size_t width = nodes_[step.sources[i]].width;
+	for (size_t e = 0; e < batch_size; e++) {
+	  const float* x = sources[i].data + e * sources[i].stride;
+	  std::copy(x, x + width, out.data + e * out.stride + step.columns[i]);
+	}
+      }
+      break;
+    }
+  }
+}
+
+void LayerGraph::backward(const ExampleView& examples, size_t begin,
+			  size_t batch_size, const PlannedArena& arena,
+			  vector<float>* losses) {
+  static thread_local aResult res(0);
+  static const vector<float> no_inputs;
+  static thread_local vector<View> source_gradients;
+  size_t num_steps = steps_.size();
+  size_t gradients_start = buffer_widths_.size() + num_dense_steps_;
+  const MemoryPlan& plan = arena.plan();
+  for (size_t s = num_steps + 1; s-- > 0;) {
+    // Gradient buffers are summed into, so clear each as its lifetime
+    // starts.
+    for (size_t b = 0; b < buffer_widths_.size(); b++) {
+      const BufferLifetime& buffer = plan.buffers[gradients_start + b];
+      if (buffer.size > 0 && buffer.firstStep == 2 * num_steps - s) {
+	memset(arena.buffer(gradients_start + b), 0,
+	       buffer.size * sizeof(float));
+      }
+    }
+    if (s == num_steps) {
+      continue;
+    }
+    const Step& step = steps_[s];
+    Node& node = nodes_[step.node];
+    source_gradients.clear();
+    for (NodeId source : step.sources) {
+      source_gradients.push_back(needs_gradient_[source] ?
+				 gradientView(arena, source) :
+				 View{nullptr, 0});
+    }
+    View out_gradient = gradientView(arena, step.node);
+    switch (step.kind) {
+    case LOAD:
+      break;
+    case DENSE_STEP: {
+      const NNLayer* layer = node.layer.get();
+      size_t num_inputs = layer->inWeights.col_size;
+      NodeId input = node.inputs[0];
+      View in = view(arena, input);
+      View in_gradient = (needs_gradient_[input] ?
+			  gradientView(arena, input) : View{nullptr, 0});
+      const float* z = arena.buffer(buffer_widths_.size() +
+				    dense_index_[step.node]);
+      bool is_output = (step.node == output_);
+      for (size_t e = 0; e < batch_size; e++) {
+	const float* labels = (is_output ? examples.labels(begin + e) :
+			       nullptr);
+	const float* x = in.data + e * in.stride;
+	for (size_t u = 0; u < node.width; u++) {
+	  float zu = z[e * node.width + u];
+	  float f = layer->activate(zu);
+	  if (is_output) {
+	    layer->lossWithGradients(u, zu, f, no_inputs, nullptr, labels[u],
+				     &res);
+	    (*losses)[u] += res.loss;
+	  } else {
+	    float upstream = out_gradient.data[e * out_gradient.stride + u];
+	    layer->lossWithGradients(u, zu, f, no_inputs, &upstream, 0.0f,
+				     &res);
+	    // The sum this layer computed passes its gradient straight
+	    // to its other inputs.
+	    for (const View& source : source_gradients) {
+	      if (source.data != nullptr) {
+		source.data[e * source.stride + u] += upstream;
+	      }
+	    }
+	  }
+	  float dz = res.dloss_df;
+	  node.biasGradients[u] += dz;
+	  float* weight_gradients = &node.weightGradients[u * num_inputs];
+	  for (size_t k = 0; k < num_inputs; k++) {
+	    weight_gradients[k] += dz * x[k];
+	  }
+	  if (in_gradient.data != nullptr) {
+	    const float* w = &layer->inWeights.data[u * num_inputs];
+	    float* dx = in_gradient.data + e * in_gradient.stride;
+	    for (size_t k = 0; k < num_inputs; k++) {
+	      dx[k] += dz * w[k];
+	    }
+	  }
+	}
+      }
+      break;
+    }
+    case SUM_STEP:
+      for (const View& source : source_gradients) {
+	if (source.data == nullptr) {
+	  continue;
+	}
+	for (size_t e = 0; e < batch_size; e++) {
+	  const float* g = out_gradient.data + e * out_gradient.stride;
+	  float* dx = source.data + e * source.stride;
+	  for (size_t u = 0; u < node.width; u++) {
+	    dx[u] += g[u];
+	  }
+	}
+      }
+      break;
+    case COPY:
+      for (size_t i = 0; i < source_gradients.size(); i++) {
+	const View& source = source_gradients[i];
+	if (source.data == nullptr) {
+	  continue;
+	}
+	size_t width = nodes_[step.sources[i]].width;
+	for (size_t e = 0; e < batch_size; e++) {
+	  const float* g = out_gradient.data + e * out_gradient.stride +
+	    step.columns[i];
+	  float* dx = source.data + e * source.stride;
+	  for (size_t u = 0; u < width; u++) {
+	    dx[u] += g[u];
+	  }
+	}
+      }
+      break;
+    }
+  }
+}
+
+void LayerGraph::addLosses(const ExampleView& examples, size_t begin,
+			   size_t batch_size, const PlannedArena& arena,
+			   vector<float>* losses) const {
+  static thread_local aResult res(0);
+  static const vector<float> no_inputs;
+  const Node& node = nodes_[output_];
+  const float* z = arena.buffer(buffer_widths_.size() +
+				dense_index_[output_]);
+  View out = view(arena, output_);
+  for (size_t e = 0; e < batch_size; e++) {
+    const float* labels = examples.labels(begin + e);
+    for (size_t u = 0; u < node.width; u++) {
+      node.layer->lossWithGradients(u, z[e * node.width + u],
+				    out.data[e * out.stride + u], no_inputs,
+				    nullptr, labels[u], &res);
+      (*losses)[u] += res.loss;
+    }
+  }
+}
+
+void LayerGraph::inferenceBatch(const vector<vector<float>>& inputs,
+				vector<float>* results) const {
+  size_t batch_size = inputs.size();
+  static thread_local PlannedArena arena;
+  static thread_local vector<size_t> key;
+  key.assign({batch_size, plan_id_});
+  arena.prepare(key, [this, batch_size]() {
+      return inferenceBuffers(batch_size);
+    });
+  forward([&inputs](size_t e) -> const vector<float>& { return inputs[e]; },
+	  batch_size, false, arena);
+  size_t width = numOutputs();
+  View out = view(arena, output_);
+  results->resize(batch_size * width);
+  for (size_t e = 0; e < batch_size; e++) {
+    std::copy(out.data + e * out.stride, out.data + e * out.stride + width,
+	      results->begin() + e * width);
+  }
+}
+
+float LayerGraph::evaluate(const ExampleView& examples,
+			   vector<float>* target_losses) const {
+  size_t batch_size = std::max<size_t>(params->sgdBatchSize, 1);
+  static thread_local PlannedArena arena;
+  static thread_local vector<size_t> key;
+  key.assign({batch_size, plan_id_});
+  arena.prepare(key, [this, batch_size]() {
+      return trainingBuffers(batch_size);
+    });
+  vector<float> losses(numOutputs(), 0.0);
+  for (size_t begin = 0; begin < examples.size(); begin += batch_size) {
+    size_t count = std::min(batch_size, examples.size() - begin);
+    forward([&](size_t e) -> const vector<float>& {
+	return examples.inputs(begin + e);
+      }, count, true, arena);
+    addLosses(examples, begin, count, arena, &losses);
+  }
+  float total_loss = 0.0;
+  for (float& loss : losses) {
+    if (examples.size() > 0) {
+      loss /= examples.size();
+    }
+    total_loss += loss;
+  }
+  if (target_losses != nullptr) {
+    target_losses->swap(losses);
+  }
+  return total_loss;
+}
+
+bool LayerGraph::train(const ExampleView& examples, TrainingReport* report) {
+  report->losses.clear();
+  report->targetLosses.clear();
+  report->epochSeconds.clear();
+  report->phases = PhaseTimes();
+  size_t batch_size = std::max<size_t>(params->sgdBatchSize, 1);
+  static thread_local PlannedArena arena;
+  static thread_local vector<size_t> key;
+  key.assign({batch_size, plan_id_});
+  arena.prepare(key, [this, batch_size]() {
+      return trainingBuffers(batch_size);
+    });
+  double total_seconds = 0.0;
+  for (size_t num_iterations = 0; num_iterations < params->maxIterations &&
+	 !trainingShouldStop(*params, report); num_iterations++) {
+    vector<float> losses(numOutputs(), 0.0);
+    double epoch_seconds = 0.0;
+    {
+      ScopedTimer timer(&epoch_seconds);
+      PhaseClock clock(true);
+      for (size_t begin = 0; begin < examples.size(); begin += batch_size) {
+	size_t count = std::min(batch_size, examples.size() - begin);
+	for (NodeId id : order_) {
+	  Node& node = nodes_[id];
+	  if (node.kind == DENSE) {
+	    std::fill(node.weightGradients.begin(),
+		      node.weightGradients.end(), 0.0f);
+	    std::fill(node.biasGradients.begin(), node.biasGradients.end(),
+		      0.0f);
+	  }
+	}
+	clock.lap(&report->phases.data);
+	forward([&](size_t e) -> const vector<float>& {
+	    return examples.inputs(begin + e);
+	  }, count, true, arena);
+	clock.lap(&report->phases.forward);
+	backward(examples, begin, count, arena, &losses);
+	clock.lap(&report->phases.backward);
+	float step_size = params->learningRate / count;
+	for (NodeId id : order_) {
+	  Node& node = nodes_[id];
+	  if (node.kind != DENSE) {
+	    continue;
+	  }
+	  vector<float>& weights = node.layer->inWeights.data;
+	  for (size_t j = 0; j < weights.size(); j++) {
+	    weights[j] -= step_size * node.weightGradients[j];
+	  }
+	  vector<float>& bias = node.layer->bias;
+	  for (size_t j = 0; j < bias.size(); j++) {
+	    bias[j] -= step_size * node.biasGradients[j];
+	  }
+	}
+	clock.lap(&report->phases.update);
+      }
+    }
+    float loss = 0.0;
+    for (float& target_loss : losses) {
+      if (examples.size() > 0) {
+	target_loss /= examples.size();
+      }
+      loss += target_loss;
+    }
+    if (params->verbose) {
+      std::cout << " iteration: " << num_iterations << " loss: " << loss <<
+	std::endl;
+    }
+    report->losses.push_back(loss);
+    report->targetLosses.push_back(losses);
+    report->epochSeconds.push_back(epoch_seconds);
+    total_seconds += epoch_seconds;
+  }
+  report->timeElapsed = total_seconds;
+  report->examplesPerSecond =
+    (total_seconds > 0 ? report->losses.size() * examples.size() /
+     total_seconds : 0.0);
+  report->peakMemoryBytes = peakMemoryBytes();
+  return true;
+}
+
+string LayerGraph::toString() const {
+  std::ostringstream out;
+  for (size_t s = 0; s < steps_.size(); s++) {
+    const Step& step = steps_[s];
+    const Node& node = nodes_[step.node];
+    out << "step " << s << ": ";
+    switch (step.kind) {
+    case LOAD:
+      out << "load " << node.width << " inputs";
+      break;
+    case DENSE_STEP:
+      out << (node.layer->type() == RELU ? "relu" : "sigmoid") << " " <<
+	node.width << " units <- node " << node.inputs[0];
+      for (NodeId source : step.sources) {
+	out << " + node " << source;
+      }
+      break;
+    case SUM_STEP:
+      out << "sum";
+      for (NodeId source : step.sources) {
+	out << " node " << source;
+      }
+      break;
+    case COPY:
+      out << "copy";
+      for (size_t i = 0; i < step.sources.size(); i++) {
+	out << " node " << step.sources[i] << " to column " <<
+	  step.columns[i];
+      }
+      break;
+    }
+    const Placement& placement = placements_[step.node];
+    out << " -> node " << step.node << " in buffer " << placement.buffer <<
+      " column " << placement.column << "\n";
+  }
+  return out.str();
+}
@@ -0,0 +1,156 @@
+#ifndef __LAYER_GRAPH_H_
+#define __LAYER_GRAPH_H_
+
+#include "memory_plan.h"
+#include "nn.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// A network whose layers form a directed acyclic graph rather than a
+// stack. Besides dense layers (of the types NN uses), a node can
+// concatenate several nodes' activations, or sum nodes of equal width
+// (a skip connection). So, for instance, the raw features can reach
+// the output layer alongside a narrow hidden layer ("wide and deep").
+//
+// compile() turns the graph into an execution plan: the nodes the
+// output depends on, in topological order, with adjacent operations
+// fused so they cost no pass over memory of their own:
+//  - a concatenation's inputs are written straight into their columns
+//    of its buffer, so it copies nothing;
+//  - a sum is folded into the dense layer computing its last input,
+//    which adds the others in as it writes each activation;
+//  - activation functions are applied as each weighted sum finishes.
+// Buffers are then laid out by planMemory, separately for inference
+// and for training.
+//
+// Training is mini-batch SGD, params->sgdBatchSize examples per step,
+// with NN's loss for the output layer's type and NN's stopping rule.
+class LayerGraph {
+ public:
+  typedef size_t NodeId;
+
+  explicit LayerGraph(const NNParams& params);
+
+  LayerGraph(const LayerGraph&) = delete;
+  LayerGraph& operator=(const LayerGraph&) = delete;
+
+  std::unique_ptr<NNParams> params;
+
+  // The raw features, params->numInputs wide.
+  NodeId input() const { return 0; }
+  NodeId addDense(NodeId input, LayerType type, size_t num_units);
+  NodeId addConcat(const vector<NodeId>& inputs);
+  // The inputs must all be the same width.
+  NodeId addSum(const vector<NodeId>& inputs);
+  size_t width(NodeId node) const { return nodes_[node].width; }
+  // The dense layer at node, or nullptr if node isn't one.
+  NNLayer* layer(NodeId node) const { return nodes_[node].layer.get(); }
+
+  // Plans execution for output, which must be a dense layer: its
+  // units are the outputs, and its type picks the loss. Nodes output
+  // doesn't depend on are left out. False if output isn't dense.
+  bool compile(NodeId output);
+
+  // Sets every weight and bias, as NN::initializeWeights does; i
+  // counts the dense layers in the order they were added.
+  void initializeWeights(float (*init)(size_t, size_t, size_t),
+			 float (*init_bias)(size_t, size_t));
+
+  // The rest need a compiled graph.
+  size_t numOutputs() const { return nodes_[output_].width; }
+  // Results hold each input's outputs in turn, numOutputs() apiece.
+  void inferenceBatch(const vector<vector<float>>& inputs,
+		      vector<float>* results) const;
+  // Mean loss over examples, summed over the output units, as
+  // NN::evaluate computes it.
+  float evaluate(const ExampleView& examples,
+		 vector<float>* target_losses = nullptr) const;
+  bool train(const ExampleView& examples, TrainingReport* report);
+
+  // Scratch memory for a batch: activations only for inference; for
+  // training also every dense layer's pre-activations, and gradients.
+  MemoryPlan planInference(size_t batch_size) const;
+  MemoryPlan planTraining(size_t batch_size) const;
+  // The execution plan, one step per line.
+  string toString() const;
+
+ private:
+  enum NodeKind { INPUT, DENSE, CONCAT, SUM };
+  struct Node {
+    NodeKind kind;
+    vector<NodeId> inputs;
+    size_t width;
+    std::unique_ptr<NNLayer> layer;
+    // Sums of the gradients over a training batch.
+    vector<float> weightGradients, biasGradients;
+  };
+  enum StepKind { LOAD, DENSE_STEP, SUM_STEP, COPY };
+  struct Step {
+    StepKind kind;
+    NodeId node;
+    // DENSE_STEP: the nodes summed with its activations. SUM_STEP: the
+    // sum's inputs. COPY: the concatenation's inputs that couldn't be
+    // written in place, each copied to its column of columns.
+    vector<NodeId> sources;
+    vector<size_t> columns;
+  };
+  // Where a node's activations are: columns [column, column + width)
+  // of each row of an arena buffer, one row per example. Gradients
+  // are laid out the same way in the buffer's gradient twin.
+  struct Placement {
+    size_t buffer;
+    size_t column;
+  };
+  struct View {
+    float* data;
+    size_t stride;
+  };
+
+  vector<BufferLifetime> inferenceBuffers(size_t batch_size) const;
+  vector<BufferLifetime> trainingBuffers(size_t batch_size) const;
+  View view(const PlannedArena& arena, NodeId node) const;
+  View gradientView(const PlannedArena& arena, NodeId node) const;
+  // Runs the steps over batch_size examples whose inputs are given by
+  // inputs(e). If training, keeps the dense layers' pre-activations.
+  void forward(const std::function<const vector<float>&(size_t)>& inputs,
+	       size_t batch_size, bool training,
+	       const PlannedArena& arena) const;
+  // Backpropagates a forward pass over examples [begin, begin +
+  // batch_size), adding to every dense layer's gradient sums and to
+  // losses.
+  void backward(const ExampleView& examples, size_t begin,
+		size_t batch_size, const PlannedArena& arena,
+		vector<float>* losses);
+  // Adds the output layer's loss on each example to losses.
+  void addLosses(const ExampleView& examples, size_t begin,
+		 size_t batch_size, const PlannedArena& arena,
+		 vector<float>* losses) const;
+
+  vector<Node> nodes_;
+  NodeId output_ = 0;
+  // The compiled plan: the nodes output depends on, in topological
+  // order, and the steps computing them.
+  vector<NodeId> order_;
+  vector<Step> steps_;
+  vector<Placement> placements_;
+  vector<size_t> buffer_widths_;
+  vector<bool> buffer_needs_gradient_;
+  // Each node's first and last steps, and whether training needs its
+  // gradient (it has a dense layer upstream, or is one).
+  vector<size_t> written_, last_read_;
+  vector<bool> needs_gradient_;
+  // Index of each dense step's pre-activation buffer among them.
+  vector<size_t> dense_index_;
+  size_t num_dense_steps_ = 0;
+  // Distinguishes this compilation's plans from any other's.
+  uint64_t plan_id_ = 0;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include "layer_graph.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+float randomWeight(size_t i, size_t j, size_t k) {
+  return static_cast<float>((rand() % 1000) * 0.002 - 1.0);
+}
+
+float randomBias(size_t i, size_t j) {
+  return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+}
+
+class LayerGraphTest : public ::testing::Test {
+ public:
+  LayerGraphTest() : params_(4, 1, DEFAULT_MIN_DELTA, 3, 4, 0.05) {
+    params_.verbose = false;
+    for (int e = 0; e < 24; e++) {
+      vector<float> x = { 0.05f * e, 1.0f - 0.04f * e, (e % 3) * 0.3f,
+			  (e % 5) * 0.2f };
+      vector<float> y = { 0.4f * x[0] + 0.2f * x[3] + 0.1f,
+			  0.3f * x[1] * x[2] + 0.2f };
+      examples_.push_back(make_pair(x, y));
+      inputs_.push_back(x);
+    }
+  }
+
+  vector<float> dense(const NNLayer* layer, const vector<float>& x) {
+    vector<float> f(layer->inWeights.row_size);
+    for (size_t u = 0; u < f.size(); u++) {
+      float z = 0.0;
+      for (size_t k = 0; k < x.size(); k++) {
+	z += layer->inWeights.at(u, k) * x[k];
+      }
+      f[u] = layer->activate(z + layer->bias[u]);
+    }
+    return f;
+  }
+
+  NNParams params_;
+  vector<pair<vector<float>, vector<float>>> examples_;
+  vector<vector<float>> inputs_;
+};
+
+TEST_F(LayerGraphTest, ChainMatchesNN) {
+  NN nn(params_);
+  nn.addLayer(RELU, 6);
+  nn.addLayer(SIGMOID, 5);
+  nn.addOutputLayer(RELU, 2);
+  srand(3);
+  nn.initializeWeights(randomWeight, randomBias);
+  LayerGraph graph(params_);
+  LayerGraph::NodeId hidden = graph.addDense(graph.input(), RELU, 6);
+  hidden = graph.addDense(hidden, SIGMOID, 5);
+  LayerGraph::NodeId output = graph.addDense(hidden, RELU, 2);
+  ASSERT_TRUE(graph.compile(output));
+  srand(3);
+  graph.initializeWeights(randomWeight, randomBias);
+
+  vector<float> expected, results;
+  nn.inferenceBatch(inputs_, &expected);
+  graph.inferenceBatch(inputs_, &results);
+  ASSERT_EQ(expected.size(), results.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_NEAR(expected[i], results[i], 1e-5);
+  }
+  vector<float> expected_losses, losses;
+  EXPECT_NEAR(nn.evaluate(examples_, &expected_losses),
+	      graph.evaluate(examples_, &losses), 1e-5);
+  // Adjacent layers share nothing, but the input and the last layer's
+  // activations can. In training, the first layers' gradients can
+  // reuse the last layers' pre-activations.
+  MemoryPlan plan = graph.planInference(inputs_.size());
+  EXPECT_LT(plan.arenaBytes(), plan.unsharedBytes());
+  plan = graph.planTraining(inputs_.size());
+  EXPECT_LT(plan.arenaBytes(), plan.unsharedBytes()) << plan.toString();
+}
+
+TEST_F(LayerGraphTest, ConcatenationIsWrittenInPlace) {
+  // Wide and deep: the raw features join a hidden layer's activations
+  // at the output.
+  LayerGraph graph(params_);
+  LayerGraph::NodeId hidden = graph.addDense(graph.input(), RELU, 3);
+  LayerGraph::NodeId wide = graph.addConcat({ graph.input(), hidden });
+  LayerGraph::NodeId output = graph.addDense(wide, RELU, 2);
+  ASSERT_TRUE(graph.compile(output));
+  EXPECT_EQ(7, graph.width(wide));
+  srand(5);
+  graph.initializeWeights(randomWeight, randomBias);
+  // Load, hidden layer and output layer: no copies.
+  EXPECT_EQ(string::npos, graph.toString().find("copy")) << graph.toString();
+
+  vector<float> results;
+  graph.inferenceBatch(inputs_, &results);
+  for (size_t e = 0; e < inputs_.size(); e++) {
+    vector<float> x = inputs_[e];
+    vector<float> h = dense(graph.layer(hidden), x);
+    x.insert(x.end(), h.begin(), h.end());
+    vector<float> f = dense(graph.layer(output), x);
+    EXPECT_NEAR(f[0], results[2 * e], 1e-5);
+    EXPECT_NEAR(f[1], results[2 * e + 1], 1e-5);
+  }
+}
+
+TEST_F(LayerGraphTest, SkipConnectionIsFusedIntoDenseLayer) {
+  LayerGraph graph(params_);
+  LayerGraph::NodeId a = graph.addDense(graph.input(), RELU, 4);
+  LayerGraph::NodeId b = graph.addDense(a, SIGMOID, 4);
+  // A residual block, and a concatenation repeating a node, which has
+  // to copy it once.
+  LayerGraph::NodeId sum = graph.addSum({ a, b });
+  LayerGraph::NodeId both = graph.addConcat({ sum, sum });
+  LayerGraph::NodeId output = graph.addDense(both, RELU, 2);
+  // Unused by the output, so not compiled.
+  graph.addDense(graph.input(), RELU, 50);
+  ASSERT_TRUE(graph.compile(output));
+  string plan = graph.toString();
+  EXPECT_EQ(string::npos, plan.find("sum")) << plan;
+  EXPECT_NE(string::npos, plan.find("+ node 1")) << plan;
+  EXPECT_NE(string::npos, plan.find("copy node 3 to column 4")) << plan;
+  EXPECT_EQ(string::npos, plan.find("50 units")) << plan;
+  srand(7);
+  graph.initializeWeights(randomWeight, randomBias);
+
+  vector<float> results;
+  graph.inferenceBatch(inputs_, &results);
+  for (size_t e = 0; e < inputs_.size(); e++) {
+    vector<float> fa = dense(graph.layer(a), inputs_[e]);
+    vector<float> fb = dense(graph.layer(b), fa);
+    vector<float> x;
+    for (int copy = 0; copy < 2; copy++) {
+      for (size_t u = 0; u < 4; u++) {
+	x.push_back(fa[u] + fb[u]);
+      }
+    }
+    vector<float> f = dense(graph.layer(output), x);
+    EXPECT_NEAR(f[0], results[2 * e], 1e-5);
+    EXPECT_NEAR(f[1], results[2 * e + 1], 1e-5);
+  }
+}
+
+TEST_F(LayerGraphTest, GradientsMatchFiniteDifferences) {
+  // One step over a single batch of every example moves each weight
+  // by learningRate times its gradient.
+  params_.sgdBatchSize = examples_.size();
+  LayerGraph graph(params_);
+  LayerGraph::NodeId a = graph.addDense(graph.input(), SIGMOID, 4);
+  LayerGraph::NodeId b = graph.addDense(a, RELU, 4);
+  LayerGraph::NodeId sum = graph.addSum({ a, b });
+  LayerGraph::NodeId wide = graph.addConcat({ graph.input(), sum, a });
+  LayerGraph::NodeId output = graph.addDense(wide, RELU, 2);
+  ASSERT_TRUE(graph.compile(output));
+  srand(11);
+  graph.initializeWeights(randomWeight, randomBias);
+
+  vector<LayerGraph::NodeId> layers = { a, b, output };
+  vector<vector<float>> numerical;
+  const double epsilon = 1e-3;
+  for (LayerGraph::NodeId node : layers) {
+    vector<float>& weights = graph.layer(node)->inWeights.data;
+    numerical.emplace_back();
+    for (size_t j = 0; j < weights.size(); j++) {
+      float saved = weights[j];
+      weights[j] = saved + epsilon;
+      double plus = graph.evaluate(examples_);
+      weights[j] = saved - epsilon;
+      double minus = graph.evaluate(examples_);
+      weights[j] = saved;
+      numerical.back().push_back((plus - minus) / (2 * epsilon));
+    }
+  }
+  vector<vector<float>> before;
+  for (LayerGraph::NodeId node : layers) {
+    before.push_back(graph.layer(node)->inWeights.data);
+  }
+  TrainingReport report;
+  ASSERT_TRUE(graph.train(examples_, &report));
+  ASSERT_EQ(1, report.losses.size());
+  for (size_t i = 0; i < layers.size(); i++) {
+    const vector<float>& after = graph.layer(layers[i])->inWeights.data;
+    for (size_t j = 0; j < after.size(); j++) {
+      float gradient = (before[i][j] - after[j]) / params_.learningRate;
+      EXPECT_NEAR(numerical[i][j], gradient, 2e-3) << i << " " << j;
+    }
+  }
+}
+
+TEST_F(LayerGraphTest, WideAndDeepTrains) {
+  params_.maxIterations = 40;
+  LayerGraph graph(params_);
+  LayerGraph::NodeId hidden = graph.addDense(graph.input(), RELU, 8);
+  LayerGraph::NodeId wide = graph.addConcat({ graph.input(), hidden });
+  LayerGraph::NodeId output = graph.addDense(wide, RELU, 2);
+  ASSERT_TRUE(graph.compile(output));
+  srand(13);
+  graph.initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>((rand() % 100) * 0.002 - 0.1);
+    }, randomBias);
+  TrainingReport report;
+  ASSERT_TRUE(graph.train(examples_, &report));
+  EXPECT_LT(report.losses.back(), 0.2 * report.losses.front());
+  EXPECT_NEAR(report.losses.back(), graph.evaluate(examples_), 0.01);
+}
+
+TEST_F(LayerGraphTest, OutputMustBeDense) {
+  LayerGraph graph(params_);
+  LayerGraph::NodeId hidden = graph.addDense(graph.input(), RELU, 3);
+  EXPECT_FALSE(graph.compile(graph.addConcat({ graph.input(), hidden })));
+  EXPECT_FALSE(graph.compile(graph.input()));
+}
@@ -0,0 +1,190 @@
+#ifndef __LINE_SOCKET_H_
+#define __LINE_SOCKET_H_
+
+// Minimal helpers for newline-delimited request/response traffic (and
+// raw byte streams) over local Unix or TCP stream sockets. Addresses
+// are either a filesystem path (Unix socket) or "host:port" (TCP).
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace line_socket {
+
+inline bool isTcpAddress(const string& address) {
+  return address.find(':') != string::npos && address[0] != '/';
+}
+
+inline bool resolveTcp(const string& address, sockaddr_in* addr) {
+  size_t colon = address.rfind(':');
+  string host = address.substr(0, colon);
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(atoi(address.c_str() + colon + 1));
+  if (host.empty() || host == "localhost") {
+    host = "127.0.0.1";
+  }
+  return inet_pton(AF_INET, host.c_str(), &addr->sin_addr) == 1;
+}
+
+// Returns a listening socket, or -1 on error. An existing Unix socket
+// file at the path is replaced.
+inline int listenOn(const string& address, int backlog = 128) {
+  if (isTcpAddress(address)) {
+    sockaddr_in addr;
+    if (!resolveTcp(address, &addr)) {
+      return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+      return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+	listen(fd, backlog) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (address.size() >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(address.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr),
+		     sizeof(addr)) != 0 || listen(fd, backlog) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Returns a connected socket, or -1 on error.
+inline int connectTo(const string& address) {
+  if (isTcpAddress(address)) {
+    sockaddr_in addr;
+    if (!resolveTcp(address, &addr)) {
+      return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr),
+			  sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    // Requests are small and latency-sensitive.
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+  }
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr),
+			sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Writes every byte to a socket. False on error, including a peer that
+// has gone away: that fails with EPIPE rather than raising SIGPIPE.
+inline bool writeAll(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  size_t written = 0;
+  while (written < size) {
+    ssize_t n = send(fd, bytes + written, size - written, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+inline bool writeAll(int fd, const string& data) {
+  return writeAll(fd, data.data(), data.size());
+}
+
+// Reads exactly size bytes; false at end of stream or on error.
+inline bool readAll(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(fd, bytes + done, size - done);
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// Buffered reader of newline-terminated lines from a socket. Lines
+// longer than max_length bytes aren't buffered in full: the reader
+// stops at them, so a peer that never sends a newline can't use up
+// memory.
+class LineReader {
+ public:
+  explicit LineReader(int fd, size_t max_length = SIZE_MAX) :
+    fd_(fd), max_length_(max_length) {}
+
+  // Reads the next line, without its newline. False at end of stream,
+  // on error, or at a line longer than max_length (see tooLong()).
+  bool readLine(string* line) {
+    for (;;) {
+      size_t newline = buffer_.find('\n', start_);
+      size_t length = (newline != string::npos ? newline :
+		       buffer_.size()) - start_;
+      if (length > max_length_) {
+	too_long_ = true;
+	return false;
+      }
+      if (newline != string::npos) {
+	line->assign(buffer_, start_, length);
+	start_ = newline + 1;
+	return true;
+      }
+      buffer_.erase(0, start_);
+      start_ = 0;
+      char chunk[4096];
+      ssize_t n = read(fd_, chunk, sizeof(chunk));
+      if (n <= 0) {
+	return false;
+      }
+      buffer_.append(chunk, n);
+    }
+  }
+  // Whether readLine stopped at a line longer than max_length.
+  bool tooLong() const { return too_long_; }
+
+ private:
+  int fd_;
+  size_t max_length_;
+  string buffer_;
+  size_t start_ = 0;
+  bool too_long_ = false;
+};
+
+}  // namespace line_socket
+
+#endif
@@ -0,0 +1,68 @@
+#include "memory_plan.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+size_t MemoryPlan::unsharedBytes() const {
+  size_t total = 0;
+  for (const BufferLifetime& buffer : buffers) {
+    total += buffer.size;
+  }
+  return total * sizeof(float);
+}
+
+string MemoryPlan::toString() const {
+  std::ostringstream out;
+  out << "arena " << arenaBytes() << " bytes for " << buffers.size() <<
+    " buffers (" << unsharedBytes() << " unshared)\n";
+  for (size_t i = 0; i < buffers.size(); i++) {
+    out << " - " << buffers[i].name << ": " << buffers[i].size <<
+      " floats at " << offsets[i] << ", steps " << buffers[i].firstStep <<
+      "-" << buffers[i].lastStep << "\n";
+  }
+  return out.str();
+}
+
+MemoryPlan planMemory(const vector<BufferLifetime>& buffers,
+		      size_t alignment) {
+  MemoryPlan plan;
+  plan.buffers = buffers;
+  plan.offsets.assign(buffers.size(), 0);
+  vector<size_t> order(buffers.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return buffers[a].size > buffers[b].size;
+    });
+  // Placed buffers whose lifetimes intersect the one being placed, as
+  // (start, end) offsets.
+  vector<std::pair<size_t, size_t>> conflicts;
+  for (size_t n = 0; n < order.size(); n++) {
+    const BufferLifetime& buffer = buffers[order[n]];
+    conflicts.clear();
+    for (size_t m = 0; m < n; m++) {
+      const BufferLifetime& placed = buffers[order[m]];
+      if (placed.firstStep <= buffer.lastStep &&
+	  buffer.firstStep <= placed.lastStep) {
+	size_t start = plan.offsets[order[m]];
+	conflicts.push_back(std::make_pair(start, start + placed.size));
+      }
+    }
+    std::sort(conflicts.begin(), conflicts.end());
+    // The first aligned gap between conflicting buffers that's big
+    // enough, or else just past the last of them.
+    size_t offset = 0;
+    for (const auto& conflict : conflicts) {
+      if (offset + buffer.size <= conflict.first) {
+	break;
+      }
+      size_t end = (conflict.second + alignment - 1) / alignment * alignment;
+      offset = std::max(offset, end);
+    }
+    plan.offsets[order[n]] = offset;
+    plan.arenaSize = std::max(plan.arenaSize, offset + buffer.size);
+  }
+  return plan;
+}
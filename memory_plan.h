@@ -0,0 +1,83 @@
+#ifndef __MEMORY_PLAN_H_
+#define __MEMORY_PLAN_H_
+
+// Static memory planning for the scratch buffers of a computation made
+// of numbered steps: given each buffer's size and the steps it's live
+// through, assigns it an offset in one arena such that buffers live at
+// the same time never overlap, so buffers that are never live together
+// share memory.
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+struct BufferLifetime {
+  string name;
+  size_t size;       // in floats
+  size_t firstStep;  // first and last steps that use it, inclusive
+  size_t lastStep;
+};
+
+struct MemoryPlan {
+  vector<BufferLifetime> buffers;
+  vector<size_t> offsets;  // of each buffer in the arena, in floats
+  size_t arenaSize = 0;    // in floats
+
+  size_t arenaBytes() const { return arenaSize * sizeof(float); }
+  // Bytes the buffers would take if each had memory of its own.
+  size_t unsharedBytes() const;
+  string toString() const;
+};
+
+// Places the largest buffers first, each at the lowest offset that
+// doesn't overlap a buffer already placed whose lifetime intersects
+// its own. Offsets are multiples of alignment floats (16 floats is a
+// 64-byte cache line).
+MemoryPlan planMemory(const vector<BufferLifetime>& buffers,
+		      size_t alignment = 16);
+
+// Memory laid out by a MemoryPlan. The plan is only redone when the
+// shape it's for changes, so passes over an unchanging network and
+// batch size allocate nothing. The arena grows to fit a new plan, and
+// is given back once a plan needs less than half of it, so one large
+// batch doesn't hold its memory for the rest of the thread's life.
+class PlannedArena {
+ public:
+  // key describes the shape the plan is for. If it differs from the
+  // last call's, calls plan_buffers to list the buffers again.
+  template <typename Lister>
+  void prepare(const vector<size_t>& key, Lister plan_buffers) {
+    if (key == key_ && !plan_.offsets.empty()) {
+      return;
+    }
+    key_ = key;
+    plan_ = planMemory(plan_buffers());
+    if (plan_.arenaSize > capacity_ || plan_.arenaSize < capacity_ / 2) {
+      memory_.reset(static_cast<float*>(
+	  aligned_alloc(64, ((plan_.arenaBytes() + 63) / 64) * 64)));
+      capacity_ = plan_.arenaSize;
+    }
+  }
+
+  float* buffer(size_t i) const { return memory_.get() + plan_.offsets[i]; }
+  const MemoryPlan& plan() const { return plan_; }
+  // Floats allocated, at least plan().arenaSize.
+  size_t capacity() const { return capacity_; }
+
+ private:
+  struct Free {
+    void operator()(float* p) const { free(p); }
+  };
+
+  vector<size_t> key_;
+  MemoryPlan plan_;
+  std::unique_ptr<float[], Free> memory_;
+  size_t capacity_ = 0;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "memory_plan.h"
+#include "nn.h"
+
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+// Checks that no two buffers live at the same step share memory, and
+// that every buffer fits in the arena.
+void expectValid(const MemoryPlan& plan) {
+  ASSERT_EQ(plan.buffers.size(), plan.offsets.size());
+  for (size_t a = 0; a < plan.buffers.size(); a++) {
+    const BufferLifetime& x = plan.buffers[a];
+    EXPECT_LE(plan.offsets[a] + x.size, plan.arenaSize) << x.name;
+    for (size_t b = a + 1; b < plan.buffers.size(); b++) {
+      const BufferLifetime& y = plan.buffers[b];
+      if (x.size == 0 || y.size == 0 || x.lastStep < y.firstStep ||
+	  y.lastStep < x.firstStep) {
+	continue;
+      }
+      EXPECT_TRUE(plan.offsets[a] + x.size <= plan.offsets[b] ||
+		  plan.offsets[b] + y.size <= plan.offsets[a])
+	<< x.name << " overlaps " << y.name << "\n" << plan.toString();
+    }
+  }
+}
+
+TEST(MemoryPlanTest, DisjointLifetimesShareMemory) {
+  MemoryPlan plan = planMemory({ { "a", 100, 0, 1 },
+				 { "b", 50, 2, 3 },
+				 { "c", 80, 4, 4 } });
+  expectValid(plan);
+  EXPECT_EQ(100, plan.arenaSize);
+  EXPECT_EQ(230 * sizeof(float), plan.unsharedBytes());
+}
+
+TEST(MemoryPlanTest, OverlappingLifetimesDont) {
+  MemoryPlan plan = planMemory({ { "a", 100, 0, 2 },
+				 { "b", 50, 1, 3 },
+				 { "c", 30, 3, 4 } }, 16);
+  expectValid(plan);
+  // c fits below b once a is dead.
+  EXPECT_EQ(0, plan.offsets[0]);
+  EXPECT_EQ(112, plan.offsets[1]);
+  EXPECT_EQ(0, plan.offsets[2]);
+  EXPECT_EQ(162, plan.arenaSize);
+}
+
+TEST(MemoryPlanTest, FillsGapsBetweenLiveBuffers) {
+  // d is live alongside a and c but not b, so it goes in b's place.
+  MemoryPlan plan = planMemory({ { "a", 64, 0, 3 },
+				 { "b", 32, 0, 0 },
+				 { "c", 64, 0, 3 },
+				 { "d", 32, 1, 2 } });
+  expectValid(plan);
+  EXPECT_EQ(160, plan.arenaSize);
+  EXPECT_EQ(plan.offsets[1], plan.offsets[3]);
+}
+
+TEST(MemoryPlanTest, ArenaGivesBackMemoryItNoLongerNeeds) {
+  PlannedArena arena;
+  auto buffers = [](size_t size) {
+    return [size]() {
+      return vector<BufferLifetime>({ { "a", size, 0, 0 } });
+    };
+  };
+  arena.prepare({ 1000 }, buffers(1000));
+  EXPECT_EQ(1000, arena.capacity());
+  // A somewhat smaller plan reuses the memory...
+  arena.prepare({ 600 }, buffers(600));
+  EXPECT_EQ(1000, arena.capacity());
+  // ...but one needing less than half of it gets an arena its size.
+  arena.prepare({ 10 }, buffers(10));
+  EXPECT_EQ(10, arena.capacity());
+  arena.buffer(0)[9] = 1.0;
+  arena.prepare({ 50 }, buffers(50));
+  EXPECT_EQ(50, arena.capacity());
+}
+
+class NNMemoryPlanTest : public ::testing::Test {
+ public:
+  std::unique_ptr<NN> makeModel() {
+    NNParams params(12, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+    std::unique_ptr<NN> nn(new NN(params));
+    nn->addLayer(RELU, 40);
+    nn->addLayer(SIGMOID, 8);
+    nn->addLayer(RELU, 30);
+    nn->addOutputLayer(RELU, 2);
+    return nn;
+  }
+};
+
+TEST_F(NNMemoryPlanTest, InferenceKeepsTwoLayersLive) {
+  std::unique_ptr<NN> nn = makeModel();
+  MemoryPlan plan = nn->planInference(16);
+  expectValid(plan);
+  ASSERT_EQ(5, plan.buffers.size());
+  // Only adjacent layers' activations are live together, so at most
+  // the two widest share the arena.
+  EXPECT_LE(plan.arenaSize, 16 * (40 + 30) + 16);
+  EXPECT_LT(plan.arenaBytes(), plan.unsharedBytes());
+}
+
+TEST_F(NNMemoryPlanTest, GradientAndBackpropagationPlansAreValid) {
+  std::unique_ptr<NN> nn = makeModel();
+  MemoryPlan gradients = nn->planGradients(25);
+  expectValid(gradients);
+  EXPECT_LT(gradients.arenaBytes(), gradients.unsharedBytes());
+  MemoryPlan backpropagation = nn->planBackpropagation();
+  expectValid(backpropagation);
+  EXPECT_LE(backpropagation.arenaSize, 2 * 40 + 16);
+}
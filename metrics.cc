@@ -0,0 +1,270 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::ostringstream;
+
+namespace {
+
+// The counters of every live thread that has recorded anything, and
+// the sums of those of threads that have exited, so their counts stay
+// in the totals without keeping an entry per thread ever started.
+// Neither is ever freed, so threads exiting during shutdown can still
+// use them.
+std::mutex registry_mutex;
+vector<Metrics::Counters*>* registry = new vector<Metrics::Counters*>;
+Metrics::Counters* retired = new Metrics::Counters;
+
+uint64_t load(const std::atomic<uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+void zero(std::atomic<uint64_t>* counter) {
+  counter->store(0, std::memory_order_relaxed);
+}
+
+// Only called with registry_mutex held, the only lock retired's
+// writers take.
+void addTo(const std::atomic<uint64_t>& from, std::atomic<uint64_t>* to) {
+  to->store(load(*to) + load(from), std::memory_order_relaxed);
+}
+
+void addCounters(const Metrics::Counters& from, Metrics::Counters* to) {
+  addTo(from.examplesProcessed, &to->examplesProcessed);
+  addTo(from.inferenceCalls, &to->inferenceCalls);
+  addTo(from.lookupCalls, &to->lookupCalls);
+  addTo(from.datasetRowsParsed, &to->datasetRowsParsed);
+  addTo(from.inferenceCacheHits, &to->inferenceCacheHits);
+  addTo(from.inferenceCacheMisses, &to->inferenceCacheMisses);
+  for (size_t i = 0; i < METRICS_MAX_LAYERS; i++) {
+    addTo(from.layerFlops[i], &to->layerFlops[i]);
+  }
+  for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+    addTo(from.inferenceLatency[i], &to->inferenceLatency[i]);
+    addTo(from.lookupLatency[i], &to->lookupLatency[i]);
+  }
+  addTo(from.inferenceLatencyNanos, &to->inferenceLatencyNanos);
+  addTo(from.lookupLatencyNanos, &to->lookupLatencyNanos);
+}
+
+void zeroCounters(Metrics::Counters* c) {
+  zero(&c->examplesProcessed);
+  zero(&c->inferenceCalls);
+  zero(&c->lookupCalls);
+  zero(&c->datasetRowsParsed);
+  zero(&c->inferenceCacheHits);
+  zero(&c->inferenceCacheMisses);
+  for (size_t i = 0; i < METRICS_MAX_LAYERS; i++) {
+    zero(&c->layerFlops[i]);
+  }
+  for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+    zero(&c->inferenceLatency[i]);
+    zero(&c->lookupLatency[i]);
+  }
+  zero(&c->inferenceLatencyNanos);
+  zero(&c->lookupLatencyNanos);
+}
+
+// A thread's counters, registered while the thread lives; when it
+// exits they're added to retired and unregistered.
+struct ThreadCounters {
+  Metrics::Counters counters;
+
+  ThreadCounters() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry->push_back(&counters);
+  }
+  ~ThreadCounters() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    addCounters(counters, retired);
+    auto entry = std::find(registry->begin(), registry->end(), &counters);
+    *entry = registry->back();
+    registry->pop_back();
+  }
+};
+
+void addHistogram(const std::atomic<uint64_t>* buckets,
+		  const std::atomic<uint64_t>& nanos,
+		  LatencyHistogram* histogram) {
+  for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+    histogram->counts[i] += load(buckets[i]);
+  }
+  histogram->sumSeconds += load(nanos) * 1e-9;
+}
+
+void jsonHistogram(const LatencyHistogram& histogram,
+		   ostringstream* out) {
+  *out << "{\"buckets\":[";
+  for (size_t i = 0; i < histogram.counts.size(); i++) {
+    *out << (i > 0 ? "," : "") << "{\"le\":";
+    if (i == histogram.counts.size() - 1) {
+      *out << "\"+Inf\"";
+    } else {
+      *out << LatencyHistogram::bucketBound(i);
+    }
+    *out << ",\"count\":" << histogram.counts[i] << "}";
+  }
+  *out << "],\"sum_seconds\":" << histogram.sumSeconds <<
+    ",\"count\":" << histogram.count() << "}";
+}
+
+void prometheusHistogram(const string& name, const string& help,
+			 const LatencyHistogram& histogram,
+			 ostringstream* out) {
+  *out << "# HELP " << name << " " << help << "\n";
+  *out << "# TYPE " << name << " histogram\n";
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < histogram.counts.size(); i++) {
+    cumulative += histogram.counts[i];
+    *out << name << "_bucket{le=\"";
+    if (i == histogram.counts.size() - 1) {
+      *out << "+Inf";
+    } else {
+      *out << LatencyHistogram::bucketBound(i);
+    }
+    *out << "\"} " << cumulative << "\n";
+  }
+  *out << name << "_sum " << histogram.sumSeconds << "\n";
+  *out << name << "_count " << histogram.count() << "\n";
+}
+
+void prometheusCounter(const string& name, const string& help,
+		       uint64_t value, ostringstream* out) {
+  *out << "# HELP " << name << " " << help << "\n";
+  *out << "# TYPE " << name << " counter\n";
+  *out << name << " " << value << "\n";
+}
+
+}  // namespace
+
+uint64_t LatencyHistogram::count() const {
+  uint64_t total = 0;
+  for (uint64_t c : counts) {
+    total += c;
+  }
+  return total;
+}
+
+double LatencyHistogram::bucketBound(size_t i) {
+  if (i >= METRICS_LATENCY_BUCKETS - 1) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return std::ldexp(1e-6, i);
+}
+
+size_t Metrics::bucketFor(double seconds) {
+  double micros = seconds * 1e6;
+  size_t bucket = 0;
+  for (double bound = 1.0; bucket < METRICS_LATENCY_BUCKETS - 1 &&
+	 micros > bound; bound *= 2) {
+    bucket++;
+  }
+  return bucket;
+}
+
+Metrics::Counters& Metrics::local() {
+  thread_local ThreadCounters counters;
+  return counters.counters;
+}
+
+size_t Metrics::numThreads() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  return registry->size();
+}
+
+MetricsSnapshot Metrics::snapshot() {
+  MetricsSnapshot snapshot;
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  vector<const Counters*> all(registry->begin(), registry->end());
+  all.push_back(retired);
+  size_t num_layers = 0;
+  for (const Counters* c : all) {
+    for (size_t i = 0; i < METRICS_MAX_LAYERS; i++) {
+      if (load(c->layerFlops[i]) > 0 && i + 1 > num_layers) {
+	num_layers = i + 1;
+      }
+    }
+  }
+  snapshot.layerFlops.resize(num_layers, 0);
+  for (const Counters* c : all) {
+    snapshot.examplesProcessed += load(c->examplesProcessed);
+    snapshot.inferenceCalls += load(c->inferenceCalls);
+    snapshot.lookupCalls += load(c->lookupCalls);
+    snapshot.datasetRowsParsed += load(c->datasetRowsParsed);
+    snapshot.inferenceCacheHits += load(c->inferenceCacheHits);
+    snapshot.inferenceCacheMisses += load(c->inferenceCacheMisses);
+    for (size_t i = 0; i < num_layers; i++) {
+      snapshot.layerFlops[i] += load(c->layerFlops[i]);
+    }
+    addHistogram(c->inferenceLatency, c->inferenceLatencyNanos,
+		 &snapshot.inferenceLatency);
+    addHistogram(c->lookupLatency, c->lookupLatencyNanos,
+		 &snapshot.lookupLatency);
+  }
+  return snapshot;
+}
+
+void Metrics::reset() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  for (Counters* c : *registry) {
+    zeroCounters(c);
+  }
+  zeroCounters(retired);
+}
+
+string MetricsSnapshot::toJson() const {
+  ostringstream out;
+  out << "{\"examples_processed\":" << examplesProcessed <<
+    ",\"inference_calls\":" << inferenceCalls <<
+    ",\"lookup_calls\":" << lookupCalls <<
+    ",\"dataset_rows_parsed\":" << datasetRowsParsed <<
+    ",\"inference_cache_hits\":" << inferenceCacheHits <<
+    ",\"inference_cache_misses\":" << inferenceCacheMisses <<
+    ",\"layer_flops\":[";
+  for (size_t i = 0; i < layerFlops.size(); i++) {
+    out << (i > 0 ? "," : "") << layerFlops[i];
+  }
+  out << "],\"inference_latency\":";
+  jsonHistogram(inferenceLatency, &out);
+  out << ",\"lookup_latency\":";
+  jsonHistogram(lookupLatency, &out);
+  out << "}";
+  return out.str();
+}
+
+string MetricsSnapshot::toPrometheus() const {
+  ostringstream out;
+  prometheusCounter("nn_examples_processed_total",
+		    "Training examples run through backpropagation.",
+		    examplesProcessed, &out);
+  prometheusCounter("nn_inference_calls_total",
+		    "Calls to NN::inference, including those from lookup.",
+		    inferenceCalls, &out);
+  prometheusCounter("nn_lookup_calls_total", "Calls to NN::lookup.",
+		    lookupCalls, &out);
+  prometheusCounter("nn_dataset_rows_parsed_total",
+		    "Rows added to a Dataset.", datasetRowsParsed, &out);
+  prometheusCounter("nn_inference_cache_hits_total",
+		    "Inputs whose outputs an InferenceCache had.",
+		    inferenceCacheHits, &out);
+  prometheusCounter("nn_inference_cache_misses_total",
+		    "Inputs an InferenceCache had to run the model for.",
+		    inferenceCacheMisses, &out);
+  out << "# HELP nn_layer_flops_total Floating point operations by layer.\n";
+  out << "# TYPE nn_layer_flops_total counter\n";
+  for (size_t i = 0; i < layerFlops.size(); i++) {
+    out << "nn_layer_flops_total{layer=\"" << i << "\"} " <<
+      layerFlops[i] << "\n";
+  }
+  prometheusHistogram("nn_inference_latency_seconds",
+		      "Latency of NN::inference.", inferenceLatency, &out);
+  prometheusHistogram("nn_lookup_latency_seconds",
+		      "Latency of NN::lookup.", lookupLatency, &out);
+  return out.str();
+}
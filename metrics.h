@@ -0,0 +1,135 @@
+#ifndef __METRICS_H_
+#define __METRICS_H_
+
+// Lightweight counters for the hot paths of the nn library. Each
+// thread updates its own set of counters without synchronization; a
+// snapshot sums them on demand and can be rendered as JSON or in the
+// Prometheus text format. Building with -DNN_NO_METRICS turns the
+// recording calls into no-ops.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Latency histogram buckets: the upper bound of bucket i is
+// 2^i microseconds, and the last bucket is unbounded.
+#define METRICS_LATENCY_BUCKETS 20
+// Layers beyond this many are counted in the last layer's bucket.
+#define METRICS_MAX_LAYERS 16
+
+struct LatencyHistogram {
+  vector<uint64_t> counts;  // per bucket, not cumulative
+  double sumSeconds = 0.0;
+
+  LatencyHistogram() : counts(METRICS_LATENCY_BUCKETS, 0) {}
+  uint64_t count() const;
+  // Upper bound of bucket i, in seconds (infinity for the last one).
+  static double bucketBound(size_t i);
+};
+
+struct MetricsSnapshot {
+  uint64_t examplesProcessed = 0;
+  uint64_t inferenceCalls = 0;
+  uint64_t lookupCalls = 0;
+  uint64_t datasetRowsParsed = 0;
+  uint64_t inferenceCacheHits = 0;
+  uint64_t inferenceCacheMisses = 0;
+  vector<uint64_t> layerFlops;  // indexed by layer
+  LatencyHistogram inferenceLatency;
+  LatencyHistogram lookupLatency;
+
+  string toJson() const;
+  string toPrometheus() const;
+};
+
+class Metrics {
+ public:
+#ifdef NN_NO_METRICS
+  static void addExamplesProcessed(uint64_t n) {}
+  static void addLayerFlops(size_t layer, uint64_t flops) {}
+  static void recordInference(double seconds) {}
+  static void recordLookup(double seconds) {}
+  static void addDatasetRowsParsed(uint64_t n) {}
+  static void addInferenceCacheHits(uint64_t n) {}
+  static void addInferenceCacheMisses(uint64_t n) {}
+  static bool enabled() { return false; }
+#else
+  static void addExamplesProcessed(uint64_t n) {
+    add(&local().examplesProcessed, n);
+  }
+  static void addLayerFlops(size_t layer, uint64_t flops) {
+    if (layer >= METRICS_MAX_LAYERS) {
+      layer = METRICS_MAX_LAYERS - 1;
+    }
+    add(&local().layerFlops[layer], flops);
+  }
+  static void recordInference(double seconds) {
+    Counters& c = local();
+    add(&c.inferenceCalls, 1);
+    record(c.inferenceLatency, &c.inferenceLatencyNanos, seconds);
+  }
+  static void recordLookup(double seconds) {
+    Counters& c = local();
+    add(&c.lookupCalls, 1);
+    record(c.lookupLatency, &c.lookupLatencyNanos, seconds);
+  }
+  static void addDatasetRowsParsed(uint64_t n) {
+    add(&local().datasetRowsParsed, n);
+  }
+  static void addInferenceCacheHits(uint64_t n) {
+    add(&local().inferenceCacheHits, n);
+  }
+  static void addInferenceCacheMisses(uint64_t n) {
+    add(&local().inferenceCacheMisses, n);
+  }
+  static bool enabled() { return true; }
+#endif
+
+  // Sums the counters of every thread that has recorded anything,
+  // including threads that have since exited.
+  static MetricsSnapshot snapshot();
+  // Zeroes all counters. Updates racing with a reset may be lost.
+  static void reset();
+  // Threads with counters of their own: those that have recorded
+  // anything and haven't exited. An exiting thread's counts are kept
+  // in a shared total instead.
+  static size_t numThreads();
+
+  // One thread's counters. Only the owning thread writes them, so
+  // plain relaxed loads and stores suffice; atomics just make the
+  // concurrent reads from snapshot() well-defined.
+  struct Counters {
+    std::atomic<uint64_t> examplesProcessed{0};
+    std::atomic<uint64_t> inferenceCalls{0};
+    std::atomic<uint64_t> lookupCalls{0};
+    std::atomic<uint64_t> datasetRowsParsed{0};
+    std::atomic<uint64_t> inferenceCacheHits{0};
+    std::atomic<uint64_t> inferenceCacheMisses{0};
+    std::atomic<uint64_t> layerFlops[METRICS_MAX_LAYERS] = {};
+    std::atomic<uint64_t> inferenceLatency[METRICS_LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> inferenceLatencyNanos{0};
+    std::atomic<uint64_t> lookupLatency[METRICS_LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> lookupLatencyNanos{0};
+  };
+
+ private:
+  static Counters& local();
+  static size_t bucketFor(double seconds);
+
+  static void add(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n,
+		   std::memory_order_relaxed);
+  }
+  static void record(std::atomic<uint64_t>* buckets,
+		     std::atomic<uint64_t>* nanos, double seconds) {
+    add(&buckets[bucketFor(seconds)], 1);
+    add(nanos, static_cast<uint64_t>(seconds * 1e9));
+  }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "metrics.h"
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+class MetricsTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    Metrics::reset();
+  }
+};
+
+TEST_F(MetricsTest, SumsCountersAcrossThreads) {
+  Metrics::addExamplesProcessed(5);
+  Metrics::addDatasetRowsParsed(2);
+  Metrics::addLayerFlops(0, 100);
+  std::thread other([]() {
+      Metrics::addExamplesProcessed(7);
+      Metrics::addLayerFlops(1, 40);
+      Metrics::recordInference(3e-6);
+    });
+  other.join();
+  MetricsSnapshot snapshot = Metrics::snapshot();
+  EXPECT_EQ(12, snapshot.examplesProcessed);
+  EXPECT_EQ(2, snapshot.datasetRowsParsed);
+  ASSERT_EQ(2, snapshot.layerFlops.size());
+  EXPECT_EQ(100, snapshot.layerFlops[0]);
+  EXPECT_EQ(40, snapshot.layerFlops[1]);
+  EXPECT_EQ(1, snapshot.inferenceCalls);
+  EXPECT_EQ(1, snapshot.inferenceLatency.count());
+}
+
+TEST_F(MetricsTest, ExitedThreadsKeepTheirCountsButNotTheirCounters) {
+  Metrics::addExamplesProcessed(1);
+  size_t threads = Metrics::numThreads();
+  for (int i = 0; i < 100; i++) {
+    std::thread other([]() {
+	Metrics::addExamplesProcessed(2);
+	Metrics::recordLookup(3e-6);
+      });
+    other.join();
+  }
+  EXPECT_EQ(threads, Metrics::numThreads());
+  MetricsSnapshot snapshot = Metrics::snapshot();
+  EXPECT_EQ(201, snapshot.examplesProcessed);
+  EXPECT_EQ(100, snapshot.lookupLatency.counts[2]);
+  Metrics::reset();
+  EXPECT_EQ(0, Metrics::snapshot().lookupCalls);
+}
+
+TEST_F(MetricsTest, BucketsLatencies) {
+  Metrics::recordLookup(0.5e-6);
+  Metrics::recordLookup(3e-6);
+  Metrics::recordLookup(1000.0);
+  MetricsSnapshot snapshot = Metrics::snapshot();
+  EXPECT_EQ(3, snapshot.lookupCalls);
+  EXPECT_EQ(1, snapshot.lookupLatency.counts[0]);  // <= 1us
+  EXPECT_EQ(1, snapshot.lookupLatency.counts[2]);  // <= 4us
+  EXPECT_EQ(1, snapshot.lookupLatency.counts.back());
+  EXPECT_NEAR(1000.0000035, snapshot.lookupLatency.sumSeconds, 1e-6);
+}
+
+TEST_F(MetricsTest, ResetClearsCounters) {
+  Metrics::addExamplesProcessed(5);
+  Metrics::reset();
+  EXPECT_EQ(0, Metrics::snapshot().examplesProcessed);
+}
+
+TEST_F(MetricsTest, FormatsJsonAndPrometheus) {
+  Metrics::addExamplesProcessed(3);
+  Metrics::addLayerFlops(0, 10);
+  Metrics::recordInference(2e-6);
+  MetricsSnapshot snapshot = Metrics::snapshot();
+
+  string json = snapshot.toJson();
+  EXPECT_NE(string::npos, json.find("\"examples_processed\":3"));
+  EXPECT_NE(string::npos, json.find("\"layer_flops\":[10]"));
+  EXPECT_NE(string::npos, json.find("\"le\":\"+Inf\""));
+
+  string text = snapshot.toPrometheus();
+  EXPECT_NE(string::npos, text.find("nn_examples_processed_total 3\n"));
+  EXPECT_NE(string::npos,
+	    text.find("nn_layer_flops_total{layer=\"0\"} 10\n"));
+  EXPECT_NE(string::npos,
+	    text.find("nn_inference_latency_seconds_bucket{le=\"+Inf\"} 1\n"));
+  EXPECT_NE(string::npos, text.find("nn_inference_latency_seconds_count 1\n"));
+}
@@ -0,0 +1,78 @@
+#include "model_handle.h"
+
+#include <thread>
+#include <vector>
+
+ModelHandle::ModelHandle(std::unique_ptr<const NN> initial,
+			 size_t max_readers) :
+  current_(initial.release()), slots_(max_readers > 0 ? max_readers : 1) {}
+
+ModelHandle::~ModelHandle() {
+  for (auto& retired : retired_) {
+    delete retired.first;
+  }
+  delete current_.load();
+}
+
+ModelHandle::ReadGuard ModelHandle::read() const {
+  // Start where this thread found a free slot last time, so threads
+  // mostly keep to their own slots.
+  static thread_local size_t hint = 0;
+  for (;;) {
+    for (size_t n = 0; n < slots_.size(); n++) {
+      size_t i = (hint + n) % slots_.size();
+      uint64_t idle = 0;
+      // The announcement must be globally visible before the model
+      // pointer is loaded, hence sequentially consistent operations
+      // here and in publish().
+      if (slots_[i].epoch.load(std::memory_order_relaxed) == 0 &&
+	  slots_[i].epoch.compare_exchange_strong(idle, epoch_.load())) {
+	hint = i;
+	return ReadGuard(&slots_[i].epoch, current_.load());
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+
+void ModelHandle::publish(std::unique_ptr<const NN> model) {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  const NN* old = current_.exchange(model.release());
+  // Readers announcing this epoch or an earlier one may hold old;
+  // readers arriving after the increment will load the new model.
+  uint64_t last_epoch = epoch_.fetch_add(1);
+  if (old != nullptr) {
+    retired_.push_back(std::make_pair(old, last_epoch));
+  }
+  version_.fetch_add(1, std::memory_order_release);
+  reclaimLocked();
+}
+
+size_t ModelHandle::reclaim() {
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  return reclaimLocked();
+}
+
+size_t ModelHandle::reclaimLocked() {
+  if (retired_.empty()) {
+    return 0;
+  }
+  // Oldest epoch any active reader may be in.
+  uint64_t oldest_active = UINT64_MAX;
+  for (const ReaderSlot& slot : slots_) {
+    uint64_t epoch = slot.epoch.load();
+    if (epoch != 0 && epoch < oldest_active) {
+      oldest_active = epoch;
+    }
+  }
+  size_t kept = 0;
+  for (auto& retired : retired_) {
+    if (retired.second < oldest_active) {
+      delete retired.first;
+    } else {
+      retired_[kept++] = retired;
+    }
+  }
+  retired_.resize(kept);
+  return kept;
+}
@@ -0,0 +1,95 @@
+#ifndef __MODEL_HANDLE_H_
+#define __MODEL_HANDLE_H_
+
+#include "nn.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Holds the current model for concurrent scoring, so it can be
+// replaced while other threads are running inference on it.
+//
+// Readers pin the current model with read(), which never blocks and
+// never takes a lock: it announces the current epoch in a reader slot
+// and loads the model pointer. Writers publish a new, immutable model
+// atomically; the model it replaces is retired and deleted only once
+// no reader slot still announces an epoch in which it was current
+// (epoch-based reclamation).
+class ModelHandle {
+ public:
+  // max_readers bounds the number of simultaneously pinned models; a
+  // reader that finds every slot taken spins until one frees up.
+  explicit ModelHandle(std::unique_ptr<const NN> initial = nullptr,
+		       size_t max_readers = 128);
+  // There must be no outstanding ReadGuards.
+  ~ModelHandle();
+
+  ModelHandle(const ModelHandle&) = delete;
+  ModelHandle& operator=(const ModelHandle&) = delete;
+
+  // Keeps the model that was current when it was created alive until
+  // it is destroyed. Don't hold one across a blocking wait: it delays
+  // reclamation of every model retired meanwhile.
+  class ReadGuard {
+   public:
+    ReadGuard(ReadGuard&& other) : slot_(other.slot_), model_(other.model_) {
+      other.slot_ = nullptr;
+    }
+    ~ReadGuard() {
+      if (slot_ != nullptr) {
+	slot_->store(0, std::memory_order_release);
+      }
+    }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    const NN* get() const { return model_; }
+    const NN* operator->() const { return model_; }
+    const NN& operator*() const { return *model_; }
+
+   private:
+    friend class ModelHandle;
+    ReadGuard(std::atomic<uint64_t>* slot, const NN* model) :
+      slot_(slot), model_(model) {}
+
+    std::atomic<uint64_t>* slot_;
+    const NN* model_;
+  };
+
+  ReadGuard read() const;
+
+  // Makes model current. Writers are serialized among themselves, but
+  // never wait for readers.
+  void publish(std::unique_ptr<const NN> model);
+
+  // Incremented by every publish.
+  uint64_t version() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  // Deletes retired models that no reader can still be using, and
+  // returns how many retired models remain. publish() calls this.
+  size_t reclaim();
+
+ private:
+  struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> epoch{0};  // 0 when idle
+  };
+
+  size_t reclaimLocked();
+
+  std::atomic<const NN*> current_;
+  std::atomic<uint64_t> epoch_{1};
+  std::atomic<uint64_t> version_{0};
+  mutable std::vector<ReaderSlot> slots_;
+
+  std::mutex writer_mutex_;
+  // Replaced models, with the last epoch in which they were current.
+  std::vector<std::pair<const NN*, uint64_t>> retired_;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "model_handle.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// A one-layer network whose output is always value.
+std::unique_ptr<const NN> constantModel(float value) {
+  NNParams params(2, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  std::unique_ptr<NN> nn(new NN(params));
+  nn->addLayer(LayerType::RELU, 1);
+  nn->layers[0]->inWeights.data = { 0.0, 0.0 };
+  nn->layers[0]->bias[0] = value;
+  return std::unique_ptr<const NN>(nn.release());
+}
+
+}  // namespace
+
+TEST(ModelHandleTest, ReadsCurrentModel) {
+  ModelHandle handle(constantModel(1.0));
+  EXPECT_EQ(0, handle.version());
+  EXPECT_FLOAT_EQ(1.0, handle.read()->inference({0.5, 0.5}));
+  handle.publish(constantModel(2.0));
+  EXPECT_EQ(1, handle.version());
+  EXPECT_FLOAT_EQ(2.0, handle.read()->inference({0.5, 0.5}));
+}
+
+TEST(ModelHandleTest, GuardPinsReplacedModel) {
+  ModelHandle handle(constantModel(1.0));
+  {
+    ModelHandle::ReadGuard guard = handle.read();
+    handle.publish(constantModel(2.0));
+    // The old model is retired but not deleted while it's pinned.
+    EXPECT_EQ(1, handle.reclaim());
+    EXPECT_FLOAT_EQ(1.0, guard->inference({0.5, 0.5}));
+    // New readers see the new model.
+    EXPECT_FLOAT_EQ(2.0, handle.read()->inference({0.5, 0.5}));
+  }
+  EXPECT_EQ(0, handle.reclaim());
+}
+
+TEST(ModelHandleTest, ConcurrentReadersAndWriter) {
+  ModelHandle handle(constantModel(0.0), 8);
+  std::atomic<bool> done(false);
+  std::atomic<int> bad_reads(0);
+  vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&]() {
+	float last = 0.0;
+	while (!done.load()) {
+	  ModelHandle::ReadGuard guard = handle.read();
+	  float value = guard->inference({0.1, 0.2});
+	  // Models are published in increasing order.
+	  if (value < last) {
+	    bad_reads++;
+	  }
+	  last = value;
+	}
+      });
+  }
+  for (int i = 1; i <= 500; i++) {
+    handle.publish(constantModel(i));
+  }
+  done = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(0, bad_reads.load());
+  EXPECT_EQ(500, handle.version());
+  EXPECT_EQ(0, handle.reclaim());
+  EXPECT_FLOAT_EQ(500.0, handle.read()->inference({0.1, 0.2}));
+}
@@ -0,0 +1,100 @@
+#include "multi_trainer.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+
+std::unique_ptr<NN> buildModel(const ModelSpec& spec) {
+  std::unique_ptr<NN> nn(new NN(spec.params));
+  for (const LayerSpec& layer : spec.hiddenLayers) {
+    nn->addLayer(layer.type, layer.numUnits);
+  }
+  nn->addOutputLayer(spec.outputType, spec.numOutputs);
+  std::mt19937 rng(spec.seed);
+  std::uniform_real_distribution<float> dist(-0.5, 0.5);
+  for (auto& layer : nn->layers) {
+    for (float& w : layer->inWeights.data) {
+      w = dist(rng);
+    }
+    for (float& b : layer->bias) {
+      b = dist(rng);
+    }
+  }
+  return nn;
+}
+
+namespace {
+
+typedef vector<pair<vector<float>, float>> Examples;
+typedef vector<pair<vector<float>, vector<float>>> MultiTargetExamples;
+
+// Rough cost of training a model: weights touched per example, times
+// the most iterations it may run for.
+double trainingCost(const ModelSpec& spec) {
+  double weights = 0.0;
+  size_t inputs = spec.params.numInputs;
+  for (const LayerSpec& layer : spec.hiddenLayers) {
+    weights += inputs * layer.numUnits;
+    inputs = layer.numUnits;
+  }
+  weights += inputs * spec.numOutputs;
+  return weights * spec.params.maxIterations;
+}
+
+}  // namespace
+
+vector<TrainedModel> MultiModelTrainer::trainAll() {
+  vector<TrainedModel> results(specs_.size());
+  ExampleView examples = (examples_ != nullptr ? ExampleView(*examples_) :
+			  ExampleView(*multi_target_examples_));
+  vector<size_t> order(specs_.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return trainingCost(specs_[a]) > trainingCost(specs_[b]);
+    });
+  // Per-node copies of the examples, when there's more than one node.
+  std::unique_ptr<NodeLocal<Examples>> local_examples;
+  std::unique_ptr<NodeLocal<MultiTargetExamples>> local_multi_target_examples;
+  if (numa_ != nullptr && numa_->numNodes() > 1) {
+    if (examples_ != nullptr) {
+      local_examples.reset(new NodeLocal<Examples>(*numa_, [this](size_t) {
+	    return std::unique_ptr<Examples>(new Examples(*examples_));
+	  }));
+    } else {
+      local_multi_target_examples.reset(new NodeLocal<MultiTargetExamples>(
+	  *numa_, [this](size_t) {
+	    return std::unique_ptr<MultiTargetExamples>(
+		new MultiTargetExamples(*multi_target_examples_));
+	  }));
+    }
+  }
+  {
+    ThreadPool pool(std::min(num_threads_ == 0 ?
+			     std::thread::hardware_concurrency() :
+			     num_threads_, std::max<size_t>(specs_.size(), 1)),
+		    (numa_ != nullptr ? numa_->pinWorkers() : nullptr));
+    for (size_t i : order) {
+      pool.schedule([this, i, &examples, &results, &local_examples,
+		     &local_multi_target_examples]() {
+	  ExampleView view = examples;
+	  if (local_examples != nullptr) {
+	    view = ExampleView(local_examples->local());
+	  } else if (local_multi_target_examples != nullptr) {
+	    view = ExampleView(local_multi_target_examples->local());
+	  }
+	  TrainedModel& result = results[i];
+	  result.name = specs_[i].name;
+	  result.nn = buildModel(specs_[i]);
+	  result.nn->train(view, &result.report);
+	});
+    }
+    pool.wait();
+  }
+  return results;
+}
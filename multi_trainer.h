@@ -0,0 +1,87 @@
+#ifndef __MULTI_TRAINER_H_
+#define __MULTI_TRAINER_H_
+
+#include "nn.h"
+#include "numa.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Processed examples shared, read-only, by every model trained on
+// them.
+typedef std::shared_ptr<const vector<pair<vector<float>, float>>>
+  ExampleStore;
+// The same for examples with one label per output unit.
+typedef std::shared_ptr<const vector<pair<vector<float>, vector<float>>>>
+  MultiTargetExampleStore;
+
+struct LayerSpec {
+  LayerType type;
+  size_t numUnits;
+};
+
+// Describes one model variant: its parameters, hidden layers, output
+// layer type and the seed its initial weights are drawn with.
+struct ModelSpec {
+  string name;
+  NNParams params;
+  vector<LayerSpec> hiddenLayers;
+  LayerType outputType;
+  unsigned int seed;
+  size_t numOutputs = 1;  // units in the output layer, one per target
+
+  ModelSpec(const string& n, const NNParams& p,
+	    const vector<LayerSpec>& hidden,
+	    LayerType output = RELU, unsigned int s = 42) :
+    name(n), params(p), hiddenLayers(hidden), outputType(output),
+    seed(s) {}
+};
+
+struct TrainedModel {
+  string name;
+  std::unique_ptr<NN> nn;
+  TrainingReport report;
+};
+
+// Builds the network described by spec, with weights and biases drawn
+// uniformly from [-0.5, 0.5) using the spec's seed.
+std::unique_ptr<NN> buildModel(const ModelSpec& spec);
+
+// Trains many models concurrently over one shared example store, so
+// the data is loaded and featurized once no matter how many variants
+// are trained.
+class MultiModelTrainer {
+ public:
+  // num_threads == 0 uses one thread per hardware thread.
+  MultiModelTrainer(ExampleStore examples, size_t num_threads = 0) :
+    examples_(examples), num_threads_(num_threads) {}
+  // Every model added must have as many outputs as the examples have
+  // labels.
+  MultiModelTrainer(MultiTargetExampleStore examples,
+		    size_t num_threads = 0) :
+    multi_target_examples_(examples), num_threads_(num_threads) {}
+
+  void addModel(const ModelSpec& spec) { specs_.push_back(spec); }
+  // Pins the training threads across the topology's nodes and, if it
+  // has several, gives each node its own copy of the examples, so
+  // training reads node-local memory.
+  void useNuma(const NumaTopology& topology) {
+    numa_.reset(new NumaTopology(topology));
+  }
+
+  // Trains every model added so far and returns them in the order they
+  // were added. The most expensive models are started first, so a long
+  // one doesn't end up running alone at the end.
+  vector<TrainedModel> trainAll();
+
+ private:
+  ExampleStore examples_;
+  MultiTargetExampleStore multi_target_examples_;
+  size_t num_threads_;
+  vector<ModelSpec> specs_;
+  std::unique_ptr<NumaTopology> numa_;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "multi_trainer.h"
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+class MultiModelTrainerTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    auto examples = std::make_shared<vector<pair<vector<float>, float>>>();
+    for (int i = 0; i < 50; i++) {
+      vector<float> inputs { 0.02f * i, 1.0f - 0.02f * i, (i % 3) * 0.5f };
+      examples->push_back(make_pair(inputs, 0.5f * inputs[0] + 0.1f));
+    }
+    examples_ = examples;
+  }
+
+  ModelSpec spec(const string& name, size_t width, float learning_rate,
+		 unsigned int seed) {
+    NNParams params(3, 20, DEFAULT_MIN_DELTA, 2, 10, learning_rate);
+    params.verbose = false;
+    return ModelSpec(name, params, {{RELU, width}}, RELU, seed);
+  }
+
+  ExampleStore examples_;
+};
+
+TEST_F(MultiModelTrainerTest, BuildModelIsDeterministic) {
+  std::unique_ptr<NN> a = buildModel(spec("a", 4, 0.01, 7));
+  std::unique_ptr<NN> b = buildModel(spec("b", 4, 0.01, 7));
+  std::unique_ptr<NN> c = buildModel(spec("c", 4, 0.01, 8));
+  ASSERT_EQ(2, a->layers.size());
+  EXPECT_EQ(4, a->layers[0]->inWeights.row_size);
+  EXPECT_EQ(a->layers[0]->inWeights.data, b->layers[0]->inWeights.data);
+  EXPECT_NE(a->layers[0]->inWeights.data, c->layers[0]->inWeights.data);
+}
+
+TEST_F(MultiModelTrainerTest, MatchesSequentialTraining) {
+  vector<ModelSpec> specs = {
+    spec("narrow", 2, 0.01, 1),
+    spec("wide", 16, 0.005, 2),
+    spec("medium", 8, 0.02, 3),
+  };
+  MultiModelTrainer trainer(examples_, 3);
+  for (const ModelSpec& s : specs) {
+    trainer.addModel(s);
+  }
+  vector<TrainedModel> models = trainer.trainAll();
+  ASSERT_EQ(specs.size(), models.size());
+  for (size_t i = 0; i < specs.size(); i++) {
+    EXPECT_EQ(specs[i].name, models[i].name);
+    std::unique_ptr<NN> expected = buildModel(specs[i]);
+    TrainingReport report;
+    expected->train(*examples_, &report);
+    EXPECT_EQ(report.losses, models[i].report.losses) << specs[i].name;
+    EXPECT_EQ(expected->layers[0]->inWeights.data,
+	      models[i].nn->layers[0]->inWeights.data) << specs[i].name;
+  }
+}
+
+TEST_F(MultiModelTrainerTest, TrainsMultiTargetModels) {
+  auto examples =
+    std::make_shared<vector<pair<vector<float>, vector<float>>>>();
+  for (const auto& example : *examples_) {
+    examples->push_back(make_pair(example.first,
+				  vector<float>{ example.second,
+				      1.0f - example.second }));
+  }
+  ModelSpec two_targets = spec("two", 4, 0.01, 5);
+  two_targets.numOutputs = 2;
+  MultiModelTrainer trainer(MultiTargetExampleStore(examples), 2);
+  trainer.addModel(two_targets);
+  vector<TrainedModel> models = trainer.trainAll();
+  ASSERT_EQ(1, models.size());
+  EXPECT_EQ(2, models[0].nn->numOutputs());
+  ASSERT_FALSE(models[0].report.targetLosses.empty());
+  EXPECT_EQ(2, models[0].report.targetLosses.back().size());
+}
+
+TEST_F(MultiModelTrainerTest, NumaTrainingMatchesSequentialTraining) {
+  // Two nodes sharing this process's first CPU, so the examples are
+  // replicated on any host.
+  string root = "/tmp/multi_trainer_test_numa_" + std::to_string(getpid());
+  int cpu = allowedCpus()[0];
+  mkdir(root.c_str(), 0755);
+  for (const char* node : {"node0", "node1"}) {
+    mkdir((root + "/" + node).c_str(), 0755);
+    std::ofstream(root + "/" + node + "/cpulist") << cpu << "\n";
+  }
+  NumaTopology topology = NumaTopology::fromSysfs(root, {cpu});
+  ASSERT_EQ(2, topology.numNodes());
+  ModelSpec model = spec("numa", 6, 0.01, 9);
+  MultiModelTrainer trainer(examples_, 2);
+  trainer.useNuma(topology);
+  trainer.addModel(model);
+  vector<TrainedModel> models = trainer.trainAll();
+  std::unique_ptr<NN> expected = buildModel(model);
+  TrainingReport report;
+  expected->train(*examples_, &report);
+  EXPECT_EQ(report.losses, models[0].report.losses);
+  EXPECT_EQ(expected->layers[0]->inWeights.data,
+	    models[0].nn->layers[0]->inWeights.data);
+  for (const char* node : {"node0", "node1"}) {
+    remove((root + "/" + node + "/cpulist").c_str());
+    rmdir((root + "/" + node).c_str());
+  }
+  rmdir(root.c_str());
+}
@@ -1,9 +1,15 @@
 #include "nn.h"
 
+#include "metrics.h"
+#include "timing.h"
+
 #include <math.h>
 #include <assert.h>
+#include <iomanip>
+#include <limits>
 #include <memory>
 #include <iostream>
+#include <string>
 #include <vector>
 
 using std::pair;
@@ -11,6 +17,7 @@ using std::vector;
 
 void NNLayer::updateWeights(const vector<aResult>& lossesAndGrads,
 			    const GDOptimizerParams& opt_params) {
+  sparseWeights.clear();
   float grad;
   for (size_t i = 0; i < inWeights.row_size; i++) {
     for (size_t j = 0; j < inWeights.col_size; j++) {
@@ -23,18 +30,111 @@ void NNLayer::updateWeights(const vector<aResult>& lossesAndGrads,
     bias[i] = lossesAndGrads[i].dloss_df *
       opt_params.learning_rate;
   }
+  if (!pruneMask.empty()) {
+    for (size_t i = 0; i < inWeights.data.size(); i++) {
+      if (!pruneMask[i]) {
+	inWeights.data[i] = 0.0;
+      }
+    }
+  }
 }
 
+void NNLayer::forwardBatch(const float* inputs, size_t batch_size,
+			   float* outputs,
+			   const KernelBlocking& blocking) const {
+  size_t num_units = inWeights.row_size, width = inWeights.col_size;
+  size_t unit_block = (blocking.units > 0 ? blocking.units : num_units);
+  size_t example_block = (blocking.examples > 0 ? blocking.examples :
+			  batch_size);
+  bool sparse = !sparseWeights.empty();
+  for (size_t jb = 0; jb < num_units; jb += unit_block) {
+    size_t je = std::min(jb + unit_block, num_units);
+    for (size_t eb = 0; eb < batch_size; eb += example_block) {
+      size_t ee = std::min(eb + example_block, batch_size);
+      for (size_t j = jb; j < je; j++) {
+	const float* w = &inWeights.data[j * width];
+	for (size_t e = eb; e < ee; e++) {
+	  const float* x = &inputs[e * width];
+	  float z = 0.0;
+	  if (sparse) {
+	    z = sparseWeights.rowDot(j, x);
+	  } else {
+	    for (size_t k = 0; k < width; k++) {
+	      z += w[k] * x[k];
+	    }
+	  }
+	  z += bias[j];
+	  outputs[e * num_units + j] = activate(z);
+	}
+      }
+    }
+  }
+}
 
-float SigmoidNNLayer::activation(size_t unit,
-				  const vector<float>& inputs)
-  const {
+float NNLayer::density() const {
+  if (inWeights.data.empty()) {
+    return 0.0;
+  }
+  size_t non_zero = 0;
+  for (float w : inWeights.data) {
+    non_zero += (w != 0);
+  }
+  return static_cast<float>(non_zero) / inWeights.data.size();
+}
+
+
+// Turns per-target loss sums over num_examples into means, returning
+// their total and handing them to target_losses if it's non-null.
+static float meanLoss(vector<float>* losses, size_t num_examples,
+		      vector<float>* target_losses) {
+  float total_loss = 0.0;
+  for (float& loss : *losses) {
+    if (num_examples > 0) {
+      loss /= num_examples;
+    }
+    total_loss += loss;
+  }
+  if (target_losses != nullptr) {
+    target_losses->swap(*losses);
+  }
+  return total_loss;
+}
+
+// Derivative of the loss w.r.t. the activation of unit, summed over
+// the units of the next layer.
+static float upstreamGradient(size_t unit,
+			      const vector<aResult>& next_layer_loss,
+			      const vector2d<float>& next_layer_weights) {
+  float upstream = 0.0;
+  for (size_t i = 0; i < next_layer_weights.row_size; i++) {
+    upstream += next_layer_loss[i].dloss_df *
+      next_layer_weights.at(i, unit);
+  }
+  return upstream;
+}
+
+float NNLayer::preActivation(size_t unit,
+			     const vector<float>& inputs) const {
   float f = 0.0;
-  for (size_t i = 0; i < inputs.size(); i++) {
-    f += inWeights.at(unit, i) * inputs[i];
+  if (!sparseWeights.empty()) {
+    f = sparseWeights.rowDot(unit, inputs.data());
+  } else {
+    for (size_t i = 0; i < inputs.size(); i++) {
+      f += inWeights.at(unit, i) * inputs[i];
+    }
   }
   f += bias[unit];
-  return 1.0 / (1 + exp(-f));
+  return f;
+}
+
+float SigmoidNNLayer::activate(float z) const {
+  return 1.0 / (1 + exp(-z));
+}
+
+float SigmoidNNLayer::activation(size_t unit,
+				  const vector<float>& inputs)
+  const {
+  return activate(preActivation(unit, inputs));
 }
 
 void SigmoidNNLayer::lossWithGradients(size_t unit,
@@ -43,18 +143,29 @@ void SigmoidNNLayer::lossWithGradients(size_t unit,
 				       const vector2d<float>* next_layer_weights,
 				       float y,
 				       aResult* res) const {
-  res->f = activation(unit, inputs);
+  float z = preActivation(unit, inputs);
+  float upstream = 0.0;
+  if (next_layer_loss != nullptr) {
+    upstream = upstreamGradient(unit, *next_layer_loss,
+				*next_layer_weights);
+  }
+  lossWithGradients(unit, z, activate(z), inputs,
+		    (next_layer_loss != nullptr ? &upstream : nullptr),
+		    y, res);
+}
+
+void SigmoidNNLayer::lossWithGradients(size_t unit, float z, float f,
+				       const vector<float>& inputs,
+				       const float* upstream,
+				       float y,
+				       aResult* res) const {
+  res->f = f;
   double activ_deriv = (res->f)*(1-res->f);
-  if (next_layer_loss == nullptr) {
+  if (upstream == nullptr) {
     res->loss = -(y * log(res->f) + (1-y) * log(1 - res->f));
     res->dloss_df = (res->f - y) * activ_deriv;
    } else {
-    res->dloss_df = 0.0;
-    for (size_t i = 0; i < next_layer_weights->row_size; i++) {
-      res->dloss_df += (*next_layer_loss)[i].dloss_df *
-	next_layer_weights->at(i, unit);
-    }
-    res->dloss_df *= activ_deriv;
+    res->dloss_df = *upstream * activ_deriv;
   }
   for (size_t i = 0; i < inputs.size(); i++) {
     res->dloss_dx[i] = inputs[i];
@@ -65,18 +176,16 @@ int SigmoidNNLayer::interpretOutput(float output) const {
   return (output >= threshold ? 1 : 0);
 }
 
+float PReluNNLayer::activate(float z) const {
+  return (z >= 0 ? z : slope * z);
+}
+
 float PReluNNLayer::activation(size_t unit,
 			       const vector<float>& inputs,
 			       bool* nonneg) const {
-  float f = 0.0;
-  //std::cout << " unit: " << unit << std::endl;
-  for (size_t i = 0; i < inputs.size(); i++) {
-    //std::cout << " - weights: " << inWeights.at(unit, i) << " input: " << inputs[i] << std::endl;
-    f += inWeights.at(unit, i) * inputs[i];
-  }
-  f += bias[unit];
+  float f = preActivation(unit, inputs);
   *nonneg = f >= 0;
-  return (f >= 0 ? f : slope * f);
+  return activate(f);
 }
 
 float PReluNNLayer::activation(size_t unit,
@@ -90,20 +199,29 @@ void PReluNNLayer::lossWithGradients(size_t unit,
 				     const vector<aResult>* next_layer_loss,
 				     const vector2d<float>* next_layer_weights,
 				     float y, aResult* res) const {
-  bool nonneg;
-  res->f = activation(unit, inputs, &nonneg);
-  double activ_deriv = (nonneg ? 1.0 : slope);
-  if (next_layer_loss == nullptr) {
+  float z = preActivation(unit, inputs);
+  float upstream = 0.0;
+  if (next_layer_loss != nullptr) {
+    upstream = upstreamGradient(unit, *next_layer_loss,
+				*next_layer_weights);
+  }
+  lossWithGradients(unit, z, activate(z), inputs,
+		    (next_layer_loss != nullptr ? &upstream : nullptr),
+		    y, res);
+}
+
+void PReluNNLayer::lossWithGradients(size_t unit, float z, float f,
+				     const vector<float>& inputs,
+				     const float* upstream,
+				     float y, aResult* res) const {
+  res->f = f;
+  double activ_deriv = (z >= 0 ? 1.0 : slope);
+  if (upstream == nullptr) {
     res->loss = (y - res->f);
     res->dloss_df = -2 * res->loss * activ_deriv;
     res->loss *= res->loss;
   } else {
-    res->dloss_df = 0.0;
-    for (size_t i = 0; i < next_layer_weights->row_size; i++) {
-      res->dloss_df += (*next_layer_loss)[i].dloss_df *
-	next_layer_weights->at(i, unit);
-    }
-    res->dloss_df *= activ_deriv;
+    res->dloss_df = *upstream * activ_deriv;
   }
   for (size_t i = 0; i < inputs.size(); i++) {
     res->dloss_dx[i] = inputs[i];
@@ -124,24 +242,30 @@ void NN::initializeWeights(float (*init)(size_t, size_t, size_t),
       layers[i]->bias[j] = init_bias(i, j);
     }
   }
+  updateSparseWeights();
 }
 
-bool NN::trainingShouldStop(const TrainingReport* report) const {
-  if (report->losses.size() < 2 + params->patience) {
-    return params->maxIterations <= report->losses.size();
+bool trainingShouldStop(const NNParams& params,
+			const TrainingReport* report) {
+  if (report->losses.size() < 2 + params.patience) {
+    return params.maxIterations <= report->losses.size();
   }
   size_t i;
-  for (i = 0; i < params->patience &&
+  for (i = 0; i < params.patience &&
 	 (2 + i) <= report->losses.size(); i++) {
     float delta = report->losses[report->losses.size() -
 			   (2 + i)] -
       report->losses[report->losses.size() -
 		     (1 + i)];
-    if (delta > params->minDeltaSgd) {
+    if (delta > params.minDeltaSgd) {
       return false;
     }
   }
-  return i == params->patience;
+  return i == params.patience;
+}
+
+bool NN::trainingShouldStop(const TrainingReport* report) const {
+  return ::trainingShouldStop(*params, report);
 }
 
 bool NN::addLayer(LayerType type, size_t num_units) {
@@ -159,26 +283,52 @@ bool NN::addLayer(LayerType type, size_t num_units) {
   return true;
 }
 
-bool NN::addOutputLayer(LayerType type) {
+bool NN::addOutputLayer(LayerType type, size_t num_outputs) {
   assert(layers.size() > 0);
   int num_inputs = (layers.size() > 0 ?
 		    layers.back()->inWeights.row_size :
 		    params->numInputs);
   switch(type) {
   case RELU:
-    layers.emplace_back(new PReluNNLayer(num_inputs, 1, 0.01));
+    layers.emplace_back(new PReluNNLayer(num_inputs, num_outputs, 0.01));
     break;
   case SIGMOID:
-    layers.emplace_back(new SigmoidNNLayer(num_inputs, 1));
+    layers.emplace_back(new SigmoidNNLayer(num_inputs, num_outputs));
     break;
   }
   return true;  
 }
 
+std::unique_ptr<NN> NN::clone() const {
+  std::unique_ptr<NN> copy(new NN(*params));
+  for (const auto& layer : layers) {
+    copy->layers.emplace_back(layer->clone());
+  }
+  copy->outputScale = outputScale;
+  copy->outputOffset = outputOffset;
+  copy->maxSparseDensity = maxSparseDensity;
+  copy->kernelTuning = kernelTuning;
+  return copy;
+}
+
+void NN::updateSparseWeights() {
+  for (auto& layer : layers) {
+    if (layer->density() <= maxSparseDensity) {
+      layer->sparseWeights.assign(layer->inWeights);
+    } else {
+      layer->sparseWeights.clear();
+    }
+  }
+}
+
 void NN::submitForAdd(const pair<vector<float>, float>& example) {
   examples.push_back(example);
 }
 
+void NN::submitForAdd(const pair<vector<float>, vector<float>>& example) {
+  multiTargetExamples.push_back(example);
+}
+
 vector<vector<float>> *NN::makeOutputVector() const {
   vector<vector<float>> *outputs =
     new vector<vector<float>>;
@@ -190,38 +340,76 @@ vector<vector<float>> *NN::makeOutputVector() const {
   return outputs;
 }
 
-float NN::backpropagate(const vector<pair<vector<float>, float>>& examples,
-			 const GDOptimizerParams& opt_params) {
-  float total_loss = 0.0;
-  vector<vector<aResult>> output_gradient_results(layers.size());
+float NN::backpropagate(const ExampleView& examples,
+			 const GDOptimizerParams& opt_params,
+			 PhaseTimes* times,
+			 vector<float>* target_losses) {
+  size_t num_outputs = numOutputs();
+  vector<float> losses(num_outputs, 0.0);
+  // Reused across calls on the same thread, so training doesn't
+  // reallocate the forward buffers, per-unit results or scratch on
+  // every batch.
+  static thread_local vector<vector<aResult>> output_gradient_results;
+  output_gradient_results.resize(layers.size());
   for (size_t i = 0; i < layers.size(); i++) {
-    output_gradient_results[i].resize(layers[i]->inWeights.row_size,
-				      aResult(layers[i]->inWeights.col_size));
-  }
-  std::unique_ptr<vector<vector<float>>> outputs(makeOutputVector());
-  for (const pair<vector<float>, float>& example : examples) {
-    /*
-    std::cout << " backpropagating: ";
-    for (float f : example.first) {
-      std::cout << f << " ";
-    }
-    std::cout << " - label: " << example.second << std::endl;
-    */
-    inference(example.first, outputs.get());
-    //std::cout << " inferred value: " << outputs->back()[0] << std::endl;
+    size_t num_units = layers[i]->inWeights.row_size;
+    size_t num_inputs = layers[i]->inWeights.col_size;
+    vector<aResult>& results = output_gradient_results[i];
+    if (results.size() != num_units ||
+	(num_units > 0 && results[0].dloss_dx.size() != num_inputs)) {
+      results.assign(num_units, aResult(num_inputs));
+    }
+  }
+  static thread_local ForwardPass pass;
+  prepareForwardPass(&pass);
+  static thread_local PlannedArena arena;
+  static thread_local vector<size_t> key;
+  shapeKey(1, &key);
+  arena.prepare(key, [this]() { return backpropagationBuffers(); });
+  PhaseTimes unused_times;
+  if (times == nullptr) {
+    times = &unused_times;
+  }
+  PhaseClock clock(times != &unused_times);
+  for (size_t e = 0; e < examples.size(); e++) {
+    assert(examples.numLabels(e) == num_outputs);
+    const float* labels = examples.labels(e);
+    pass.outputs[0] = examples.inputs(e);
+    clock.lap(&times->data);
+    forward(&pass);
+    clock.lap(&times->forward);
     for (size_t i = layers.size() - 1; i < layers.size(); i--) {
       NNLayer* layer = layers[i].get();
-      const vector2d<float>* next_layer_weights =
-	(i < layers.size() - 1 ? &(layers[i+1]->inWeights) : nullptr);
-      const vector<aResult>* next_layer_loss =
-	(i < layers.size() - 1 ? &(output_gradient_results[i+1]) : nullptr);
+      const float* upstream_grads = nullptr;
+      if (i < layers.size() - 1) {
+	// Sum each unit's gradient over the next layer with one
+	// row-major sweep of its weights, rather than walking a column
+	// of them per unit.
+	const vector<aResult>& next_layer_loss = output_gradient_results[i+1];
+	float* next_dloss_df = arena.buffer(2 * i);
+	float* upstream = arena.buffer(2 * i + 1);
+	for (size_t k = 0; k < next_layer_loss.size(); k++) {
+	  next_dloss_df[k] = next_layer_loss[k].dloss_df;
+	}
+	layers[i+1]->inWeights.transposeMultiply(next_dloss_df, upstream);
+	upstream_grads = upstream;
+      }
+      // Layer i's weights haven't been updated yet for this example,
+      // so the forward pass values are still exact.
+      const vector<float>& z = pass.preActivations[i];
+      const vector<float>& f = pass.outputs[i+1];
       for (size_t j = 0; j < layer->inWeights.row_size; j++) {
-	layer->lossWithGradients(j, (*outputs)[i],
-	                         next_layer_loss, next_layer_weights,
-				 example.second,
+	layer->lossWithGradients(j, z[j], f[j], pass.outputs[i],
+				 (upstream_grads != nullptr ?
+				  &upstream_grads[j] : nullptr),
+				 (upstream_grads == nullptr ? labels[j] : 0.0f),
 				 &output_gradient_results[i][j]);
       }
+      clock.lap(&times->backward);
       layer->updateWeights(output_gradient_results[i], opt_params);
+      clock.lap(&times->update);
+      // Summing the upstream gradient and updating the weights.
+      Metrics::addLayerFlops(i, 4 * layer->inWeights.data.size());
       /*
       for (size_t i = 0; i < layer->inWeights.row_size; i++) {
 	std::cout << "{";
@@ -238,55 +426,531 @@ float NN::backpropagate(const vector<pair<vector<float>, float>>& examples,
       std::cout << endl;
       */
     }
-    aResult res = output_gradient_results.back()[0];
-    /*
-    if (rand()%20000 == 0) {
-      std::cout << "estimated: " << res.f << " actual: " <<
-	example.second << " loss: " << res.loss << std::endl;
+    for (size_t j = 0; j < num_outputs; j++) {
+      losses[j] += output_gradient_results.back()[j].loss;
     }
-    */
-    total_loss += res.loss;
   }
 
-  if (examples.size() > 0) {
-    total_loss /= examples.size();
-  }
-  return total_loss;
+  Metrics::addExamplesProcessed(examples.size());
+  return meanLoss(&losses, examples.size(), target_losses);
 }
 
 float NN::inference(const vector<float>& inputs,
 		     vector<vector<float>>* outputs) const {
+  double seconds = 0.0;
+  PhaseClock clock(Metrics::enabled());
   (*outputs)[0] = inputs;
   for (size_t i = 0; i < layers.size(); i++) {
     const NNLayer* layer = layers[i].get();
     for (size_t j = 0; j < layer->inWeights.row_size; ++j) {
       (*outputs)[i+1][j] = layer->activation(j, (*outputs)[i]);
     }
+    Metrics::addLayerFlops(i, 2 * layer->forwardWeights());
+  }
+  clock.lap(&seconds);
+  Metrics::recordInference(seconds);
+  return mapOutput(0, outputs->back()[0]);
+}
+
+void NN::prepareForwardPass(ForwardPass* pass) const {
+  pass->preActivations.resize(layers.size());
+  pass->outputs.resize(layers.size() + 1);
+  pass->outputs[0].resize(params->numInputs);
+  for (size_t i = 0; i < layers.size(); i++) {
+    pass->preActivations[i].resize(layers[i]->inWeights.row_size);
+    pass->outputs[i+1].resize(layers[i]->inWeights.row_size);
+  }
+}
+
+void NN::shapeKey(size_t size, vector<size_t>* key) const {
+  key->clear();
+  key->push_back(size);
+  key->push_back(params->numInputs);
+  for (const auto& layer : layers) {
+    key->push_back(layer->inWeights.row_size);
+  }
+}
+
+vector<BufferLifetime> NN::inferenceBuffers(size_t batch_size) const {
+  // Step i runs layer i, reading buffer i and writing buffer i + 1, so
+  // only adjacent layers' activations are ever live together.
+  vector<BufferLifetime> buffers;
+  buffers.push_back({"inputs", batch_size * params->numInputs, 0, 0});
+  for (size_t i = 0; i < layers.size(); i++) {
+    buffers.push_back({"activations " + std::to_string(i),
+		       batch_size * layers[i]->inWeights.row_size, i, i + 1});
+  }
+  return buffers;
+}
+
+vector<BufferLifetime> NN::gradientBuffers(size_t num_examples) const {
+  // Layer i is step L - 1 - i. Its dloss/df is written then and read at
+  // the next step, by layer i - 1; its upstream sums live for one step.
+  vector<BufferLifetime> buffers;
+  size_t last = layers.size() - 1;
+  for (size_t i = 0; i < layers.size(); i++) {
+    size_t num_units = layers[i]->inWeights.row_size;
+    buffers.push_back({"dloss/df " + std::to_string(i),
+		       num_examples * num_units, last - i, last - i + 1});
+    buffers.push_back({"upstream " + std::to_string(i),
+		       (i < last ? num_units : 0), last - i, last - i});
+  }
+  return buffers;
+}
+
+vector<BufferLifetime> NN::backpropagationBuffers() const {
+  // Per example, at the step for layer i (L - 1 - i): the next layer's
+  // dloss/df gathered from its results, and the sums over it.
+  vector<BufferLifetime> buffers;
+  size_t last = layers.size() - 1;
+  for (size_t i = 0; i < layers.size(); i++) {
+    bool has_next = i < last;
+    buffers.push_back({"next dloss/df " + std::to_string(i),
+		       (has_next ? layers[i+1]->inWeights.row_size : 0),
+		       last - i, last - i});
+    buffers.push_back({"upstream " + std::to_string(i),
+		       (has_next ? layers[i]->inWeights.row_size : 0),
+		       last - i, last - i});
   }
-  return outputs->back()[0];
+  return buffers;
+}
+
+MemoryPlan NN::planInference(size_t batch_size) const {
+  return planMemory(inferenceBuffers(batch_size));
+}
+
+MemoryPlan NN::planGradients(size_t num_examples) const {
+  return planMemory(gradientBuffers(num_examples));
+}
+
+MemoryPlan NN::planBackpropagation() const {
+  return planMemory(backpropagationBuffers());
+}
+
+float NN::inference(const vector<float>& inputs, ForwardPass* pass) const {
+  double seconds = 0.0;
+  PhaseClock clock(Metrics::enabled());
+  pass->outputs[0] = inputs;
+  float result = mapOutput(0, forward(pass));
+  clock.lap(&seconds);
+  Metrics::recordInference(seconds);
+  return result;
+}
+
+float NN::forward(ForwardPass* pass) const {
+  for (size_t i = 0; i < layers.size(); i++) {
+    const NNLayer* layer = layers[i].get();
+    vector<float>& z = pass->preActivations[i];
+    vector<float>& f = pass->outputs[i+1];
+    for (size_t j = 0; j < layer->inWeights.row_size; ++j) {
+      z[j] = layer->preActivation(j, pass->outputs[i]);
+      f[j] = layer->activate(z[j]);
+    }
+    Metrics::addLayerFlops(i, 2 * layer->forwardWeights());
+  }
+  return pass->outputs.back()[0];
 }
 
 float NN::inference(const vector<float>& inputs) const {
-  std::unique_ptr<vector<vector<float>>> outputs(makeOutputVector());
-  return inference(inputs, outputs.get());
+  // Only the pass's outputs are used, but sizing them this way reuses
+  // them across calls instead of allocating a makeOutputVector().
+  static thread_local ForwardPass pass;
+  prepareForwardPass(&pass);
+  return inference(inputs, &pass.outputs);
+}
+
+void NN::inferenceAll(const vector<float>& inputs,
+		      vector<float>* outputs) const {
+  static thread_local ForwardPass pass;
+  prepareForwardPass(&pass);
+  inference(inputs, &pass);
+  *outputs = pass.outputs.back();
+  for (size_t j = 0; j < outputs->size(); j++) {
+    (*outputs)[j] = mapOutput(j, (*outputs)[j]);
+  }
 }
 
 bool NN::train(TrainingReport* report) {
+  if (examples.empty() && !multiTargetExamples.empty()) {
+    return train(multiTargetExamples, report);
+  }
+  return train(examples, report);
+}
+
+bool NN::train(const ExampleView& training_examples,
+	       TrainingReport* report) {
+  return trainEpochs([this, &training_examples](
+	  const GDOptimizerParams& opt_params, PhaseTimes* times,
+	  vector<float>* target_losses, size_t* num_examples) {
+      *num_examples = training_examples.size();
+      return backpropagate(training_examples, opt_params, times,
+			   target_losses);
+    }, report);
+}
+
+bool NN::train(ExampleSource* source, TrainingReport* report) {
+  vector<pair<vector<float>, vector<float>>> batch;
+  vector<float> batch_losses;
+  return trainEpochs([this, source, &batch, &batch_losses](
+	  const GDOptimizerParams& opt_params, PhaseTimes* times,
+	  vector<float>* target_losses, size_t* num_examples) {
+      vector<float> losses(numOutputs(), 0.0);
+      *num_examples = 0;
+      source->rewind();
+      for (;;) {
+	{
+	  ScopedTimer timer(&times->data);
+	  if (!source->nextBatch(&batch)) {
+	    break;
+	  }
+	}
+	backpropagate(batch, opt_params, times, &batch_losses);
+	for (size_t j = 0; j < losses.size(); j++) {
+	  losses[j] += batch_losses[j] * batch.size();
+	}
+	*num_examples += batch.size();
+      }
+      return meanLoss(&losses, *num_examples, target_losses);
+    }, report);
+}
+
+bool NN::trainEpochs(const std::function<float(const GDOptimizerParams&,
+					       PhaseTimes*, vector<float>*,
+					       size_t*)>& epoch,
+		     TrainingReport* report) {
   report->losses.clear();
+  report->targetLosses.clear();
   GDOptimizerParams opt_params;
   opt_params.learning_rate = params->learningRate;
+  report->epochSeconds.clear();
+  report->phases = PhaseTimes();
+  double total_seconds = 0.0;
+  size_t examples_processed = 0;
   for (size_t num_iterations = 0; num_iterations < params->maxIterations &&
 	 !trainingShouldStop(report); num_iterations++) {
-    std::cout << " iteration: " << num_iterations;
     float loss = 0.0;
-    loss = backpropagate(examples, opt_params);
-    std::cout << " loss: " << loss << std::endl;
+    double epoch_seconds = 0.0;
+    vector<float> target_losses;
+    size_t num_examples = 0;
+    {
+      ScopedTimer timer(&epoch_seconds);
+      loss = epoch(opt_params, &report->phases, &target_losses,
+		   &num_examples);
+    }
+    if (params->verbose) {
+      std::cout << " iteration: " << num_iterations << " loss: " << loss <<
+	std::endl;
+    }
     report->losses.push_back(loss);
+    report->targetLosses.push_back(target_losses);
+    report->epochSeconds.push_back(epoch_seconds);
+    total_seconds += epoch_seconds;
+    examples_processed += num_examples;
   }
+  report->timeElapsed = total_seconds;
+  report->examplesPerSecond = (total_seconds > 0 ?
+			       examples_processed / total_seconds : 0.0);
+  report->peakMemoryBytes = peakMemoryBytes();
+  updateSparseWeights();
   return true;
 }
 
+void NN::inferenceBatch(const vector<vector<float>>& inputs,
+			vector<float>* results) const {
+  double seconds = 0.0;
+  PhaseClock clock(Metrics::enabled());
+  size_t batch_size = inputs.size();
+  // Each layer's activations, one row per example in the batch; see
+  // inferenceBuffers.
+  static thread_local PlannedArena arena;
+  static thread_local vector<size_t> key;
+  shapeKey(batch_size, &key);
+  arena.prepare(key, [this, batch_size]() {
+      return inferenceBuffers(batch_size);
+    });
+  size_t width = params->numInputs;
+  float* layer_in = arena.buffer(0);
+  for (size_t e = 0; e < batch_size; e++) {
+    std::copy(inputs[e].begin(), inputs[e].begin() + width,
+	      layer_in + e * width);
+  }
+  for (size_t i = 0; i < layers.size(); i++) {
+    const NNLayer* layer = layers[i].get();
+    size_t num_units = layer->inWeights.row_size;
+    float* layer_out = arena.buffer(i + 1);
+    KernelBlocking blocking;
+    if (kernelTuning != nullptr) {
+      blocking = kernelTuning->blocking(num_units, width, batch_size);
+    }
+    layer->forwardBatch(layer_in, batch_size, layer_out, blocking);
+    Metrics::addLayerFlops(i, 2 * batch_size * layer->forwardWeights());
+    layer_in = layer_out;
+    width = num_units;
+  }
+  results->assign(layer_in, layer_in + batch_size * width);
+  if (!outputScale.empty()) {
+    for (size_t e = 0; e < batch_size; e++) {
+      for (size_t j = 0; j < width; j++) {
+	(*results)[e * width + j] = mapOutput(j, (*results)[e * width + j]);
+      }
+    }
+  }
+  clock.lap(&seconds);
+  Metrics::recordInference(seconds);
+}
+
+bool NN::save(std::ostream& out) const {
+  out << std::setprecision(std::numeric_limits<float>::max_digits10);
+  out << "nn 1\n";
+  out << "params " << params->numInputs << " " << params->maxIterations <<
+    " " << params->minDeltaSgd << " " << params->patience << " " <<
+    params->sgdBatchSize << " " << params->learningRate << "\n";
+  out << "layers " << layers.size() << "\n";
+  for (const auto& layer : layers) {
+    out << "layer ";
+    switch (layer->type()) {
+    case RELU:
+      out << "relu " << layer->inWeights.row_size << " " <<
+	layer->inWeights.col_size << " " <<
+	static_cast<const PReluNNLayer*>(layer.get())->slope << "\n";
+      break;
+    case SIGMOID:
+      out << "sigmoid " << layer->inWeights.row_size << " " <<
+	layer->inWeights.col_size << " " <<
+	static_cast<const SigmoidNNLayer*>(layer.get())->threshold << "\n";
+      break;
+    }
+    for (size_t i = 0; i < layer->inWeights.data.size(); i++) {
+      out << (i > 0 ? " " : "") << layer->inWeights.data[i];
+    }
+    out << "\n";
+    for (size_t i = 0; i < layer->bias.size(); i++) {
+      out << (i > 0 ? " " : "") << layer->bias[i];
+    }
+    out << "\n";
+  }
+  if (!outputScale.empty()) {
+    out << "output " << outputScale.size() << "\n";
+    for (size_t i = 0; i < outputScale.size(); i++) {
+      out << (i > 0 ? " " : "") << outputScale[i];
+    }
+    out << "\n";
+    for (size_t i = 0; i < outputOffset.size(); i++) {
+      out << (i > 0 ? " " : "") << outputOffset[i];
+    }
+    out << "\n";
+  }
+  return out.good();
+}
+
+std::unique_ptr<NN> NN::load(std::istream& in) {
+  string tag;
+  int version;
+  if (!(in >> tag >> version) || tag != "nn" || version != 1) {
+    return nullptr;
+  }
+  unsigned int num_inputs, max_iterations, sgd_batch_size;
+  float min_delta_sgd, learning_rate;
+  size_t patience, num_layers;
+  if (!(in >> tag >> num_inputs >> max_iterations >> min_delta_sgd >>
+	patience >> sgd_batch_size >> learning_rate) || tag != "params") {
+    return nullptr;
+  }
+  if (!(in >> tag >> num_layers) || tag != "layers") {
+    return nullptr;
+  }
+  std::unique_ptr<NN> nn(new NN(NNParams(num_inputs, max_iterations,
+					 min_delta_sgd, patience,
+					 sgd_batch_size, learning_rate)));
+  size_t expected_inputs = num_inputs;
+  for (size_t i = 0; i < num_layers; i++) {
+    string type;
+    size_t num_units, layer_inputs;
+    float param;
+    if (!(in >> tag >> type >> num_units >> layer_inputs >> param) ||
+	tag != "layer" || layer_inputs != expected_inputs) {
+      return nullptr;
+    }
+    if (type == "relu") {
+      nn->layers.emplace_back(new PReluNNLayer(layer_inputs, num_units,
+					       param));
+    } else if (type == "sigmoid") {
+      nn->layers.emplace_back(new SigmoidNNLayer(layer_inputs, num_units,
+						 param));
+    } else {
+      return nullptr;
+    }
+    NNLayer* layer = nn->layers.back().get();
+    for (float& w : layer->inWeights.data) {
+      if (!(in >> w)) {
+	return nullptr;
+      }
+    }
+    for (float& b : layer->bias) {
+      if (!(in >> b)) {
+	return nullptr;
+      }
+    }
+    expected_inputs = num_units;
+  }
+  // The output map is optional, and last.
+  nn->updateSparseWeights();
+  size_t num_outputs;
+  if (!(in >> tag)) {
+    return nn;
+  }
+  if (tag != "output" || !(in >> num_outputs) ||
+      num_outputs != nn->numOutputs()) {
+    return nullptr;
+  }
+  nn->outputScale.resize(num_outputs);
+  nn->outputOffset.resize(num_outputs);
+  for (float& scale : nn->outputScale) {
+    if (!(in >> scale)) {
+      return nullptr;
+    }
+  }
+  for (float& offset : nn->outputOffset) {
+    if (!(in >> offset)) {
+      return nullptr;
+    }
+  }
+  return nn;
+}
+
+float NN::updateOnline(const ExampleView& batch, size_t max_steps) {
+  GDOptimizerParams opt_params;
+  opt_params.learning_rate = params->learningRate;
+  float loss = 0.0;
+  for (size_t step = 0; step < max_steps; step++) {
+    float previous_loss = loss;
+    loss = backpropagate(batch, opt_params);
+    if (step > 0 && previous_loss - loss < params->minDeltaSgd) {
+      break;
+    }
+  }
+  updateSparseWeights();
+  return loss;
+}
+
+void NN::computeGradients(const ExampleView& examples,
+			  NNGradients* gradients,
+			  const std::function<void(size_t)>& layer_done) const {
+  size_t n = examples.size();
+  gradients->weights.resize(layers.size());
+  gradients->biases.resize(layers.size());
+  for (size_t i = 0; i < layers.size(); i++) {
+    const NNLayer* layer = layers[i].get();
+    gradients->weights[i].assign(layer->inWeights.data.size(), 0.0);
+    gradients->biases[i].assign(layer->bias.size(), 0.0);
+  }
+  static thread_local vector<size_t> key;
+  shapeKey(n, &key);
+  // Every example's forward pass is kept, so the backward pass can run
+  // one layer at a time over all of them. The passes are sized for the
+  // shape in key and freed when it changes, so one large batch doesn't
+  // keep its memory for the rest of the thread's life.
+  static thread_local vector<ForwardPass> passes;
+  static thread_local vector<size_t> passes_key;
+  if (key != passes_key) {
+    vector<ForwardPass>(n).swap(passes);
+    for (ForwardPass& pass : passes) {
+      prepareForwardPass(&pass);
+    }
+    passes_key = key;
+  }
+  for (size_t e = 0; e < n; e++) {
+    passes[e].outputs[0] = examples.inputs(e);
+    forward(&passes[e]);
+  }
+  // Each example's derivatives of the loss w.r.t. each layer's
+  // activations, and scratch for the sums over the next layer; see
+  // gradientBuffers.
+  static thread_local PlannedArena arena;
+  arena.prepare(key, [this, n]() { return gradientBuffers(n); });
+  static thread_local aResult res(0);
+  for (size_t i = layers.size() - 1; i < layers.size(); i--) {
+    const NNLayer* layer = layers[i].get();
+    size_t num_units = layer->inWeights.row_size;
+    size_t num_inputs = layer->inWeights.col_size;
+    size_t next_units = (i + 1 < layers.size() ?
+			 layers[i+1]->inWeights.row_size : 0);
+    float* dloss_df = arena.buffer(2 * i);
+    const float* next_dloss_df = (i + 1 < layers.size() ?
+				  arena.buffer(2 * (i + 1)) : nullptr);
+    float* upstream = arena.buffer(2 * i + 1);
+    res.dloss_dx.resize(num_inputs);
+    float* weight_grads = gradients->weights[i].data();
+    float* bias_grads = gradients->biases[i].data();
+    for (size_t e = 0; e < n; e++) {
+      const ForwardPass& pass = passes[e];
+      const float* labels = examples.labels(e);
+      const float* upstream_grads = nullptr;
+      if (i + 1 < layers.size()) {
+	layers[i+1]->inWeights.transposeMultiply(
+	    &next_dloss_df[e * next_units], upstream);
+	upstream_grads = upstream;
+      }
+      const vector<float>& inputs = pass.outputs[i];
+      for (size_t j = 0; j < num_units; j++) {
+	layer->lossWithGradients(j, pass.preActivations[i][j],
+				 pass.outputs[i+1][j], inputs,
+				 (upstream_grads != nullptr ?
+				  &upstream_grads[j] : nullptr),
+				 (upstream_grads == nullptr ? labels[j] : 0.0f),
+				 &res);
+	dloss_df[e * num_units + j] = res.dloss_df;
+	float* row = &weight_grads[j * num_inputs];
+	for (size_t k = 0; k < num_inputs; k++) {
+	  row[k] += res.dloss_df * inputs[k];
+	}
+	bias_grads[j] += res.dloss_df;
+      }
+    }
+    if (n > 0) {
+      for (float& g : gradients->weights[i]) {
+	g /= n;
+      }
+      for (float& g : gradients->biases[i]) {
+	g /= n;
+      }
+    }
+    if (layer_done) {
+      layer_done(i);
+    }
+  }
+}
+
+float NN::evaluate(const ExampleView& examples,
+		   vector<float>* target_losses) const {
+  static thread_local ForwardPass pass;
+  prepareForwardPass(&pass);
+  const NNLayer* output_layer = layers.back().get();
+  size_t num_outputs = numOutputs();
+  aResult res(output_layer->inWeights.col_size);
+  vector<float> losses(num_outputs, 0.0);
+  for (size_t e = 0; e < examples.size(); e++) {
+    assert(examples.numLabels(e) == num_outputs);
+    const float* labels = examples.labels(e);
+    pass.outputs[0] = examples.inputs(e);
+    forward(&pass);
+    for (size_t j = 0; j < num_outputs; j++) {
+      output_layer->lossWithGradients(j, pass.preActivations.back()[j],
+				      pass.outputs.back()[j],
+				      pass.outputs[layers.size() - 1],
+				      nullptr, labels[j], &res);
+      losses[j] += res.loss;
+    }
+  }
+  return meanLoss(&losses, examples.size(), target_losses);
+}
+
 int NN::lookup(const vector<float>& inputs) const {
-  return layers.back()->interpretOutput(inference(inputs));
+  double seconds = 0.0;
+  PhaseClock clock(Metrics::enabled());
+  int result = layers.back()->interpretOutput(inference(inputs));
+  clock.lap(&seconds);
+  Metrics::recordLookup(seconds);
+  return result;
 }
 
@@ -1,6 +1,12 @@
 #ifndef __NN_H_
 #define __NN_H_
 
+#include "example_source.h"
+#include "memory_plan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -18,6 +24,7 @@ using std::string;
 #define NN_ERR 1
 
 #define DEFAULT_MIN_DELTA 1e-6
+#define DEFAULT_MAX_SPARSE_DENSITY 0.3
 
 typedef enum {
   SIGMOID,
@@ -34,8 +41,8 @@ class vector2d {
   vector<T> data;
   size_t row_size, col_size;
 
-  vector2d<T>() { col_size = row_size = 0; }
-  vector2d<T>(int ic, int jc) { resize(ic, jc); }
+  vector2d() { col_size = row_size = 0; }
+  vector2d(int ic, int jc) { resize(ic, jc); }
   void resize(size_t ic, size_t jc, T def) {
     row_size = ic;
     col_size = jc;
@@ -50,6 +57,88 @@ class vector2d {
   const T& at(size_t i, size_t j) const {
     return data[i * col_size + j];
   }
+
+  // Computes out[j] = sum_i v[i] * at(i, j), i.e. the transpose of
+  // this matrix times v, without materializing the transpose. Rows are
+  // walked in order, one block of columns at a time so the block of
+  // out stays in cache, so every access is unit-stride. out must have
+  // col_size entries; they are overwritten.
+  void transposeMultiply(const T* v, T* out) const {
+    const size_t kBlockCols = 256;
+    for (size_t j = 0; j < col_size; j++) {
+      out[j] = 0;
+    }
+    for (size_t jb = 0; jb < col_size; jb += kBlockCols) {
+      size_t je = std::min(jb + kBlockCols, col_size);
+      for (size_t i = 0; i < row_size; i++) {
+	const T* row = &data[i * col_size];
+	T vi = v[i];
+	for (size_t j = jb; j < je; j++) {
+	  out[j] += vi * row[j];
+	}
+      }
+    }
+  }
+};
+
+// Compressed sparse row (CSR) copy of a vector2d that keeps only its
+// non-zero entries: row i's are values[rowStarts[i]] up to
+// values[rowStarts[i+1]], in the given columns, in column order.
+template <typename T>
+class sparse2d {
+ public:
+  vector<T> values;
+  vector<uint32_t> columns;
+  vector<uint32_t> rowStarts;  // one per row plus one; empty if unset
+
+  bool empty() const { return rowStarts.empty(); }
+  void clear() {
+    values.clear();
+    columns.clear();
+    rowStarts.clear();
+  }
+  void assign(const vector2d<T>& dense) {
+    clear();
+    rowStarts.push_back(0);
+    for (size_t i = 0; i < dense.row_size; i++) {
+      for (size_t j = 0; j < dense.col_size; j++) {
+	if (dense.at(i, j) != 0) {
+	  values.push_back(dense.at(i, j));
+	  columns.push_back(j);
+	}
+      }
+      rowStarts.push_back(values.size());
+    }
+  }
+  // Dot product of row i and v. Skipping the zero entries doesn't
+  // change the sum, so this matches the dense product exactly (for
+  // finite v).
+  T rowDot(size_t i, const T* v) const {
+    T sum = 0;
+    for (uint32_t p = rowStarts[i]; p < rowStarts[i+1]; p++) {
+      sum += values[p] * v[columns[p]];
+    }
+    return sum;
+  }
+};
+
+// Loop blocking for a layer's batched forward pass: its units are run
+// units at a time, each block over examples examples at a time, so
+// that a block of weights and a block of activations can stay in cache
+// together. Every blocking computes the same sums in the same order;
+// 0 means unblocked.
+struct KernelBlocking {
+  size_t units = 0;
+  size_t examples = 0;
+};
+
+// Picks the blocking for each layer shape and batch size, e.g. by
+// timing the candidates on this host (see KernelAutotuner).
+class KernelTuning {
+ public:
+  virtual ~KernelTuning() {}
+  virtual KernelBlocking blocking(size_t num_units, size_t num_inputs,
+				  size_t batch_size) const = 0;
 };
 
 // Result with derivatives for each input variable.
@@ -58,7 +147,9 @@ struct aResult {
   float loss, dloss_df;  // derivative w.r.t. activation
   vector<float> dloss_dx;  // derivative w.r.t. previous layer
 
-  aResult(int num_vars) { dloss_dx.resize(num_vars, 0.0); }
+  aResult(int num_vars) : f(0), loss(0), dloss_df(0) {
+    dloss_dx.resize(num_vars, 0.0);
+  }
   string toString() const {
     std::ostringstream out;
     out << "f: " << f << " loss: " << loss << " dloss/df: " <<
@@ -70,21 +161,70 @@ struct aResult {
   }
 };
 
+// Values computed by a forward pass, kept around so that
+// backpropagation can read them instead of recomputing every unit's
+// dot product. Layer i's pre-activations and activations are in
+// preActivations[i] and outputs[i+1]; outputs[0] holds the inputs.
+struct ForwardPass {
+  vector<vector<float>> preActivations;
+  vector<vector<float>> outputs;
+};
+
+// Gradients of the loss w.r.t. every weight and bias, per layer, laid
+// out like the layers' inWeights.data and bias.
+struct NNGradients {
+  vector<vector<float>> weights;
+  vector<vector<float>> biases;
+};
+
 struct GDOptimizerParams {
   float learning_rate;
 };
 
+// Wall time spent in each phase of backpropagation, in seconds.
+struct PhaseTimes {
+  double data = 0.0;      // staging examples into the forward buffers
+  double forward = 0.0;   // forward pass
+  double backward = 0.0;  // computing losses and gradients
+  double update = 0.0;    // applying weight updates
+
+  double total() const { return data + forward + backward + update; }
+};
+
 struct TrainingReport {
-  vector<float> losses;  // loss at each iteration
-  float timeElapsed;     // total training time
+  vector<float> losses;        // loss at each iteration
+  // Loss of each output unit (target) at each iteration; losses holds
+  // their sum.
+  vector<vector<float>> targetLosses;
+  vector<float> epochSeconds;  // wall time of each iteration
+  float timeElapsed = 0.0;     // total training time, in seconds
+  PhaseTimes phases;           // time split by phase, over all iterations
+  float examplesPerSecond = 0.0;
+  size_t peakMemoryBytes = 0;  // peak resident set size when done
 
   string toString() {
     ostringstream out;
     out << "Training report: " << endl;
     for (size_t i = 0; i < losses.size(); i++) {
-      out << " - iteration " << i << ": loss " << losses[i] << endl;
+      out << " - iteration " << i << ": loss " << losses[i];
+      if (i < targetLosses.size() && targetLosses[i].size() > 1) {
+	out << " [";
+	for (size_t j = 0; j < targetLosses[i].size(); j++) {
+	  out << (j > 0 ? ", " : "") << targetLosses[i][j];
+	}
+	out << "]";
+      }
+      if (i < epochSeconds.size()) {
+	out << " (" << epochSeconds[i] << "s)";
+      }
+      out << endl;
     }
-    out << "--- training completed" << endl;
+    out << "--- training completed in " << timeElapsed << "s, " <<
+      examplesPerSecond << " examples/s" << endl;
+    out << "--- phases: data " << phases.data << "s, forward " <<
+      phases.forward << "s, backward " << phases.backward <<
+      "s, update " << phases.update << "s" << endl;
+    out << "--- peak memory: " << peakMemoryBytes << " bytes" << endl;
     return out.str();
   }
 };
@@ -92,12 +232,25 @@ struct TrainingReport {
 struct NNLayer {
   vector2d<float> inWeights;
   vector<float> bias;
+  // While non-empty, a copy of inWeights that the forward pass uses
+  // instead, for layers that are mostly zeros. Updating the weights
+  // clears it; see NN::updateSparseWeights.
+  sparse2d<float> sparseWeights;
+  // If non-empty, one entry per weight: weights whose entry is 0 have
+  // been pruned, and training keeps them at zero.
+  vector<uint8_t> pruneMask;
+
+  virtual ~NNLayer() {}
 
   void Init(unsigned int num_inputs, unsigned int num_outputs) {
     inWeights.resize(num_outputs, num_inputs);
     bias.resize(num_outputs);
   }
   
+  // Weighted sum of the inputs plus bias, before the activation
+  // function is applied.
+  float preActivation(size_t unit, const vector<float>& inputs) const;
+  virtual float activate(float z) const = 0;
   virtual float activation(size_t unit,
 			    const vector<float>& inputs) const = 0;
   virtual void lossWithGradients(size_t unit,
@@ -105,9 +258,31 @@ struct NNLayer {
 				 const vector<aResult>* next_layer_loss,
 				 const vector2d<float>* next_layer_weights,
 				 float y, aResult* res) const = 0;
+  // As above, but with the unit's pre-activation z and activation f
+  // already known from a forward pass, and with the derivative of the
+  // loss w.r.t. f already summed over the next layer (upstream), or
+  // nullptr if this is the output layer.
+  virtual void lossWithGradients(size_t unit, float z, float f,
+				 const vector<float>& inputs,
+				 const float* upstream,
+				 float y, aResult* res) const = 0;
   virtual int interpretOutput(float output) const = 0;
+  virtual LayerType type() const = 0;
+  virtual NNLayer* clone() const = 0;
   void updateWeights(const vector<aResult>& lossesAndGrads,
 		     const GDOptimizerParams& opt_params);
+  // Runs the layer on batch_size examples: inputs holds a row of
+  // col_size activations per example, and outputs gets a row of
+  // row_size per example.
+  void forwardBatch(const float* inputs, size_t batch_size, float* outputs,
+		    const KernelBlocking& blocking) const;
+  // Fraction of the weights that are non-zero.
+  float density() const;
+  // Number of weights the forward pass multiplies by.
+  size_t forwardWeights() const {
+    return (sparseWeights.empty() ? inWeights.data.size() :
+	    sparseWeights.values.size());
+  }
   string toString() const {
     std::ostringstream out;
     out << "wts: ";
@@ -136,6 +311,7 @@ struct PReluNNLayer: public NNLayer {
     slope = sl;
   }
 
+  float activate(float z) const;
   float activation(size_t unit,
 		   const vector<float>& inputs) const;
   float activation(size_t unit,
@@ -146,7 +322,13 @@ struct PReluNNLayer: public NNLayer {
 			 const vector<aResult>* next_layer_loss,
 			 const vector2d<float>* next_layer_weights,
 			 float y, aResult* res) const;
+  void lossWithGradients(size_t unit, float z, float f,
+			 const vector<float>& inputs,
+			 const float* upstream,
+			 float y, aResult* res) const;
   int interpretOutput(float output) const;
+  LayerType type() const { return RELU; }
+  NNLayer* clone() const { return new PReluNNLayer(*this); }
 };
 
 struct SigmoidNNLayer: public NNLayer {
@@ -158,6 +340,7 @@ struct SigmoidNNLayer: public NNLayer {
    NNLayer::Init(num_inputs, num_outputs);
    threshold = th;
  }
+  float activate(float z) const;
   float activation(size_t unit,
     		    const vector<float>& inputs) const;
   void lossWithGradients(size_t unit,
@@ -165,7 +348,65 @@ struct SigmoidNNLayer: public NNLayer {
 			 const vector<aResult>* next_layer_loss,
 			 const vector2d<float>* next_layer_weights,
 			 float y, aResult* res) const;
+  void lossWithGradients(size_t unit, float z, float f,
+			 const vector<float>& inputs,
+			 const float* upstream,
+			 float y, aResult* res) const;
   int interpretOutput(float output) const;
+  LayerType type() const { return SIGMOID; }
+  NNLayer* clone() const { return new SigmoidNNLayer(*this); }
+};
+
+// A read-only view of examples owned elsewhere: either all of them,
+// or just those at the given indices, in that order. Examples have
+// either a single label or one label per output unit. Converts
+// implicitly from a vector of examples.
+class ExampleView {
+ public:
+  ExampleView(const vector<pair<vector<float>, float>>& examples) :
+    examples_(&examples), multi_target_examples_(nullptr),
+    indices_(nullptr) {}
+  ExampleView(const vector<pair<vector<float>, float>>& examples,
+	      const vector<size_t>& indices) :
+    examples_(&examples), multi_target_examples_(nullptr),
+    indices_(&indices) {}
+  ExampleView(const vector<pair<vector<float>, vector<float>>>& examples) :
+    examples_(nullptr), multi_target_examples_(&examples),
+    indices_(nullptr) {}
+  ExampleView(const vector<pair<vector<float>, vector<float>>>& examples,
+	      const vector<size_t>& indices) :
+    examples_(nullptr), multi_target_examples_(&examples),
+    indices_(&indices) {}
+
+  size_t size() const {
+    if (indices_ != nullptr) {
+      return indices_->size();
+    }
+    return (examples_ != nullptr ? examples_->size() :
+	    multi_target_examples_->size());
+  }
+  const vector<float>& inputs(size_t i) const {
+    return (examples_ != nullptr ? (*examples_)[row(i)].first :
+	    (*multi_target_examples_)[row(i)].first);
+  }
+  // The example's labels, one per output unit.
+  const float* labels(size_t i) const {
+    return (examples_ != nullptr ? &(*examples_)[row(i)].second :
+	    (*multi_target_examples_)[row(i)].second.data());
+  }
+  size_t numLabels(size_t i) const {
+    return (examples_ != nullptr ? 1 :
+	    (*multi_target_examples_)[row(i)].second.size());
+  }
+
+ private:
+  size_t row(size_t i) const {
+    return (indices_ != nullptr ? (*indices_)[i] : i);
+  }
+
+  const vector<pair<vector<float>, float>>* examples_;
+  const vector<pair<vector<float>, vector<float>>>* multi_target_examples_;
+  const vector<size_t>* indices_;
 };
 
 struct NNParams {
@@ -175,6 +416,7 @@ struct NNParams {
   size_t patience;
   unsigned int sgdBatchSize;
   float learningRate;
+  bool verbose = true;  // print the loss at each iteration of training
   NNParams(unsigned int numinputs,
 	   unsigned int maxiter,
 	   float mindeltasgd,
@@ -189,30 +431,121 @@ struct NNParams {
     learningRate(learningrate) {}
   NNParams(const NNParams& p) :
       NNParams(p.numInputs, p.maxIterations, p.minDeltaSgd,
-	       p.patience, p.sgdBatchSize, p.learningRate) {}
+	       p.patience, p.sgdBatchSize, p.learningRate) {
+    verbose = p.verbose;
+  }
+  NNParams& operator=(const NNParams&) = default;
 };
 
+// True once report shows training has run params.maxIterations
+// iterations, or the loss has improved by at most params.minDeltaSgd
+// for params.patience iterations in a row.
+bool trainingShouldStop(const NNParams& params,
+			const TrainingReport* report);
+
 class NN {
  public:
   vector<std::unique_ptr<NNLayer>> layers;
   vector<pair<vector<float>, float>> examples;
+  // Examples with one label per output unit, for networks with several
+  // outputs.
+  vector<pair<vector<float>, vector<float>>> multiTargetExamples;
+
+  // Affine map the inference methods apply to each output unit's
+  // value, e.g. to unscale predictions: output j becomes
+  // value * outputScale[j] + outputOffset[j]. Training and evaluate()
+  // don't apply it. Empty for none.
+  vector<float> outputScale, outputOffset;
+
+  // Layers with at most this fraction of non-zero weights run their
+  // forward pass on sparse (CSR) copies of their weights.
+  float maxSparseDensity = DEFAULT_MAX_SPARSE_DENSITY;
+
+  // Blocking for inferenceBatch's layer kernels; unblocked if null.
+  std::shared_ptr<const KernelTuning> kernelTuning;
 
   std::unique_ptr<NNParams> params;
   NN(const NNParams& nn_params) {
     params.reset(new NNParams(nn_params));
   }
+  // A copy of the parameters, layers and output map, without examples.
+  std::unique_ptr<NN> clone() const;
+  // Gives every layer whose density is at most maxSparseDensity a
+  // sparse copy of its weights, and drops the others'. Training,
+  // loading and initializeWeights call this; call it after changing
+  // weights directly.
+  void updateSparseWeights();
 
   bool addLayer(LayerType type, size_t num_units);
-  bool addOutputLayer(LayerType type);
+  // An output layer with several units trains one target per unit,
+  // all sharing the hidden layers.
+  bool addOutputLayer(LayerType type, size_t num_outputs = 1);
+  size_t numOutputs() const {
+    return (layers.empty() ? 0 : layers.back()->inWeights.row_size);
+  }
   void submitForAdd(const pair<vector<float>, float>& example);
+  void submitForAdd(const pair<vector<float>, vector<float>>& example);
   float inference(const vector<float>& inputs,
 		   vector<vector<float>>* outputs) const;
   float inference(const vector<float>& inputs) const;
+  // Like inference(inputs), but returns every output unit's value
+  // rather than only the first.
+  void inferenceAll(const vector<float>& inputs,
+		    vector<float>* outputs) const;
+  // Forward pass that also records pre-activations, for reuse by
+  // backpropagation. The pass must have been sized by prepareForwardPass.
+  float inference(const vector<float>& inputs, ForwardPass* pass) const;
   int lookup(const vector<float>& inputs) const;
+  // Runs a batch of inputs through the network layer by layer, so each
+  // unit's weights are read once per batch rather than once per input.
+  // Results hold each input's outputs in turn, numOutputs() apiece.
+  void inferenceBatch(const vector<vector<float>>& inputs,
+		      vector<float>* results) const;
+  // For online learning: applies at most max_steps gradient steps over
+  // a small batch of new examples, in place, stopping early once the
+  // loss improves by less than params->minDeltaSgd. Returns the loss
+  // from the last step.
+  float updateOnline(const ExampleView& batch, size_t max_steps);
+  // Gradients of the mean loss over examples (as evaluate() computes
+  // it) w.r.t. every weight and bias, at the current weights, as
+  // backpropagation computes them but without updating anything.
+  // Layers are finished last to first, each over every example; if
+  // layer_done is set it's called with each layer's index as soon as
+  // that layer's gradients are final, e.g. to start sending them while
+  // the layers before it are computed.
+  void computeGradients(
+      const ExampleView& examples, NNGradients* gradients,
+      const std::function<void(size_t layer)>& layer_done = nullptr) const;
+  // Mean loss of the output layer over examples, without training,
+  // summed over the output units. If target_losses is non-null, it
+  // gets each unit's mean loss.
+  float evaluate(const ExampleView& examples,
+		 vector<float>* target_losses = nullptr) const;
+  // Trains on the submitted examples: the single-label ones if there
+  // are any, otherwise the multi-target ones.
   bool train(TrainingReport* report);
+  // Trains on examples owned by the caller rather than on those
+  // submitted with submitForAdd, so many networks can share one
+  // read-only set of examples.
+  bool train(const ExampleView& training_examples, TrainingReport* report);
+  // Trains on examples streamed from source, one batch at a time, so
+  // they needn't all fit in memory. Each iteration is one full pass
+  // over the source; the weight updates are the same as training on
+  // all of its examples at once.
+  bool train(ExampleSource* source, TrainingReport* report);
   void initializeWeights(float (*init)(size_t, size_t, size_t),
 			 float( *init_bias)(size_t, size_t));
   vector<vector<float>>* makeOutputVector() const;
+  // Sizes the buffers in pass for this network, reusing any storage
+  // it already has.
+  void prepareForwardPass(ForwardPass* pass) const;
+  // Layouts of the scratch memory inferenceBatch uses for a batch of
+  // batch_size inputs, computeGradients for num_examples examples, and
+  // backpropagate; each is planned once per thread, network shape and
+  // size, and reused by every later call.
+  MemoryPlan planInference(size_t batch_size) const;
+  MemoryPlan planGradients(size_t num_examples) const;
+  MemoryPlan planBackpropagation() const;
 
   string toString() const {
     ostringstream out;
@@ -222,9 +555,43 @@ class NN {
     }
     return out.str();
   }  
+  // Writes the parameters, layers and weights as text; load() reads
+  // them back, returning nullptr if the input is malformed.
+  bool save(std::ostream& out) const;
+  static std::unique_ptr<NN> load(std::istream& in);
+
   bool trainingShouldStop(const TrainingReport* report) const;
-  float backpropagate(const vector<pair<vector<float>, float>>& examples,
-		       const GDOptimizerParams& opt_params);
+  // Returns the mean loss, summed over the output units. If times is
+  // non-null, the time spent in each phase is added to it; if
+  // target_losses is non-null, it gets each output unit's mean loss.
+  float backpropagate(const ExampleView& examples,
+		       const GDOptimizerParams& opt_params,
+		       PhaseTimes* times = nullptr,
+		       vector<float>* target_losses = nullptr);
+
+ private:
+  // Runs the forward pass on the inputs already in pass->outputs[0].
+  float forward(ForwardPass* pass) const;
+  // The buffers each plan above lays out, with the backward pass's
+  // steps numbered from the output layer down.
+  vector<BufferLifetime> inferenceBuffers(size_t batch_size) const;
+  vector<BufferLifetime> gradientBuffers(size_t num_examples) const;
+  vector<BufferLifetime> backpropagationBuffers() const;
+  // What a plan depends on: the size and the width of every layer.
+  void shapeKey(size_t size, vector<size_t>* key) const;
+  // Applies the output map to output unit's value.
+  float mapOutput(size_t unit, float value) const {
+    return (outputScale.empty() ? value :
+	    value * outputScale[unit] + outputOffset[unit]);
+  }
+  // Runs training iterations until trainingShouldStop, filling in
+  // report. Each call of epoch is one iteration: it returns the loss,
+  // sets the per-target losses and the number of examples seen, and
+  // adds its phase times.
+  bool trainEpochs(const std::function<float(const GDOptimizerParams&,
+					     PhaseTimes*, vector<float>*,
+					     size_t*)>& epoch,
+		   TrainingReport* report);
 };
 
 #endif
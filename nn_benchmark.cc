@@ -0,0 +1,336 @@
+// Microbenchmarks for layers, whole networks and dataset processing,
+// over synthetic data. The size of the synthetic dataset can be set
+// with --synthetic_rows=N and --synthetic_features=N; all other flags
+// are passed through to Google Benchmark.
+
+#include "dataset.h"
+#include "inference_cache.h"
+#include "layer_graph.h"
+#include "nn.h"
+#include "pruning.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+namespace {
+
+size_t synthetic_rows = 10000;
+size_t synthetic_features = 16;
+
+float randomWeight(size_t i, size_t j, size_t k) {
+  return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+}
+
+float randomBias(size_t i, size_t j) {
+  return static_cast<float>(((rand() % 100) * 0.01) - 0.5);
+}
+
+vector<float> randomInputs(size_t n, std::mt19937* rng) {
+  std::uniform_real_distribution<float> dist(0.0, 1.0);
+  vector<float> inputs(n);
+  for (float& x : inputs) {
+    x = dist(*rng);
+  }
+  return inputs;
+}
+
+void randomizeLayer(NNLayer* layer, std::mt19937* rng) {
+  std::uniform_real_distribution<float> dist(-0.5, 0.5);
+  for (float& w : layer->inWeights.data) {
+    w = dist(*rng);
+  }
+  for (float& b : layer->bias) {
+    b = dist(*rng);
+  }
+}
+
+vector<pair<vector<float>, float>> syntheticExamples(size_t rows,
+						     size_t features) {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> dist(0.0, 1.0);
+  vector<pair<vector<float>, float>> examples(rows);
+  for (auto& example : examples) {
+    example.first = randomInputs(features, &rng);
+    example.second = dist(rng);
+  }
+  return examples;
+}
+
+// Rows shaped like the solar generation data: a few date fields, a
+// categorical source key and numeric readings, with the label last.
+vector<vector<string>> syntheticRows(size_t rows) {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> power(0.0, 1000.0);
+  vector<vector<string>> result(rows);
+  for (size_t i = 0; i < rows; i++) {
+    result[i] = {
+      "120", std::to_string(i % 12), std::to_string(i % 28),
+      std::to_string(i % 24), "4135001",
+      "source_" + std::to_string(i % 22),
+      std::to_string(power(rng)), std::to_string(power(rng) / 10),
+      std::to_string(power(rng) * 5)
+    };
+  }
+  return result;
+}
+
+const vector<string> kFieldNames = {
+  "YEAR", "MONTH", "DAY", "HOUR",  "PLANT_ID", "SOURCE_KEY",
+  "DC_POWER", "AC_POWER", "DAILY_YIELD"
+};
+
+std::unique_ptr<NN> makeNetwork(size_t num_inputs, size_t width,
+				size_t num_hidden = 1) {
+  NNParams params(num_inputs, 1, DEFAULT_MIN_DELTA, 1, 10, 0.001);
+  std::unique_ptr<NN> nn(new NN(params));
+  for (size_t i = 0; i < num_hidden; i++) {
+    nn->addLayer(LayerType::RELU, width);
+  }
+  nn->addOutputLayer(LayerType::RELU);
+  srand(42);
+  nn->initializeWeights(randomWeight, randomBias);
+  return nn;
+}
+
+std::unique_ptr<NNLayer> makeLayer(LayerType type, size_t width) {
+  switch (type) {
+  case RELU:
+    return std::unique_ptr<NNLayer>(new PReluNNLayer(width, width, 0.01));
+  case SIGMOID:
+    break;
+  }
+  return std::unique_ptr<NNLayer>(new SigmoidNNLayer(width, width));
+}
+
+void BM_LayerActivation(benchmark::State& state, LayerType type) {
+  size_t width = state.range(0);
+  std::unique_ptr<NNLayer> layer_ptr = makeLayer(type, width);
+  NNLayer& layer = *layer_ptr;
+  std::mt19937 rng(42);
+  randomizeLayer(&layer, &rng);
+  vector<float> inputs = randomInputs(width, &rng);
+  for (auto _ : state) {
+    for (size_t j = 0; j < width; j++) {
+      benchmark::DoNotOptimize(layer.activation(j, inputs));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * width);
+  state.counters["FLOPS"] = benchmark::Counter(
+      2.0 * width * width * state.iterations(),
+      benchmark::Counter::kIsRate);
+}
+
+void BM_LayerLossWithGradients(benchmark::State& state, LayerType type) {
+  size_t width = state.range(0);
+  std::unique_ptr<NNLayer> layer_ptr = makeLayer(type, width);
+  NNLayer& layer = *layer_ptr;
+  std::mt19937 rng(42);
+  randomizeLayer(&layer, &rng);
+  vector<float> inputs = randomInputs(width, &rng);
+  vector<float> z(width), f(width);
+  for (size_t j = 0; j < width; j++) {
+    z[j] = layer.preActivation(j, inputs);
+    f[j] = layer.activate(z[j]);
+  }
+  vector<float> upstream = randomInputs(width, &rng);
+  vector<aResult> results(width, aResult(width));
+  for (auto _ : state) {
+    for (size_t j = 0; j < width; j++) {
+      layer.lossWithGradients(j, z[j], f[j], inputs, &upstream[j],
+			      0.0, &results[j]);
+    }
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * width);
+}
+
+void BM_NNInference(benchmark::State& state) {
+  size_t width = state.range(0);
+  std::unique_ptr<NN> nn = makeNetwork(synthetic_features, width);
+  std::mt19937 rng(42);
+  vector<float> inputs = randomInputs(synthetic_features, &rng);
+  ForwardPass pass;
+  nn->prepareForwardPass(&pass);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nn->inference(inputs, &pass));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// As BM_NNInference, with the input's outputs already cached.
+void BM_InferenceCacheHit(benchmark::State& state) {
+  size_t width = state.range(0);
+  ModelHandle handle(makeNetwork(synthetic_features, width));
+  InferenceCache cache(&handle, InferenceCacheParams());
+  std::mt19937 rng(42);
+  vector<float> inputs = randomInputs(synthetic_features, &rng);
+  cache.inference(inputs);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cache.inference(inputs));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Batch inference on a network pruned to state.range(1) percent
+// sparsity. Layers switch to the sparse kernels from 70%.
+void BM_NNInferenceBatchPruned(benchmark::State& state) {
+  size_t width = state.range(0);
+  std::unique_ptr<NN> nn = makeNetwork(synthetic_features, width, 2);
+  PruningParams params;
+  params.sparsity = state.range(1) / 100.0;
+  pruneByMagnitude(nn.get(), params);
+  std::mt19937 rng(42);
+  vector<vector<float>> inputs(32);
+  for (vector<float>& x : inputs) {
+    x = randomInputs(synthetic_features, &rng);
+  }
+  vector<float> results;
+  for (auto _ : state) {
+    nn->inferenceBatch(inputs, &results);
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+
+// Batch inference on a wide-and-deep graph: the raw features join one
+// hidden layer of width state.range(0) at the output.
+void BM_LayerGraphWideAndDeepBatch(benchmark::State& state) {
+  NNParams params(synthetic_features, 1, DEFAULT_MIN_DELTA, 1, 32, 0.001);
+  LayerGraph graph(params);
+  LayerGraph::NodeId hidden = graph.addDense(graph.input(), RELU,
+					     state.range(0));
+  LayerGraph::NodeId wide = graph.addConcat({ graph.input(), hidden });
+  graph.compile(graph.addDense(wide, RELU, 1));
+  srand(42);
+  graph.initializeWeights(randomWeight, randomBias);
+  std::mt19937 rng(42);
+  vector<vector<float>> inputs(32);
+  for (vector<float>& x : inputs) {
+    x = randomInputs(synthetic_features, &rng);
+  }
+  vector<float> results;
+  for (auto _ : state) {
+    graph.inferenceBatch(inputs, &results);
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+
+void BM_NNBackpropagateEpoch(benchmark::State& state) {
+  size_t width = state.range(0);
+  std::unique_ptr<NN> nn = makeNetwork(synthetic_features, width);
+  vector<pair<vector<float>, float>> examples =
+    syntheticExamples(synthetic_rows, synthetic_features);
+  GDOptimizerParams opt_params;
+  opt_params.learning_rate = 0.001;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(nn->backpropagate(examples, opt_params));
+  }
+  state.SetItemsProcessed(state.iterations() * examples.size());
+}
+
+void BM_DatasetAddRow(benchmark::State& state) {
+  vector<vector<string>> rows = syntheticRows(synthetic_rows);
+  for (auto _ : state) {
+    Dataset dataset(kFieldNames, kFieldNames.size() - 1);
+    for (const vector<string>& row : rows) {
+      dataset.add_row(row);
+    }
+    benchmark::DoNotOptimize(dataset.hasNext());
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+
+// As above, with an hour (four readings) of each inverter's DC_POWER
+// history as features.
+void BM_DatasetAddRowWindowed(benchmark::State& state) {
+  vector<vector<string>> rows = syntheticRows(synthetic_rows);
+  for (auto _ : state) {
+    Dataset dataset(kFieldNames, kFieldNames.size() - 1);
+    dataset.add_window_features(5, {{6, WINDOW_LAG, 1},
+				    {6, WINDOW_MEAN, 4},
+				    {6, WINDOW_MIN, 4},
+				    {6, WINDOW_MAX, 4},
+				    {6, WINDOW_STD, 4}});
+    for (const vector<string>& row : rows) {
+      dataset.add_row(row);
+    }
+    benchmark::DoNotOptimize(dataset.hasNext());
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+
+void BM_DatasetProcessExample(benchmark::State& state) {
+  vector<vector<string>> rows = syntheticRows(synthetic_rows);
+  Dataset dataset(kFieldNames, kFieldNames.size() - 1);
+  for (const vector<string>& row : rows) {
+    dataset.add_row(row);
+  }
+  dataset.process_features();
+  pair<vector<float>, float> example;
+  for (auto _ : state) {
+    for (const vector<string>& row : rows) {
+      dataset.process_example(row, &example);
+    }
+    benchmark::DoNotOptimize(example.second);
+  }
+  state.SetItemsProcessed(state.iterations() * rows.size());
+}
+
+BENCHMARK_CAPTURE(BM_LayerActivation, sigmoid, SIGMOID)
+    ->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK_CAPTURE(BM_LayerActivation, prelu, RELU)
+    ->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK_CAPTURE(BM_LayerLossWithGradients, sigmoid, SIGMOID)
+    ->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK_CAPTURE(BM_LayerLossWithGradients, prelu, RELU)
+    ->RangeMultiplier(4)->Range(16, 1024);
+BENCHMARK(BM_NNInference)->RangeMultiplier(4)->Range(8, 512);
+BENCHMARK(BM_InferenceCacheHit)->RangeMultiplier(4)->Range(8, 512);
+BENCHMARK(BM_NNInferenceBatchPruned)
+    ->ArgsProduct({{128, 512}, {0, 50, 90, 95}});
+BENCHMARK(BM_LayerGraphWideAndDeepBatch)->RangeMultiplier(4)->Range(8, 512);
+BENCHMARK(BM_NNBackpropagateEpoch)->RangeMultiplier(4)->Range(8, 128)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DatasetAddRow)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DatasetAddRowWindowed)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DatasetProcessExample)->Unit(benchmark::kMillisecond);
+
+// Removes our own flags from argv, leaving the rest for the
+// benchmark library.
+void parseFlags(int* argc, char** argv) {
+  int out = 1;
+  for (int i = 1; i < *argc; i++) {
+    const char* rows_flag = "--synthetic_rows=";
+    const char* features_flag = "--synthetic_features=";
+    if (strncmp(argv[i], rows_flag, strlen(rows_flag)) == 0) {
+      synthetic_rows = strtoul(argv[i] + strlen(rows_flag), nullptr, 10);
+    } else if (strncmp(argv[i], features_flag,
+		       strlen(features_flag)) == 0) {
+      synthetic_features = strtoul(argv[i] + strlen(features_flag),
+				   nullptr, 10);
+    } else {
+      argv[out++] = argv[i];
+    }
+  }
+  *argc = out;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  parseFlags(&argc, argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
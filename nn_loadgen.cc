@@ -0,0 +1,138 @@
+// Load generator for nn_server: opens several connections, each
+// sending requests of random features one at a time, and reports
+// throughput and latency percentiles.
+//
+// Usage: nn_loadgen --features=N [--connect=ADDR] [--connections=N]
+//                   [--requests=N]
+// --requests is per connection.
+
+#include "line_socket.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+namespace {
+
+bool flagValue(const char* arg, const char* name, string* value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+    *value = arg + len + 1;
+    return true;
+  }
+  return false;
+}
+
+// Sends requests on one connection, recording each one's latency in
+// seconds. Returns false on a connection or protocol error.
+bool runConnection(const string& address, size_t num_requests,
+		   size_t num_features, unsigned int seed,
+		   vector<double>* latencies) {
+  int fd = line_socket::connectTo(address);
+  if (fd < 0) {
+    return false;
+  }
+  line_socket::LineReader reader(fd);
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> dist(0.0, 1.0);
+  std::ostringstream request;
+  string reply;
+  bool ok = true;
+  for (size_t r = 0; r < num_requests && ok; r++) {
+    request.str("");
+    for (size_t i = 0; i < num_features; i++) {
+      request << (i > 0 ? "," : "") << dist(rng);
+    }
+    request << "\n";
+    auto start = std::chrono::steady_clock::now();
+    ok = line_socket::writeAll(fd, request.str()) &&
+      reader.readLine(&reply) && reply.compare(0, 5, "error") != 0;
+    latencies->push_back(std::chrono::duration<double>(
+	std::chrono::steady_clock::now() - start).count());
+  }
+  close(fd);
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  string address = "/tmp/nn_server.sock", value;
+  size_t num_connections = 16, num_requests = 1000, num_features = 0;
+  for (int i = 1; i < argc; i++) {
+    if (flagValue(argv[i], "--connect", &value)) {
+      address = value;
+    } else if (flagValue(argv[i], "--connections", &value)) {
+      num_connections = strtoul(value.c_str(), nullptr, 10);
+    } else if (flagValue(argv[i], "--requests", &value)) {
+      num_requests = strtoul(value.c_str(), nullptr, 10);
+    } else if (flagValue(argv[i], "--features", &value)) {
+      num_features = strtoul(value.c_str(), nullptr, 10);
+    } else {
+      std::cerr << "unknown flag: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (num_features == 0) {
+    std::cerr << "--features is required" << std::endl;
+    return 1;
+  }
+
+  vector<vector<double>> latencies(num_connections);
+  vector<char> ok(num_connections, 0);
+  vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t c = 0; c < num_connections; c++) {
+    threads.emplace_back([&, c]() {
+	ok[c] = runConnection(address, num_requests, num_features, c,
+			      &latencies[c]);
+      });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  vector<double> all;
+  for (size_t c = 0; c < num_connections; c++) {
+    if (!ok[c]) {
+      std::cerr << "connection " << c << " failed" << std::endl;
+    }
+    all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+  }
+  if (all.empty()) {
+    return 1;
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&all](double p) {
+    return all[std::min(all.size() - 1,
+			static_cast<size_t>(p * all.size()))] * 1e6;
+  };
+  std::cout << all.size() << " requests in " << seconds << "s: " <<
+    all.size() / seconds << " requests/s" << std::endl;
+  std::cout << "latency us: p50 " << percentile(0.5) << " p90 " <<
+    percentile(0.9) << " p99 " << percentile(0.99) << " max " <<
+    all.back() * 1e6 << std::endl;
+
+  int fd = line_socket::connectTo(address);
+  string stats;
+  if (fd >= 0 && line_socket::writeAll(fd, "stats\n")) {
+    line_socket::LineReader reader(fd);
+    if (reader.readLine(&stats)) {
+      std::cout << "server " << stats << std::endl;
+    }
+    close(fd);
+  }
+  return std::all_of(ok.begin(), ok.end(), [](char c) { return c != 0; }) ?
+    0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "csv.h"
 #include "dataset.h"
+#include "example_file.h"
 #include "nn.h"
 
 #include <iomanip>
@@ -7,6 +8,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <fstream>
 
 void processDate(const string& date, vector<string>* fields) {
   std::istringstream is(date);
@@ -23,8 +25,12 @@ void processDate(const string& date, vector<string>* fields) {
   fields->push_back(os.str()); os.str(""); os.clear();
 }
 
-int main(int argc, char **argv) {
-  io::CSVReader<7> in("Plant_1_Generation_Data.csv");
+const char* kDataPath = "Plant_1_Generation_Data.csv";
+
+// Parses and featurizes the plant data, writing the examples to path
+// stamped with source, the data file's stamp.
+bool writeExampleFile(const char* path, const ExampleSourceStamp& source) {
+  io::CSVReader<7> in(kDataPath);
   vector<string> field_names = {
     "YEAR", "MONTH", "DAY", "HOUR",  "PLANT_ID", "SOURCE_KEY",
 		    "DC_POWER", "AC_POWER", "DAILY_YIELD"};
@@ -32,8 +38,10 @@ int main(int argc, char **argv) {
 		    "DATE_TIME", "PLANT_ID", "SOURCE_KEY",
 		    "DC_POWER", "AC_POWER", "DAILY_YIELD",
 		 "TOTAL_YIELD");
-  Dataset dataset(field_names,
-		  field_names.size() - 1);
+  // DC_POWER, AC_POWER and DAILY_YIELD are trained together, sharing
+  // the hidden layer.
+  vector<size_t> label_indices = { 6, 7, 8 };
+  Dataset dataset(field_names, label_indices);
   vector<string> values(7);
   while(in.read_row(values[0], values[1], values[2], values[3],
 		    values[4], values[5], values[6])) {
@@ -45,11 +53,31 @@ int main(int argc, char **argv) {
     dataset.add_row(full_fields);
   }
   dataset.process_features();
-  size_t num_fields = dataset.output_features().size();
-  NNParams params(num_fields, 200, 1e-8, 4, 10, 0.001);
+  return dataset.write_examples(path, 4096, source);
+}
+
+int main(int argc, char **argv) {
+  // Parsing the CSV dominates short runs, so the processed examples are
+  // kept in an example file and reused by later runs, until the CSV's
+  // size or modification time no longer match the ones it was made
+  // from.
+  const char* example_path = "Plant_1_Generation_Data.nnex";
+  ExampleSourceStamp data;
+  if (!ExampleSourceStamp::of(kDataPath, &data)) {
+    std::cerr << "couldn't read " << kDataPath << std::endl;
+    return 1;
+  }
+  MappedExampleFile examples;
+  bool current = examples.open(example_path) && examples.source() == data;
+  if (!current && (!writeExampleFile(example_path, data) ||
+		   !examples.open(example_path))) {
+    std::cerr << "couldn't write " << example_path << std::endl;
+    return 1;
+  }
+  NNParams params(examples.numFeatures(), 200, 1e-8, 4, 10, 0.001);
   NN nn(params);
   nn.addLayer(LayerType::RELU, 10);
-  nn.addOutputLayer(LayerType::RELU);
+  nn.addOutputLayer(LayerType::RELU, examples.numLabels());
   srand(42);
   nn.initializeWeights([](size_t i, size_t j, size_t k) {
       return static_cast<float>(((rand() % 100)*0.01)-0.5);
@@ -58,14 +86,13 @@ int main(int argc, char **argv) {
       return static_cast<float>(((rand() % 100)*0.01)-0.5);
     });
 
-  pair<vector<float>, float> example;
-  for (dataset.next(&example); dataset.hasNext();
-       dataset.next(&example)) {
-    nn.submitForAdd(example);
-  }
-
   TrainingReport report;
-  nn.train(&report);
+  nn.train(&examples, &report);
   std::cout << report.toString() << std::endl;
+  // The trained model can be served with nn_server --model=<path>.
+  if (argc > 1) {
+    std::ofstream out(argv[1]);
+    nn.save(out);
+  }
   return 0;
 }
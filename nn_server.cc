@@ -0,0 +1,335 @@
+// Serves inference for a saved model over a local Unix or TCP socket.
+// Each request is one line of comma-separated feature values and gets
+// one line back with the network's outputs, comma-separated.
+// Concurrent requests are coalesced into micro batches. A line reading
+// "stats" gets the number of requests and batches run so far.
+//
+// With --transform, a FeatureTransform saved from the training Dataset,
+// requests are raw comma-separated rows instead (with every field the
+// dataset had; label fields may be left empty), and replies are
+// unscaled predictions.
+//
+// With --tuning_cache, the batched kernels' blocking is tuned for this
+// host's CPU at startup, and the choices are kept in the given file for
+// the next start on the same kind of CPU.
+//
+// With --numa, each NUMA node gets its own copy of the model and its
+// own batcher, with the batcher's worker pinned to the node's CPUs.
+// Connections are spread over the nodes, and each connection's thread
+// is pinned to its node, so scoring reads node-local weights. With
+// --huge_pages, the weights are also backed by transparent huge pages
+// where the kernel allows.
+//
+// With --cache=N, up to N inputs' outputs are kept (per NUMA node), so
+// repeated inputs skip the batcher and the network; --cache_quantum=Q
+// rounds features to multiples of Q first, so nearby inputs share
+// entries. "stats" then also reports the cache's hits and misses.
+//
+// A connection sending a line longer than --max_line bytes (default
+// 1 MiB) is closed, after an error line the client may not get to
+// read.
+//
+// Usage: nn_server --model=PATH [--transform=PATH] [--listen=ADDR]
+//                  [--max_batch=N] [--max_wait_us=N] [--tuning_cache=PATH]
+//                  [--numa] [--huge_pages] [--cache=N] [--cache_quantum=Q]
+//                  [--max_line=N]
+// ADDR is a socket path (default /tmp/nn_server.sock) or host:port.
+
+#include "autotune.h"
+#include "batcher.h"
+#include "feature_transform.h"
+#include "inference_cache.h"
+#include "line_socket.h"
+#include "model_handle.h"
+#include "nn.h"
+#include "numa.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+bool flagValue(const char* arg, const char* name, string* value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+    *value = arg + len + 1;
+    return true;
+  }
+  return false;
+}
+
+// Parses comma-separated floats; false if any field isn't a number.
+bool parseFeatures(const string& line, vector<float>* features) {
+  features->clear();
+  const char* p = line.c_str();
+  while (*p != 0) {
+    char* end;
+    float val = strtof(p, &end);
+    if (end == p) {
+      return false;
+    }
+    features->push_back(val);
+    p = end;
+    while (*p == ' ') {
+      p++;
+    }
+    if (*p == ',') {
+      p++;
+    } else if (*p != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The model's outputs for features, from cache if it's non-null and
+// has them.
+vector<float> score(InferenceBatcher* batcher, InferenceCache* cache,
+		    vector<float>* features) {
+  if (cache == nullptr) {
+    return batcher->inferAll(*features);
+  }
+  vector<float> outputs;
+  uint64_t version;
+  if (cache->find(*features, &outputs, &version)) {
+    return outputs;
+  }
+  cache->quantize(features);
+  outputs = batcher->inferAll(*features);
+  if (!outputs.empty()) {
+    cache->insert(*features, version, outputs);
+  }
+  return outputs;
+}
+
+// What connections are served with. Connection threads are detached,
+// so each shares ownership of it, and it outlives main if need be.
+struct Serving {
+  // Before the batchers and caches, which use them, so destroyed after.
+  vector<std::unique_ptr<ModelHandle>> models;
+  vector<std::unique_ptr<InferenceBatcher>> batchers;
+  vector<std::unique_ptr<InferenceCache>> caches;
+  std::unique_ptr<FeatureTransform> transform;
+  unsigned int numInputs = 0;
+  size_t maxLineLength = 1 << 20;
+};
+
+// Serves a connection with the given node's batcher and cache (if
+// caching).
+void serveConnection(int fd, const Serving& serving, size_t node) {
+  const vector<std::unique_ptr<InferenceBatcher>>& batchers =
+    serving.batchers;
+  const vector<std::unique_ptr<InferenceCache>>& caches = serving.caches;
+  unsigned int num_inputs = serving.numInputs;
+  const FeatureTransform* transform = serving.transform.get();
+  InferenceBatcher* batcher = batchers[node].get();
+  InferenceCache* cache = caches.empty() ? nullptr : caches[node].get();
+  line_socket::LineReader reader(fd, serving.maxLineLength);
+  string line;
+  vector<float> features(num_inputs);
+  std::ostringstream reply;
+  reply << std::setprecision(9);
+  while (reader.readLine(&line)) {
+    reply.str("");
+    if (line == "stats") {
+      uint64_t requests = 0, batches = 0;
+      for (const auto& node_batcher : batchers) {
+	requests += node_batcher->requestsRun();
+	batches += node_batcher->batchesRun();
+      }
+      reply << "requests " << requests << " batches " << batches;
+      if (!caches.empty()) {
+	uint64_t hits = 0, misses = 0;
+	for (const auto& node_cache : caches) {
+	  hits += node_cache->hits();
+	  misses += node_cache->misses();
+	}
+	reply << " cache_hits " << hits << " cache_misses " << misses;
+      }
+      reply << "\n";
+    } else if (transform != nullptr) {
+      features.resize(num_inputs);
+      if (!transform->transformLine(line.data(), line.size(), ',',
+				    features.data())) {
+	reply << "error: expected " << transform->numFields() <<
+	  " comma-separated fields\n";
+      } else {
+	vector<float> outputs = score(batcher, cache, &features);
+	for (size_t i = 0; i < outputs.size(); i++) {
+	  if (i < transform->numLabels()) {
+	    outputs[i] = transform->unscaleLabel(outputs[i], i);
+	  }
+	  reply << (i > 0 ? "," : "") << outputs[i];
+	}
+	reply << "\n";
+      }
+    } else if (!parseFeatures(line, &features) ||
+	       features.size() != num_inputs) {
+      reply << "error: expected " << num_inputs <<
+	" comma-separated numbers\n";
+    } else {
+      vector<float> outputs = score(batcher, cache, &features);
+      for (size_t i = 0; i < outputs.size(); i++) {
+	reply << (i > 0 ? "," : "") << outputs[i];
+      }
+      reply << "\n";
+    }
+    if (!line_socket::writeAll(fd, reply.str())) {
+      break;
+    }
+  }
+  if (reader.tooLong()) {
+    line_socket::writeAll(fd, "error: line longer than " +
+			  std::to_string(serving.maxLineLength) +
+			  " bytes\n");
+  }
+  close(fd);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  string model_path, transform_path, address = "/tmp/nn_server.sock", value;
+  string tuning_cache;
+  bool numa = false, huge_pages = false;
+  BatcherParams batcher_params;
+  InferenceCacheParams cache_params;
+  cache_params.capacity = 0;
+  auto serving = std::make_shared<Serving>();
+  for (int i = 1; i < argc; i++) {
+    if (flagValue(argv[i], "--model", &value)) {
+      model_path = value;
+    } else if (flagValue(argv[i], "--transform", &value)) {
+      transform_path = value;
+    } else if (flagValue(argv[i], "--listen", &value)) {
+      address = value;
+    } else if (flagValue(argv[i], "--max_batch", &value)) {
+      batcher_params.maxBatchSize = std::max(1, atoi(value.c_str()));
+    } else if (flagValue(argv[i], "--max_wait_us", &value)) {
+      batcher_params.maxWait = std::chrono::microseconds(atoi(value.c_str()));
+    } else if (flagValue(argv[i], "--tuning_cache", &value)) {
+      tuning_cache = value;
+    } else if (flagValue(argv[i], "--cache", &value)) {
+      cache_params.capacity = std::max(0, atoi(value.c_str()));
+    } else if (flagValue(argv[i], "--cache_quantum", &value)) {
+      cache_params.quantum = atof(value.c_str());
+    } else if (flagValue(argv[i], "--max_line", &value)) {
+      serving->maxLineLength = std::max(1, atoi(value.c_str()));
+    } else if (strcmp(argv[i], "--numa") == 0) {
+      numa = true;
+    } else if (strcmp(argv[i], "--huge_pages") == 0) {
+      huge_pages = true;
+    } else {
+      std::cerr << "unknown flag: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  std::ifstream model_file(model_path);
+  std::unique_ptr<NN> nn = NN::load(model_file);
+  if (nn == nullptr) {
+    std::cerr << "couldn't load a model from '" << model_path << "'" <<
+      std::endl;
+    return 1;
+  }
+  unsigned int num_inputs = nn->params->numInputs;
+  serving->numInputs = num_inputs;
+  std::unique_ptr<FeatureTransform>& transform = serving->transform;
+  if (!transform_path.empty()) {
+    std::ifstream transform_file(transform_path);
+    transform = FeatureTransform::load(transform_file);
+    if (transform == nullptr || transform->numFeatures() != num_inputs) {
+      std::cerr << "couldn't load a transform for the model from '" <<
+	transform_path << "'" << std::endl;
+      return 1;
+    }
+  }
+  if (!tuning_cache.empty()) {
+    auto tuner = std::make_shared<KernelAutotuner>(tuning_cache);
+    // Batches take any size up to max_batch; the tuner rounds sizes up
+    // to powers of two.
+    vector<size_t> batch_sizes;
+    for (size_t size = 1; size < 2 * batcher_params.maxBatchSize; size *= 2) {
+      batch_sizes.push_back(size);
+    }
+    tuner->tune(*nn, batch_sizes);
+    std::cerr << "tuned " << tuner->numTuned() << " kernel shapes for " <<
+      tuner->cpuModel() << std::endl;
+    nn->kernelTuning = tuner;
+  }
+  std::cerr << "scratch per batch of " << batcher_params.maxBatchSize <<
+    ": " << nn->planInference(batcher_params.maxBatchSize).arenaBytes() <<
+    " bytes" << std::endl;
+  NumaTopology topology = (numa ? NumaTopology::discover() :
+			   NumaTopology::singleNode());
+  vector<std::unique_ptr<ModelHandle>>& models = serving->models;
+  vector<std::unique_ptr<InferenceBatcher>>& batchers = serving->batchers;
+  vector<std::unique_ptr<InferenceCache>>& caches = serving->caches;
+  for (size_t node = 0; node < topology.numNodes(); node++) {
+    std::unique_ptr<NN> replica;
+    if (numa) {
+      runOnNode(topology, node, [&nn, &replica]() { replica = nn->clone(); });
+    } else {
+      replica = std::move(nn);
+    }
+    if (huge_pages) {
+      adviseHugePages(*replica);
+    }
+    models.emplace_back(new ModelHandle(std::move(replica)));
+    BatcherParams node_params = batcher_params;
+    if (numa) {
+      vector<int> cpus = topology.nodes()[node].cpus;
+      node_params.onWorkerStart = [cpus]() { pinCurrentThread(cpus); };
+    }
+    batchers.emplace_back(new InferenceBatcher(models.back().get(),
+					       node_params));
+    if (cache_params.capacity > 0) {
+      caches.emplace_back(new InferenceCache(models.back().get(),
+					     cache_params));
+    }
+  }
+  if (numa) {
+    std::cerr << "serving from " << topology.numNodes() <<
+      " NUMA node(s)" << std::endl;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  int listen_fd = line_socket::listenOn(address);
+  if (listen_fd < 0) {
+    std::cerr << "couldn't listen on " << address << ": " <<
+      strerror(errno) << std::endl;
+    return 1;
+  }
+  std::cerr << "serving " << model_path << " on " << address << std::endl;
+  size_t next_node = 0;
+  for (;;) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      std::cerr << "accept failed: " << strerror(errno) << std::endl;
+      return 1;
+    }
+    size_t node = next_node++ % batchers.size();
+    vector<int> cpus;
+    if (numa) {
+      cpus = topology.nodes()[node].cpus;
+    }
+    std::thread([serving, fd, node, cpus]() {
+	if (!cpus.empty()) {
+	  pinCurrentThread(cpus);
+	}
+	serveConnection(fd, *serving, node);
+      }).detach();
+  }
+}
@@ -3,6 +3,26 @@
 #include "gtest/gtest.h"
 #include "gradient_test.h"
 
+TEST(Vector2dTest, TransposeMultiply) {
+  // Wide enough to span more than one column block.
+  vector2d<float> m(3, 600);
+  for (size_t i = 0; i < m.row_size; i++) {
+    for (size_t j = 0; j < m.col_size; j++) {
+      m.at(i, j) = 0.01 * (i + 1) * ((j % 7) - 3.0);
+    }
+  }
+  vector<float> v { 1.0, -2.0, 0.5 };
+  vector<float> out(m.col_size, 42.0);
+  m.transposeMultiply(v.data(), out.data());
+  for (size_t j = 0; j < m.col_size; j++) {
+    float expected = 0.0;
+    for (size_t i = 0; i < m.row_size; i++) {
+      expected += v[i] * m.at(i, j);
+    }
+    EXPECT_FLOAT_EQ(expected, out[j]) << ": column " << j;
+  }
+}
+
 TEST(SigmoidNNLayerTest, TestActivation) {
   SigmoidNNLayer layer(3, 2);
   layer.inWeights.data = { 0.5, 0.2, -1.0, 0.1,
@@ -293,3 +313,203 @@ TEST_F(NNTest, NNBackPropagateAtDifferentLearningRates) {
   EXPECT_TRUE(floatVector2DsEqualTo(updatedWeightsLayer1, nn->layers[1]->inWeights));
 }
 
+
+TEST_F(NNTest, NNInferenceRecordsForwardPass) {
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(0.1*(j+1));
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(-0.1);
+    });
+  vector<float> inputs { 0.5, 1.0, -0.1, 2.5, 0.0, 0.0, -0.2, 0.6, 0.5, 0.3 };
+  ForwardPass pass;
+  nn->prepareForwardPass(&pass);
+  float result = nn->inference(inputs, &pass);
+  EXPECT_FLOAT_EQ(nn->inference(inputs), result);
+  ASSERT_EQ(2, pass.preActivations.size());
+  ASSERT_EQ(3, pass.outputs.size());
+  for (size_t i = 0; i < nn->layers.size(); i++) {
+    for (size_t j = 0; j < pass.preActivations[i].size(); j++) {
+      EXPECT_FLOAT_EQ(nn->layers[i]->preActivation(j, pass.outputs[i]),
+		      pass.preActivations[i][j]);
+      EXPECT_FLOAT_EQ(nn->layers[i]->activation(j, pass.outputs[i]),
+		      pass.outputs[i+1][j]);
+    }
+  }
+}
+
+TEST_F(NNTest, TrainPopulatesTimingReport) {
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(0.1*(j+1));
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(0.0);
+    });
+  for (int i = 0; i < 20; i++) {
+    vector<float> inputs(10, 0.05 * i);
+    nn->submitForAdd(make_pair(inputs, (i % 2 == 0 ? 1.0f : 0.0f)));
+  }
+  TrainingReport report;
+  ASSERT_TRUE(nn->train(&report));
+  ASSERT_FALSE(report.losses.empty());
+  EXPECT_EQ(report.losses.size(), report.epochSeconds.size());
+  EXPECT_GT(report.timeElapsed, 0.0);
+  EXPECT_GT(report.examplesPerSecond, 0.0);
+  EXPECT_GT(report.phases.forward, 0.0);
+  EXPECT_GT(report.phases.backward, 0.0);
+  EXPECT_LE(report.phases.total(), report.timeElapsed * 1.01);
+  EXPECT_GT(report.peakMemoryBytes, 0);
+}
+
+TEST_F(NNTest, UpdateOnlineTakesBoundedSteps) {
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(0.1*(j+1));
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(0.0);
+    });
+  vector<pair<vector<float>, float>> batch;
+  for (int i = 0; i < 4; i++) {
+    batch.push_back(make_pair(vector<float>(10, 0.1 * i), 1.0f));
+  }
+  float before = nn->evaluate(batch);
+  vector<float> weights = nn->layers[0]->inWeights.data;
+  float loss = nn->updateOnline(batch, 0);
+  EXPECT_FLOAT_EQ(0.0, loss);
+  EXPECT_EQ(weights, nn->layers[0]->inWeights.data);
+
+  nn->params->minDeltaSgd = 0.0;
+  nn->updateOnline(batch, 5);
+  EXPECT_LT(nn->evaluate(batch), before);
+}
+
+TEST_F(NNTest, SaveAndLoadRoundTrip) {
+  srand(3);
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    });
+  std::stringstream stream;
+  ASSERT_TRUE(nn->save(stream));
+  std::unique_ptr<NN> loaded = NN::load(stream);
+  ASSERT_NE(nullptr, loaded);
+  EXPECT_EQ(nn->params->numInputs, loaded->params->numInputs);
+  EXPECT_FLOAT_EQ(nn->params->learningRate, loaded->params->learningRate);
+  ASSERT_EQ(nn->layers.size(), loaded->layers.size());
+  for (size_t i = 0; i < nn->layers.size(); i++) {
+    EXPECT_EQ(nn->layers[i]->type(), loaded->layers[i]->type());
+    EXPECT_EQ(nn->layers[i]->inWeights.data,
+	      loaded->layers[i]->inWeights.data);
+    EXPECT_EQ(nn->layers[i]->bias, loaded->layers[i]->bias);
+  }
+
+  std::stringstream truncated("nn 1\nparams 10 40 0.0001 1 10 0.01\n"
+			      "layers 1\nlayer relu 4 10 0.01\n0.1 0.2");
+  EXPECT_EQ(nullptr, NN::load(truncated));
+}
+
+TEST_F(NNTest, InferenceBatchMatchesInference) {
+  srand(5);
+  nn->initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    });
+  vector<vector<float>> inputs;
+  for (int e = 0; e < 7; e++) {
+    vector<float> x(10);
+    for (size_t k = 0; k < x.size(); k++) {
+      x[k] = 0.1 * ((e * 3 + k) % 11) - 0.4;
+    }
+    inputs.push_back(x);
+  }
+  vector<float> results;
+  nn->inferenceBatch(inputs, &results);
+  ASSERT_EQ(inputs.size(), results.size());
+  for (size_t e = 0; e < inputs.size(); e++) {
+    EXPECT_EQ(nn->inference(inputs[e]), results[e]);
+  }
+}
+
+TEST(MultiOutputNNTest, TrainsEveryTarget) {
+  NNParams params(2, 200, DEFAULT_MIN_DELTA, 4, 1, 0.05);
+  params.verbose = false;
+  NN nn(params);
+  nn.addLayer(LayerType::RELU, 8);
+  nn.addOutputLayer(LayerType::RELU, 3);
+  ASSERT_EQ(3, nn.numOutputs());
+  srand(7);
+  nn.initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+    });
+  for (int e = 0; e < 40; e++) {
+    float x0 = 0.025 * e, x1 = 1.0 - 0.025 * e;
+    nn.submitForAdd(make_pair(vector<float>{ x0, x1 },
+			      vector<float>{ x0, x1, 0.5f * (x0 + x1) }));
+  }
+  vector<float> before;
+  nn.evaluate(nn.multiTargetExamples, &before);
+  ASSERT_EQ(3, before.size());
+
+  TrainingReport report;
+  ASSERT_TRUE(nn.train(&report));
+  ASSERT_EQ(report.losses.size(), report.targetLosses.size());
+  for (size_t i = 0; i < report.losses.size(); i++) {
+    ASSERT_EQ(3, report.targetLosses[i].size());
+    EXPECT_FLOAT_EQ(report.losses[i], report.targetLosses[i][0] +
+		    report.targetLosses[i][1] + report.targetLosses[i][2]);
+  }
+  vector<float> after;
+  float total = nn.evaluate(nn.multiTargetExamples, &after);
+  EXPECT_FLOAT_EQ(total, after[0] + after[1] + after[2]);
+  for (size_t j = 0; j < 3; j++) {
+    EXPECT_LT(after[j], before[j]) << "target " << j;
+  }
+
+  vector<float> outputs;
+  nn.inferenceAll({ 0.25, 0.75 }, &outputs);
+  ASSERT_EQ(3, outputs.size());
+  EXPECT_EQ(nn.inference({ 0.25, 0.75 }), outputs[0]);
+  vector<float> batch_results;
+  nn.inferenceBatch({ { 0.25, 0.75 }, { 0.5, 0.5 } }, &batch_results);
+  ASSERT_EQ(6, batch_results.size());
+  EXPECT_EQ(outputs, vector<float>(batch_results.begin(),
+				   batch_results.begin() + 3));
+}
+
+TEST(MultiOutputNNTest, OneTargetMatchesSingleLabel) {
+  NNParams params(3, 5, DEFAULT_MIN_DELTA, 4, 1, 0.05);
+  params.verbose = false;
+  NN single(params), multi(params);
+  for (NN* nn : { &single, &multi }) {
+    nn->addLayer(LayerType::RELU, 4);
+    nn->addOutputLayer(LayerType::SIGMOID);
+    srand(11);
+    nn->initializeWeights([](size_t i, size_t j, size_t k) {
+	return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+      },
+      [](size_t i, size_t j) {
+	return static_cast<float>((rand() % 1000) * 0.001 - 0.5);
+      });
+  }
+  for (int e = 0; e < 10; e++) {
+    vector<float> x = { 0.1f * e, 0.05f * e, 1.0f - 0.1f * e };
+    float y = (e % 3 == 0 ? 1.0 : 0.0);
+    single.submitForAdd(make_pair(x, y));
+    multi.submitForAdd(make_pair(x, vector<float>{ y }));
+  }
+  TrainingReport single_report, multi_report;
+  single.train(&single_report);
+  multi.train(&multi_report);
+  EXPECT_EQ(single_report.losses, multi_report.losses);
+  for (size_t i = 0; i < single.layers.size(); i++) {
+    EXPECT_EQ(single.layers[i]->inWeights.data,
+	      multi.layers[i]->inWeights.data);
+  }
+}
@@ -0,0 +1,145 @@
+// One process of a data-parallel training job. Each of N workers loads
+// its own contiguous 1/N of the rows of an example file (as nn_main
+// writes them), and the workers train identical copies of the network
+// nn_main builds, summing their gradients over a ring of socket
+// connections between them; see DataParallelTrainer.
+//
+// Usage: nn_worker --examples=PATH --rank=R --peers=ADDR,ADDR,...
+//                  [--model=PATH] [--batch=N] [--iterations=N]
+//                  [--learning_rate=X]
+// peers lists every worker's address, in rank order, the same for all
+// of them; each is a socket path or host:port. Rank 0 prints the loss
+// at each iteration and, with --model, saves the trained model there.
+
+#include "data_parallel.h"
+#include "example_file.h"
+#include "nn.h"
+#include "ring_allreduce.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool flagValue(const char* arg, const char* name, string* value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+    *value = arg + len + 1;
+    return true;
+  }
+  return false;
+}
+
+vector<string> splitCommas(const string& list) {
+  vector<string> fields;
+  size_t start = 0;
+  for (;;) {
+    size_t comma = list.find(',', start);
+    fields.push_back(list.substr(start, comma - start));
+    if (comma == string::npos) {
+      return fields;
+    }
+    start = comma + 1;
+  }
+}
+
+// Reads rows [begin, end) of the example file.
+void readRows(MappedExampleFile* file, size_t begin, size_t end,
+	      vector<pair<vector<float>, vector<float>>>* examples) {
+  vector<pair<vector<float>, vector<float>>> batch;
+  size_t row = 0;
+  file->rewind();
+  while (row < end && file->nextBatch(&batch)) {
+    for (size_t i = 0; i < batch.size() && row < end; i++, row++) {
+      if (row >= begin) {
+	examples->push_back(std::move(batch[i]));
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  string examples_path, model_path, peers, value;
+  size_t rank = 0;
+  unsigned int iterations = 200;
+  float learning_rate = 0.01;
+  DataParallelParams params;
+  for (int i = 1; i < argc; i++) {
+    if (flagValue(argv[i], "--examples", &value)) {
+      examples_path = value;
+    } else if (flagValue(argv[i], "--rank", &value)) {
+      rank = atoi(value.c_str());
+    } else if (flagValue(argv[i], "--peers", &value)) {
+      peers = value;
+    } else if (flagValue(argv[i], "--model", &value)) {
+      model_path = value;
+    } else if (flagValue(argv[i], "--batch", &value)) {
+      params.batchSize = std::max(1, atoi(value.c_str()));
+    } else if (flagValue(argv[i], "--iterations", &value)) {
+      iterations = atoi(value.c_str());
+    } else if (flagValue(argv[i], "--learning_rate", &value)) {
+      learning_rate = atof(value.c_str());
+    } else {
+      std::cerr << "unknown flag: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  vector<string> addresses = splitCommas(peers);
+  if (peers.empty() || rank >= addresses.size()) {
+    std::cerr << "--rank must index the --peers list" << std::endl;
+    return 1;
+  }
+  MappedExampleFile file;
+  if (!file.open(examples_path)) {
+    std::cerr << "couldn't open " << examples_path << std::endl;
+    return 1;
+  }
+  size_t num_ranks = addresses.size();
+  vector<pair<vector<float>, vector<float>>> shard;
+  readRows(&file, rank * file.numRows() / num_ranks,
+	   (rank + 1) * file.numRows() / num_ranks, &shard);
+
+  RingAllReduce ring(rank, addresses);
+  if (!ring.connect()) {
+    std::cerr << "couldn't connect to the other workers" << std::endl;
+    return 1;
+  }
+  NNParams nn_params(file.numFeatures(), iterations, 1e-8, 4,
+		     params.batchSize, learning_rate);
+  nn_params.verbose = (rank == 0);
+  NN nn(nn_params);
+  nn.addLayer(LayerType::RELU, 10);
+  nn.addOutputLayer(LayerType::RELU, file.numLabels());
+  // The same seed on every worker gives identical replicas.
+  srand(42);
+  nn.initializeWeights([](size_t i, size_t j, size_t k) {
+      return static_cast<float>(((rand() % 100)*0.01)-0.5);
+    },
+    [](size_t i, size_t j) {
+      return static_cast<float>(((rand() % 100)*0.01)-0.5);
+    });
+
+  DataParallelTrainer trainer(&ring, params);
+  TrainingReport report;
+  if (!trainer.train(&nn, shard, &report)) {
+    std::cerr << "training failed: lost a connection or a worker has no "
+      "examples" << std::endl;
+    return 1;
+  }
+  if (rank == 0) {
+    std::cout << report.toString() << std::endl;
+    std::cout << "sent " << ring.bytesSent() << " bytes" << std::endl;
+    if (!model_path.empty()) {
+      std::ofstream out(model_path);
+      nn.save(out);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+namespace {
+
+const size_t kHugePageBytes = 2 << 20;
+
+}  // namespace
+
+bool parseCpuList(const string& list, vector<int>* cpus) {
+  cpus->clear();
+  std::istringstream ranges(list);
+  string range;
+  while (std::getline(ranges, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace),
+		range.end());
+    if (range.empty()) {
+      continue;
+    }
+    char* end;
+    long first = strtol(range.c_str(), &end, 10), last = first;
+    if (end == range.c_str() || first < 0) {
+      return false;
+    }
+    if (*end == '-') {
+      const char* start = end + 1;
+      last = strtol(start, &end, 10);
+      if (end == start || last < first) {
+	return false;
+      }
+    }
+    if (*end != '\0') {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus->push_back(cpu);
+    }
+  }
+  return true;
+}
+
+vector<int> allowedCpus() {
+  vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+	cpus.push_back(cpu);
+      }
+    }
+  }
+  if (cpus.empty()) {
+    // No affinity information: assume every hardware thread.
+    for (unsigned int cpu = 0; cpu < std::thread::hardware_concurrency();
+	 cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+NumaTopology NumaTopology::discover(const string& sysfs_root) {
+  return fromSysfs(sysfs_root, allowedCpus());
+}
+
+NumaTopology NumaTopology::fromSysfs(const string& sysfs_root,
+				     const vector<int>& allowed_cpus) {
+  NumaTopology topology;
+  DIR* dir = opendir(sysfs_root.c_str());
+  if (dir != nullptr) {
+    while (dirent* entry = readdir(dir)) {
+      string name = entry->d_name;
+      char* end;
+      long id = (name.compare(0, 4, "node") == 0 && name.size() > 4 ?
+		 strtol(name.c_str() + 4, &end, 10) : -1);
+      if (id < 0 || *end != '\0') {
+	continue;
+      }
+      std::ifstream cpulist(sysfs_root + "/" + name + "/cpulist");
+      string list;
+      vector<int> cpus;
+      if (!std::getline(cpulist, list) || !parseCpuList(list, &cpus)) {
+	continue;
+      }
+      NumaNode node;
+      node.id = id;
+      for (int cpu : cpus) {
+	if (std::find(allowed_cpus.begin(), allowed_cpus.end(), cpu) !=
+	    allowed_cpus.end()) {
+	  node.cpus.push_back(cpu);
+	}
+      }
+      std::sort(node.cpus.begin(), node.cpus.end());
+      if (!node.cpus.empty()) {
+	topology.nodes_.push_back(node);
+      }
+    }
+    closedir(dir);
+  }
+  if (topology.nodes_.empty()) {
+    NumaNode node;
+    node.id = 0;
+    node.cpus = allowed_cpus;
+    topology.nodes_.push_back(node);
+  }
+  std::sort(topology.nodes_.begin(), topology.nodes_.end(),
+	    [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+  return topology;
+}
+
+NumaTopology NumaTopology::singleNode() {
+  return fromSysfs("", allowedCpus());
+}
+
+size_t NumaTopology::nodeOfCpu(int cpu) const {
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    const vector<int>& cpus = nodes_[i].cpus;
+    if (std::binary_search(cpus.begin(), cpus.end(), cpu)) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+size_t NumaTopology::currentNode() const {
+  if (nodes_.size() == 1) {
+    return 0;
+  }
+  int cpu = sched_getcpu();
+  return (cpu < 0 ? 0 : nodeOfCpu(cpu));
+}
+
+int NumaTopology::cpuForWorker(size_t worker) const {
+  const vector<int>& cpus = nodes_[worker % nodes_.size()].cpus;
+  return (cpus.empty() ? -1 : cpus[(worker / nodes_.size()) % cpus.size()]);
+}
+
+std::function<void(size_t)> NumaTopology::pinWorkers() const {
+  NumaTopology topology = *this;
+  return [topology](size_t worker) {
+    pinCurrentThread(topology.cpuForWorker(worker));
+  };
+}
+
+bool pinCurrentThread(int cpu) {
+  return pinCurrentThread(vector<int>{cpu});
+}
+
+bool pinCurrentThread(const vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  bool any = false;
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+      any = true;
+    }
+  }
+  return any &&
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void runOnNode(const NumaTopology& topology, size_t node,
+	       const std::function<void()>& fn) {
+  const vector<int>& cpus = topology.nodes()[node].cpus;
+  std::thread thread([&cpus, &fn]() {
+      // Unpinned, fn still runs; its memory just lands wherever the
+      // thread happens to be.
+      pinCurrentThread(cpus);
+      fn();
+    });
+  thread.join();
+}
+
+bool adviseHugePages(const void* data, size_t bytes) {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  uintptr_t end = begin + bytes;
+  begin = (begin + kHugePageBytes - 1) & ~(kHugePageBytes - 1);
+  end &= ~(kHugePageBytes - 1);
+  if (end <= begin) {
+    return false;
+  }
+#ifdef MADV_HUGEPAGE
+  return madvise(reinterpret_cast<void*>(begin), end - begin,
+		 MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
+size_t adviseHugePages(const NN& nn) {
+  size_t advised = 0;
+  for (const auto& layer : nn.layers) {
+    const vector<float>& weights = layer->inWeights.data;
+    advised += adviseHugePages(weights.data(),
+			       weights.size() * sizeof(float));
+  }
+  return advised;
+}
@@ -0,0 +1,117 @@
+#ifndef __NUMA_H_
+#define __NUMA_H_
+
+// NUMA awareness for scoring and training threads: the host's node
+// topology (read from sysfs), pinning threads to CPUs, and read-only
+// data replicated per node so threads read memory local to their
+// socket. On hosts without NUMA information everything degrades to a
+// single node, where replication makes one copy and pinning only
+// restricts threads to the CPUs the process may use anyway.
+
+#include "nn.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct NumaNode {
+  int id;            // the kernel's node number
+  vector<int> cpus;  // CPUs this process may run on, ascending
+};
+
+class NumaTopology {
+ public:
+  // Reads the nodes and their CPUs from sysfs, keeping only the CPUs
+  // this process may run on (its affinity mask) and the nodes that
+  // have any. Falls back to singleNode() if sysfs has no node
+  // information.
+  static NumaTopology discover(
+      const string& sysfs_root = "/sys/devices/system/node");
+  // As above, but with the allowed CPUs given.
+  static NumaTopology fromSysfs(const string& sysfs_root,
+				const vector<int>& allowed_cpus);
+  // One node holding every allowed CPU.
+  static NumaTopology singleNode();
+
+  const vector<NumaNode>& nodes() const { return nodes_; }
+  size_t numNodes() const { return nodes_.size(); }
+  // Index in nodes() of the node cpu belongs to, or 0 if it's unknown.
+  size_t nodeOfCpu(int cpu) const;
+  // Index in nodes() of the node the calling thread is running on.
+  size_t currentNode() const;
+  // The CPU to pin worker i of a pool to: workers are spread across
+  // the nodes round-robin, then across each node's CPUs.
+  int cpuForWorker(size_t worker) const;
+  // A ThreadPool on_start function pinning workers as cpuForWorker.
+  std::function<void(size_t)> pinWorkers() const;
+
+ private:
+  vector<NumaNode> nodes_;
+};
+
+// Parses a sysfs CPU list such as "0-3,8,10-11".
+bool parseCpuList(const string& list, vector<int>* cpus);
+// CPUs in the calling thread's affinity mask.
+vector<int> allowedCpus();
+// Restrict the calling thread to the given CPUs. False if none of
+// them can be used, leaving the thread's affinity as it was.
+bool pinCurrentThread(int cpu);
+bool pinCurrentThread(const vector<int>& cpus);
+// Runs fn on a new thread pinned to the given node's CPUs and waits
+// for it. Under the default (first-touch) memory policy, memory fn
+// allocates and first writes is placed on that node.
+void runOnNode(const NumaTopology& topology, size_t node,
+	       const std::function<void()>& fn);
+
+// Asks for transparent huge pages to back the 2MB-aligned part of
+// [data, data + bytes), to cut TLB misses on large weight arrays. Pages
+// already touched are collapsed into huge pages in the background by
+// khugepaged. False if there's no aligned 2MB page in the range or the
+// kernel refused.
+bool adviseHugePages(const void* data, size_t bytes);
+// Advises huge pages for every layer's weights; returns how many
+// layers were advised.
+size_t adviseHugePages(const NN& nn);
+
+// One read-only copy of a T per NUMA node, each built by make(node) on
+// a thread pinned to the node, so its memory is local to the node.
+template <typename T>
+class NodeLocal {
+ public:
+  NodeLocal(const NumaTopology& topology,
+	    const std::function<std::unique_ptr<T>(size_t node)>& make) :
+    topology_(topology), copies_(topology.numNodes()) {
+    for (size_t node = 0; node < copies_.size(); node++) {
+      runOnNode(topology_, node, [this, node, &make]() {
+	  copies_[node] = make(node);
+	});
+    }
+  }
+
+  size_t size() const { return copies_.size(); }
+  const T& at(size_t node) const { return *copies_[node]; }
+  // The copy local to the calling thread's node.
+  const T& local() const { return *copies_[topology_.currentNode()]; }
+
+ private:
+  NumaTopology topology_;
+  vector<std::unique_ptr<const T>> copies_;
+};
+
+// Splits examples into one contiguous shard per node, each copied on
+// its own node.
+template <typename Example>
+NodeLocal<vector<Example>> shardExamples(const NumaTopology& topology,
+					 const vector<Example>& examples) {
+  size_t num_shards = topology.numNodes();
+  return NodeLocal<vector<Example>>(topology, [&](size_t shard) {
+      size_t begin = examples.size() * shard / num_shards;
+      size_t end = examples.size() * (shard + 1) / num_shards;
+      return std::unique_ptr<vector<Example>>(new vector<Example>(
+	  examples.begin() + begin, examples.begin() + end));
+    });
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+#include "thread_pool.h"
+
+class NumaTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = "/tmp/numa_test_" + std::to_string(getpid());
+    mkdir(root_.c_str(), 0755);
+  }
+  void TearDown() override {
+    for (const string& node : nodes_) {
+      remove((root_ + "/" + node + "/cpulist").c_str());
+      rmdir((root_ + "/" + node).c_str());
+    }
+    rmdir(root_.c_str());
+  }
+
+  // Adds a fake sysfs node directory.
+  void addNode(const string& name, const string& cpulist) {
+    mkdir((root_ + "/" + name).c_str(), 0755);
+    std::ofstream(root_ + "/" + name + "/cpulist") << cpulist << "\n";
+    nodes_.push_back(name);
+  }
+
+  string root_;
+  vector<string> nodes_;
+};
+
+TEST_F(NumaTest, ParsesCpuLists) {
+  vector<int> cpus;
+  EXPECT_TRUE(parseCpuList("0-3,8,10-11", &cpus));
+  EXPECT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+  EXPECT_TRUE(parseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(parseCpuList("3-1", &cpus));
+  EXPECT_FALSE(parseCpuList("a", &cpus));
+  EXPECT_FALSE(parseCpuList("1-", &cpus));
+}
+
+TEST_F(NumaTest, ReadsNodesFromSysfs) {
+  addNode("node1", "4-7");
+  addNode("node0", "0-3");
+  addNode("node2", "8-9");  // no allowed CPUs, so dropped
+  addNode("possible", "0-1");
+  NumaTopology topology = NumaTopology::fromSysfs(root_,
+						  {0, 1, 2, 5, 6, 7});
+  ASSERT_EQ(2, topology.numNodes());
+  EXPECT_EQ(0, topology.nodes()[0].id);
+  EXPECT_EQ(vector<int>({0, 1, 2}), topology.nodes()[0].cpus);
+  EXPECT_EQ(1, topology.nodes()[1].id);
+  EXPECT_EQ(vector<int>({5, 6, 7}), topology.nodes()[1].cpus);
+  EXPECT_EQ(1, topology.nodeOfCpu(6));
+  EXPECT_EQ(0, topology.nodeOfCpu(2));
+  // Workers alternate between the nodes.
+  EXPECT_EQ(0, topology.cpuForWorker(0));
+  EXPECT_EQ(5, topology.cpuForWorker(1));
+  EXPECT_EQ(1, topology.cpuForWorker(2));
+  EXPECT_EQ(6, topology.cpuForWorker(3));
+  EXPECT_EQ(0, topology.cpuForWorker(6));
+}
+
+TEST_F(NumaTest, FallsBackToSingleNode) {
+  NumaTopology topology = NumaTopology::fromSysfs(root_ + "/missing",
+						  {0, 1});
+  ASSERT_EQ(1, topology.numNodes());
+  EXPECT_EQ(vector<int>({0, 1}), topology.nodes()[0].cpus);
+  EXPECT_EQ(0, topology.currentNode());
+
+  NumaTopology host = NumaTopology::discover();
+  ASSERT_GE(host.numNodes(), 1);
+  EXPECT_LT(host.currentNode(), host.numNodes());
+}
+
+TEST_F(NumaTest, PinsThreads) {
+  int cpu = allowedCpus().back();
+  std::atomic<int> ran_on{-1};
+  std::thread thread([cpu, &ran_on]() {
+      EXPECT_TRUE(pinCurrentThread(cpu));
+      ran_on = sched_getcpu();
+    });
+  thread.join();
+  EXPECT_EQ(cpu, ran_on.load());
+  EXPECT_FALSE(pinCurrentThread(vector<int>()));
+}
+
+TEST_F(NumaTest, PinsPoolWorkers) {
+  NumaTopology topology = NumaTopology::singleNode();
+  std::function<void(size_t)> pin = topology.pinWorkers();
+  std::mutex mutex;
+  vector<size_t> started;
+  {
+    ThreadPool pool(3, [&](size_t worker) {
+	pin(worker);
+	std::lock_guard<std::mutex> lock(mutex);
+	started.push_back(worker);
+      });
+    pool.schedule([&topology]() {
+	EXPECT_EQ(0, topology.nodeOfCpu(sched_getcpu()));
+      });
+    pool.wait();
+  }
+  std::sort(started.begin(), started.end());
+  EXPECT_EQ(vector<size_t>({0, 1, 2}), started);
+}
+
+TEST_F(NumaTest, ReplicatesPerNode) {
+  int cpu = allowedCpus()[0];
+  addNode("node0", std::to_string(cpu));
+  addNode("node1", std::to_string(cpu));
+  NumaTopology topology = NumaTopology::fromSysfs(root_, {cpu});
+  ASSERT_EQ(2, topology.numNodes());
+
+  NNParams params(3, 1, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+  NN nn(params);
+  nn.addLayer(RELU, 4);
+  nn.addOutputLayer(RELU);
+  nn.initializeWeights([](size_t i, size_t j, size_t k) {
+      return 0.1f * (j + 1) - 0.05f * k;
+    },
+    [](size_t i, size_t j) { return 0.01f * j; });
+  NodeLocal<NN> replicas(topology, [&nn](size_t) { return nn.clone(); });
+  ASSERT_EQ(2, replicas.size());
+  EXPECT_NE(&replicas.at(0), &replicas.at(1));
+  vector<float> x = {0.5, -1.0, 2.0};
+  EXPECT_EQ(nn.inference(x), replicas.at(1).inference(x));
+  EXPECT_EQ(nn.inference(x), replicas.local().inference(x));
+
+  vector<int> examples = {1, 2, 3, 4, 5};
+  NodeLocal<vector<int>> shards = shardExamples(topology, examples);
+  EXPECT_EQ(vector<int>({1, 2}), shards.at(0));
+  EXPECT_EQ(vector<int>({3, 4, 5}), shards.at(1));
+}
+
+TEST_F(NumaTest, AdvisesHugePagesOnlyForAlignedRanges) {
+  vector<float> small(1024);
+  EXPECT_FALSE(adviseHugePages(small.data(), small.size() * sizeof(float)));
+  // 6MB always spans a whole aligned 2MB page, though the kernel may
+  // not support transparent huge pages; just check it's harmless.
+  vector<float> large(6 << 18);
+  adviseHugePages(large.data(), large.size() * sizeof(float));
+  large[123] = 1.0;
+  EXPECT_EQ(1.0, large[123]);
+}
@@ -0,0 +1,72 @@
+#include "pruning.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Zeroes the num_pruned smallest-magnitude weights among layers'. Ties
+// at the threshold are broken in layer and weight order.
+size_t pruneSmallest(const vector<NNLayer*>& layers, size_t num_pruned) {
+  if (num_pruned == 0) {
+    return 0;
+  }
+  vector<float> magnitudes;
+  for (const NNLayer* layer : layers) {
+    for (float w : layer->inWeights.data) {
+      magnitudes.push_back(std::fabs(w));
+    }
+  }
+  num_pruned = std::min(num_pruned, magnitudes.size());
+  std::nth_element(magnitudes.begin(), magnitudes.begin() + num_pruned - 1,
+		   magnitudes.end());
+  float threshold = magnitudes[num_pruned - 1];
+  // nth_element leaves everything smaller than the threshold before it.
+  size_t ties = num_pruned -
+    std::count_if(magnitudes.begin(), magnitudes.begin() + num_pruned,
+		  [threshold](float m) { return m < threshold; });
+  for (NNLayer* layer : layers) {
+    for (float& w : layer->inWeights.data) {
+      float m = std::fabs(w);
+      if (m < threshold || (m == threshold && ties > 0)) {
+	ties -= (m == threshold);
+	w = 0.0;
+      }
+    }
+  }
+  return num_pruned;
+}
+
+}  // namespace
+
+size_t pruneByMagnitude(NN* nn, const PruningParams& params) {
+  float sparsity = std::min(std::max(params.sparsity, 0.0f), 1.0f);
+  size_t pruned = 0;
+  if (params.perLayer) {
+    for (auto& layer : nn->layers) {
+      pruned += pruneSmallest({layer.get()}, static_cast<size_t>(
+	  sparsity * layer->inWeights.data.size()));
+    }
+  } else {
+    vector<NNLayer*> layers;
+    size_t num_weights = 0;
+    for (auto& layer : nn->layers) {
+      layers.push_back(layer.get());
+      num_weights += layer->inWeights.data.size();
+    }
+    pruned = pruneSmallest(layers, static_cast<size_t>(
+	sparsity * num_weights));
+  }
+  if (params.fixMask) {
+    for (auto& layer : nn->layers) {
+      const vector<float>& weights = layer->inWeights.data;
+      layer->pruneMask.resize(weights.size());
+      for (size_t i = 0; i < weights.size(); i++) {
+	layer->pruneMask[i] = (weights[i] != 0);
+      }
+    }
+  }
+  nn->updateSparseWeights();
+  return pruned;
+}
@@ -0,0 +1,25 @@
+#ifndef __PRUNING_H_
+#define __PRUNING_H_
+
+#include "nn.h"
+
+struct PruningParams {
+  // Fraction of the weights to zero, smallest magnitudes first.
+  float sparsity = 0.9;
+  // Whether every layer loses that fraction of its own weights, with
+  // a threshold per layer, rather than the network losing it overall
+  // with one global threshold.
+  bool perLayer = false;
+  // Whether later training keeps the pruned weights at zero, so the
+  // pruned network can be fine-tuned with a fixed mask.
+  bool fixMask = true;
+};
+
+// Zeroes nn's smallest-magnitude weights (biases are kept), then lets
+// layers that are now sparse enough switch to the sparse forward
+// kernels (see NN::maxSparseDensity). Pruning a trained network and
+// fine-tuning it with nn->train usually recovers most of its accuracy.
+// Returns the number of weights pruned.
+size_t pruneByMagnitude(NN* nn, const PruningParams& params);
+
+#endif
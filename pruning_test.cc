@@ -0,0 +1,162 @@
+#include "pruning.h"
+
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+class PruningTest : public ::testing::Test {
+ public:
+  std::unique_ptr<NN> makeModel() {
+    NNParams params(8, 3, DEFAULT_MIN_DELTA, 1, 1, 0.01);
+    params.verbose = false;
+    std::unique_ptr<NN> nn(new NN(params));
+    nn->addLayer(RELU, 40);
+    nn->addLayer(RELU, 20);
+    nn->addOutputLayer(RELU, 2);
+    srand(5);
+    nn->initializeWeights([](size_t i, size_t j, size_t k) {
+	return static_cast<float>((rand() % 1000) * 0.002 - 1.0);
+      },
+      [](size_t i, size_t j) {
+	return static_cast<float>((rand() % 1000) * 0.0002);
+      });
+    for (int e = 0; e < 20; e++) {
+      vector<float> x(8);
+      for (size_t k = 0; k < x.size(); k++) {
+	x[k] = ((e * 7 + k * 3) % 11) * 0.1f;
+      }
+      examples_.push_back(make_pair(x, vector<float>{x[0] + x[1], x[2]}));
+      inputs_.push_back(x);
+    }
+    return nn;
+  }
+
+  static size_t countZeros(const NN& nn) {
+    size_t zeros = 0;
+    for (const auto& layer : nn.layers) {
+      for (float w : layer->inWeights.data) {
+	zeros += (w == 0);
+      }
+    }
+    return zeros;
+  }
+
+  vector<pair<vector<float>, vector<float>>> examples_;
+  vector<vector<float>> inputs_;
+};
+
+TEST_F(PruningTest, PrunesSmallestWeightsGlobally) {
+  std::unique_ptr<NN> nn = makeModel();
+  std::unique_ptr<NN> original = nn->clone();
+  size_t num_weights = 8 * 40 + 40 * 20 + 20 * 2;
+  PruningParams params;
+  params.sparsity = 0.9;
+  EXPECT_EQ(static_cast<size_t>(0.9 * num_weights),
+	    pruneByMagnitude(nn.get(), params));
+  EXPECT_EQ(static_cast<size_t>(0.9 * num_weights), countZeros(*nn));
+  float largest_pruned = 0.0, smallest_kept = 1e9;
+  for (size_t i = 0; i < nn->layers.size(); i++) {
+    const vector<float>& pruned = nn->layers[i]->inWeights.data;
+    const vector<float>& weights = original->layers[i]->inWeights.data;
+    for (size_t k = 0; k < weights.size(); k++) {
+      if (pruned[k] == 0) {
+	largest_pruned = std::max(largest_pruned, std::fabs(weights[k]));
+      } else {
+	EXPECT_EQ(weights[k], pruned[k]);
+	smallest_kept = std::min(smallest_kept, std::fabs(weights[k]));
+      }
+    }
+    EXPECT_EQ(original->layers[i]->bias, nn->layers[i]->bias);
+  }
+  EXPECT_LE(largest_pruned, smallest_kept);
+}
+
+TEST_F(PruningTest, PrunesEachLayer) {
+  std::unique_ptr<NN> nn = makeModel();
+  PruningParams params;
+  params.sparsity = 0.75;
+  params.perLayer = true;
+  pruneByMagnitude(nn.get(), params);
+  for (const auto& layer : nn->layers) {
+    EXPECT_NEAR(0.25, layer->density(), 1.0 / layer->inWeights.data.size());
+    EXPECT_FALSE(layer->sparseWeights.empty());
+  }
+}
+
+TEST_F(PruningTest, SparseKernelsMatchDense) {
+  std::unique_ptr<NN> nn = makeModel();
+  PruningParams params;
+  pruneByMagnitude(nn.get(), params);
+  std::unique_ptr<NN> dense = nn->clone();
+  dense->maxSparseDensity = 0.0;
+  dense->updateSparseWeights();
+  for (size_t i = 0; i < nn->layers.size(); i++) {
+    EXPECT_FALSE(nn->layers[i]->sparseWeights.empty());
+    EXPECT_TRUE(dense->layers[i]->sparseWeights.empty());
+  }
+  vector<float> sparse_results, dense_results;
+  nn->inferenceBatch(inputs_, &sparse_results);
+  dense->inferenceBatch(inputs_, &dense_results);
+  EXPECT_EQ(dense_results, sparse_results);
+  for (const vector<float>& x : inputs_) {
+    EXPECT_EQ(dense->inference(x), nn->inference(x));
+  }
+  EXPECT_EQ(dense->evaluate(examples_), nn->evaluate(examples_));
+}
+
+TEST_F(PruningTest, DenseLayersStayDense) {
+  std::unique_ptr<NN> nn = makeModel();
+  PruningParams params;
+  params.sparsity = 0.5;
+  pruneByMagnitude(nn.get(), params);
+  for (const auto& layer : nn->layers) {
+    EXPECT_TRUE(layer->sparseWeights.empty());
+  }
+}
+
+TEST_F(PruningTest, FineTuningKeepsMask) {
+  std::unique_ptr<NN> nn = makeModel();
+  PruningParams params;
+  pruneByMagnitude(nn.get(), params);
+  std::unique_ptr<NN> pruned = nn->clone();
+  TrainingReport report;
+  ASSERT_TRUE(nn->train(examples_, &report));
+  size_t changed = 0;
+  for (size_t i = 0; i < nn->layers.size(); i++) {
+    const vector<float>& before = pruned->layers[i]->inWeights.data;
+    const vector<float>& after = nn->layers[i]->inWeights.data;
+    for (size_t k = 0; k < before.size(); k++) {
+      if (before[k] == 0) {
+	EXPECT_EQ(0.0, after[k]);
+      } else {
+	changed += (after[k] != before[k]);
+      }
+    }
+    // Training rebuilds the sparse weights from the trained ones.
+    EXPECT_FALSE(nn->layers[i]->sparseWeights.empty());
+  }
+  EXPECT_GT(changed, 0);
+  std::unique_ptr<NN> dense = nn->clone();
+  dense->maxSparseDensity = 0.0;
+  dense->updateSparseWeights();
+  EXPECT_EQ(dense->evaluate(examples_), nn->evaluate(examples_));
+}
+
+TEST_F(PruningTest, LoadedModelUsesSparseKernels) {
+  std::unique_ptr<NN> nn = makeModel();
+  PruningParams params;
+  pruneByMagnitude(nn.get(), params);
+  std::stringstream saved;
+  ASSERT_TRUE(nn->save(saved));
+  std::unique_ptr<NN> loaded = NN::load(saved);
+  ASSERT_NE(nullptr, loaded);
+  for (size_t i = 0; i < loaded->layers.size(); i++) {
+    EXPECT_EQ(nn->layers[i]->sparseWeights.values,
+	      loaded->layers[i]->sparseWeights.values);
+  }
+  EXPECT_EQ(nn->inference(inputs_[3]), loaded->inference(inputs_[3]));
+}
@@ -0,0 +1,156 @@
+#include "ring_allreduce.h"
+
+#include "line_socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+
+RingAllReduce::RingAllReduce(size_t rank, const vector<string>& addresses) :
+  rank_(rank), addresses_(addresses) {}
+
+RingAllReduce::~RingAllReduce() {
+  if (next_fd_ >= 0) {
+    close(next_fd_);
+  }
+  if (prev_fd_ >= 0) {
+    close(prev_fd_);
+  }
+}
+
+bool RingAllReduce::connect(std::chrono::milliseconds timeout) {
+  if (size() <= 1) {
+    return true;
+  }
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  const string& address = addresses_[rank_];
+  int listen_fd = line_socket::listenOn(address, 1);
+  if (listen_fd < 0) {
+    return false;
+  }
+  // The next rank may not be listening yet.
+  const string& next = addresses_[(rank_ + 1) % size()];
+  while ((next_fd_ = line_socket::connectTo(next)) < 0 &&
+	 std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  pollfd listening = { listen_fd, POLLIN, 0 };
+  int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now()).count();
+  if (next_fd_ >= 0 && poll(&listening, 1, std::max(remaining_ms, 0)) == 1) {
+    prev_fd_ = accept(listen_fd, nullptr, nullptr);
+  }
+  close(listen_fd);
+  if (!line_socket::isTcpAddress(address)) {
+    unlink(address.c_str());
+  }
+  // Each side says who it is, so a misconfigured ring fails here
+  // rather than producing wrong sums.
+  uint32_t my_rank = rank_, prev_rank;
+  if (next_fd_ < 0 || prev_fd_ < 0 ||
+      !line_socket::writeAll(next_fd_, &my_rank, sizeof(my_rank)) ||
+      !line_socket::readAll(prev_fd_, &prev_rank, sizeof(prev_rank)) ||
+      prev_rank != (rank_ + size() - 1) % size()) {
+    return false;
+  }
+  fcntl(next_fd_, F_SETFL, fcntl(next_fd_, F_GETFL) | O_NONBLOCK);
+  fcntl(prev_fd_, F_SETFL, fcntl(prev_fd_, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+bool RingAllReduce::exchange(const float* send, size_t send_count,
+			     float* receive, size_t receive_count) {
+  const char* out = reinterpret_cast<const char*>(send);
+  char* in = reinterpret_cast<char*>(receive);
+  size_t to_send = send_count * sizeof(float);
+  size_t to_receive = receive_count * sizeof(float);
+  bytes_sent_ += to_send;
+  while (to_send > 0 || to_receive > 0) {
+    pollfd fds[2];
+    nfds_t num_fds = 0;
+    if (to_send > 0) {
+      fds[num_fds++] = { next_fd_, POLLOUT, 0 };
+    }
+    if (to_receive > 0) {
+      fds[num_fds++] = { prev_fd_, POLLIN, 0 };
+    }
+    if (poll(fds, num_fds, -1) < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    for (nfds_t i = 0; i < num_fds; i++) {
+      if (fds[i].revents == 0) {
+	continue;
+      }
+      if (fds[i].fd == next_fd_ && to_send > 0) {
+	// A dead neighbour makes this fail with EPIPE instead of killing
+	// the process with SIGPIPE.
+	ssize_t n = ::send(next_fd_, out, to_send, MSG_NOSIGNAL);
+	if (n < 0 && errno != EAGAIN && errno != EINTR) {
+	  return false;
+	}
+	if (n > 0) {
+	  out += n;
+	  to_send -= n;
+	}
+      } else if (fds[i].fd == prev_fd_) {
+	ssize_t n = read(prev_fd_, in, to_receive);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+	  return false;
+	}
+	if (n > 0) {
+	  in += n;
+	  to_receive -= n;
+	}
+      }
+    }
+  }
+  return true;
+}
+
+bool RingAllReduce::allReduce(float* data, size_t n) {
+  size_t p = size();
+  if (p <= 1 || n == 0) {
+    return true;
+  }
+  received_.resize(n / p + 1);
+  // Reduce-scatter: at step s, send the partial sum of chunk (rank - s)
+  // and add the previous rank's partial sum of chunk (rank - s - 1).
+  // Afterwards this rank holds the full sum of chunk (rank + 1).
+  for (size_t s = 0; s + 1 < p; s++) {
+    size_t send_chunk = (rank_ + p - s) % p;
+    size_t receive_chunk = (rank_ + p - s - 1) % p;
+    size_t send_start = chunkStart(send_chunk, n);
+    size_t receive_start = chunkStart(receive_chunk, n);
+    size_t receive_count = chunkStart(receive_chunk + 1, n) - receive_start;
+    if (!exchange(data + send_start,
+		  chunkStart(send_chunk + 1, n) - send_start,
+		  received_.data(), receive_count)) {
+      return false;
+    }
+    float* target = data + receive_start;
+    for (size_t i = 0; i < receive_count; i++) {
+      target[i] += received_[i];
+    }
+  }
+  // All-gather: pass the finished chunks around the ring.
+  for (size_t s = 0; s + 1 < p; s++) {
+    size_t send_chunk = (rank_ + 1 + p - s) % p;
+    size_t receive_chunk = (rank_ + p - s) % p;
+    size_t send_start = chunkStart(send_chunk, n);
+    size_t receive_start = chunkStart(receive_chunk, n);
+    if (!exchange(data + send_start,
+		  chunkStart(send_chunk + 1, n) - send_start,
+		  data + receive_start,
+		  chunkStart(receive_chunk + 1, n) - receive_start)) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,61 @@
+#ifndef __RING_ALLREDUCE_H_
+#define __RING_ALLREDUCE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Sums arrays of floats across a group of processes (ranks) connected
+// in a ring over Unix or TCP sockets: each rank sends to the next and
+// receives from the one before. allReduce is a reduce-scatter followed
+// by an all-gather, so each rank sends and receives about 2n floats
+// whatever the number of ranks.
+class RingAllReduce {
+ public:
+  // addresses[r] is where rank r listens: a socket path or host:port.
+  RingAllReduce(size_t rank, const vector<string>& addresses);
+  ~RingAllReduce();
+
+  RingAllReduce(const RingAllReduce&) = delete;
+  RingAllReduce& operator=(const RingAllReduce&) = delete;
+
+  // Listens on this rank's address, connects to the next rank's and
+  // accepts the previous rank, retrying until timeout as the other
+  // processes start. False if the ring couldn't be formed.
+  bool connect(std::chrono::milliseconds timeout = std::chrono::seconds(60));
+
+  // Replaces data with its elementwise sum over every rank. All ranks
+  // must make the same calls, in the same order and with the same n.
+  // Each element is summed by one rank and copied to the others, so
+  // every rank gets bit-identical results. False on a connection
+  // error, after which the ring is unusable.
+  bool allReduce(float* data, size_t n);
+
+  size_t rank() const { return rank_; }
+  size_t size() const { return addresses_.size(); }
+  uint64_t bytesSent() const { return bytes_sent_; }
+
+ private:
+  // Sends one buffer to the next rank while receiving another from the
+  // previous one, so neither side blocks the ring when the socket
+  // buffers fill up.
+  bool exchange(const float* send, size_t send_count, float* receive,
+		size_t receive_count);
+  // First element of chunk c of an n-element array.
+  size_t chunkStart(size_t c, size_t n) const {
+    return n * c / addresses_.size();
+  }
+
+  size_t rank_;
+  vector<string> addresses_;
+  int next_fd_ = -1;
+  int prev_fd_ = -1;
+  vector<float> received_;
+  uint64_t bytes_sent_ = 0;
+};
+
+#endif
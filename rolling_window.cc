@@ -0,0 +1,208 @@
+#include "rolling_window.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+size_t powerOfTwoAtLeast(size_t n) {
+  size_t size = 1;
+  while (size < n) {
+    size *= 2;
+  }
+  return size;
+}
+
+const char* statName(WindowStat stat) {
+  switch (stat) {
+  case WINDOW_LAG:
+    return "lag";
+  case WINDOW_MEAN:
+    return "mean";
+  case WINDOW_MIN:
+    return "min";
+  case WINDOW_MAX:
+    return "max";
+  case WINDOW_STD:
+    return "std";
+  }
+  return "";
+}
+
+}  // namespace
+
+RollingWindows::RollingWindows(const vector<string>& field_names,
+			       size_t group_field,
+			       const vector<WindowFeature>& features) :
+  features_(features), group_field_(group_field) {
+  for (const WindowFeature& feature : features_) {
+    feature_names_.push_back(field_names[feature.field] + "_" +
+			     statName(feature.stat) + "_" +
+			     std::to_string(feature.rows));
+    size_t s = 0;
+    while (s < sources_.size() && sources_[s].field != feature.field) {
+      s++;
+    }
+    if (s == sources_.size()) {
+      sources_.push_back(Source{feature.field, 1, {}, {}});
+    }
+    Source& source = sources_[s];
+    source.capacity = std::max(source.capacity, feature.rows);
+    Slot slot{s, 0};
+    if (feature.stat == WINDOW_MEAN || feature.stat == WINDOW_STD) {
+      // Means and deviations over the same window share their state.
+      auto window = std::find(source.windows.begin(), source.windows.end(),
+			      feature.rows);
+      slot.index = window - source.windows.begin();
+      if (window == source.windows.end()) {
+	source.windows.push_back(feature.rows);
+      }
+    } else if (feature.stat != WINDOW_LAG) {
+      slot.index = source.queueFeatures.size();
+      source.queueFeatures.push_back(slots_.size());
+    }
+    slots_.push_back(slot);
+  }
+}
+
+RollingWindows::Group& RollingWindows::group(const vector<string>& fields) {
+  static const string kAllRows;
+  const string& key = (group_field_ == kNoGroup ? kAllRows :
+		       fields[group_field_]);
+  auto iter = groups_.find(key);
+  if (iter != groups_.end()) {
+    return iter->second;
+  }
+  Group& group = groups_[key];
+  group.fields.resize(sources_.size());
+  for (size_t s = 0; s < sources_.size(); s++) {
+    const Source& source = sources_[s];
+    History& history = group.fields[s];
+    history.values.resize(powerOfTwoAtLeast(source.capacity));
+    history.means.resize(source.windows.size());
+    history.m2s.resize(source.windows.size());
+    for (size_t f : source.queueFeatures) {
+      history.queues.emplace_back(powerOfTwoAtLeast(features_[f].rows));
+    }
+    history.queueBegin.resize(source.queueFeatures.size());
+    history.queueSize.resize(source.queueFeatures.size());
+  }
+  return group;
+}
+
+void RollingWindows::update(const vector<string>& fields, float* features) {
+  Group& g = group(fields);
+  uint64_t n = g.rows;
+  for (size_t i = 0; i < features_.size(); i++) {
+    if (n == 0) {
+      features[i] = 0.0;
+      continue;
+    }
+    const WindowFeature& feature = features_[i];
+    const History& history = g.fields[slots_[i].source];
+    size_t index = slots_[i].index;
+    uint64_t count = std::min<uint64_t>(feature.rows, n);
+    switch (feature.stat) {
+    case WINDOW_LAG:
+      features[i] = value(history, n - count);
+      break;
+    case WINDOW_MEAN:
+      features[i] = history.means[index];
+      break;
+    case WINDOW_STD: {
+      double variance = history.m2s[index] / count;
+      features[i] = variance > 0.0 ? std::sqrt(variance) : 0.0;
+      break;
+    }
+    case WINDOW_MIN:
+    case WINDOW_MAX:
+      // The queue's front is the window's extreme.
+      features[i] = value(history,
+			  history.queues[index][history.queueBegin[index]]);
+      break;
+    }
+  }
+
+  for (size_t s = 0; s < sources_.size(); s++) {
+    const Source& source = sources_[s];
+    History& history = g.fields[s];
+    float val = strtod(fields[source.field].c_str(), nullptr);
+    // The value leaving each window is still in the ring until val
+    // replaces the oldest one.
+    for (size_t w = 0; w < source.windows.size(); w++) {
+      size_t rows = source.windows[w];
+      double& mean = history.means[w];
+      double& m2 = history.m2s[w];
+      if (n >= rows) {
+	// Welford's update with old replaced by val in a full window.
+	double old = value(history, n - rows);
+	double old_mean = mean;
+	mean += (val - old) / rows;
+	m2 += (val - old) * ((val - mean) + (old - old_mean));
+      } else {
+	// Welford's update with val added to the n values so far.
+	double delta = val - mean;
+	mean += delta / (n + 1);
+	m2 += delta * (val - mean);
+      }
+    }
+    history.values[n & (history.values.size() - 1)] = val;
+    // Updates leave rounding error behind, most after a value far from
+    // the rest has come and gone, so once per window length the mean
+    // and deviations are recomputed from the values in the window:
+    // O(1) per row on average.
+    for (size_t w = 0; w < source.windows.size(); w++) {
+      size_t rows = source.windows[w];
+      if ((n + 1) % rows != 0) {
+	continue;
+      }
+      double sum = 0.0;
+      for (uint64_t r = n + 1 - rows; r <= n; r++) {
+	sum += value(history, r);
+      }
+      double mean = sum / rows;
+      double m2 = 0.0;
+      for (uint64_t r = n + 1 - rows; r <= n; r++) {
+	double deviation = value(history, r) - mean;
+	m2 += deviation * deviation;
+      }
+      history.means[w] = mean;
+      history.m2s[w] = m2;
+    }
+    for (size_t q = 0; q < source.queueFeatures.size(); q++) {
+      const WindowFeature& feature = features_[source.queueFeatures[q]];
+      vector<uint64_t>& queue = history.queues[q];
+      size_t mask = queue.size() - 1;
+      size_t& begin = history.queueBegin[q];
+      size_t& size = history.queueSize[q];
+      if (size > 0 && queue[begin] + feature.rows <= n) {
+	begin = (begin + 1) & mask;
+	size--;
+      }
+      // Rows that can no longer be the window's extreme, since val is
+      // newer and at least as extreme, leave from the back.
+      while (size > 0) {
+	float last = value(history, queue[(begin + size - 1) & mask]);
+	if (feature.stat == WINDOW_MIN ? last < val : last > val) {
+	  break;
+	}
+	size--;
+      }
+      queue[(begin + size) & mask] = n;
+      size++;
+    }
+  }
+  g.rows++;
+}
+
+void RollingWindows::appendTo(vector<string>* fields) {
+  scratch_.resize(features_.size());
+  update(*fields, scratch_.data());
+  char buffer[32];
+  for (float feature : scratch_) {
+    char* end = std::to_chars(buffer, buffer + sizeof(buffer), feature).ptr;
+    fields->emplace_back(buffer, end);
+  }
+}
@@ -0,0 +1,115 @@
+#ifndef __ROLLING_WINDOW_H_
+#define __ROLLING_WINDOW_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+typedef enum {
+  WINDOW_LAG,   // the value rows back
+  WINDOW_MEAN,
+  WINDOW_MIN,
+  WINDOW_MAX,
+  WINDOW_STD,   // population standard deviation
+} WindowStat;
+
+// A feature computed from a numeric field's values in the previous
+// rows of the same group: for WINDOW_LAG the value rows rows back, for
+// the others a statistic over the last rows rows.
+struct WindowFeature {
+  size_t field;
+  WindowStat stat;
+  size_t rows;
+};
+
+// Time-series features of rows arriving in time order, e.g. each
+// inverter's mean DC_POWER over its last four readings. Rows are
+// grouped by the value of a key field, each group with its own
+// history, and each feature sees only earlier rows of the row's group,
+// so a window over the label doesn't leak it. Until a group has a full
+// window, statistics cover the rows it has, and lags reach back to
+// its first row; a group's first row gets 0 for every feature.
+//
+// Each row costs O(1) per feature, however long the windows: a group
+// keeps each field's recent values in a ring buffer, running means and
+// sums of squared deviations, and monotonic queues for minima and
+// maxima. The deviations are updated by Welford's method as values
+// enter and leave a window, and recomputed from the window once per
+// window length, so they keep their precision on large values and
+// long streams.
+class RollingWindows {
+ public:
+  static const size_t kNoGroup = SIZE_MAX;
+
+  // group_field is the index of the key field, or kNoGroup for one
+  // history over all rows. Every feature's rows must be positive.
+  RollingWindows(const vector<string>& field_names, size_t group_field,
+		 const vector<WindowFeature>& features);
+
+  size_t numFeatures() const { return features_.size(); }
+  // Named after the field, statistic and window, e.g. "DC_POWER_mean_4".
+  const vector<string>& featureNames() const { return feature_names_; }
+  size_t numGroups() const { return groups_.size(); }
+
+  // Writes numFeatures() features for the row, then adds the row to
+  // its group's history.
+  void update(const vector<string>& fields, float* features);
+  // The same, appending the features to the row as text fields.
+  void appendTo(vector<string>* fields);
+  // Forgets every group's history.
+  void clear() { groups_.clear(); }
+
+ private:
+  // The history of one numeric field within a group.
+  struct History {
+    // At least the last capacity values, by row number modulo the
+    // size, a power of two so the modulo is a mask.
+    vector<float> values;
+    // Per window in the source's windows, the mean of the values in
+    // it and the sum of their squared deviations from it.
+    vector<double> means, m2s;
+    // Per min/max feature, row numbers whose values are increasing
+    // (minima) or decreasing (maxima): at most rows entries, in a ring
+    // sized as values is.
+    vector<vector<uint64_t>> queues;
+    vector<size_t> queueBegin, queueSize;
+  };
+  struct Group {
+    uint64_t rows = 0;
+    vector<History> fields;
+  };
+  // A field the features read, and what its history must keep.
+  struct Source {
+    size_t field;
+    size_t capacity;
+    // Window lengths needing running means.
+    vector<size_t> windows;
+    // The min/max features, each with a queue.
+    vector<size_t> queueFeatures;
+  };
+  // Where a feature finds its state: its source, and its window among
+  // the source's windows or its queue among its queues.
+  struct Slot {
+    size_t source;
+    size_t index;
+  };
+
+  Group& group(const vector<string>& fields);
+  float value(const History& history, uint64_t row) const {
+    return history.values[row & (history.values.size() - 1)];
+  }
+
+  vector<WindowFeature> features_;
+  vector<string> feature_names_;
+  size_t group_field_;
+  vector<Source> sources_;
+  vector<Slot> slots_;
+  std::unordered_map<string, Group> groups_;
+  vector<float> scratch_;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "rolling_window.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Each feature recomputed from the group's earlier values.
+float bruteForce(const vector<float>& earlier, const WindowFeature& feature) {
+  if (earlier.empty()) {
+    return 0.0;
+  }
+  size_t count = std::min(feature.rows, earlier.size());
+  vector<float> window(earlier.end() - count, earlier.end());
+  switch (feature.stat) {
+  case WINDOW_LAG:
+    return window.front();
+  case WINDOW_MIN:
+    return *std::min_element(window.begin(), window.end());
+  case WINDOW_MAX:
+    return *std::max_element(window.begin(), window.end());
+  case WINDOW_MEAN:
+  case WINDOW_STD: {
+    double sum = 0.0;
+    for (float v : window) {
+      sum += v;
+    }
+    double mean = sum / count;
+    if (feature.stat == WINDOW_MEAN) {
+      return mean;
+    }
+    double squares = 0.0;
+    for (float v : window) {
+      squares += (v - mean) * (v - mean);
+    }
+    return std::sqrt(squares / count);
+  }
+  }
+  return 0.0;
+}
+
+}  // namespace
+
+TEST(RollingWindowsTest, NamesFeatures) {
+  RollingWindows windows({"key", "power"}, 0,
+			 {{1, WINDOW_LAG, 1}, {1, WINDOW_MEAN, 4},
+			  {1, WINDOW_STD, 12}});
+  EXPECT_EQ(vector<string>({"power_lag_1", "power_mean_4", "power_std_12"}),
+	    windows.featureNames());
+}
+
+TEST(RollingWindowsTest, SeesOnlyEarlierRowsOfTheGroup) {
+  RollingWindows windows({"key", "power"}, 0,
+			 {{1, WINDOW_LAG, 1}, {1, WINDOW_MAX, 2}});
+  vector<string> row = {"a", "5"};
+  windows.appendTo(&row);
+  EXPECT_EQ(vector<string>({"a", "5", "0", "0"}), row);
+  row = {"b", "7"};
+  windows.appendTo(&row);
+  EXPECT_EQ(vector<string>({"b", "7", "0", "0"}), row);
+  row = {"a", "3"};
+  windows.appendTo(&row);
+  EXPECT_EQ(vector<string>({"a", "3", "5", "5"}), row);
+  row = {"a", "4"};
+  windows.appendTo(&row);
+  EXPECT_EQ(vector<string>({"a", "4", "3", "5"}), row);
+  row = {"a", "1"};
+  windows.appendTo(&row);
+  EXPECT_EQ(vector<string>({"a", "1", "4", "4"}), row);
+  EXPECT_EQ(2, windows.numGroups());
+
+  windows.clear();
+  row = {"a", "2"};
+  windows.appendTo(&row);
+  EXPECT_EQ(vector<string>({"a", "2", "0", "0"}), row);
+}
+
+TEST(RollingWindowsTest, MatchesBruteForce) {
+  vector<WindowFeature> features;
+  for (size_t rows : {1, 3, 8}) {
+    for (WindowStat stat : {WINDOW_LAG, WINDOW_MEAN, WINDOW_MIN, WINDOW_MAX,
+			    WINDOW_STD}) {
+      features.push_back({1, stat, rows});
+      features.push_back({2, stat, rows + 1});
+    }
+  }
+  RollingWindows windows({"key", "a", "b"}, 0, features);
+  std::mt19937 rng(42);
+  // Few distinct values, so the queues see ties.
+  std::uniform_int_distribution<int> value(0, 9);
+  std::map<string, vector<vector<float>>> earlier;
+  vector<float> computed(windows.numFeatures());
+  for (size_t i = 0; i < 500; i++) {
+    string key = "k" + std::to_string(rng() % 3);
+    vector<string> row = {key, std::to_string(value(rng)),
+			  std::to_string(value(rng) * 0.5)};
+    windows.update(row, computed.data());
+    vector<vector<float>>& history = earlier[key];
+    history.resize(3);
+    for (size_t f = 0; f < features.size(); f++) {
+      EXPECT_NEAR(bruteForce(history[features[f].field], features[f]),
+		  computed[f], 1e-4)
+	<< windows.featureNames()[f] << " at row " << i;
+    }
+    history[1].push_back(std::stof(row[1]));
+    history[2].push_back(std::stof(row[2]));
+  }
+  EXPECT_EQ(3, windows.numGroups());
+}
+
+TEST(RollingWindowsTest, NoGroupSharesOneHistory) {
+  RollingWindows windows({"key", "power"}, RollingWindows::kNoGroup,
+			 {{1, WINDOW_MEAN, 2}});
+  float mean;
+  windows.update({"a", "2"}, &mean);
+  windows.update({"b", "4"}, &mean);
+  EXPECT_FLOAT_EQ(2.0, mean);
+  windows.update({"c", "8"}, &mean);
+  EXPECT_FLOAT_EQ(3.0, mean);
+  windows.update({"a", "0"}, &mean);
+  EXPECT_FLOAT_EQ(6.0, mean);
+  EXPECT_EQ(1, windows.numGroups());
+}
+
+TEST(RollingWindowsTest, DeviationStaysAccurateOnLargeValues) {
+  // Readings far from 0 with a small spread, and now and then one much
+  // larger, over a long stream.
+  RollingWindows windows({"power"}, RollingWindows::kNoGroup,
+			 {{0, WINDOW_STD, 5}, {0, WINDOW_MEAN, 5}});
+  float features[2];
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> spread(0.0, 1.0);
+  for (size_t i = 0; i < 200000; i++) {
+    float val = 1e5 + spread(rng);
+    if (i % 1000 == 500) {
+      val *= 100;
+    }
+    windows.update({std::to_string(val)}, features);
+  }
+  vector<float> last;
+  for (int i = 0; i < 7; i++) {
+    last.push_back(std::stof(std::to_string(1e5 + 0.1 * i)));
+    windows.update({std::to_string(last.back())}, features);
+  }
+  windows.update({"0"}, features);
+  WindowFeature std_5 = {0, WINDOW_STD, 5}, mean_5 = {0, WINDOW_MEAN, 5};
+  EXPECT_NEAR(bruteForce(last, std_5), features[0], 1e-4);
+  EXPECT_NEAR(bruteForce(last, mean_5), features[1], 1e-2);
+}
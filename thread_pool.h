@@ -0,0 +1,104 @@
+#ifndef __THREAD_POOL_H_
+#define __THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running tasks in the order they were
+// scheduled.
+class ThreadPool {
+ public:
+  // num_threads == 0 uses one thread per hardware thread. If on_start
+  // is set, each worker calls it with its index (0 to num_threads - 1)
+  // before running any task, e.g. to pin itself to a CPU.
+  explicit ThreadPool(size_t num_threads = 0,
+		      std::function<void(size_t)> on_start = nullptr) {
+    if (num_threads == 0) {
+      num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads == 0) {
+      num_threads = 1;
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+      workers_.emplace_back([this, i, on_start]() {
+	  if (on_start) {
+	    on_start(i);
+	  }
+	  run();
+	});
+    }
+  }
+
+  // Finishes all scheduled tasks before returning.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return workers_.size(); }
+
+  void schedule(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+      pending_++;
+    }
+    work_available_.notify_one();
+  }
+
+  // Blocks until every task scheduled so far has finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+ private:
+  void run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+	std::unique_lock<std::mutex> lock(mutex_);
+	work_available_.wait(lock, [this]() {
+	    return stopping_ || !tasks_.empty();
+	  });
+	if (tasks_.empty()) {
+	  return;
+	}
+	task = std::move(tasks_.front());
+	tasks_.pop_front();
+      }
+      task();
+      {
+	std::lock_guard<std::mutex> lock(mutex_);
+	pending_--;
+	if (pending_ == 0) {
+	  all_done_.notify_all();
+	}
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable all_done_;
+  std::deque<std::function<void()>> tasks_;
+  size_t pending_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+#endif
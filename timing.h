@@ -0,0 +1,63 @@
+#ifndef __TIMING_H_
+#define __TIMING_H_
+
+// Low-overhead wall-clock timing for instrumenting hot paths. Building
+// with -DNN_NO_TIMING turns all of it into no-ops.
+
+#include <chrono>
+#include <cstddef>
+
+#include <sys/resource.h>
+
+// Splits elapsed time between phases: each call to lap() charges the
+// time since the previous lap (or since construction) to one phase, so
+// a sequence of phases costs one clock read per phase boundary.
+class PhaseClock {
+ public:
+#ifdef NN_NO_TIMING
+  explicit PhaseClock(bool enabled) {}
+  void lap(double* seconds) {}
+#else
+  explicit PhaseClock(bool enabled) : enabled_(enabled) {
+    if (enabled_) {
+      last_ = std::chrono::steady_clock::now();
+    }
+  }
+  void lap(double* seconds) {
+    if (!enabled_) {
+      return;
+    }
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    *seconds += std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+  }
+
+ private:
+  bool enabled_;
+  std::chrono::steady_clock::time_point last_;
+#endif
+};
+
+// Adds the lifetime of the enclosing scope to *seconds.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(double* seconds) : clock_(true), seconds_(seconds) {}
+  ~ScopedTimer() { clock_.lap(seconds_); }
+
+ private:
+  PhaseClock clock_;
+  double* seconds_;
+};
+
+// Peak resident set size of this process so far, in bytes.
+inline size_t peakMemoryBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // ru_maxrss is in kilobytes on Linux.
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+#endif